@@ -130,6 +130,34 @@ ng_ipaddr_ipequal(const ng_ipaddr_t *a, const ng_ipaddr_t *b)
 }
 
 
+/* FNV-1a hash of the address bytes */
+GLOBAL unsigned int
+ng_ipaddr_hash(const ng_ipaddr_t *a)
+{
+	const unsigned char *p;
+	unsigned int h = 2166136261U;
+	size_t len;
+
+	assert(a != NULL);
+#ifdef WANT_IPV6
+	if (a->sa.sa_family == AF_INET6) {
+		p = (const unsigned char *)&a->sin6.sin6_addr;
+		len = sizeof(a->sin6.sin6_addr);
+	} else
+#endif
+	{
+		assert(a->sin4.sin_family == AF_INET);
+		p = (const unsigned char *)&a->sin4.sin_addr;
+		len = sizeof(a->sin4.sin_addr);
+	}
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+
 #ifdef WANT_IPV6
 GLOBAL const char *
 ng_ipaddr_tostr(const ng_ipaddr_t *addr)
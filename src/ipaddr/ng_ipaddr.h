@@ -105,6 +105,10 @@ GLOBAL void ng_ipaddr_setport PARAMS((ng_ipaddr_t *a, UINT16 port));
 /* return true if a and b have the same IP address. If a and b have different AF, return false. */
 GLOBAL bool ng_ipaddr_ipequal PARAMS((const ng_ipaddr_t *a, const ng_ipaddr_t *b));
 
+/* return hash value of the IP address of a (the port is ignored): equal
+ * addresses, according to ng_ipaddr_ipequal(), have equal hash values. */
+GLOBAL unsigned int ng_ipaddr_hash PARAMS((const ng_ipaddr_t *a));
+
 
 #ifdef WANT_IPV6
 /* convert struct sockaddr to string, returns pointer to static buffer */
@@ -0,0 +1,670 @@
+/*
+ * ngIRCd -- The Next Generation IRC Daemon
+ * Copyright (c)2001-2014 Alexander Barton (alex@barton.de) and Contributors.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * Please read the file COPYING, README and AUTHORS for more information.
+ */
+
+#define GLOBAL_INIT
+#include "portab.h"
+
+/**
+ * @file
+ * Micro benchmarks for internal data structures of the daemon.
+ *
+ * This program is linked against all modules of ngircd (except ngircd.c)
+ * and measures selected code paths in-process. It is not part of the
+ * test suite, use "make bench" to build and run it.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#ifdef HAVE_SYS_RESOURCE_H
+# include <sys/resource.h>
+#endif
+
+#include "array.h"
+#include "conn.h"
+#include "channel.h"
+#include "client.h"
+#include "conf.h"
+#include "io.h"
+#include "lists.h"
+#include "match.h"
+#include "ngircd.h"
+#include "ringbuf.h"
+
+/** Minimum run time of a single measurement in microseconds. */
+#define BENCH_MIN_USEC 250000
+
+/** Size of a "burst" of data in connection buffers in bytes. */
+#define BENCH_BURST_LEN 65536
+
+/** Length of a line of IRC protocol in the buffer benchmarks. */
+#define BENCH_LINE_LEN 40
+
+/** Number of bytes in the buffers in the steady-state benchmarks. */
+#define BENCH_BACKLOG_LEN 4096
+
+/** Number of idle and busy connections in the IO benchmark. */
+#define BENCH_IO_IDLE 10000
+#define BENCH_IO_BUSY 1000
+
+/** Number of bans and of client masks in the list benchmark. */
+#define BENCH_LIST_BANS 10000
+#define BENCH_LIST_MASKS 100000
+
+static double Now PARAMS((void));
+static double Measure PARAMS((unsigned long (*Func)(unsigned long), unsigned long *Ops));
+static void Bench_Init PARAMS((void));
+static void Bench_ClientSearch PARAMS((void));
+static void Bench_Lists PARAMS((void));
+static void Bench_Netsplit PARAMS((void));
+static void Bench_Buffers PARAMS((void));
+static void Bench_IO PARAMS((void));
+static void Bench_IO_Backend PARAMS((const char *Backend));
+
+static unsigned long Lookup_Index PARAMS((unsigned long Start));
+static unsigned long Lookup_List PARAMS((unsigned long Start));
+static unsigned long Check_Compiled PARAMS((unsigned long Start));
+static unsigned long Check_Uncompiled PARAMS((unsigned long Start));
+static unsigned long Burst_Array PARAMS((unsigned long Start));
+static unsigned long Burst_Ringbuf PARAMS((unsigned long Start));
+static unsigned long Steady_Array PARAMS((unsigned long Start));
+static unsigned long Steady_Ringbuf PARAMS((unsigned long Start));
+static unsigned long IO_Round PARAMS((unsigned long Start));
+static void IO_Callback PARAMS((int Fd, short What));
+static void IO_Skip PARAMS((const char *Backend));
+static void IO_Cleanup PARAMS((void));
+
+static unsigned long Client_Number;
+static struct list_head Bans;
+static CLIENT *Ban_Client[BENCH_LIST_MASKS];
+static char Line[BENCH_LINE_LEN];
+static array Buf_Array;
+static ringbuf Buf_Ringbuf;
+static int IO_Idle[BENCH_IO_IDLE];
+static int IO_Server[BENCH_IO_BUSY];
+static int IO_Peer[BENCH_IO_BUSY];
+static int IO_IdleCount, IO_BusyCount;
+static unsigned long IO_Pending;
+
+/** IO backends compared in the IO benchmark, see io_library_init_using(). */
+static const char *IO_Backends[] = { "io_uring", "epoll", "kqueue", "/dev/poll" };
+
+
+/**
+ * Get current time.
+ *
+ * @return Time in microseconds.
+ */
+static double
+Now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec * 1000000.0 + (double)tv.tv_usec;
+}
+
+
+/**
+ * Call a benchmark function repeatedly until BENCH_MIN_USEC have passed.
+ *
+ * The function is called with a running counter and returns the number
+ * of operations it performed.
+ *
+ * @param Func Function to measure.
+ * @param Ops Receives the number of operations performed in total.
+ * @return Average time of one operation in nanoseconds.
+ */
+static double
+Measure(unsigned long (*Func)(unsigned long), unsigned long *Ops)
+{
+	double start, elapsed;
+	unsigned long n = 0;
+
+	start = Now();
+	do {
+		n += Func(n);
+		elapsed = Now() - start;
+	} while (elapsed < BENCH_MIN_USEC);
+
+	*Ops = n;
+	return elapsed * 1000.0 / (double)n;
+}
+
+
+static void
+Bench_Init(void)
+{
+	strlcpy(Conf_ServerName, "bench.example.net", sizeof(Conf_ServerName));
+	strlcpy(Conf_ServerInfo, "ngIRCd benchmark", sizeof(Conf_ServerInfo));
+	Conf_MaxNickLength = CLIENT_NICK_LEN_DEFAULT;
+	NGIRCd_Start = time(NULL);
+
+	Channel_Init();
+	Client_Init();
+}
+
+
+/**
+ * Look up 1000 nicknames using Client_Search().
+ * Every 4th nickname is unknown and every 2nd one differs in case.
+ */
+static unsigned long
+Lookup_Index(unsigned long Start)
+{
+	char nick[CLIENT_ID_LEN];
+	unsigned long i, n;
+
+	for (i = 0; i < 1000; i++) {
+		n = ((Start + i) * 7919) % (Client_Number + Client_Number / 3);
+		snprintf(nick, sizeof(nick), (i & 1) ? "B%08lu" : "b%08lu", n);
+		(void)Client_Search(nick);
+	}
+	return i;
+}
+
+
+/**
+ * Look up 10 nicknames walking the client list, which is what
+ * Client_Search() did before the client index has been introduced.
+ */
+static unsigned long
+Lookup_List(unsigned long Start)
+{
+	char nick[CLIENT_ID_LEN];
+	unsigned long i, n;
+	CLIENT *c;
+
+	for (i = 0; i < 10; i++) {
+		n = ((Start + i) * 7919) % (Client_Number + Client_Number / 3);
+		snprintf(nick, sizeof(nick), (i & 1) ? "B%08lu" : "b%08lu", n);
+		for (c = Client_First(); c; c = Client_Next(c)) {
+			if (strcasecmp(Client_ID(c), nick) == 0)
+				break;
+		}
+	}
+	return i;
+}
+
+
+/**
+ * Benchmark nickname lookups with 1k, 10k and 100k known clients.
+ *
+ * The clients are registered as "unknown" local clients without a
+ * connection, this keeps the set-up independent of any user counters.
+ */
+static void
+Bench_ClientSearch(void)
+{
+	static const unsigned long sizes[] = { 1000, 10000, 100000 };
+	char nick[CLIENT_ID_LEN];
+	unsigned long i, ops_index, ops_list;
+	double ns_index, ns_list;
+	CLIENT *c;
+
+	printf("Client_Search(), nickname lookups:\n");
+	for (i = 0; i < C_ARRAY_SIZE(sizes); i++) {
+		while (Client_Number < sizes[i]) {
+			c = Client_NewLocal(NONE, "client.example.net",
+					    CLIENT_UNKNOWN, false);
+			if (!c) {
+				fprintf(stderr, "Failed to create client!\n");
+				exit(1);
+			}
+			snprintf(nick, sizeof(nick), "b%08lu", Client_Number);
+			Client_SetID(c, nick);
+			Client_Number++;
+		}
+
+		ns_index = Measure(Lookup_Index, &ops_index);
+		ns_list = Measure(Lookup_List, &ops_list);
+		printf("  %7lu clients: index %8.1f ns/lookup, list walk %12.1f ns/lookup\n",
+		       Client_Number, ns_index, ns_list);
+	}
+}
+
+
+/**
+ * Check the mask of one client against the ban list using Lists_Check().
+ */
+static unsigned long
+Check_Compiled(unsigned long Start)
+{
+	(void)Lists_Check(&Bans, Ban_Client[(Start * 7919) % BENCH_LIST_MASKS]);
+	return 1;
+}
+
+
+/**
+ * Check the mask of one client against the ban list using
+ * MatchCaseInsensitive() for each entry, which is what Lists_Check() did
+ * before list entries have been compiled.
+ */
+static unsigned long
+Check_Uncompiled(unsigned long Start)
+{
+	struct list_elem *e;
+	CLIENT *c = Ban_Client[(Start * 7919) % BENCH_LIST_MASKS];
+
+	for (e = Lists_GetFirst(&Bans); e; e = Lists_GetNext(e)) {
+		if (MatchCaseInsensitive(Lists_GetMask(e), Client_MaskCloaked(c)))
+			break;
+	}
+	return 1;
+}
+
+
+/**
+ * Benchmark checking client masks against a list of bans. Most bans don't
+ * match, so (almost) all list entries have to be checked every time.
+ *
+ * The clients created by Bench_ClientSearch() get distinct user and
+ * host names for this.
+ */
+static void
+Bench_Lists(void)
+{
+	char str[MASK_LEN];
+	unsigned long i, n = 0, ops_compiled, ops_uncompiled;
+	double ns_compiled, ns_uncompiled;
+	CLIENT *c;
+
+	for (c = Client_First(); c && n < BENCH_LIST_MASKS; c = Client_Next(c)) {
+		if (Client_Type(c) != CLIENT_UNKNOWN)
+			continue;
+		snprintf(str, sizeof(str), "u%lu", n);
+		Client_SetUser(c, str, false);
+		snprintf(str, sizeof(str), "c%lu.ISP%lu.example.net", n, n % 97);
+		Client_SetHostname(c, str);
+		Ban_Client[n++] = c;
+	}
+	if (n < BENCH_LIST_MASKS) {
+		fprintf(stderr, "Not enough clients for list benchmark!\n");
+		exit(1);
+	}
+
+	for (i = 0; i < BENCH_LIST_BANS; i++) {
+		switch (i % 4) {
+		case 0:
+			snprintf(str, sizeof(str), "*!*@c%lu.isp%lu.example.com",
+				 i, i % 97);
+			break;
+		case 1:
+			snprintf(str, sizeof(str), "Spam%lu*!*@*", i);
+			break;
+		case 2:
+			snprintf(str, sizeof(str), "*!~evil%lu@*.example.net", i);
+			break;
+		default:
+			snprintf(str, sizeof(str), "*!*@10.%lu.%lu.*",
+				 i / 256, i % 256);
+		}
+		if (!Lists_Add(&Bans, str, 0, NULL, false)) {
+			fprintf(stderr, "Failed to add ban!\n");
+			exit(1);
+		}
+	}
+
+	printf("Lists_Check(), %d bans, %d client masks:\n",
+	       BENCH_LIST_BANS, BENCH_LIST_MASKS);
+	ns_compiled = Measure(Check_Compiled, &ops_compiled);
+	ns_uncompiled = Measure(Check_Uncompiled, &ops_uncompiled);
+	printf("  compiled %10.1f ns/check, MatchCaseInsensitive() %12.1f ns/check\n",
+	       ns_compiled, ns_uncompiled);
+
+	Lists_Free(&Bans);
+}
+
+
+/**
+ * Benchmark a netsplit: two servers with 50k users each are linked, their
+ * users have been introduced alternately, and one of them splits off.
+ */
+static void
+Bench_Netsplit(void)
+{
+	CLIENT *hub[2];
+	char name[CLIENT_ID_LEN];
+	unsigned long i;
+	double start;
+	int n;
+
+	for (n = 0; n < 2; n++) {
+		snprintf(name, sizeof(name), "hub%d.example.net", n);
+		hub[n] = Client_NewRemoteServer(Client_ThisServer(), name,
+						NULL, 1, n + 2, "Hub", false);
+		if (!hub[n]) {
+			fprintf(stderr, "Failed to create server!\n");
+			exit(1);
+		}
+	}
+	for (i = 0; i < 100000; i++) {
+		snprintf(name, sizeof(name), "s%08lu", i);
+		if (!Client_NewRemoteUser(hub[i % 2], name, 2, "user",
+					  "client.example.net", 1, "+",
+					  "User", false)) {
+			fprintf(stderr, "Failed to create user!\n");
+			exit(1);
+		}
+	}
+
+	printf("Client_Destroy(), netsplit of a server with 50000 users:\n");
+	start = Now();
+	Client_Destroy(hub[0], "Bench", "Bench", false);
+	printf("  %.1f ms (%ld users left)\n", (Now() - start) / 1000.0,
+	       Client_UserCount());
+}
+
+
+/**
+ * Fill an array with a burst of lines, then consume them one by one, like
+ * the read and write buffers of connections did before ring buffers have
+ * been introduced.
+ */
+static unsigned long
+Burst_Array(unsigned long UNUSED Start)
+{
+	unsigned long i, n = BENCH_BURST_LEN / BENCH_LINE_LEN;
+
+	for (i = 0; i < n; i++)
+		(void)array_catb(&Buf_Array, Line, sizeof(Line));
+	while (array_bytes(&Buf_Array) > 0)
+		array_moveleft(&Buf_Array, 1, sizeof(Line));
+	return n;
+}
+
+
+/**
+ * Fill a ring buffer with a burst of lines, then consume them one by one.
+ */
+static unsigned long
+Burst_Ringbuf(unsigned long UNUSED Start)
+{
+	unsigned long i, n = BENCH_BURST_LEN / BENCH_LINE_LEN;
+
+	for (i = 0; i < n; i++)
+		(void)ringbuf_catb(&Buf_Ringbuf, Line, sizeof(Line));
+	while (ringbuf_bytes(&Buf_Ringbuf) > 0)
+		ringbuf_consume(&Buf_Ringbuf, sizeof(Line));
+	return n;
+}
+
+
+/**
+ * Append and consume 1000 lines to/from an array holding a backlog.
+ */
+static unsigned long
+Steady_Array(unsigned long UNUSED Start)
+{
+	unsigned long i;
+
+	for (i = 0; i < 1000; i++) {
+		(void)array_catb(&Buf_Array, Line, sizeof(Line));
+		array_moveleft(&Buf_Array, 1, sizeof(Line));
+	}
+	return i;
+}
+
+
+/**
+ * Append and consume 1000 lines to/from a ring buffer holding a backlog.
+ */
+static unsigned long
+Steady_Ringbuf(unsigned long UNUSED Start)
+{
+	unsigned long i;
+
+	for (i = 0; i < 1000; i++) {
+		(void)ringbuf_catb(&Buf_Ringbuf, Line, sizeof(Line));
+		ringbuf_consume(&Buf_Ringbuf, sizeof(Line));
+	}
+	return i;
+}
+
+
+/**
+ * Benchmark connection buffers: arrays, which have to move the remaining
+ * data after consuming bytes from the front, and ring buffers.
+ */
+static void
+Bench_Buffers(void)
+{
+	unsigned long ops_array, ops_ringbuf;
+	double ns_array, ns_ringbuf;
+	char backlog[BENCH_BACKLOG_LEN];
+
+	memset(Line, 'x', sizeof(Line));
+	Line[sizeof(Line) - 2] = '\r';
+	Line[sizeof(Line) - 1] = '\n';
+	memset(backlog, 'y', sizeof(backlog));
+
+	printf("Connection buffers, %d byte lines:\n", BENCH_LINE_LEN);
+
+	ns_array = Measure(Burst_Array, &ops_array);
+	ns_ringbuf = Measure(Burst_Ringbuf, &ops_ringbuf);
+	printf("  %5d KB burst:   array %8.1f ns/line, ring buffer %8.1f ns/line\n",
+	       BENCH_BURST_LEN / 1024, ns_array, ns_ringbuf);
+
+	(void)array_catb(&Buf_Array, backlog, sizeof(backlog));
+	(void)ringbuf_catb(&Buf_Ringbuf, backlog, sizeof(backlog));
+	ns_array = Measure(Steady_Array, &ops_array);
+	ns_ringbuf = Measure(Steady_Ringbuf, &ops_ringbuf);
+	printf("  %5d KB backlog: array %8.1f ns/line, ring buffer %8.1f ns/line\n",
+	       BENCH_BACKLOG_LEN / 1024, ns_array, ns_ringbuf);
+
+	array_free(&Buf_Array);
+	ringbuf_free(&Buf_Ringbuf);
+}
+
+
+/**
+ * IO callback of the "server" side of the busy connections: read a line,
+ * then wait until the socket is writable and echo it, like a connection
+ * handling a command and sending a reply.
+ */
+static void
+IO_Callback(int Fd, short What)
+{
+	char buf[2 * BENCH_LINE_LEN];
+	struct iovec iov;
+	ssize_t len;
+
+	if (What & IO_WANTREAD) {
+		iov.iov_base = buf;
+		iov.iov_len = sizeof(buf);
+		len = io_readv(Fd, &iov, 1);
+		if (len > 0)
+			io_event_add(Fd, IO_WANTWRITE);
+		if (len < (ssize_t)sizeof(buf))
+			io_event_blocked(Fd, IO_WANTREAD);
+	}
+	if (What & IO_WANTWRITE) {
+		iov.iov_base = Line;
+		iov.iov_len = sizeof(Line);
+		if (io_writev(Fd, &iov, 1) > 0)
+			IO_Pending--;
+		io_event_del(Fd, IO_WANTWRITE);
+	}
+}
+
+
+/**
+ * Send a line on each busy connection and wait for all replies.
+ */
+static unsigned long
+IO_Round(unsigned long UNUSED Start)
+{
+	char buf[BENCH_LINE_LEN];
+	struct timeval tv;
+	int i;
+
+	for (i = 0; i < BENCH_IO_BUSY; i++)
+		(void)write(IO_Peer[i], Line, sizeof(Line));
+
+	IO_Pending = BENCH_IO_BUSY;
+	while (IO_Pending > 0) {
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		if (io_dispatch(&tv) < 0)
+			break;
+	}
+
+	/* Replies can still be queued in the backend (io_uring) */
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+	(void)io_dispatch(&tv);
+
+	for (i = 0; i < BENCH_IO_BUSY; i++)
+		(void)read(IO_Peer[i], buf, sizeof(buf));
+	return BENCH_IO_BUSY;
+}
+
+
+/**
+ * Handle failure to create a socket: skip the benchmark if the limit of
+ * open files has been reached, and abort on all other errors.
+ *
+ * @param Backend Name of the IO backend.
+ */
+static void
+IO_Skip(const char *Backend)
+{
+	if (errno != EMFILE && errno != ENFILE) {
+		fprintf(stderr, "Can't create sockets: %s!\n", strerror(errno));
+		exit(1);
+	}
+	printf("  %-10s skipped, can't create sockets (check \"ulimit -n\")!\n",
+	       Backend);
+	IO_Cleanup();
+}
+
+
+/**
+ * Close all sockets of the IO benchmark and shut down the IO library.
+ */
+static void
+IO_Cleanup(void)
+{
+	int i;
+
+	for (i = 0; i < IO_BusyCount; i++) {
+		io_close(IO_Server[i]);
+		close(IO_Peer[i]);
+	}
+	for (i = 0; i < IO_IdleCount; i++)
+		io_close(IO_Idle[i]);
+	IO_BusyCount = IO_IdleCount = 0;
+	io_library_shutdown();
+}
+
+
+/**
+ * Benchmark an IO backend with idle connections that are registered for
+ * reading and busy ones exchanging a line in each round.
+ *
+ * @param Backend Name of the IO backend, see io_library_init_using().
+ */
+static void
+Bench_IO_Backend(const char *Backend)
+{
+	unsigned long ops;
+	int i, fds[2];
+	double ns;
+
+	if (!io_library_init_using(BENCH_IO_IDLE + 2 * BENCH_IO_BUSY + 10,
+				   Backend)) {
+		printf("  %-10s not available\n", Backend);
+		return;
+	}
+
+	for (i = 0; i < BENCH_IO_IDLE; i++) {
+		IO_Idle[i] = socket(AF_UNIX, SOCK_DGRAM, 0);
+		if (IO_Idle[i] < 0) {
+			IO_Skip(Backend);
+			return;
+		}
+		IO_IdleCount++;
+		if (!io_event_create(IO_Idle[i], IO_WANTREAD, IO_Callback)) {
+			fprintf(stderr, "Can't register socket (%s)!\n", Backend);
+			exit(1);
+		}
+	}
+	for (i = 0; i < BENCH_IO_BUSY; i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+			IO_Skip(Backend);
+			return;
+		}
+		IO_Server[i] = fds[0];
+		IO_Peer[i] = fds[1];
+		IO_BusyCount++;
+		if (!io_setnonblock(fds[0])
+		    || !io_event_create(fds[0],
+					IO_WANTREAD | IO_EDGE | IO_MANAGED,
+					IO_Callback)) {
+			fprintf(stderr, "Can't register socket (%s)!\n", Backend);
+			exit(1);
+		}
+	}
+
+	ns = Measure(IO_Round, &ops);
+	printf("  %-10s %8.1f ns/request (read, interest change, write)\n",
+	       Backend, ns);
+	IO_Cleanup();
+}
+
+
+/**
+ * Benchmark all IO backends that are available (selected at compile time
+ * and supported by the running system), one after the other.
+ */
+static void
+Bench_IO(void)
+{
+#if defined(HAVE_GETRLIMIT) && defined(HAVE_SYS_RESOURCE_H)
+	struct rlimit rl;
+#endif
+	size_t i;
+
+	printf("IO backends, %d idle and %d busy connections:\n",
+	       BENCH_IO_IDLE, BENCH_IO_BUSY);
+
+#if defined(HAVE_GETRLIMIT) && defined(HAVE_SYS_RESOURCE_H)
+	/* Raise the limit of open files as far as possible */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		(void)setrlimit(RLIMIT_NOFILE, &rl);
+	}
+#endif
+
+	for (i = 0; i < sizeof(IO_Backends) / sizeof(IO_Backends[0]); i++)
+		Bench_IO_Backend(IO_Backends[i]);
+}
+
+
+int
+main(void)
+{
+	Bench_Init();
+	Bench_ClientSearch();
+	Bench_Lists();
+	Bench_Netsplit();
+	Bench_Buffers();
+	Bench_IO();
+	return 0;
+}
+
+/* -eof- */
@@ -44,23 +44,28 @@
 #define REMOVE_KICK 2
 
 static CHANNEL *My_Channels;
-static CL2CHAN *My_Cl2Chan;
+
+static CHANNEL **My_ChannelIndex, **My_ChannelOldIndex;
+static size_t My_ChannelIndexSize, My_ChannelOldIndexSize;
+static size_t My_ChannelIndexCount, My_ChannelRehashPos;
 
 static CL2CHAN *Get_Cl2Chan PARAMS(( CHANNEL *Chan, CLIENT *Client ));
 static CL2CHAN *Add_Client PARAMS(( CHANNEL *Chan, CLIENT *Client ));
 static bool Remove_Client PARAMS(( int Type, CHANNEL *Chan, CLIENT *Client, CLIENT *Origin, const char *Reason, bool InformServer ));
-static CL2CHAN *Get_First_Cl2Chan PARAMS(( CLIENT *Client, CHANNEL *Chan ));
-static CL2CHAN *Get_Next_Cl2Chan PARAMS(( CL2CHAN *Start, CLIENT *Client, CHANNEL *Chan ));
 static void Delete_Channel PARAMS(( CHANNEL *Chan ));
 static void Free_Channel PARAMS(( CHANNEL *Chan ));
 static void Set_KeyFile PARAMS((CHANNEL *Chan, const char *KeyFile));
 
+static void Index_Link PARAMS((CHANNEL **Index, size_t Size, CHANNEL *Chan));
+static void Index_Unlink PARAMS((CHANNEL *Chan));
+static void Index_Rehash PARAMS((void));
+static bool Index_Add PARAMS((CHANNEL *Chan));
+
 
 GLOBAL void
 Channel_Init( void )
 {
 	My_Channels = NULL;
-	My_Cl2Chan = NULL;
 } /* Channel_Init */
 
 
@@ -222,21 +227,28 @@ Channel_Exit( void )
 	CHANNEL *c, *c_next;
 	CL2CHAN *cl2chan, *cl2chan_next;
 
-	/* free struct Channel */
+	/* free struct Channel and its member list; don't touch the
+	 * clients, they have already been freed at this point! */
 	c = My_Channels;
 	while (c) {
 		c_next = c->next;
+		cl2chan = c->members;
+		while (cl2chan) {
+			cl2chan_next = cl2chan->next;
+			free(cl2chan);
+			cl2chan = cl2chan_next;
+		}
 		Free_Channel(c);
 		c = c_next;
 	}
+	My_Channels = NULL;
 
-	/* Free Channel allocation table */
-	cl2chan = My_Cl2Chan;
-	while (cl2chan) {
-		cl2chan_next = cl2chan->next;
-		free(cl2chan);
-		cl2chan = cl2chan_next;
-	}
+	/* free channel index */
+	free(My_ChannelIndex);
+	free(My_ChannelOldIndex);
+	My_ChannelIndex = My_ChannelOldIndex = NULL;
+	My_ChannelIndexSize = My_ChannelOldIndexSize = 0;
+	My_ChannelIndexCount = My_ChannelRehashPos = 0;
 } /* Channel_Exit */
 
 
@@ -422,9 +434,9 @@ Channel_Kick(CLIENT *Peer, CLIENT *Target, CLIENT *Origin, const char *Name,
 
 
 GLOBAL void
-Channel_Quit( CLIENT *Client, const char *Reason )
+Channel_Quit( CLIENT *Client, const char *Reason, bool Queue )
 {
-	CHANNEL *c, *next_c;
+	CL2CHAN *cl2chan, *next_cl2chan;
 
 	assert( Client != NULL );
 	assert( Reason != NULL );
@@ -432,14 +444,20 @@ Channel_Quit( CLIENT *Client, const char *Reason )
 	if (Conf_MorePrivacy)
 		Reason = "";
 
-	IRC_WriteStrRelatedPrefix( Client, Client, false, "QUIT :%s", Reason );
+	if (Queue)
+		IRC_QueueRelatedQuit(Client, Reason);
+	else
+		IRC_WriteStrRelatedPrefix(Client, Client, false, "QUIT :%s",
+					  Reason);
 
-	c = My_Channels;
-	while( c )
-	{
-		next_c = c->next;
-		Remove_Client( REMOVE_QUIT, c, Client, Client, Reason, false );
-		c = next_c;
+	/* Only walk the channels of this client: Remove_Client() frees
+	 * the current membership, so save the pointer to the next one. */
+	cl2chan = (CL2CHAN *)Client_Cl2Chan(Client);
+	while (cl2chan) {
+		next_cl2chan = cl2chan->next_chan;
+		Remove_Client(REMOVE_QUIT, cl2chan->channel, Client, Client,
+			      Reason, false);
+		cl2chan = next_cl2chan;
 	}
 } /* Channel_Quit */
 
@@ -474,18 +492,8 @@ Channel_CountVisible (CLIENT *Client)
 GLOBAL unsigned long
 Channel_MemberCount( CHANNEL *Chan )
 {
-	CL2CHAN *cl2chan;
-	unsigned long count = 0;
-
 	assert( Chan != NULL );
-
-	cl2chan = My_Cl2Chan;
-	while( cl2chan )
-	{
-		if( cl2chan->channel == Chan ) count++;
-		cl2chan = cl2chan->next;
-	}
-	return count;
+	return Chan->member_count;
 } /* Channel_MemberCount */
 
 
@@ -499,11 +507,11 @@ Channel_CountForUser( CLIENT *Client )
 
 	assert( Client != NULL );
 
-	cl2chan = My_Cl2Chan;
+	cl2chan = (CL2CHAN *)Client_Cl2Chan(Client);
 	while( cl2chan )
 	{
-		if( cl2chan->client == Client ) count++;
-		cl2chan = cl2chan->next;
+		count++;
+		cl2chan = cl2chan->next_chan;
 	}
 
 	return count;
@@ -575,16 +583,26 @@ Channel_Search( const char *Name )
 
 	assert( Name != NULL );
 
+	if (!My_ChannelIndex)
+		return NULL;
+	Index_Rehash();
+
 	search_hash = Hash( Name );
-	c = My_Channels;
-	while( c )
-	{
-		if( search_hash == c->hash )
-		{
-			/* hash hit */
-			if( strcasecmp( Name, c->name ) == 0 ) return c;
-		}
-		c = c->next;
+	c = My_ChannelIndex[search_hash & (My_ChannelIndexSize - 1)];
+	while (c) {
+		if (search_hash == c->hash && strcasecmp(Name, c->name) == 0)
+			return c;
+		c = c->hash_next;
+	}
+
+	/* Not (yet) migrated to the new table while resizing? */
+	if (!My_ChannelOldIndex)
+		return NULL;
+	c = My_ChannelOldIndex[search_hash & (My_ChannelOldIndexSize - 1)];
+	while (c) {
+		if (search_hash == c->hash && strcasecmp(Name, c->name) == 0)
+			return c;
+		c = c->hash_next;
 	}
 	return NULL;
 } /* Channel_Search */
@@ -594,16 +612,17 @@ GLOBAL CL2CHAN *
 Channel_FirstMember( CHANNEL *Chan )
 {
 	assert( Chan != NULL );
-	return Get_First_Cl2Chan( NULL, Chan );
+	return Chan->members;
 } /* Channel_FirstMember */
 
 
 GLOBAL CL2CHAN *
-Channel_NextMember( CHANNEL *Chan, CL2CHAN *Cl2Chan )
+Channel_NextMember( CHANNEL UNUSED *Chan, CL2CHAN *Cl2Chan )
 {
 	assert( Chan != NULL );
 	assert( Cl2Chan != NULL );
-	return Get_Next_Cl2Chan( Cl2Chan->next, NULL, Chan );
+	assert( Cl2Chan->channel == Chan );
+	return Cl2Chan->next;
 } /* Channel_NextMember */
 
 
@@ -611,16 +630,17 @@ GLOBAL CL2CHAN *
 Channel_FirstChannelOf( CLIENT *Client )
 {
 	assert( Client != NULL );
-	return Get_First_Cl2Chan( Client, NULL );
+	return (CL2CHAN *)Client_Cl2Chan(Client);
 } /* Channel_FirstChannelOf */
 
 
 GLOBAL CL2CHAN *
-Channel_NextChannelOf( CLIENT *Client, CL2CHAN *Cl2Chan )
+Channel_NextChannelOf( CLIENT UNUSED *Client, CL2CHAN *Cl2Chan )
 {
 	assert( Client != NULL );
 	assert( Cl2Chan != NULL );
-	return Get_Next_Cl2Chan( Cl2Chan->next, Client, NULL );
+	assert( Cl2Chan->client == Client );
+	return Cl2Chan->next_chan;
 } /* Channel_NextChannelOf */
 
 
@@ -994,7 +1014,13 @@ Channel_Create( const char *Name )
 	memset( c, 0, sizeof( CHANNEL ));
 	strlcpy( c->name, Name, sizeof( c->name ));
 	c->hash = Hash( c->name );
+	if (!Index_Add(c)) {
+		free(c);
+		return NULL;
+	}
 	c->next = My_Channels;
+	if (c->next)
+		c->next->prev = c;
 #ifndef STRICT_RFC
 	c->creation_time = time(NULL);
 #endif
@@ -1004,19 +1030,29 @@ Channel_Create( const char *Name )
 } /* Channel_Create */
 
 
+/**
+ * Look up the membership of a client in a channel.
+ *
+ * The member list of the channel and the channel list of the client are
+ * walked in lockstep, so the lookup costs O(min(members, channels)).
+ */
 static CL2CHAN *
 Get_Cl2Chan( CHANNEL *Chan, CLIENT *Client )
 {
-	CL2CHAN *cl2chan;
+	CL2CHAN *by_chan, *by_client;
 
 	assert( Chan != NULL );
 	assert( Client != NULL );
 
-	cl2chan = My_Cl2Chan;
-	while( cl2chan )
-	{
-		if(( cl2chan->channel == Chan ) && ( cl2chan->client == Client )) return cl2chan;
-		cl2chan = cl2chan->next;
+	by_chan = Chan->members;
+	by_client = (CL2CHAN *)Client_Cl2Chan(Client);
+	while (by_chan && by_client) {
+		if (by_chan->client == Client)
+			return by_chan;
+		if (by_client->channel == Chan)
+			return by_client;
+		by_chan = by_chan->next;
+		by_client = by_client->next_chan;
 	}
 	return NULL;
 } /* Get_Cl2Chan */
@@ -1041,9 +1077,20 @@ Add_Client( CHANNEL *Chan, CLIENT *Client )
 	cl2chan->client = Client;
 	strcpy( cl2chan->modes, "" );
 
-	/* concatenate */
-	cl2chan->next = My_Cl2Chan;
-	My_Cl2Chan = cl2chan;
+	/* concatenate to the member list of the channel ... */
+	cl2chan->prev = NULL;
+	cl2chan->next = Chan->members;
+	if (cl2chan->next)
+		cl2chan->next->prev = cl2chan;
+	Chan->members = cl2chan;
+	Chan->member_count++;
+
+	/* ... and to the channel list of the client */
+	cl2chan->prev_chan = NULL;
+	cl2chan->next_chan = (CL2CHAN *)Client_Cl2Chan(Client);
+	if (cl2chan->next_chan)
+		cl2chan->next_chan->prev_chan = cl2chan;
+	Client_SetCl2Chan(Client, (POINTER *)cl2chan);
 
 	LogDebug("User \"%s\" joined channel \"%s\".", Client_Mask(Client), Chan->name);
 
@@ -1054,7 +1101,7 @@ Add_Client( CHANNEL *Chan, CLIENT *Client )
 static bool
 Remove_Client( int Type, CHANNEL *Chan, CLIENT *Client, CLIENT *Origin, const char *Reason, bool InformServer )
 {
-	CL2CHAN *cl2chan, *last_cl2chan;
+	CL2CHAN *cl2chan;
 	CHANNEL *c;
 
 	assert( Chan != NULL );
@@ -1067,22 +1114,29 @@ Remove_Client( int Type, CHANNEL *Chan, CLIENT *Client, CLIENT *Origin, const ch
 	if(InformServer)
 		InformServer = !Channel_IsLocal(Chan);
 
-	last_cl2chan = NULL;
-	cl2chan = My_Cl2Chan;
-	while( cl2chan )
-	{
-		if(( cl2chan->channel == Chan ) && ( cl2chan->client == Client )) break;
-		last_cl2chan = cl2chan;
-		cl2chan = cl2chan->next;
-	}
+	cl2chan = Get_Cl2Chan(Chan, Client);
 	if( ! cl2chan ) return false;
 
 	c = cl2chan->channel;
 	assert( c != NULL );
 
-	/* maintain cl2chan list */
-	if( last_cl2chan ) last_cl2chan->next = cl2chan->next;
-	else My_Cl2Chan = cl2chan->next;
+	/* maintain member list of the channel */
+	if (cl2chan->prev)
+		cl2chan->prev->next = cl2chan->next;
+	else
+		c->members = cl2chan->next;
+	if (cl2chan->next)
+		cl2chan->next->prev = cl2chan->prev;
+	assert(c->member_count > 0);
+	c->member_count--;
+
+	/* maintain channel list of the client */
+	if (cl2chan->prev_chan)
+		cl2chan->prev_chan->next_chan = cl2chan->next_chan;
+	else
+		Client_SetCl2Chan(Client, (POINTER *)cl2chan->next_chan);
+	if (cl2chan->next_chan)
+		cl2chan->next_chan->prev_chan = cl2chan->prev_chan;
 	free( cl2chan );
 
 	switch( Type )
@@ -1134,7 +1188,7 @@ Remove_Client( int Type, CHANNEL *Chan, CLIENT *Client, CLIENT *Origin, const ch
 	/* When channel is empty and is not pre-defined, delete */
 	if( ! Channel_HasMode( Chan, 'P' ))
 	{
-		if( ! Get_First_Cl2Chan( NULL, Chan )) Delete_Channel( Chan );
+		if( ! Chan->members ) Delete_Channel( Chan );
 	}
 
 	return true;
@@ -1302,61 +1356,146 @@ Channel_CheckKey(CHANNEL *Chan, CLIENT *Client, const char *Key)
 } /* Channel_CheckKey */
 
 
-static CL2CHAN *
-Get_First_Cl2Chan( CLIENT *Client, CHANNEL *Chan )
+/**
+ * Remove a channel and free all of its data structures.
+ */
+static void
+Delete_Channel(CHANNEL *Chan)
 {
-	return Get_Next_Cl2Chan( My_Cl2Chan, Client, Chan );
-} /* Get_First_Cl2Chan */
+	assert(Chan != NULL);
 
+	/* maintain channel list */
+	if (Chan->prev)
+		Chan->prev->next = Chan->next;
+	else
+		My_Channels = Chan->next;
+	if (Chan->next)
+		Chan->next->prev = Chan->prev;
 
-static CL2CHAN *
-Get_Next_Cl2Chan( CL2CHAN *Start, CLIENT *Client, CHANNEL *Channel )
+	/* maintain channel index */
+	Index_Unlink(Chan);
+	My_ChannelIndexCount--;
+	Index_Rehash();
+
+	LogDebug("Freed channel structure for \"%s\".", Chan->name);
+	Free_Channel(Chan);
+} /* Delete_Channel */
+
+
+/**
+ * Prepend a channel to its bucket in a channel index table.
+ */
+static void
+Index_Link(CHANNEL **Index, size_t Size, CHANNEL *Chan)
 {
-	CL2CHAN *cl2chan;
+	CHANNEL **bucket;
+
+	bucket = &Index[Chan->hash & (Size - 1)];
+	Chan->hash_next = *bucket;
+	if (Chan->hash_next)
+		Chan->hash_next->hash_pprev = &Chan->hash_next;
+	Chan->hash_pprev = bucket;
+	*bucket = Chan;
+}
 
-	assert( Client != NULL || Channel != NULL );
 
-	cl2chan = Start;
-	while( cl2chan )
-	{
-		if(( Client ) && ( cl2chan->client == Client )) return cl2chan;
-		if(( Channel ) && ( cl2chan->channel == Channel )) return cl2chan;
-		cl2chan = cl2chan->next;
-	}
-	return NULL;
-} /* Get_Next_Cl2Chan */
+/**
+ * Remove a channel from the index table it is linked into, in O(1).
+ */
+static void
+Index_Unlink(CHANNEL *Chan)
+{
+	assert(Chan->hash_pprev != NULL);
+
+	*Chan->hash_pprev = Chan->hash_next;
+	if (Chan->hash_next)
+		Chan->hash_next->hash_pprev = Chan->hash_pprev;
+	Chan->hash_next = NULL;
+	Chan->hash_pprev = NULL;
+}
 
 
 /**
- * Remove a channel and free all of its data structures.
+ * Continue resizing the channel index, if a resize is in progress.
+ *
+ * To never stall the event loop when the index has to grow, not all
+ * channels are moved to the new table at once: each index operation
+ * migrates the next CHANNEL_INDEX_STEP buckets of the old table. Until
+ * the old table is empty, lookups have to check both tables.
  */
 static void
-Delete_Channel(CHANNEL *Chan)
+Index_Rehash(void)
 {
-	CHANNEL *chan, *last_chan;
+	CHANNEL *c;
+	int n;
 
-	last_chan = NULL;
-	chan = My_Channels;
-	while (chan) {
-		if (chan == Chan)
-			break;
-		last_chan = chan;
-		chan = chan->next;
+	if (!My_ChannelOldIndex)
+		return;
+
+	for (n = 0; n < CHANNEL_INDEX_STEP
+	     && My_ChannelRehashPos < My_ChannelOldIndexSize; n++) {
+		while ((c = My_ChannelOldIndex[My_ChannelRehashPos])) {
+			Index_Unlink(c);
+			Index_Link(My_ChannelIndex, My_ChannelIndexSize, c);
+		}
+		My_ChannelRehashPos++;
 	}
 
-	assert(chan != NULL);
-	if (!chan)
+	if (My_ChannelRehashPos < My_ChannelOldIndexSize)
 		return;
 
-	/* maintain channel list */
-	if (last_chan)
-		last_chan->next = chan->next;
-	else
-		My_Channels = chan->next;
+	free(My_ChannelOldIndex);
+	My_ChannelOldIndex = NULL;
+	My_ChannelOldIndexSize = 0;
+	LogDebug("Channel index resized to %lu buckets (%lu entries).",
+		 (unsigned long)My_ChannelIndexSize,
+		 (unsigned long)My_ChannelIndexCount);
+}
 
-	LogDebug("Freed channel structure for \"%s\".", Chan->name);
-	Free_Channel(Chan);
-} /* Delete_Channel */
+
+/**
+ * Add a new channel to the channel index, growing the index if required.
+ *
+ * @return true on success, false if the index could not be allocated.
+ */
+static bool
+Index_Add(CHANNEL *Chan)
+{
+	CHANNEL **index;
+
+	assert(Chan != NULL);
+
+	if (!My_ChannelIndex) {
+		My_ChannelIndex = (CHANNEL **)calloc(CHANNEL_INDEX_SIZE,
+						     sizeof(CHANNEL *));
+		if (!My_ChannelIndex) {
+			Log(LOG_EMERG, "Can't allocate memory! [Index_Add]");
+			return false;
+		}
+		My_ChannelIndexSize = CHANNEL_INDEX_SIZE;
+	}
+
+	Index_Rehash();
+
+	if (!My_ChannelOldIndex && My_ChannelIndexCount >= My_ChannelIndexSize) {
+		/* Start growing the index; if there is not enough memory,
+		 * simply continue with longer bucket chains. */
+		index = (CHANNEL **)calloc(My_ChannelIndexSize * 2,
+					   sizeof(CHANNEL *));
+		if (index) {
+			My_ChannelOldIndex = My_ChannelIndex;
+			My_ChannelOldIndexSize = My_ChannelIndexSize;
+			My_ChannelIndex = index;
+			My_ChannelIndexSize *= 2;
+			My_ChannelRehashPos = 0;
+		} else
+			Log(LOG_EMERG, "Can't allocate memory! [Index_Add]");
+	}
+
+	Index_Link(My_ChannelIndex, My_ChannelIndexSize, Chan);
+	My_ChannelIndexCount++;
+	return true;
+}
 
 
 static void
@@ -26,6 +26,9 @@
 typedef struct _CHANNEL
 {
 	struct _CHANNEL *next;
+	struct _CHANNEL *prev;
+	struct _CHANNEL *hash_next;	/* Next channel in same index bucket */
+	struct _CHANNEL **hash_pprev;	/* Pointer pointing to this channel */
 	char name[CHANNEL_NAME_LEN];	/* Name of the channel */
 	UINT32 hash;			/* Hash of the (lowecase!) name */
 	char modes[CHANNEL_MODE_LEN];	/* Channel modes */
@@ -41,11 +44,16 @@ typedef struct _CHANNEL
 	struct list_head list_excepts;	/* list head of (ban) exception list */
 	struct list_head list_invites;	/* list head of invited users */
 	array keyfile;			/* Name of the channel key file */
+	struct _CLIENT2CHAN *members;	/* List of channel members */
+	unsigned long member_count;	/* Number of channel members */
 } CHANNEL;
 
 typedef struct _CLIENT2CHAN
 {
-	struct _CLIENT2CHAN *next;
+	struct _CLIENT2CHAN *next;	/* Next member of the same channel */
+	struct _CLIENT2CHAN *prev;	/* Previous member of the same channel */
+	struct _CLIENT2CHAN *next_chan;	/* Next channel of the same client */
+	struct _CLIENT2CHAN *prev_chan;	/* Previous channel of the same client */
 	CLIENT *client;
 	CHANNEL *channel;
 	char modes[CHANNEL_MODE_LEN];	/* User-Modes in Channel */
@@ -69,7 +77,8 @@ GLOBAL void Channel_Exit PARAMS(( void ));
 GLOBAL bool Channel_Join PARAMS(( CLIENT *Client, const char *Name ));
 GLOBAL bool Channel_Part PARAMS(( CLIENT *Client, CLIENT *Origin, const char *Name, const char *Reason ));
 
-GLOBAL void Channel_Quit PARAMS(( CLIENT *Client, const char *Reason ));
+GLOBAL void Channel_Quit PARAMS(( CLIENT *Client, const char *Reason,
+				   bool Queue ));
 
 GLOBAL void Channel_Kick PARAMS((CLIENT *Peer, CLIENT *Target, CLIENT *Origin,
 				 const char *Name, const char *Reason));
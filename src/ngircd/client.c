@@ -45,10 +45,17 @@ static CLIENT *This_Server, *My_Clients;
 static WHOWAS My_Whowas[MAX_WHOWAS];
 static int Last_Whowas = -1;
 static long Max_Users, My_Max_Users;
+static long Users, My_Users, Services, My_Services, Servers, My_Servers;
+static long Opers, Unknown;
 
+static CLIENT **My_ClientIndex;
+static size_t My_ClientIndexSize, My_ClientIndexCount;
 
-static unsigned long Count PARAMS(( CLIENT_TYPE Type ));
-static unsigned long MyCount PARAMS(( CLIENT_TYPE Type ));
+/** Server which is being removed in a netsplit right now, if any. */
+static CLIENT *My_Netsplit;
+
+
+static void Count_Client PARAMS(( CLIENT *Client, int Delta ));
 
 static CLIENT *New_Client_Struct PARAMS(( void ));
 static void Generate_MyToken PARAMS(( CLIENT *Client ));
@@ -56,6 +63,14 @@ static void Adjust_Counters PARAMS(( CLIENT *Client ));
 
 static void Free_Client PARAMS(( CLIENT **Client ));
 
+static void Link_Child PARAMS(( CLIENT *Client ));
+static void Unlink_Child PARAMS(( CLIENT *Client ));
+
+static bool Index_Resize PARAMS(( size_t Size ));
+static void Index_Add PARAMS(( CLIENT *Client ));
+static void Index_Del PARAMS(( CLIENT *Client ));
+static CLIENT *Index_Lookup PARAMS(( const char *ID ));
+
 static CLIENT *Init_New_Client PARAMS((CONN_ID Idx, CLIENT *Introducer,
 				       CLIENT *TopServer, int Type, const char *ID,
 				       const char *User, const char *Hostname, const char *Info,
@@ -74,7 +89,7 @@ Client_Init( void )
 	struct hostent *h;
 
 	This_Server = New_Client_Struct( );
-	if( ! This_Server )
+	if( ! This_Server || ! Index_Resize( CLIENT_INDEX_SIZE ))
 	{
 		Log( LOG_EMERG, "Can't allocate client structure for server! Going down." );
 		Log( LOG_ALERT, "%s exiting due to fatal errors!", PACKAGE_NAME );
@@ -88,6 +103,7 @@ Client_Init( void )
 	This_Server->introducer = This_Server;
 	This_Server->mytoken = 1;
 	This_Server->hops = 0;
+	Count_Client(This_Server, 1);
 
 	gethostname( This_Server->host, CLIENT_HOST_LEN );
 	if (Conf_DNS) {
@@ -123,6 +139,13 @@ Client_Exit( void )
 	if (cnt)
 		Log(LOG_INFO, "Freed %d client structure%s.",
 		    cnt, cnt == 1 ? "" : "s");
+
+	Users = My_Users = Services = My_Services = Servers = My_Servers = 0;
+	Opers = Unknown = 0;
+
+	free(My_ClientIndex);
+	My_ClientIndex = NULL;
+	My_ClientIndexSize = My_ClientIndexCount = 0;
 } /* Client_Exit */
 
 
@@ -195,6 +218,10 @@ Init_New_Client(CONN_ID Idx, CLIENT *Introducer, CLIENT *TopServer,
 	client->introducer = Introducer;
 	client->topserver = TopServer;
 	client->type = Type;
+	client->hops = Hops;
+	client->token = Token;
+	Count_Client(client, 1);
+	Link_Child(client);
 	if (ID)
 		Client_SetID(client, ID);
 	if (User) {
@@ -205,8 +232,6 @@ Init_New_Client(CONN_ID Idx, CLIENT *Introducer, CLIENT *TopServer,
 		Client_SetHostname(client, Hostname);
 	if (Info)
 		Client_SetInfo(client, Info);
-	client->hops = Hops;
-	client->token = Token;
 	if (Modes)
 		Client_SetModes(client, Modes);
 	if (Type == CLIENT_SERVER)
@@ -216,6 +241,8 @@ Init_New_Client(CONN_ID Idx, CLIENT *Introducer, CLIENT *TopServer,
 		client->away = strndup(DEFAULT_AWAY_MSG, CLIENT_AWAY_LEN - 1);
 
 	client->next = (POINTER *)My_Clients;
+	if (My_Clients)
+		My_Clients->prev = client;
 	My_Clients = client;
 
 	Adjust_Counters(client);
@@ -229,7 +256,7 @@ Client_Destroy( CLIENT *Client, const char *LogMsg, const char *FwdMsg, bool Sen
 {
 	/* remove a client */
 
-	CLIENT *last, *c;
+	CLIENT *c;
 	char msg[COMMAND_LEN];
 	const char *txt;
 
@@ -239,86 +266,89 @@ Client_Destroy( CLIENT *Client, const char *LogMsg, const char *FwdMsg, bool Sen
 	if (!txt)
 		txt = "Reason unknown";
 
-	/* netsplit message */
-	if( Client->type == CLIENT_SERVER ) {
+	if (Client->type == CLIENT_SERVER) {
+		/* netsplit message */
 		strlcpy(msg, This_Server->id, sizeof (msg));
 		strlcat(msg, " ", sizeof (msg));
 		strlcat(msg, Client->id, sizeof (msg));
+
+		/*
+		 * The client that is about to be removed is a server, so all
+		 * clients introduced by this server have to be removed, too.
+		 *
+		 * Call Client_Destroy() recursively for each of them; this
+		 * removes them from the list of children of this server and
+		 * cleans up the whole subtree in O(subtree) time.
+		 *
+		 * The QUIT messages for local users are queued while the
+		 * whole subtree is removed and sent afterwards, see
+		 * Destroy_UserOrService().
+		 */
+		if (!My_Netsplit)
+			My_Netsplit = Client;
+		while ((c = Client->children))
+			Client_Destroy(c, NULL, msg, false);
+		if (My_Netsplit == Client) {
+			My_Netsplit = NULL;
+			IRC_FlushRelatedQuits();
+		}
 	}
 
-	last = NULL;
-	c = My_Clients;
-	while( c )
+	/* remove the client from the client list ... */
+	c = Client;
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		My_Clients = (CLIENT *)c->next;
+	if (c->next)
+		((CLIENT *)c->next)->prev = c->prev;
+
+	/* ... and from all other structures */
+	Unlink_Child(c);
+	Index_Del(c);
+	Count_Client(c, -1);
+
+	if(c->type == CLIENT_USER || c->type == CLIENT_SERVICE)
+		Destroy_UserOrService(c, txt, FwdMsg, SendQuit);
+	else if( c->type == CLIENT_SERVER )
 	{
-		if(( Client->type == CLIENT_SERVER ) && ( c->introducer == Client ) && ( c != Client ))
-		{
-			/*
-			 * The client that is about to be removed is a server,
-			 * the client we are checking right now is a child of that
-			 * server and thus has to be removed, too.
-			 *
-			 * Call Client_Destroy() recursively with the server as the
-			 * new "object to be removed". This starts the cycle again, until
-			 * all servers that are linked via the original server have been
-			 * removed.
-			 */
-			Client_Destroy( c, NULL, msg, false );
-			last = NULL;
-			c = My_Clients;
-			continue;
+		if (c != This_Server) {
+			if (c->conn_id != NONE)
+				Log(LOG_NOTICE|LOG_snotice,
+				    "Server \"%s\" unregistered (connection %d): %s.",
+				c->id, c->conn_id, txt);
+			else
+				Log(LOG_NOTICE|LOG_snotice,
+				    "Server \"%s\" unregistered: %s.",
+				    c->id, txt);
 		}
-		if( c == Client )
+
+		/* inform other servers */
+		if( ! NGIRCd_SignalQuit )
 		{
-			/* found  the client: remove it */
-			if( last ) last->next = c->next;
-			else My_Clients = (CLIENT *)c->next;
-
-			if(c->type == CLIENT_USER || c->type == CLIENT_SERVICE)
-				Destroy_UserOrService(c, txt, FwdMsg, SendQuit);
-			else if( c->type == CLIENT_SERVER )
-			{
-				if (c != This_Server) {
-					if (c->conn_id != NONE)
-						Log(LOG_NOTICE|LOG_snotice,
-						    "Server \"%s\" unregistered (connection %d): %s.",
-						c->id, c->conn_id, txt);
-					else
-						Log(LOG_NOTICE|LOG_snotice,
-						    "Server \"%s\" unregistered: %s.",
-						    c->id, txt);
-				}
-
-				/* inform other servers */
-				if( ! NGIRCd_SignalQuit )
-				{
-					if( FwdMsg ) IRC_WriteStrServersPrefix( Client_NextHop( c ), c, "SQUIT %s :%s", c->id, FwdMsg );
-					else IRC_WriteStrServersPrefix( Client_NextHop( c ), c, "SQUIT %s :", c->id );
-				}
-			}
+			if( FwdMsg ) IRC_WriteStrServersPrefix( Client_NextHop( c ), c, "SQUIT %s :%s", c->id, FwdMsg );
+			else IRC_WriteStrServersPrefix( Client_NextHop( c ), c, "SQUIT %s :", c->id );
+		}
+	}
+	else
+	{
+		if (c->conn_id != NONE) {
+			if (c->id[0])
+				Log(LOG_NOTICE,
+				    "Client \"%s\" unregistered (connection %d): %s.",
+				    c->id, c->conn_id, txt);
 			else
-			{
-				if (c->conn_id != NONE) {
-					if (c->id[0])
-						Log(LOG_NOTICE,
-						    "Client \"%s\" unregistered (connection %d): %s.",
-						    c->id, c->conn_id, txt);
-					else
-						Log(LOG_NOTICE,
-						    "Client unregistered (connection %d): %s.",
-						    c->conn_id, txt);
-				} else {
-					Log(LOG_WARNING,
-					    "Unregistered unknown client \"%s\": %s",
-					    c->id[0] ? c->id : "(No Nick)", txt);
-				}
-			}
-
-			Free_Client(&c);
-			break;
+				Log(LOG_NOTICE,
+				    "Client unregistered (connection %d): %s.",
+				    c->conn_id, txt);
+		} else {
+			Log(LOG_WARNING,
+			    "Unregistered unknown client \"%s\": %s",
+			    c->id[0] ? c->id : "(No Nick)", txt);
 		}
-		last = c;
-		c = (CLIENT *)c->next;
 	}
+
+	Free_Client(&c);
 } /* Client_Destroy */
 
 
@@ -386,6 +416,9 @@ Client_SetID( CLIENT *Client, const char *ID )
 	assert( Client != NULL );
 	assert( ID != NULL );
 
+	if (Client->id[0])
+		Index_Del(Client);
+
 	strlcpy( Client->id, ID, sizeof( Client->id ));
 
 	if (Conf_CloakUserToNick) {
@@ -395,6 +428,9 @@ Client_SetID( CLIENT *Client, const char *ID )
 
 	/* Hash */
 	Client->hash = Hash( Client->id );
+
+	if (Client->id[0])
+		Index_Add(Client);
 } /* Client_SetID */
 
 
@@ -458,7 +494,9 @@ Client_SetModes( CLIENT *Client, const char *Modes )
 	assert( Client != NULL );
 	assert( Modes != NULL );
 
+	Count_Client(Client, -1);
 	strlcpy(Client->modes, Modes, sizeof( Client->modes ));
+	Count_Client(Client, 1);
 } /* Client_SetModes */
 
 
@@ -506,11 +544,25 @@ Client_SetAway( CLIENT *Client, const char *Txt )
 } /* Client_SetAway */
 
 
+/**
+ * Set the head of the list of channel memberships of a client.
+ * The list itself is maintained by the channel module.
+ */
+GLOBAL void
+Client_SetCl2Chan( CLIENT *Client, POINTER *Cl2Chan )
+{
+	assert( Client != NULL );
+	Client->cl2chan = Cl2Chan;
+} /* Client_SetCl2Chan */
+
+
 GLOBAL void
 Client_SetType( CLIENT *Client, int Type )
 {
 	assert( Client != NULL );
+	Count_Client(Client, -1);
 	Client->type = Type;
+	Count_Client(Client, 1);
 	if( Type == CLIENT_SERVER ) Generate_MyToken( Client );
 	Adjust_Counters( Client );
 } /* Client_SetType */
@@ -520,7 +572,9 @@ GLOBAL void
 Client_SetHops( CLIENT *Client, int Hops )
 {
 	assert( Client != NULL );
+	Count_Client(Client, -1);
 	Client->hops = Hops;
+	Count_Client(Client, 1);
 } /* Client_SetHops */
 
 
@@ -537,7 +591,11 @@ Client_SetIntroducer( CLIENT *Client, CLIENT *Introducer )
 {
 	assert( Client != NULL );
 	assert( Introducer != NULL );
+	Count_Client(Client, -1);
+	Unlink_Child(Client);
 	Client->introducer = Introducer;
+	Link_Child(Client);
+	Count_Client(Client, 1);
 } /* Client_SetIntroducer */
 
 
@@ -555,7 +613,9 @@ Client_ModeAdd( CLIENT *Client, char Mode )
 
 	x[0] = Mode; x[1] = '\0';
 	if (!Client_HasMode(Client, x[0])) {
+		Count_Client(Client, -1);
 		strlcat( Client->modes, x, sizeof( Client->modes ));
+		Count_Client(Client, 1);
 		return true;
 	}
 	else return false;
@@ -580,11 +640,13 @@ Client_ModeDel( CLIENT *Client, char Mode )
 	if( ! p ) return false;
 
 	/* Client has Mode -> delete */
+	Count_Client(Client, -1);
 	while( *p )
 	{
 		*p = *(p + 1);
 		p++;
 	}
+	Count_Client(Client, 1);
 	return true;
 } /* Client_ModeDel */
 
@@ -598,8 +660,6 @@ GLOBAL CLIENT *
 Client_Search( const char *Nick )
 {
 	char search_id[CLIENT_ID_LEN], *ptr;
-	CLIENT *c = NULL;
-	UINT32 search_hash;
 
 	assert( Nick != NULL );
 
@@ -608,15 +668,7 @@ Client_Search( const char *Nick )
 	ptr = strchr( search_id, '!' );
 	if( ptr ) *ptr = '\0';
 
-	search_hash = Hash(search_id);
-
-	c = My_Clients;
-	while (c) {
-		if (c->hash == search_hash && strcasecmp(c->id, search_id) == 0)
-			return c;
-		c = (CLIENT *)c->next;
-	}
-	return NULL;
+	return Index_Lookup(search_id);
 }
 
 
@@ -666,12 +718,16 @@ Client_GetFromToken( CLIENT *Client, int Token )
 	if (!Token)
 		return NULL;
 
-	c = My_Clients;
+	/* directly linked servers are their own introducers */
+	if (Client->type == CLIENT_SERVER && Client->introducer == Client &&
+	    Client->token == Token)
+		return Client;
+
+	c = Client->children;
 	while (c) {
-		if ((c->type == CLIENT_SERVER) && (c->introducer == Client) &&
-			(c->token == Token))
+		if ((c->type == CLIENT_SERVER) && (c->token == Token))
 				return c;
-		c = (CLIENT *)c->next;
+		c = c->sibling_next;
 	}
 	return NULL;
 } /* Client_GetFromToken */
@@ -1002,6 +1058,14 @@ Client_Away( CLIENT *Client )
 } /* Client_Away */
 
 
+GLOBAL POINTER *
+Client_Cl2Chan( CLIENT *Client )
+{
+	assert( Client != NULL );
+	return Client->cl2chan;
+} /* Client_Cl2Chan */
+
+
 GLOBAL char *
 Client_AccountName(CLIENT *Client)
 {
@@ -1076,18 +1140,15 @@ Client_CheckID( CLIENT *Client, char *ID )
 	}
 
 	/* ID already in use? */
-	c = My_Clients;
-	while (c) {
-		if (strcasecmp(c->id, ID) == 0) {
-			snprintf(str, sizeof(str), "ID \"%s\" already registered", ID);
-			if (c->conn_id != NONE)
-				Log(LOG_ERR, "%s (on connection %d)!", str, c->conn_id);
-			else
-				Log(LOG_ERR, "%s (via network)!", str);
-			Conn_Close(Client->conn_id, str, str, true);
-			return false;
-		}
-		c = (CLIENT *)c->next;
+	c = Index_Lookup(ID);
+	if (c) {
+		snprintf(str, sizeof(str), "ID \"%s\" already registered", ID);
+		if (c->conn_id != NONE)
+			Log(LOG_ERR, "%s (on connection %d)!", str, c->conn_id);
+		else
+			Log(LOG_ERR, "%s (via network)!", str);
+		Conn_Close(Client->conn_id, str, str, true);
+		return false;
 	}
 
 	return true;
@@ -1112,85 +1173,56 @@ Client_Next( CLIENT *c )
 GLOBAL long
 Client_UserCount( void )
 {
-	return Count( CLIENT_USER );
+	return Users;
 } /* Client_UserCount */
 
 
 GLOBAL long
 Client_ServiceCount( void )
 {
-	return Count( CLIENT_SERVICE );;
+	return Services;
 } /* Client_ServiceCount */
 
 
 GLOBAL long
 Client_ServerCount( void )
 {
-	return Count( CLIENT_SERVER );
+	return Servers;
 } /* Client_ServerCount */
 
 
 GLOBAL long
 Client_MyUserCount( void )
 {
-	return MyCount( CLIENT_USER );
+	return My_Users;
 } /* Client_MyUserCount */
 
 
 GLOBAL long
 Client_MyServiceCount( void )
 {
-	return MyCount( CLIENT_SERVICE );
+	return My_Services;
 } /* Client_MyServiceCount */
 
 
 GLOBAL unsigned long
 Client_MyServerCount( void )
 {
-	CLIENT *c;
-	unsigned long cnt = 0;
-
-	c = My_Clients;
-	while( c )
-	{
-		if(( c->type == CLIENT_SERVER ) && ( c->hops == 1 )) cnt++;
-		c = (CLIENT *)c->next;
-	}
-	return cnt;
+	return (unsigned long)My_Servers;
 } /* Client_MyServerCount */
 
 
 GLOBAL unsigned long
 Client_OperCount( void )
 {
-	CLIENT *c;
-	unsigned long cnt = 0;
-
-	c = My_Clients;
-	while( c )
-	{
-		if (c && c->type == CLIENT_USER && Client_HasMode(c, 'o' ))
-			cnt++;
-		c = (CLIENT *)c->next;
-	}
-	return cnt;
+	return (unsigned long)Opers;
 } /* Client_OperCount */
 
 
 GLOBAL unsigned long
 Client_UnknownCount( void )
 {
-	CLIENT *c;
-	unsigned long cnt = 0;
-
-	c = My_Clients;
-	while( c )
-	{
-		if( c && ( c->type != CLIENT_USER ) && ( c->type != CLIENT_SERVICE ) && ( c->type != CLIENT_SERVER )) cnt++;
-		c = (CLIENT *)c->next;
-	}
-
-	return cnt;
+	return (unsigned long)Unknown;
 } /* Client_UnknownCount */
 
 
@@ -1345,36 +1377,42 @@ Client_Introduce(CLIENT *From, CLIENT *Client, int Type)
 } /* Client_Introduce */
 
 
-static unsigned long
-Count( CLIENT_TYPE Type )
-{
-	CLIENT *c;
-	unsigned long cnt = 0;
-
-	c = My_Clients;
-	while( c )
-	{
-		if( c->type == Type ) cnt++;
-		c = (CLIENT *)c->next;
-	}
-	return cnt;
-} /* Count */
-
-
-static unsigned long
-MyCount( CLIENT_TYPE Type )
+/**
+ * Add a client to (Delta 1) or remove it from (Delta -1) the client counters.
+ *
+ * The counters depend on the type, the introducer, the hop count and the
+ * user modes of a client. Therefore all functions changing one of these
+ * have to remove the client from the counters before and to re-add it
+ * after the change, so that all counters stay valid without walking the
+ * client list.
+ */
+static void
+Count_Client( CLIENT *Client, int Delta )
 {
-	CLIENT *c;
-	unsigned long cnt = 0;
+	assert(Client != NULL);
 
-	c = My_Clients;
-	while( c )
-	{
-		if(( c->introducer == This_Server ) && ( c->type == Type )) cnt++;
-		c = (CLIENT *)c->next;
+	switch (Client->type) {
+	case CLIENT_USER:
+		Users += Delta;
+		if (Client->introducer == This_Server)
+			My_Users += Delta;
+		if (strchr(Client->modes, 'o'))
+			Opers += Delta;
+		break;
+	case CLIENT_SERVICE:
+		Services += Delta;
+		if (Client->introducer == This_Server)
+			My_Services += Delta;
+		break;
+	case CLIENT_SERVER:
+		Servers += Delta;
+		if (Client->hops == 1)
+			My_Servers += Delta;
+		break;
+	default:
+		Unknown += Delta;
 	}
-	return cnt;
-} /* MyCount */
+} /* Count_Client */
 
 
 /**
@@ -1427,6 +1465,172 @@ Free_Client(CLIENT **Client)
 	*Client = NULL;
 }
 
+/**
+ * Add a client to the list of children of its introducer.
+ *
+ * Servers which are their own introducers (directly linked servers and this
+ * server itself) are not linked. New children are prepended, so that the
+ * list is ordered like the client list (newest client first).
+ */
+static void
+Link_Child(CLIENT *Client)
+{
+	CLIENT *introducer;
+
+	assert(Client != NULL);
+
+	introducer = Client->introducer;
+	if (!introducer || introducer == Client)
+		return;
+
+	Client->sibling_prev = NULL;
+	Client->sibling_next = introducer->children;
+	if (Client->sibling_next)
+		Client->sibling_next->sibling_prev = Client;
+	introducer->children = Client;
+}
+
+/**
+ * Remove a client from the list of children of its introducer.
+ */
+static void
+Unlink_Child(CLIENT *Client)
+{
+	CLIENT *introducer;
+
+	assert(Client != NULL);
+
+	introducer = Client->introducer;
+	if (!introducer || introducer == Client)
+		return;
+
+	if (Client->sibling_prev)
+		Client->sibling_prev->sibling_next = Client->sibling_next;
+	else
+		introducer->children = Client->sibling_next;
+	if (Client->sibling_next)
+		Client->sibling_next->sibling_prev = Client->sibling_prev;
+	Client->sibling_next = Client->sibling_prev = NULL;
+}
+
+/**
+ * Resize the client index and re-distribute all indexed clients.
+ *
+ * The index is a hash table with chained buckets (linked by the "hash_next"
+ * pointers of the CLIENT structures), its size is always a power of two.
+ *
+ * @param Size New number of buckets.
+ * @return true on success, false if no memory could be allocated; in this
+ *	   case the old table is left unchanged.
+ */
+static bool
+Index_Resize(size_t Size)
+{
+	CLIENT **index, *c, *next;
+	size_t i;
+
+	assert(Size > 0);
+	assert((Size & (Size - 1)) == 0);
+
+	index = (CLIENT **)calloc(Size, sizeof(CLIENT *));
+	if (!index) {
+		Log(LOG_EMERG, "Can't allocate memory! [Index_Resize]");
+		return false;
+	}
+
+	for (i = 0; i < My_ClientIndexSize; i++) {
+		c = My_ClientIndex[i];
+		while (c) {
+			next = c->hash_next;
+			c->hash_next = index[c->hash & (Size - 1)];
+			index[c->hash & (Size - 1)] = c;
+			c = next;
+		}
+	}
+
+	free(My_ClientIndex);
+	My_ClientIndex = index;
+	My_ClientIndexSize = Size;
+	LogDebug("Client index resized to %lu buckets (%lu entries).",
+		 (unsigned long)Size, (unsigned long)My_ClientIndexCount);
+	return true;
+}
+
+/**
+ * Add a client to the index, using its current ID and hash.
+ *
+ * New entries are prepended to their bucket, so Index_Lookup() returns the
+ * newest client with a given ID, like the list walk in Client_Search() did.
+ */
+static void
+Index_Add(CLIENT *Client)
+{
+	size_t bucket;
+
+	assert(Client != NULL);
+	assert(My_ClientIndex != NULL);
+
+	if (My_ClientIndexCount >= My_ClientIndexSize)
+		(void)Index_Resize(My_ClientIndexSize * 2);
+
+	bucket = Client->hash & (My_ClientIndexSize - 1);
+	Client->hash_next = My_ClientIndex[bucket];
+	My_ClientIndex[bucket] = Client;
+	My_ClientIndexCount++;
+}
+
+/**
+ * Remove a client from the index, if it has been indexed.
+ */
+static void
+Index_Del(CLIENT *Client)
+{
+	CLIENT **c;
+
+	assert(Client != NULL);
+
+	if (!My_ClientIndex)
+		return;
+
+	c = &My_ClientIndex[Client->hash & (My_ClientIndexSize - 1)];
+	while (*c) {
+		if (*c == Client) {
+			*c = Client->hash_next;
+			Client->hash_next = NULL;
+			My_ClientIndexCount--;
+			return;
+		}
+		c = &(*c)->hash_next;
+	}
+}
+
+/**
+ * Look up a client by its ID (case-insensitive).
+ *
+ * @param ID The nickname or server name to search for.
+ * @return Pointer to CLIENT structure or NULL if not found.
+ */
+static CLIENT *
+Index_Lookup(const char *ID)
+{
+	CLIENT *c;
+	UINT32 search_hash;
+
+	assert(ID != NULL);
+
+	if (!My_ClientIndex)
+		return NULL;
+
+	search_hash = Hash(ID);
+	c = My_ClientIndex[search_hash & (My_ClientIndexSize - 1)];
+	while (c) {
+		if (c->hash == search_hash && strcasecmp(c->id, ID) == 0)
+			return c;
+		c = c->hash_next;
+	}
+	return NULL;
+}
+
 static void
 Generate_MyToken( CLIENT *Client )
 {
@@ -1579,8 +1783,10 @@ Destroy_UserOrService(CLIENT *Client, const char *Txt, const char *FwdMsg, bool
 		}
 	}
 
-	/* Unregister client from channels */
-	Channel_Quit(Client, FwdMsg ? FwdMsg : Client->id);
+	/* Unregister client from channels, queue the QUIT messages when
+	 * the client is part of a netsplit */
+	Channel_Quit(Client, FwdMsg ? FwdMsg : Client->id,
+		     My_Netsplit != NULL);
 
 	/* Register client in My_Whowas structure */
 	Client_RegisterWhowas(Client);
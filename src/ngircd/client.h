@@ -44,6 +44,11 @@ typedef struct _CLIENT
 	char id[CLIENT_ID_LEN];		/* nick (user) / ID (server) */
 	UINT32 hash;			/* hash of lower-case ID */
 	POINTER *next;			/* pointer to next client structure */
+	struct _CLIENT *prev;		/* pointer to previous client structure */
+	struct _CLIENT *hash_next;	/* next client in same index bucket */
+	struct _CLIENT *children;	/* clients introduced by this server */
+	struct _CLIENT *sibling_next;	/* next client of same introducer */
+	struct _CLIENT *sibling_prev;	/* previous client of same introducer */
 	CLIENT_TYPE type;		/* type of client, see CLIENT_xxx */
 	CONN_ID conn_id;		/* ID of the connection (if local) or NONE (remote) */
 	struct _CLIENT *introducer;	/* ID of the servers which the client is connected to */
@@ -63,6 +68,7 @@ typedef struct _CLIENT
 	char flags[CLIENT_FLAGS_LEN];	/* flags of the client */
 	char *account_name;		/* login account (for services) */
 	int capabilities;		/* enabled IRC capabilities */
+	POINTER *cl2chan;		/* channel memberships, see channel.c */
 } CLIENT;
 
 #else
@@ -126,6 +132,7 @@ GLOBAL int Client_MyToken PARAMS(( CLIENT *Client ));
 GLOBAL CLIENT *Client_TopServer PARAMS(( CLIENT *Client ));
 GLOBAL CLIENT *Client_NextHop PARAMS(( CLIENT *Client ));
 GLOBAL char *Client_Away PARAMS(( CLIENT *Client ));
+GLOBAL POINTER *Client_Cl2Chan PARAMS(( CLIENT *Client ));
 GLOBAL char *Client_AccountName PARAMS((CLIENT *Client));
 GLOBAL time_t Client_StartTime PARAMS(( CLIENT *Client ));
 
@@ -145,6 +152,7 @@ GLOBAL void Client_SetModes PARAMS(( CLIENT *Client, const char *Modes ));
 GLOBAL void Client_SetFlags PARAMS(( CLIENT *Client, const char *Flags ));
 GLOBAL void Client_SetIntroducer PARAMS(( CLIENT *Client, CLIENT *Introducer ));
 GLOBAL void Client_SetAway PARAMS(( CLIENT *Client, const char *Txt ));
+GLOBAL void Client_SetCl2Chan PARAMS(( CLIENT *Client, POINTER *Cl2Chan ));
 GLOBAL void Client_SetAccountName PARAMS((CLIENT *Client, const char *AccountName));
 
 GLOBAL bool Client_ModeAdd PARAMS(( CLIENT *Client, char Mode ));
@@ -383,6 +383,7 @@ Conf_Test( void )
 
 	puts("[LIMITS]");
 	printf("  ConnectRetry = %d\n", Conf_ConnectRetry);
+	printf("  HelperProcesses = %d\n", Conf_HelperProcesses);
 	printf("  IdleTimeout = %d\n", Conf_IdleTimeout);
 	printf("  MaxConnections = %d\n", Conf_MaxConnections);
 	printf("  MaxConnectionsIP = %d\n", Conf_MaxConnectionsIP);
@@ -390,6 +391,7 @@ Conf_Test( void )
 	printf("  MaxNickLength = %u\n", Conf_MaxNickLength - 1);
 	printf("  MaxPenaltyTime = %ld\n", Conf_MaxPenaltyTime);
 	printf("  MaxListSize = %d\n", Conf_MaxListSize);
+	printf("  MaxLoginsPerSecond = %d\n", Conf_MaxLoginsPerSecond);
 	printf("  PingTimeout = %d\n", Conf_PingTimeout);
 	printf("  PongTimeout = %d\n", Conf_PongTimeout);
 	puts("");
@@ -425,6 +427,7 @@ Conf_Test( void )
 #ifndef STRICT_RFC
 	printf("  RequireAuthPing = %s\n", yesno_to_str(Conf_AuthPing));
 #endif
+	printf("  ResolvConfFile = %s\n", Conf_ResolvConfFile);
 	printf("  ScrubCTCP = %s\n", yesno_to_str(Conf_ScrubCTCP));
 #ifdef SYSLOG
 	printf("  SyslogFacility = %s\n",
@@ -762,6 +765,7 @@ Set_Defaults(bool InitServers)
 
 	/* Limits */
 	Conf_ConnectRetry = 60;
+	Conf_HelperProcesses = 4;
 	Conf_IdleTimeout = 0;
 	Conf_MaxConnections = 0;
 	Conf_MaxConnectionsIP = 5;
@@ -769,6 +773,7 @@ Set_Defaults(bool InitServers)
 	Conf_MaxNickLength = CLIENT_NICK_LEN_DEFAULT;
 	Conf_MaxPenaltyTime = -1;
 	Conf_MaxListSize = 100;
+	Conf_MaxLoginsPerSecond = 0;
 	Conf_PingTimeout = 120;
 	Conf_PongTimeout = 20;
 
@@ -811,6 +816,7 @@ Set_Defaults(bool InitServers)
 #endif
 	Conf_PAMIsOptional = false;
 	strcpy(Conf_PAMServiceName, "ngircd");
+	strlcpy(Conf_ResolvConfFile, RESOLV_CONF, sizeof(Conf_ResolvConfFile));
 	Conf_ScrubCTCP = false;
 #ifdef SYSLOG
 #ifdef LOG_LOCAL5
@@ -1471,6 +1477,16 @@ Handle_LIMITS(const char *File, int Line, char *Var, char *Arg)
 		}
 		return;
 	}
+	if (strcasecmp(Var, "HelperProcesses") == 0) {
+		Conf_HelperProcesses = atoi(Arg);
+		if (Conf_HelperProcesses < 1) {
+			Config_Error(LOG_WARNING,
+				     "%s, line %d: Value of \"HelperProcesses\" too low!",
+				     File, Line);
+			Conf_HelperProcesses = 1;
+		}
+		return;
+	}
 	if (strcasecmp(Var, "IdleTimeout") == 0) {
 		Conf_IdleTimeout = atoi(Arg);
 		if (!Conf_IdleTimeout && strcmp(Arg, "0"))
@@ -1505,6 +1521,12 @@ Handle_LIMITS(const char *File, int Line, char *Var, char *Arg)
 			Config_Error_NaN(File, Line, Var);
 		return;
 	}
+	if (strcasecmp(Var, "MaxLoginsPerSecond") == 0) {
+		Conf_MaxLoginsPerSecond = atoi(Arg);
+		if (!Conf_MaxLoginsPerSecond && strcmp(Arg, "0"))
+			Config_Error_NaN(File, Line, Var);
+		return;
+	}
 	if (strcasecmp(Var, "MaxPenaltyTime") == 0) {
 		Conf_MaxPenaltyTime = atol(Arg);
 		if (Conf_MaxPenaltyTime < -1)
@@ -1704,6 +1726,13 @@ Handle_OPTIONS(const char *File, int Line, char *Var, char *Arg)
 		return;
 	}
 #endif
+	if (strcasecmp(Var, "ResolvConfFile") == 0) {
+		len = strlcpy(Conf_ResolvConfFile, Arg,
+			      sizeof(Conf_ResolvConfFile));
+		if (len >= sizeof(Conf_ResolvConfFile))
+			Config_Error_TooLong(File, Line, Var);
+		return;
+	}
 	if (strcasecmp(Var, "ScrubCTCP") == 0) {
 		Conf_ScrubCTCP = Check_ArgIsTrue(Arg);
 		return;
@@ -2261,6 +2290,9 @@ Init_Server_Struct( CONF_SERVER *Server )
 {
 	assert( Server != NULL );
 
+	/* Abort a host name lookup still in progress */
+	Resolve_Cancel(&Server->res_stat);
+
 	memset( Server, 0, sizeof (CONF_SERVER) );
 
 	Server->group = NONE;
@@ -2268,7 +2300,7 @@ Init_Server_Struct( CONF_SERVER *Server )
 
 	if( NGIRCd_Passive ) Server->flags = CONF_SFLAG_DISABLED;
 
-	Proc_InitStruct(&Server->res_stat);
+	Resolve_InitStruct(&Server->res_stat);
 	Server->conn_id = NONE;
 	memset(&Server->bind_addr, 0, sizeof(Server->bind_addr));
 }
@@ -25,6 +25,7 @@
 #include "tool.h"
 #include "ng_ipaddr.h"
 #include "proc.h"
+#include "resolve.h"
 #include "conf-ssl.h"
 
 /**
@@ -53,7 +54,7 @@ typedef struct _Conf_Server
 	UINT16 port;			/**< Server port to connect to */
 	int group;			/**< Group ID of this server */
 	time_t lasttry;			/**< Time of last connection attempt */
-	PROC_STAT res_stat;		/**< Status of the resolver */
+	RES_STAT res_stat;		/**< Status of the resolver */
 	int flags;			/**< Server flags */
 	CONN_ID conn_id;		/**< ID of server connection or NONE */
 	ng_ipaddr_t bind_addr;		/**< Source address to use for outgoing
@@ -207,6 +208,9 @@ GLOBAL bool Conf_PAMIsOptional;
 /** The service name to use for PAM */
 GLOBAL char Conf_PAMServiceName[MAX_PAM_SERVICE_NAME_LEN];
 
+/** Resolver configuration file (resolv.conf) */
+GLOBAL char Conf_ResolvConfFile[FNAME_LEN];
+
 /** Disable all CTCP commands except for /me ? */
 GLOBAL bool Conf_ScrubCTCP;
 
@@ -222,6 +226,9 @@ GLOBAL bool Conf_ConnectIPv6;
 /** Try to connect to remote systems using the IPv4 protocol (true) */
 GLOBAL bool Conf_ConnectIPv4;
 
+/** Maximum number of worker processes of each helper pool */
+GLOBAL int Conf_HelperProcesses;
+
 /** Idle timout (seconds), after which the daemon should exit */
 GLOBAL int Conf_IdleTimeout;
 
@@ -234,6 +241,9 @@ GLOBAL int Conf_MaxJoins;
 /** Maximum number of connections per IP address */
 GLOBAL int Conf_MaxConnectionsIP;
 
+/** Maximum number of logins started per second (login queue) */
+GLOBAL int Conf_MaxLoginsPerSecond;
+
 /** Maximum length of a nickname */
 GLOBAL unsigned int Conf_MaxNickLength;
 
@@ -21,13 +21,23 @@
 #include <assert.h>
 #include <time.h>
 
-#ifdef DEBUG
-# include "log.h"
-#endif
+#include "log.h"
 #include "conn.h"
 
 #include "conf.h"
 #include "conn-func.h"
+#include "conn-timer.h"
+
+/** Connection marked for sending, see Conn_SetFlag(). */
+typedef struct {
+	CONN_ID conn;
+	int flag;
+} CONN_MARK;
+
+static array Marked_Conns;
+static unsigned long Mark_Epoch;
+
+static CONN_MARK *Get_Mark PARAMS((CONN_ID Idx));
 
 /**
  * Update "idle timestamp", the time of the last visible user action
@@ -115,6 +125,13 @@ Conn_SetPenalty(CONN_ID Idx, time_t Seconds)
 		My_Connections[Idx].delaytime = t;
 
 	My_Connections[Idx].delaytime += Seconds;
+	Conn_CheckReading(Idx);
+
+	/* Check the connection again when the penalty time ends, if this
+	 * is earlier than the timer of the connection expires. */
+	t = Timer_Expires(TIMER_CONN(Idx));
+	if (t && t > My_Connections[Idx].delaytime)
+		(void)Timer_Set(TIMER_CONN(Idx), My_Connections[Idx].delaytime);
 
 #ifdef DEBUG
 	Log(LOG_DEBUG,
@@ -125,28 +142,132 @@ Conn_SetPenalty(CONN_ID Idx, time_t Seconds)
 #endif
 } /* Conn_SetPenalty */
 
-GLOBAL void
+/**
+ * Start a new round of marking connections, clearing all flags.
+ *
+ * Flags are only valid if they have been set in the current round (epoch)
+ * and all marked connections are collected in a list, so neither clearing
+ * the flags nor walking the marked connections has to scan the whole
+ * connection pool.
+ *
+ * Rounds can be nested, as sending to the marked connections can result in
+ * new messages (e.g. QUIT when a write buffer overflows): the connections of
+ * a new round are appended to the list, behind the ones of the outer round.
+ *
+ * @return Position of the first connection of this round in the list, to
+ *	   be passed to Conn_NextFlagged() and Conn_ReleaseFlags().
+ */
+GLOBAL size_t
 Conn_ClearFlags( void )
 {
 	CONN_ID i;
 
-	for( i = 0; i < Pool_Size; i++ ) My_Connections[i].flag = 0;
+	if (++Mark_Epoch == 0) {
+		/* Overflow: invalidate all stale epochs and start over */
+		for (i = 0; i < Pool_Size; i++)
+			My_Connections[i].flag_epoch = 0;
+		Mark_Epoch = 1;
+	}
+	return array_length(&Marked_Conns, sizeof(CONN_MARK));
 } /* Conn_ClearFlags */
 
+/**
+ * Get the mark of a connection in the current round.
+ *
+ * The epoch of the connection is not sufficient: its mark may have been
+ * released already by Conn_ReleaseFlags() (and the position reused).
+ *
+ * @param Idx Connection index.
+ * @return Mark of the connection or NULL if it isn't marked.
+ */
+static CONN_MARK *
+Get_Mark(CONN_ID Idx)
+{
+	CONN_MARK *mark;
+	size_t pos = My_Connections[Idx].flag_pos;
+
+	if (My_Connections[Idx].flag_epoch != Mark_Epoch
+	    || pos >= array_length(&Marked_Conns, sizeof(CONN_MARK)))
+		return NULL;
+	mark = (CONN_MARK *)array_get(&Marked_Conns, sizeof(CONN_MARK), pos);
+	if (!mark || mark->conn != Idx)
+		return NULL;
+	return mark;
+} /* Get_Mark */
+
 GLOBAL int
 Conn_Flag( CONN_ID Idx )
 {
+	CONN_MARK *mark;
+
 	assert( Idx > NONE );
-	return My_Connections[Idx].flag;
+
+	mark = Get_Mark(Idx);
+	return mark ? mark->flag : 0;
 } /* Conn_Flag */
 
 GLOBAL void
 Conn_SetFlag( CONN_ID Idx, int Flag )
 {
+	CONN_MARK mark, *m;
+
 	assert( Idx > NONE );
-	My_Connections[Idx].flag = Flag;
+
+	m = Get_Mark(Idx);
+	if (m) {
+		/* Already marked in this round, only update the flag */
+		m->flag = Flag;
+		return;
+	}
+
+	mark.conn = Idx;
+	mark.flag = Flag;
+	if (!array_catb(&Marked_Conns, (char *)&mark, sizeof(mark))) {
+		Log(LOG_EMERG, "Can't allocate memory! [Conn_SetFlag]");
+		return;
+	}
+	My_Connections[Idx].flag_epoch = Mark_Epoch;
+	My_Connections[Idx].flag_pos =
+		array_length(&Marked_Conns, sizeof(CONN_MARK)) - 1;
 } /* Conn_SetFlag */
 
+/**
+ * Get the next connection marked in the current round.
+ *
+ * @param Pos Position in the list of marked connections, initialize it
+ *	      with the return value of Conn_ClearFlags().
+ * @param Flag Receives the flag of the connection.
+ * @return Connection index or NONE when all connections have been returned.
+ */
+GLOBAL CONN_ID
+Conn_NextFlagged( size_t *Pos, int *Flag )
+{
+	CONN_MARK *mark;
+
+	assert(Pos != NULL);
+	assert(Flag != NULL);
+
+	if (*Pos >= array_length(&Marked_Conns, sizeof(CONN_MARK)))
+		return NONE;
+
+	mark = (CONN_MARK *)array_get(&Marked_Conns, sizeof(CONN_MARK), *Pos);
+	assert(mark != NULL);
+	(*Pos)++;
+	*Flag = mark->flag;
+	return mark->conn;
+} /* Conn_NextFlagged */
+
+/**
+ * Finish a round of marking connections and forget its connections.
+ *
+ * @param Start Return value of the Conn_ClearFlags() call starting the round.
+ */
+GLOBAL void
+Conn_ReleaseFlags( size_t Start )
+{
+	array_truncate(&Marked_Conns, sizeof(CONN_MARK), Start);
+} /* Conn_ReleaseFlags */
+
 GLOBAL CONN_ID
 Conn_First( void )
 {
@@ -219,10 +340,11 @@ Conn_SendQ( CONN_ID Idx )
 	assert( Idx > NONE );
 #ifdef ZLIB
 	if( My_Connections[Idx].options & CONN_ZIP )
-		return array_bytes(&My_Connections[Idx].zip.wbuf);
+		return ringbuf_bytes(&My_Connections[Idx].zip.wbuf);
 	else
 #endif
-	return array_bytes(&My_Connections[Idx].wbuf);
+	return ringbuf_bytes(&My_Connections[Idx].wbuf)
+		+ My_Connections[Idx].outq_bytes;
 } /* Conn_SendQ */
 
 /**
@@ -256,10 +378,10 @@ Conn_RecvQ( CONN_ID Idx )
 	assert( Idx > NONE );
 #ifdef ZLIB
 	if( My_Connections[Idx].options & CONN_ZIP )
-		return array_bytes(&My_Connections[Idx].zip.rbuf);
+		return ringbuf_bytes(&My_Connections[Idx].zip.rbuf);
 	else
 #endif
-	return array_bytes(&My_Connections[Idx].rbuf);
+	return ringbuf_bytes(&My_Connections[Idx].rbuf);
 } /* Conn_RecvQ */
 
 /**
@@ -46,9 +46,11 @@ GLOBAL const char *Conn_IPA PARAMS(( CONN_ID Idx ));
 
 GLOBAL void Conn_SetPenalty PARAMS(( CONN_ID Idx, time_t Seconds ));
 
-GLOBAL void Conn_ClearFlags PARAMS(( void ));
+GLOBAL size_t Conn_ClearFlags PARAMS(( void ));
 GLOBAL int Conn_Flag PARAMS(( CONN_ID Idx ));
 GLOBAL void Conn_SetFlag PARAMS(( CONN_ID Idx, int Flag ));
+GLOBAL CONN_ID Conn_NextFlagged PARAMS(( size_t *Pos, int *Flag ));
+GLOBAL void Conn_ReleaseFlags PARAMS(( size_t Start ));
 
 GLOBAL CONN_ID Conn_First PARAMS(( void ));
 GLOBAL CONN_ID Conn_Next PARAMS(( CONN_ID Idx ));
@@ -0,0 +1,183 @@
+/*
+ * ngIRCd -- The Next Generation IRC Daemon
+ * Copyright (c)2001-2014 Alexander Barton (alex@barton.de) and Contributors.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * Please read the file COPYING, README and AUTHORS for more information.
+ */
+
+#include "portab.h"
+
+/**
+ * @file
+ * Split received data into lines
+ *
+ * All line terminators of a buffer are located in a single pass: the data
+ * is compared to CR and LF in blocks of 32 (AVX2) or 16 bytes (SSE2), if
+ * the compiler targets a CPU supporting these instruction sets, and byte
+ * by byte otherwise (and for the remaining bytes at the end of the buffer).
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+# define LINES_VECTOR 32
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+# define LINES_VECTOR 16
+#endif
+
+#include "conn-lines.h"
+
+static bool Add_Line PARAMS((const char *Buf, size_t Len, size_t Eol,
+			     size_t *Pos, LINE_SPAN *Line));
+
+#ifdef LINES_VECTOR
+static unsigned int Eol_Mask PARAMS((const char *Buf));
+static unsigned int Lowest_Bit PARAMS((unsigned int Mask));
+#endif
+
+
+/**
+ * Find complete lines in a buffer.
+ *
+ * RFC 2812 requires lines to be terminated by CR+LF, but unless ngIRCd is
+ * compiled with STRICT_RFC, a single CR or LF terminates a line, too
+ * (unfortunately, there are quite a few clients out there that send such
+ * lines -- e. g. mIRC, BitchX, and Trillian).
+ *
+ * The buffer doesn't have to be NULL terminated, lines may contain NULL
+ * characters. Data following the last line terminator is not returned.
+ *
+ * @param Buf	Buffer to split.
+ * @param Len	Number of bytes in the buffer.
+ * @param Lines	Array receiving the lines, in order.
+ * @param Max	Maximum number of lines to return (size of Lines).
+ * @returns	Number of lines found.
+ */
+GLOBAL size_t
+Lines_Split(const char *Buf, size_t Len, LINE_SPAN *Lines, size_t Max)
+{
+	size_t count = 0, pos = 0, i = 0;
+#ifdef LINES_VECTOR
+	unsigned int mask, bit;
+#endif
+
+	assert(Buf != NULL || Len == 0);
+	assert(Lines != NULL);
+
+	if (Max == 0)
+		return 0;
+
+#ifdef LINES_VECTOR
+	for (; i + LINES_VECTOR <= Len; i += LINES_VECTOR) {
+		mask = Eol_Mask(Buf + i);
+		while (mask) {
+			bit = Lowest_Bit(mask);
+			mask &= mask - 1;
+			if (Add_Line(Buf, Len, i + bit, &pos, &Lines[count])
+			    && ++count == Max)
+				return count;
+		}
+	}
+#endif
+	for (; i < Len; i++) {
+		if (Buf[i] != '\r' && Buf[i] != '\n')
+			continue;
+		if (Add_Line(Buf, Len, i, &pos, &Lines[count])
+		    && ++count == Max)
+			return count;
+	}
+	return count;
+} /* Lines_Split */
+
+/**
+ * Check a CR or LF character and add a line if it terminates one.
+ *
+ * @param Buf	Buffer.
+ * @param Len	Number of bytes in the buffer.
+ * @param Eol	Offset of the CR or LF character.
+ * @param Pos	Offset of the start of the current line, updated when a
+ *		line has been found.
+ * @param Line	Receives the line.
+ * @returns	true if a line has been found.
+ */
+static bool
+Add_Line(const char *Buf, size_t Len, size_t Eol, size_t *Pos, LINE_SPAN *Line)
+{
+	size_t delta = 1;
+
+	/* LF of a CR+LF line terminator that has already been handled */
+	if (Eol < *Pos)
+		return false;
+
+	if (Buf[Eol] == '\r' && Eol + 1 < Len && Buf[Eol + 1] == '\n')
+		delta = 2;
+#ifdef STRICT_RFC
+	else
+		return false;
+#endif
+
+	Line->start = *Pos;
+	Line->len = Eol - *Pos;
+	Line->end = Eol + delta;
+	*Pos = Line->end;
+	return true;
+} /* Add_Line */
+
+#ifdef LINES_VECTOR
+
+/**
+ * Compare a block of data to CR and LF.
+ *
+ * @param Buf	Block of LINES_VECTOR bytes, not necessarily aligned.
+ * @returns	Bit mask, bit n is set if byte n is a CR or LF character.
+ */
+static unsigned int
+Eol_Mask(const char *Buf)
+{
+#if defined(__AVX2__)
+	__m256i data = _mm256_loadu_si256((const __m256i *)Buf);
+
+	return (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_cmpeq_epi8(data, _mm256_set1_epi8('\r')),
+			_mm256_cmpeq_epi8(data, _mm256_set1_epi8('\n'))));
+#else
+	__m128i data = _mm_loadu_si128((const __m128i *)Buf);
+
+	return (unsigned int)_mm_movemask_epi8(_mm_or_si128(
+			_mm_cmpeq_epi8(data, _mm_set1_epi8('\r')),
+			_mm_cmpeq_epi8(data, _mm_set1_epi8('\n'))));
+#endif
+} /* Eol_Mask */
+
+/**
+ * Get the position of the lowest bit set in a bit mask.
+ *
+ * @param Mask	Bit mask, must not be 0.
+ * @returns	Position of the bit.
+ */
+static unsigned int
+Lowest_Bit(unsigned int Mask)
+{
+#ifdef __GNUC__
+	return (unsigned int)__builtin_ctz(Mask);
+#else
+	unsigned int bit = 0;
+
+	while (!(Mask & 1)) {
+		Mask >>= 1;
+		bit++;
+	}
+	return bit;
+#endif
+} /* Lowest_Bit */
+
+#endif /* LINES_VECTOR */
+
+/* -eof- */
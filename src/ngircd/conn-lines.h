@@ -0,0 +1,31 @@
+/*
+ * ngIRCd -- The Next Generation IRC Daemon
+ * Copyright (c)2001-2014 Alexander Barton (alex@barton.de) and Contributors.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * Please read the file COPYING, README and AUTHORS for more information.
+ */
+
+#ifndef __conn_lines_h__
+#define __conn_lines_h__
+
+/**
+ * @file
+ * Split received data into lines (header)
+ */
+
+typedef struct {
+	size_t start;		/**< Offset of the first character of the line */
+	size_t len;		/**< Length of the line without line terminator */
+	size_t end;		/**< Offset following the line terminator */
+} LINE_SPAN;
+
+GLOBAL size_t Lines_Split PARAMS((const char *Buf, size_t Len,
+				  LINE_SPAN *Lines, size_t Max));
+
+#endif
+
+/* -eof- */
@@ -654,11 +654,14 @@ ConnSSL_HandleError(CONNECTION * c, const int code, const char *fname)
 
 	switch (ret) {
 	case SSL_ERROR_WANT_READ:
+		io_event_blocked(c->sock, IO_WANTREAD);
 		io_event_del(c->sock, IO_WANTWRITE);
 		Conn_OPTION_ADD(c, CONN_SSL_WANT_READ);
 		return 0;	/* try again later */
 	case SSL_ERROR_WANT_WRITE:
+		io_event_blocked(c->sock, IO_WANTWRITE);
 		io_event_del(c->sock, IO_WANTREAD);
+		Conn_CheckReading(CONNECTION2ID(c));
 		Conn_OPTION_ADD(c, CONN_SSL_WANT_WRITE); /* fall through */
 	case SSL_ERROR_NONE:
 		return 0;	/* try again later */
@@ -699,9 +702,14 @@ ConnSSL_HandleError(CONNECTION * c, const int code, const char *fname)
 	case GNUTLS_E_AGAIN:
 	case GNUTLS_E_INTERRUPTED:
 		if (gnutls_record_get_direction(c->ssl_state.gnutls_session)) {
+			if (code == GNUTLS_E_AGAIN)
+				io_event_blocked(c->sock, IO_WANTWRITE);
 			Conn_OPTION_ADD(c, CONN_SSL_WANT_WRITE);
 			io_event_del(c->sock, IO_WANTREAD);
+			Conn_CheckReading(CONNECTION2ID(c));
 		} else {
+			if (code == GNUTLS_E_AGAIN)
+				io_event_blocked(c->sock, IO_WANTREAD);
 			Conn_OPTION_ADD(c, CONN_SSL_WANT_READ);
 			io_event_del(c->sock, IO_WANTWRITE);
 		}
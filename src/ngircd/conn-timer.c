@@ -0,0 +1,375 @@
+/*
+ * ngIRCd -- The Next Generation IRC Daemon
+ * Copyright (c)2001-2014 Alexander Barton (alex@barton.de) and Contributors.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * Please read the file COPYING, README and AUTHORS for more information.
+ */
+
+#include "portab.h"
+
+/**
+ * @file
+ * Timer wheel for connection timeouts
+ *
+ * Timers have a resolution of one second and are identified by small
+ * non-negative numbers chosen by the caller. They are kept in a hierarchical
+ * timer wheel: level 0 has one slot for each of the next TIMER_SLOTS
+ * seconds, and each slot of a higher level covers TIMER_SLOTS slots of the
+ * level below. When the wheel reaches the start of a slot of a higher level,
+ * its timers are moved ("cascaded") down to the lower levels.
+ *
+ * Setting and deleting a timer is O(1), expiring timers is O(expired) plus
+ * the occasional cascade. Timers are linked by their IDs instead of pointers,
+ * so the data they belong to can be moved around in memory freely.
+ */
+
+#include <assert.h>
+
+#include "array.h"
+#include "defines.h"
+#include "log.h"
+
+#include "conn-timer.h"
+
+#define TIMER_BITS	6
+#define TIMER_SLOTS	(1 << TIMER_BITS)
+#define TIMER_MASK	(TIMER_SLOTS - 1)
+#define TIMER_LEVELS	3
+
+/** Number of seconds covered by the whole timer wheel */
+#define TIMER_RANGE	((time_t)1 << (TIMER_LEVELS * TIMER_BITS))
+
+/** Index of the list of expired timers, following the lists of all slots */
+#define TIMER_DUE	(TIMER_LEVELS * TIMER_SLOTS)
+
+#define TIMER_PTR(Id)	((TIMER *)array_start(&My_Timers) + (Id))
+
+typedef struct {
+	int next;		/**< Next timer in the same list or NONE */
+	int prev;		/**< Previous timer in the same list or NONE */
+	int list;		/**< List this timer is linked to or NONE */
+	time_t expires;		/**< Time of expiry */
+} TIMER;
+
+static array My_Timers;
+static int My_TimerCount;
+static long My_TimersArmed;
+static int Lists[TIMER_DUE + 1];
+static time_t Wheel_Time;
+
+static void Link PARAMS((int Id, int List));
+static void Unlink PARAMS((int Id));
+static void Insert PARAMS((int Id));
+static void Advance PARAMS((void));
+static void Rebuild PARAMS((time_t Now));
+
+
+/**
+ * Initialize the timer wheel.
+ *
+ * @param Now Current time.
+ */
+GLOBAL void
+Timer_Init(time_t Now)
+{
+	int i;
+
+	array_free(&My_Timers);
+	My_TimerCount = 0;
+	My_TimersArmed = 0;
+	for (i = 0; i <= TIMER_DUE; i++)
+		Lists[i] = NONE;
+	Wheel_Time = Now;
+} /* Timer_Init */
+
+/**
+ * Delete all timers and free all memory of the timer wheel.
+ */
+GLOBAL void
+Timer_Exit(void)
+{
+	Timer_Init(0);
+} /* Timer_Exit */
+
+/**
+ * Set a timer, replacing its old expiry time if it is already set.
+ *
+ * Timers expiring at or before the current time of the wheel are returned
+ * by the next call to Timer_Expired().
+ *
+ * @param Id Timer ID.
+ * @param Expires Time of expiry.
+ * @returns true on success, false if memory could not be allocated.
+ */
+GLOBAL bool
+Timer_Set(int Id, time_t Expires)
+{
+	TIMER *t;
+	int i, n;
+
+	assert(Id >= 0);
+
+	if (Id >= My_TimerCount) {
+		n = My_TimerCount * 2;
+		if (n <= Id)
+			n = Id + 1;
+		if (!array_alloc(&My_Timers, sizeof(TIMER), (size_t)(n - 1))) {
+			Log(LOG_EMERG, "Can't allocate memory! [Timer_Set]");
+			return false;
+		}
+		for (i = My_TimerCount; i < n; i++) {
+			t = TIMER_PTR(i);
+			t->next = t->prev = t->list = NONE;
+			t->expires = 0;
+		}
+		My_TimerCount = n;
+	}
+
+	if (TIMER_PTR(Id)->list != NONE)
+		Unlink(Id);
+	TIMER_PTR(Id)->expires = Expires;
+	Insert(Id);
+	return true;
+} /* Timer_Set */
+
+/**
+ * Delete a timer, if it is set.
+ *
+ * @param Id Timer ID.
+ */
+GLOBAL void
+Timer_Del(int Id)
+{
+	assert(Id >= 0);
+
+	if (Id < My_TimerCount && TIMER_PTR(Id)->list != NONE)
+		Unlink(Id);
+} /* Timer_Del */
+
+/**
+ * Get the expiry time of a timer.
+ *
+ * @param Id Timer ID.
+ * @returns Time of expiry or 0 if the timer is not set.
+ */
+GLOBAL time_t
+Timer_Expires(int Id)
+{
+	assert(Id >= 0);
+
+	if (Id < My_TimerCount && TIMER_PTR(Id)->list != NONE)
+		return TIMER_PTR(Id)->expires;
+	return 0;
+} /* Timer_Expires */
+
+/**
+ * Get the next expired timer.
+ *
+ * The timer is deleted before it is returned, so it is safe to set it again
+ * (or to set or delete any other timer) before calling this function again.
+ *
+ * @param Now Current time.
+ * @returns ID of an expired timer or NONE if no timer has expired.
+ */
+GLOBAL int
+Timer_Expired(time_t Now)
+{
+	int id;
+
+	/* The clock has been adjusted, rebuild the whole wheel */
+	if (Now < Wheel_Time || Now - Wheel_Time > TIMER_RANGE)
+		Rebuild(Now);
+
+	while (Lists[TIMER_DUE] == NONE && Wheel_Time < Now) {
+		if (My_TimersArmed == 0)
+			Wheel_Time = Now;
+		else
+			Advance();
+	}
+
+	id = Lists[TIMER_DUE];
+	if (id != NONE)
+		Unlink(id);
+	return id;
+} /* Timer_Expired */
+
+/**
+ * Get the time at which the timer wheel needs attention next.
+ *
+ * This is the expiry time of the next timer or the time at which the timers
+ * of a slot of a higher level are cascaded, whatever comes first.
+ *
+ * @returns Time or 0 if no timer is set.
+ */
+GLOBAL time_t
+Timer_Next(void)
+{
+	time_t next = 0, start;
+	int i, level, shift;
+
+	if (My_TimersArmed == 0)
+		return 0;
+	if (Lists[TIMER_DUE] != NONE)
+		return Wheel_Time;
+
+	for (i = 1; i < TIMER_SLOTS; i++) {
+		if (Lists[(Wheel_Time + i) & TIMER_MASK] != NONE) {
+			next = Wheel_Time + i;
+			break;
+		}
+	}
+
+	for (level = 1; level < TIMER_LEVELS; level++) {
+		shift = level * TIMER_BITS;
+		for (i = 1; i <= TIMER_SLOTS; i++) {
+			start = ((Wheel_Time >> shift) + i) << shift;
+			if (next && start >= next)
+				break;
+			if (Lists[level * TIMER_SLOTS
+				  + ((start >> shift) & TIMER_MASK)] != NONE) {
+				next = start;
+				break;
+			}
+		}
+	}
+	return next;
+} /* Timer_Next */
+
+/**
+ * Link a timer to the head of a list.
+ */
+static void
+Link(int Id, int List)
+{
+	TIMER *t = TIMER_PTR(Id);
+
+	t->list = List;
+	t->prev = NONE;
+	t->next = Lists[List];
+	if (t->next != NONE)
+		TIMER_PTR(t->next)->prev = Id;
+	Lists[List] = Id;
+	My_TimersArmed++;
+} /* Link */
+
+/**
+ * Unlink a timer from its list.
+ */
+static void
+Unlink(int Id)
+{
+	TIMER *t = TIMER_PTR(Id);
+
+	assert(t->list != NONE);
+
+	if (t->prev != NONE)
+		TIMER_PTR(t->prev)->next = t->next;
+	else
+		Lists[t->list] = t->next;
+	if (t->next != NONE)
+		TIMER_PTR(t->next)->prev = t->prev;
+	t->next = t->prev = t->list = NONE;
+	My_TimersArmed--;
+} /* Unlink */
+
+/**
+ * Link a timer to the slot matching its expiry time.
+ *
+ * Timers expiring beyond the range of the wheel are linked to the last slot
+ * within range, they are inserted again when this slot is cascaded.
+ */
+static void
+Insert(int Id)
+{
+	time_t expires, delta;
+	int level, shift;
+
+	expires = TIMER_PTR(Id)->expires;
+	delta = expires - Wheel_Time;
+
+	if (delta <= 0) {
+		Link(Id, TIMER_DUE);
+		return;
+	}
+
+	/* Use the lowest level on which the slot of the timer still lies
+	 * ahead of the current slot, less than one full turn away */
+	for (level = 0; level < TIMER_LEVELS - 1; level++) {
+		shift = level * TIMER_BITS;
+		if ((expires >> shift) - (Wheel_Time >> shift) < TIMER_SLOTS)
+			break;
+	}
+	shift = level * TIMER_BITS;
+	if ((expires >> shift) - (Wheel_Time >> shift) >= TIMER_SLOTS)
+		expires = ((Wheel_Time >> shift) + TIMER_SLOTS - 1) << shift;
+	Link(Id, level * TIMER_SLOTS + (int)((expires >> shift) & TIMER_MASK));
+} /* Insert */
+
+/**
+ * Advance the timer wheel by one second.
+ *
+ * Cascade the slots of the higher levels starting now, then move all timers
+ * of the current slot of level 0 to the list of expired timers.
+ */
+static void
+Advance(void)
+{
+	int level, shift, list, id, next;
+
+	Wheel_Time++;
+
+	for (level = TIMER_LEVELS - 1; level > 0; level--) {
+		shift = level * TIMER_BITS;
+		if (Wheel_Time & (((time_t)1 << shift) - 1))
+			continue;
+
+		list = level * TIMER_SLOTS
+		       + (int)((Wheel_Time >> shift) & TIMER_MASK);
+		id = Lists[list];
+		while (id != NONE) {
+			next = TIMER_PTR(id)->next;
+			Unlink(id);
+			Insert(id);
+			id = next;
+		}
+	}
+
+	list = (int)(Wheel_Time & TIMER_MASK);
+	while ((id = Lists[list]) != NONE) {
+		Unlink(id);
+		Link(id, TIMER_DUE);
+	}
+} /* Advance */
+
+/**
+ * Insert all timers again, using a new current time.
+ *
+ * @param Now New current time of the wheel.
+ */
+static void
+Rebuild(time_t Now)
+{
+	int i;
+
+	LogDebug("Rebuilding timer wheel (%ld second%s off) ...",
+		 (long)(Now - Wheel_Time),
+		 Now - Wheel_Time != 1 ? "s" : "");
+
+	for (i = 0; i <= TIMER_DUE; i++)
+		Lists[i] = NONE;
+	My_TimersArmed = 0;
+	Wheel_Time = Now;
+
+	for (i = 0; i < My_TimerCount; i++) {
+		if (TIMER_PTR(i)->list == NONE)
+			continue;
+		TIMER_PTR(i)->list = NONE;
+		Insert(i);
+	}
+} /* Rebuild */
+
+/* -eof- */
@@ -0,0 +1,34 @@
+/*
+ * ngIRCd -- The Next Generation IRC Daemon
+ * Copyright (c)2001-2014 Alexander Barton (alex@barton.de) and Contributors.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * Please read the file COPYING, README and AUTHORS for more information.
+ */
+
+#ifndef __conn_timer_h__
+#define __conn_timer_h__
+
+/**
+ * @file
+ * Timer wheel for connection timeouts (header)
+ */
+
+#include <time.h>
+
+GLOBAL void Timer_Init PARAMS((time_t Now));
+GLOBAL void Timer_Exit PARAMS((void));
+
+GLOBAL bool Timer_Set PARAMS((int Id, time_t Expires));
+GLOBAL void Timer_Del PARAMS((int Id));
+GLOBAL time_t Timer_Expires PARAMS((int Id));
+
+GLOBAL int Timer_Expired PARAMS((time_t Now));
+GLOBAL time_t Timer_Next PARAMS((void));
+
+#endif
+
+/* -eof- */
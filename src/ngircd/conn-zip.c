@@ -30,7 +30,7 @@
 #include "conn.h"
 #include "conn-func.h"
 #include "log.h"
-#include "array.h"
+#include "ringbuf.h"
 
 #include "conn-zip.h"
 
@@ -96,7 +96,7 @@ Zip_Buffer( CONN_ID Idx, const char *Data, size_t Len )
 	assert( Data != NULL );
 	assert( Len > 0 );
 
-	buflen = array_bytes(&My_Connections[Idx].zip.wbuf);
+	buflen = ringbuf_bytes(&My_Connections[Idx].zip.wbuf);
 	if (buflen + Len >= WRITEBUFFER_SLINK_LEN) {
 		/* compression buffer is full, flush */
 		if( ! Zip_Flush( Idx )) return false;
@@ -104,13 +104,13 @@ Zip_Buffer( CONN_ID Idx, const char *Data, size_t Len )
 
 	/* check again; if zip buf is still too large do not append data:
 	 * otherwise the zip wbuf would grow too large */
-	buflen = array_bytes(&My_Connections[Idx].zip.wbuf);
+	buflen = ringbuf_bytes(&My_Connections[Idx].zip.wbuf);
 	if (buflen + Len >= WRITEBUFFER_SLINK_LEN) {
 		Log(LOG_ALERT, "Zip Write buffer space exhausted: %lu bytes", buflen + Len);
 		Conn_Close(Idx, "Zip Write buffer space exhausted", NULL, false);
 		return false;
 	}
-	return array_catb(&My_Connections[Idx].zip.wbuf, Data, Len);
+	return ringbuf_catb(&My_Connections[Idx].zip.wbuf, Data, Len);
 } /* Zip_Buffer */
 
 
@@ -131,11 +131,15 @@ Zip_Flush( CONN_ID Idx )
 
 	out = &My_Connections[Idx].zip.out;
 
-	out->avail_in = (uInt)array_bytes(&My_Connections[Idx].zip.wbuf);
+	out->avail_in = (uInt)ringbuf_bytes(&My_Connections[Idx].zip.wbuf);
 	if (!out->avail_in)
 		return true;	/* nothing to do. */
 
-	out->next_in = array_start(&My_Connections[Idx].zip.wbuf);
+	/* The compression buffer is always flushed completely, so its
+	 * contents never wrap around */
+	assert(ringbuf_contiguous(&My_Connections[Idx].zip.wbuf)
+	       == out->avail_in);
+	out->next_in = ringbuf_start(&My_Connections[Idx].zip.wbuf);
 	assert(out->next_in != NULL);
 
 	out->next_out = zipbuf;
@@ -167,16 +171,16 @@ Zip_Flush( CONN_ID Idx )
 #if DEBUG_ZIP
 	Log(LOG_DEBUG, "zipbuf_used: %d", zipbuf_used);
 #endif
-	if (!array_catb(&My_Connections[Idx].wbuf,
-			(char *)zipbuf, (size_t) zipbuf_used)) {
+	if (!ringbuf_catb(&My_Connections[Idx].wbuf,
+			  (char *)zipbuf, (size_t) zipbuf_used)) {
 		Log (LOG_ALERT, "Compression error: can't copy data!?");
 		Conn_Close(Idx, "Compression error!", NULL, false);
 		return false;
 	}
 
 	My_Connections[Idx].bytes_out += zipbuf_used;
-	My_Connections[Idx].zip.bytes_out += array_bytes(&My_Connections[Idx].zip.wbuf);
-	array_trunc(&My_Connections[Idx].zip.wbuf);
+	My_Connections[Idx].zip.bytes_out += ringbuf_bytes(&My_Connections[Idx].zip.wbuf);
+	ringbuf_trunc(&My_Connections[Idx].zip.wbuf);
 
 	return true;
 } /* Zip_Flush */
@@ -203,13 +207,20 @@ Unzip_Buffer( CONN_ID Idx )
 
 	assert( Idx > NONE );
 
-	z_rdatalen = (unsigned int)array_bytes(&My_Connections[Idx].zip.rbuf);
+	z_rdatalen = (unsigned int)ringbuf_bytes(&My_Connections[Idx].zip.rbuf);
 	if (z_rdatalen == 0)
 		return true;
 
+	/* Received data may wrap around in the buffer */
+	if (!ringbuf_linearize(&My_Connections[Idx].zip.rbuf, 0)) {
+		Log(LOG_ALERT, "Decompression error: can't allocate memory!?");
+		Conn_Close(Idx, "Decompression error!", NULL, false);
+		return false;
+	}
+
 	in = &My_Connections[Idx].zip.in;
 
-	in->next_in = array_start(&My_Connections[Idx].zip.rbuf);
+	in->next_in = ringbuf_start(&My_Connections[Idx].zip.rbuf);
 	assert(in->next_in != NULL);
 
 	in->avail_in = z_rdatalen;
@@ -236,16 +247,16 @@ Unzip_Buffer( CONN_ID Idx )
 		in->avail_out, unzipbuf_used);
 #endif
 	assert(unzipbuf_used <= READBUFFER_LEN);
-	if (!array_catb(&My_Connections[Idx].rbuf, (char*) unzipbuf,
+	if (!ringbuf_catb(&My_Connections[Idx].rbuf, (char*) unzipbuf,
 			(size_t)unzipbuf_used)) {
 		Log (LOG_ALERT, "Decompression error: can't copy data!?");
 		Conn_Close(Idx, "Decompression error!", NULL, false);
 		return false;
 	}
 	if( in->avail_in > 0 ) {
-		array_moveleft(&My_Connections[Idx].zip.rbuf, 1, in_len );
+		ringbuf_consume(&My_Connections[Idx].zip.rbuf, in_len);
 	} else {
-		array_trunc( &My_Connections[Idx].zip.rbuf );
+		ringbuf_trunc(&My_Connections[Idx].zip.rbuf);
 		My_Connections[Idx].zip.bytes_in += unzipbuf_used;
 	}
 
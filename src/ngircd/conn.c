@@ -36,8 +36,13 @@
 #include <strings.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
+#ifdef HAVE_SYS_RESOURCE_H
+# include <sys/resource.h>
+#endif
 #include <netinet/in.h>
 
 #ifdef HAVE_NETINET_IP_H
@@ -61,6 +66,8 @@
 #include "conn-ssl.h"
 #include "conn-zip.h"
 #include "conn-func.h"
+#include "conn-lines.h"
+#include "conn-timer.h"
 #include "io.h"
 #include "log.h"
 #include "ng_ipaddr.h"
@@ -72,32 +79,65 @@
 #define MAX_COMMANDS 3			/** Max. commands per loop for users */
 #define MAX_COMMANDS_SERVER_MIN 10	/** Min. commands per loop for servers */
 #define MAX_COMMANDS_SERVICE 10		/** Max. commands per loop for services */
+#define MAX_COMMANDS_BATCH 32		/** Max. commands split at once */
+#define MAX_WRITE_IOV 64		/** Max. buffers written at once */
 
 #define SD_LISTEN_FDS_START 3		/** systemd(8) socket activation offset */
 
+#define IPCOUNT_MIN 64			/** Initial size of the IP hash table */
+
 #define THROTTLE_CMDS 1			/** Throttling: max commands reached */
 #define THROTTLE_BPS 2			/** Throttling: max bps reached */
 
 static bool Handle_Write PARAMS(( CONN_ID Idx ));
-static bool Conn_Write PARAMS(( CONN_ID Idx, char *Data, size_t Len ));
+static bool Conn_Write PARAMS(( CONN_ID Idx, const char *Data, size_t Len ));
+static bool Check_Write_Space PARAMS(( CONN_ID Idx, size_t Len ));
+static bool Queue_Add PARAMS(( CONN_ID Idx, MSGBLOCK *Block, size_t Len ));
+static int Queue_Iovec PARAMS(( CONN_ID Idx, struct iovec *Iov, int Max ));
+static void Queue_Consume PARAMS(( CONN_ID Idx, size_t Len ));
+static size_t Iovec_Len PARAMS(( const struct iovec *Iov, int Cnt ));
+static void Queue_Free PARAMS(( CONN_ID Idx ));
 static int New_Connection PARAMS(( int Sock, bool IsSSL ));
+static IPCOUNT *IPCount_Lookup PARAMS(( const ng_ipaddr_t *Addr ));
+static long IPCount_Get PARAMS(( const ng_ipaddr_t *Addr ));
+static void IPCount_Add PARAMS(( const ng_ipaddr_t *Addr ));
+static void IPCount_Del PARAMS(( const ng_ipaddr_t *Addr ));
 static CONN_ID Socket2Index PARAMS(( int Sock ));
+static CONN_ID Pool_ReserveSize PARAMS(( void ));
+static bool Pool_Resize PARAMS(( CONN_ID Size ));
 static void Read_Request PARAMS(( CONN_ID Idx ));
 static unsigned int Handle_Buffer PARAMS(( CONN_ID Idx ));
-static void Check_Connections PARAMS(( void ));
+static void Handle_Timeout PARAMS(( int Id ));
+static void Check_Connection PARAMS(( CONN_ID Idx ));
+static void Schedule_Connection PARAMS(( CONN_ID Idx ));
 static void Check_Servers PARAMS(( void ));
 static void Init_Conn_Struct PARAMS(( CONN_ID Idx ));
 static bool Init_Socket PARAMS(( int Sock ));
+static void Set_Socket_Options PARAMS(( int Sock ));
 static void New_Server PARAMS(( int Server, ng_ipaddr_t *dest ));
 static void Simple_Message PARAMS(( int Sock, const char *Msg ));
 static int NewListener PARAMS(( const char *listen_addr, UINT16 Port ));
 static void Account_Connection PARAMS((void));
+static void Start_Login PARAMS((CONN_ID Idx));
+static bool Login_Token PARAMS((time_t Now));
+static void Admit_Logins PARAMS((void));
 static void Throttle_Connection PARAMS((const CONN_ID Idx, CLIENT *Client,
 					const int Reason, unsigned int Value));
+static void List_Add PARAMS((int List, CONN_ID Idx));
+static void List_Del PARAMS((int List, CONN_ID Idx));
 
 static array My_Listeners;
-static array My_ConnArray;
+static CONN_ID Pool_Reserved;
+static CONN_ID *My_ConnList[CONN_LISTS];
+static CONN_ID My_ConnListLen[CONN_LISTS];
 static size_t NumConnections, NumConnectionsMax, NumConnectionsAccepted;
+static IPCOUNT *My_IPCounts;
+static size_t My_IPCountsSize, My_IPCountsUsed;
+static array My_LoginQueue;
+static size_t LoginQueueHead;
+static long NumLoginsQueued, NumLoginsQueuedMax, NumLoginsRejected;
+static long LoginTokens;
+static time_t LoginTokensTime;
 
 #ifdef TCPWRAP
 int allow_severity = LOG_INFO;
@@ -114,8 +154,10 @@ static void cb_listen_ssl PARAMS((int sock, short irrelevant));
 static void cb_connserver_login_ssl PARAMS((int sock, short what));
 static void cb_clientserver_ssl PARAMS((int sock, short what));
 #endif
-static void cb_Read_Resolver_Result PARAMS((int sock, UNUSED short what));
-static void cb_Connect_to_Server PARAMS((int sock, UNUSED short what));
+static void cb_Resolver_Result PARAMS((int Idx, const char *Host,
+				       const char *Ident));
+static void cb_Connect_to_Server PARAMS((int Server, const ng_ipaddr_t *Addrs,
+					 size_t Count));
 static void cb_clientserver PARAMS((int sock, short what));
 
 time_t idle_t = 0;
@@ -166,7 +208,8 @@ static void
 cb_listen(int sock, short irrelevant)
 {
 	(void) irrelevant;
-	(void) New_Connection(sock, false);
+	while (New_Connection(sock, false) != -2)
+		/* accept all pending connections */ ;
 }
 
 /**
@@ -306,20 +349,26 @@ cb_clientserver(int sock, short what)
 GLOBAL void
 Conn_Init( void )
 {
-	int size;
+	CONN_ID size;
 
 	/* Initialize the "connection pool".
 	 * FIXME: My_Connetions/Pool_Size is needed by other parts of the
 	 * code; remove them! */
 	Pool_Size = 0;
-	size = Conf_MaxConnections > 0 ? Conf_MaxConnections : CONNECTION_POOL;
-	if (Socket2Index(size) <= NONE) {
+	size = Pool_ReserveSize();
+	if (!Pool_Resize(size)) {
 		Log(LOG_EMERG, "Failed to initialize connection pool!");
 		exit(1);
 	}
+	Log(LOG_INFO,
+	    "Reserved connection pool for %ld sockets (%lu bytes, %lu per connection).",
+	    (long)size, (unsigned long)size * sizeof(CONNECTION),
+	    (unsigned long)sizeof(CONNECTION));
 
 	/* Initialize "listener" array. */
 	array_free( &My_Listeners );
+
+	Timer_Init(time(NULL));
 } /* Conn_Init */
 
 /**
@@ -329,40 +378,38 @@ GLOBAL void
 Conn_Exit( void )
 {
 	CONN_ID idx;
+	int i;
 
 	Conn_ExitListeners();
 
 	LogDebug("Shutting down all connections ..." );
-	for( idx = 0; idx < Pool_Size; idx++ ) {
-		if( My_Connections[idx].sock > NONE ) {
-			Conn_Close( idx, NULL, NGIRCd_SignalRestart ?
-				"Server going down (restarting)":"Server going down", true );
-		}
+	while (My_ConnListLen[CONN_LIST_ACTIVE] > 0) {
+		idx = My_ConnList[CONN_LIST_ACTIVE][0];
+		Conn_Close( idx, NULL, NGIRCd_SignalRestart ?
+			"Server going down (restarting)":"Server going down", true );
 	}
 
-	array_free(&My_ConnArray);
+	/* Abort pending host name lookups of outgoing server links */
+	for (i = 0; i < MAX_SERVERS; i++)
+		Resolve_Cancel(&Conf_Server[i].res_stat);
+
+	for (i = 0; i < CONN_LISTS; i++) {
+		free(My_ConnList[i]);
+		My_ConnList[i] = NULL;
+		My_ConnListLen[i] = 0;
+	}
+	free(My_Connections);
 	My_Connections = NULL;
-	Pool_Size = 0;
+	Pool_Size = Pool_Reserved = 0;
+	free(My_IPCounts);
+	My_IPCounts = NULL;
+	My_IPCountsSize = My_IPCountsUsed = 0;
+	array_free(&My_LoginQueue);
+	LoginQueueHead = 0;
+	Timer_Exit();
 	io_library_shutdown();
 } /* Conn_Exit */
 
-/**
- * Close all sockets (file descriptors) of open connections.
- * This is useful in forked child processes, for example, to make sure that
- * they don't hold connections open that the main process wants to close.
- */
-GLOBAL void
-Conn_CloseAllSockets(int ExceptOf)
-{
-	CONN_ID idx;
-
-	for(idx = 0; idx < Pool_Size; idx++) {
-		if(My_Connections[idx].sock > NONE &&
-		   My_Connections[idx].sock != ExceptOf)
-			close(My_Connections[idx].sock);
-	}
-}
-
 /**
  * Initialize listening ports.
  *
@@ -387,7 +434,7 @@ Init_Listeners(array *a, const char *listen_addr, void (*func)(int,short))
 			port++;
 			continue;
 		}
-		if (!io_event_create( fd, IO_WANTREAD, func )) {
+		if (!io_event_create(fd, IO_WANTREAD|IO_LISTEN, func)) {
 			Log(LOG_ERR,
 			    "io_event_create(): Can't add fd %d (port %u): %s!",
 			    fd, (unsigned int) *port, strerror(errno));
@@ -463,7 +510,8 @@ Conn_InitListeners( void )
 			}
 
 			Init_Socket(fd);
-			if (!io_event_create(fd, IO_WANTREAD, cb_listen)) {
+			if (!io_event_create(fd, IO_WANTREAD|IO_LISTEN,
+					     cb_listen)) {
 				Log(LOG_ERR,
 				    "io_event_create(): Can't add fd %d: %s!",
 				    fd, strerror(errno));
@@ -656,44 +704,52 @@ NewListener(const char *listen_addr, UINT16 Port)
 GLOBAL void
 Conn_Handler(void)
 {
-	int i;
+	int i, n;
 	size_t wdatalen;
-	struct timeval tv;
-	time_t t;
+	struct timeval tv, now;
+	time_t t, next;
 	bool command_available;
 
 	Log(LOG_NOTICE, "Server \"%s\" (on \"%s\") ready.",
 	    Client_ID(Client_ThisServer()), Client_Hostname(Client_ThisServer()));
 
+	t = time(NULL);
+	(void)Timer_Set(TIMER_SERVERS, t);
+	(void)Timer_Set(TIMER_HOUSEKEEPING, t);
+
 	while (!NGIRCd_SignalQuit && !NGIRCd_SignalRestart) {
 		t = time(NULL);
 		command_available = false;
 
-		/* Check configured servers and established links */
-		Check_Servers();
-		Check_Connections();
-
-		/* Expire outdated class/list items */
-		Class_Expire();
+		/* Check configured servers, established links and
+		 * everything else that has a timeout pending */
+		while ((i = Timer_Expired(t)) != NONE)
+			Handle_Timeout(i);
 
-		/* Look for non-empty read buffers ... */
-		for (i = 0; i < Pool_Size; i++) {
-			if ((My_Connections[i].sock > NONE)
-			    && (array_bytes(&My_Connections[i].rbuf) > 0)) {
+		/* Look for non-empty read buffers ... Walk the list backwards,
+		 * handling commands can close connections and remove them
+		 * from the list (and move the last entry to their position). */
+		for (n = My_ConnListLen[CONN_LIST_INPUT] - 1; n >= 0; n--) {
+			if (n >= My_ConnListLen[CONN_LIST_INPUT])
+				continue;
+			i = My_ConnList[CONN_LIST_INPUT][n];
+			if (ringbuf_bytes(&My_Connections[i].rbuf) > 0) {
 				/* ... and try to handle the received data */
 				Handle_Buffer(i);
 			}
+			if (ringbuf_bytes(&My_Connections[i].rbuf) == 0)
+				List_Del(CONN_LIST_INPUT, i);
 		}
 
 		/* Look for non-empty write buffers ... */
-		for (i = 0; i < Pool_Size; i++) {
-			if (My_Connections[i].sock <= NONE)
-				continue;
+		for (n = My_ConnListLen[CONN_LIST_OUTPUT] - 1; n >= 0; n--) {
+			i = My_ConnList[CONN_LIST_OUTPUT][n];
 
-			wdatalen = array_bytes(&My_Connections[i].wbuf);
+			wdatalen = ringbuf_bytes(&My_Connections[i].wbuf)
+				   + My_Connections[i].outq_bytes;
 #ifdef ZLIB
 			if (wdatalen > 0 ||
-			    array_bytes(&My_Connections[i].zip.wbuf) > 0)
+			    ringbuf_bytes(&My_Connections[i].zip.wbuf) > 0)
 #else
 			if (wdatalen > 0)
 #endif
@@ -704,22 +760,36 @@ Conn_Handler(void)
 #endif
 				io_event_add(My_Connections[i].sock,
 					     IO_WANTWRITE);
-			}
+			} else
+				List_Del(CONN_LIST_OUTPUT, i);
 		}
 
-		/* Check from which sockets we possibly could read ... */
-		for (i = 0; i < Pool_Size; i++) {
-			if (My_Connections[i].sock <= NONE)
+		/* Check from which sockets we possibly could read ... Only
+		 * connections not being read from are listed, see
+		 * Conn_CheckReading(); they are removed from the list as soon
+		 * as their socket is watched for reading again. */
+		for (n = My_ConnListLen[CONN_LIST_READ] - 1; n >= 0; n--) {
+			i = My_ConnList[CONN_LIST_READ][n];
+			if (Conn_OPTION_ISSET(&My_Connections[i],
+					      CONN_ISPENDING)) {
+				/* Not admitted yet, Admit_Logins() checks
+				 * the connection again */
+				io_event_del(My_Connections[i].sock,
+					     IO_WANTREAD);
+				List_Del(CONN_LIST_READ, i);
 				continue;
+			}
 #ifdef SSL_SUPPORT
 			if (SSL_WantWrite(&My_Connections[i]))
 				/* TLS/SSL layer needs to write data; deal
 				 * with this first! */
 				continue;
 #endif
-			if (Proc_InProgress(&My_Connections[i].proc_stat)) {
-				/* Wait for completion of forked subprocess
-				 * and ignore the socket in the meantime ... */
+			if (Resolve_InProgress(&My_Connections[i].res_stat)
+			    || Proc_InProgress(&My_Connections[i].proc_stat)) {
+				/* Wait for completion of the lookup or
+				 * authentication and ignore the socket in
+				 * the meantime ... */
 				io_event_del(My_Connections[i].sock,
 					     IO_WANTREAD);
 				continue;
@@ -736,7 +806,7 @@ Conn_Handler(void)
 				continue;
 			}
 
-			if (array_bytes(&My_Connections[i].rbuf) >= COMMAND_LEN) {
+			if (ringbuf_bytes(&My_Connections[i].rbuf) >= COMMAND_LEN) {
 				/* There is still more data in the read buffer
 				 * than a single valid command can get long:
 				 * so either there is a complete command, or
@@ -750,17 +820,38 @@ Conn_Handler(void)
 			}
 
 			io_event_add(My_Connections[i].sock, IO_WANTREAD);
+			List_Del(CONN_LIST_READ, i);
 		}
 
 		/* Don't wait for data when there is still at least one command
 		 * available in a read buffer which can be handled immediately;
-		 * set the timeout for reading from the network to 1 second
-		 * otherwise, which is the granularity with witch we handle
-		 * "penalty times" for example.
+		 * wait until the next timer expires otherwise, "penalty times"
+		 * for example.
 		 * Note: tv_sec/usec are undefined(!) after io_dispatch()
 		 * returns, so we have to set it before each call to it! */
-		tv.tv_usec = 0;
-		tv.tv_sec = command_available ? 0 : 1;
+		tv.tv_sec = tv.tv_usec = 0;
+		next = Resolve_NextTimeout();
+		if (next)
+			(void)Timer_Set(TIMER_RESOLVER, next);
+		else
+			Timer_Del(TIMER_RESOLVER);
+		next = Timer_Next();
+		if (!command_available && next > t) {
+			gettimeofday(&now, NULL);
+			if (next > now.tv_sec) {
+				/* Keep tv_usec below one second, kqueue and
+				 * select() fail with EINVAL otherwise */
+				tv.tv_sec = next - now.tv_sec;
+				if (now.tv_usec > 0) {
+					tv.tv_sec--;
+					tv.tv_usec = 1000000 - now.tv_usec;
+				}
+			} else {
+				/* time() lags behind gettimeofday() */
+				tv.tv_usec = 1000;
+			}
+		} else if (!command_available && !next)
+			tv.tv_sec = 1;
 
 		/* Wait for activity ... */
 		i = io_dispatch(&tv);
@@ -789,45 +880,23 @@ Conn_Handler(void)
 } /* Conn_Handler */
 
 /**
- * Write a text string into the socket of a connection.
+ * Format a message line for sending it to one or more connections.
  *
- * This function automatically appends CR+LF to the string and validates that
- * the result is a valid IRC message (oversized messages are shortened, for
- * example). Then it calls the Conn_Write() function to do the actual sending.
+ * This function validates that the result is a valid IRC message (oversized
+ * messages are shortened) and appends CR+LF to it. The resulting line can be
+ * passed to Conn_WriteLine() for as many connections as required.
  *
- * @param Idx		Index fo the connection.
+ * @param Buffer	Buffer receiving the line, at least COMMAND_LEN bytes.
  * @param Format	Format string, see printf().
- * @returns		true on success, false otherwise.
+ * @param ap		Arguments of the format string.
+ * @returns		Length of the line in bytes, including CR+LF.
  */
-#ifdef PROTOTYPES
-GLOBAL bool
-Conn_WriteStr(CONN_ID Idx, const char *Format, ...)
-#else
-GLOBAL bool
-Conn_WriteStr(Idx, Format, va_alist)
-CONN_ID Idx;
-const char *Format;
-va_dcl
-#endif
+static size_t
+Format_Line(char *Buffer, const char *Format, va_list ap)
 {
-	char buffer[COMMAND_LEN];
-#ifdef ICONV
-	char *ptr, *message;
-#endif
-	size_t len;
-	bool ok;
-	va_list ap;
 	int r;
 
-	assert( Idx > NONE );
-	assert( Format != NULL );
-
-#ifdef PROTOTYPES
-	va_start( ap, Format );
-#else
-	va_start( ap );
-#endif
-	r = vsnprintf(buffer, COMMAND_LEN - 2, Format, ap);
+	r = vsnprintf(Buffer, COMMAND_LEN - 2, Format, ap);
 	if (r >= COMMAND_LEN - 2 || r == -1) {
 		/*
 		 * The string that should be written to the socket is longer
@@ -859,32 +928,256 @@ va_dcl
 		 *                                                   -alex-
 		 */
 
-		strcpy (buffer + sizeof(buffer) - strlen(CUT_TXTSUFFIX) - 2 - 1,
+		strcpy (Buffer + COMMAND_LEN - strlen(CUT_TXTSUFFIX) - 2 - 1,
 			CUT_TXTSUFFIX);
 	}
 
+	return strlcat(Buffer, "\r\n", COMMAND_LEN);
+} /* Format_Line */
+
+/**
+ * Format a message line for sending it to one or more connections.
+ *
+ * Use this function together with Conn_WriteLine() to send the very same
+ * message to multiple connections without formatting it again and again.
+ *
+ * @param Buffer	Buffer receiving the line, at least COMMAND_LEN bytes.
+ * @param Format	Format string, see printf().
+ * @returns		Length of the line in bytes, including CR+LF.
+ */
+#ifdef PROTOTYPES
+GLOBAL size_t
+Conn_FormatLine(char *Buffer, const char *Format, ...)
+#else
+GLOBAL size_t
+Conn_FormatLine(Buffer, Format, va_alist)
+char *Buffer;
+const char *Format;
+va_dcl
+#endif
+{
+	size_t len;
+	va_list ap;
+
+	assert(Buffer != NULL);
+	assert(Format != NULL);
+
+#ifdef PROTOTYPES
+	va_start(ap, Format);
+#else
+	va_start(ap);
+#endif
+	len = Format_Line(Buffer, Format, ap);
+	va_end(ap);
+	return len;
+} /* Conn_FormatLine */
+
+/**
+ * Write a text string into the socket of a connection.
+ *
+ * This function automatically appends CR+LF to the string and validates that
+ * the result is a valid IRC message (oversized messages are shortened, for
+ * example). Then it calls the Conn_Write() function to do the actual sending.
+ *
+ * @param Idx		Index fo the connection.
+ * @param Format	Format string, see printf().
+ * @returns		true on success, false otherwise.
+ */
+#ifdef PROTOTYPES
+GLOBAL bool
+Conn_WriteStr(CONN_ID Idx, const char *Format, ...)
+#else
+GLOBAL bool
+Conn_WriteStr(Idx, Format, va_alist)
+CONN_ID Idx;
+const char *Format;
+va_dcl
+#endif
+{
+	char buffer[COMMAND_LEN];
+	size_t len;
+	va_list ap;
+
+	assert( Idx > NONE );
+	assert( Format != NULL );
+
+#ifdef PROTOTYPES
+	va_start( ap, Format );
+#else
+	va_start( ap );
+#endif
+	len = Format_Line(buffer, Format, ap);
+	va_end( ap );
+
+	return Conn_WriteLine(Idx, buffer, len);
+} /* Conn_WriteStr */
+
+/**
+ * Write a message line formatted by Conn_FormatLine() into the socket of a
+ * connection.
+ *
+ * The line is copied as-is, unless the connection requires a conversion of
+ * the character set of the message.
+ *
+ * @param Idx		Index fo the connection.
+ * @param Line		Message line, including CR+LF.
+ * @param Len		Length of the message line.
+ * @returns		true on success, false otherwise.
+ */
+GLOBAL bool
+Conn_WriteLine(CONN_ID Idx, const char *Line, size_t Len)
+{
+#ifdef ICONV
+	char buffer[COMMAND_LEN], *ptr, *message;
+#endif
+	bool ok;
+
+	assert(Idx > NONE);
+	assert(Line != NULL);
+	assert(Len >= 2 && Len < COMMAND_LEN);
+
 #ifdef ICONV
-	ptr = strchr(buffer + 1, ':');
-	if (ptr) {
-		ptr++;
-		message = Conn_EncodingTo(Idx, ptr);
-		if (message != ptr)
-			strlcpy(ptr, message, sizeof(buffer) - (ptr - buffer));
+	if (My_Connections[Idx].iconv_to != (iconv_t)(-1)) {
+		strlcpy(buffer, Line, Len - 1);
+		ptr = strchr(buffer + 1, ':');
+		if (ptr) {
+			ptr++;
+			message = Conn_EncodingTo(Idx, ptr);
+			if (message != ptr)
+				strlcpy(ptr, message,
+					sizeof(buffer) - (ptr - buffer));
+		}
+		Len = strlcat(buffer, "\r\n", sizeof(buffer));
+		Line = buffer;
 	}
 #endif
 
 #ifdef SNIFFER
 	if (NGIRCd_Sniffer)
-		Log(LOG_DEBUG, " -> connection %d: '%s'.", Idx, buffer);
+		Log(LOG_DEBUG, " -> connection %d: '%.*s'.", Idx,
+		    (int)Len - 2, Line);
 #endif
 
-	len = strlcat( buffer, "\r\n", sizeof( buffer ));
-	ok = Conn_Write(Idx, buffer, len);
+	ok = Conn_Write(Idx, Line, Len);
 	My_Connections[Idx].msg_out++;
 
-	va_end( ap );
 	return ok;
-} /* Conn_WriteStr */
+} /* Conn_WriteLine */
+
+/**
+ * Create a message block that can be shared by the output queues of many
+ * connections (when sending the same message to all members of a channel,
+ * for example), instead of copying it into the write buffer of each one.
+ *
+ * @param Line	Message line formatted by Conn_FormatLine(), including CR+LF.
+ * @param Len	Length of the message line.
+ * @returns	New message block (holding one reference) or NULL on error.
+ */
+GLOBAL MSGBLOCK *
+Conn_NewBlock(const char *Line, size_t Len)
+{
+	MSGBLOCK *block;
+
+	assert(Line != NULL);
+	assert(Len >= 2 && Len < COMMAND_LEN);
+
+	block = malloc(sizeof(MSGBLOCK) + Len);
+	if (!block) {
+		Log(LOG_EMERG, "Can't allocate memory! [Conn_NewBlock]");
+		return NULL;
+	}
+	block->refcnt = 1;
+	block->len = Len;
+	memcpy(block->data, Line, Len);
+	block->data[Len] = '\0';
+	return block;
+} /* Conn_NewBlock */
+
+/**
+ * Release a reference to a message block and free it when it is no longer
+ * in use.
+ *
+ * @param Block	Message block.
+ */
+GLOBAL void
+Conn_ReleaseBlock(MSGBLOCK *Block)
+{
+	assert(Block != NULL);
+	assert(Block->refcnt > 0);
+
+	if (--Block->refcnt == 0)
+		free(Block);
+} /* Conn_ReleaseBlock */
+
+/**
+ * Queue a message block for sending on a connection.
+ *
+ * The connection takes its own reference to the block, the data is not
+ * copied. Compressed and encrypted links as well as connections that require
+ * a conversion of the character set can't share the data and get a copy of
+ * the message line using Conn_WriteLine() instead.
+ *
+ * @param Idx	Index of the connection.
+ * @param Block	Message block, see Conn_NewBlock().
+ * @returns	true on success, false otherwise.
+ */
+GLOBAL bool
+Conn_WriteBlock(CONN_ID Idx, MSGBLOCK *Block)
+{
+	size_t pending;
+
+	assert(Idx > NONE);
+	assert(Block != NULL);
+
+#ifdef ZLIB
+	if (Conn_OPTION_ISSET(&My_Connections[Idx], CONN_ZIP))
+		return Conn_WriteLine(Idx, Block->data, Block->len);
+#endif
+#ifdef SSL_SUPPORT
+	if (Conn_OPTION_ISSET(&My_Connections[Idx], CONN_SSL))
+		return Conn_WriteLine(Idx, Block->data, Block->len);
+#endif
+#ifdef ICONV
+	if (My_Connections[Idx].iconv_to != (iconv_t)(-1))
+		return Conn_WriteLine(Idx, Block->data, Block->len);
+#endif
+#ifdef SNIFFER
+	if (NGIRCd_Sniffer)
+		return Conn_WriteLine(Idx, Block->data, Block->len);
+#endif
+
+	if (My_Connections[Idx].sock <= NONE) {
+		LogDebug("Skipped write on closed socket (connection %d).", Idx);
+		return false;
+	}
+
+	if (!Check_Write_Space(Idx, Block->len))
+		return false;
+
+	/* Data in the write buffer that is not queued yet has to be sent
+	 * before the message block, so queue it first. */
+	pending = ringbuf_bytes(&My_Connections[Idx].wbuf)
+		  - My_Connections[Idx].outq_wbuf;
+	if (pending > 0) {
+		if (!Queue_Add(Idx, NULL, pending))
+			return false;
+		My_Connections[Idx].outq_wbuf += pending;
+	}
+
+	if (!Queue_Add(Idx, Block, Block->len))
+		return false;
+	Block->refcnt++;
+	My_Connections[Idx].outq_bytes += Block->len;
+
+	My_Connections[Idx].bytes_out += Block->len;
+	My_Connections[Idx].msg_out++;
+	List_Add(CONN_LIST_OUTPUT, Idx);
+
+	/* Adjust global write counter */
+	WCounter += Block->len;
+
+	return true;
+} /* Conn_WriteBlock */
 
 GLOBAL char*
 Conn_Password( CONN_ID Idx )
@@ -920,10 +1213,8 @@ Conn_SetPassword( CONN_ID Idx, const char *Pwd )
  * @returns	true on success, false otherwise.
  */
 static bool
-Conn_Write( CONN_ID Idx, char *Data, size_t Len )
+Conn_Write( CONN_ID Idx, const char *Data, size_t Len )
 {
-	CLIENT *c;
-	size_t writebuf_limit = WRITEBUFFER_MAX_LEN;
 	assert( Idx > NONE );
 	assert( Data != NULL );
 	assert( Len > 0 );
@@ -936,17 +1227,6 @@ Conn_Write( CONN_ID Idx, char *Data, size_t Len )
 		return false;
 	}
 
-	/* Make sure that there still exists a CLIENT structure associated
-	 * with this connection and check if this is a server or not: */
-	c = Conn_GetClient(Idx);
-	if (c) {
-		/* Servers do get special write buffer limits, so they can
-		 * generate all the messages that are required while peering. */
-		if (Client_Type(c) == CLIENT_SERVER)
-			writebuf_limit = WRITEBUFFER_SLINK_LEN;
-	} else
-		LogDebug("Write on socket without client (connection %d)!?", Idx);
-
 #ifdef ZLIB
 	if ( Conn_OPTION_ISSET( &My_Connections[Idx], CONN_ZIP )) {
 		/* Compressed link:
@@ -961,32 +1241,17 @@ Conn_Write( CONN_ID Idx, char *Data, size_t Len )
 	{
 		/* Uncompressed link:
 		 * Check if outbound buffer has enough space for the data. */
-		if (array_bytes(&My_Connections[Idx].wbuf) + Len >=
-		    WRITEBUFFER_FLUSH_LEN) {
-			/* Buffer is full, flush it. Handle_Write deals with
-			 * low-level errors, if any. */
-			if (!Handle_Write(Idx))
-				return false;
-		}
-
-		/* When the write buffer is still too big after flushing it,
-		 * the connection will be killed. */
-		if (array_bytes(&My_Connections[Idx].wbuf) + Len >=
-		    writebuf_limit) {
-			Log(LOG_NOTICE,
-			    "Write buffer space exhausted (connection %d, limit is %lu bytes, %lu bytes new, %lu bytes pending)",
-			    Idx, writebuf_limit, Len,
-			    (unsigned long)array_bytes(&My_Connections[Idx].wbuf));
-			Conn_Close(Idx, "Write buffer space exhausted", NULL, false);
+		if (!Check_Write_Space(Idx, Len))
 			return false;
-		}
 
-		/* Copy data to write buffer */
-		if (!array_catb(&My_Connections[Idx].wbuf, Data, Len))
+		/* Copy data to write buffer, it is sent after all data
+		 * in the output queue. */
+		if (!ringbuf_catb(&My_Connections[Idx].wbuf, Data, Len))
 			return false;
 
 		My_Connections[Idx].bytes_out += Len;
 	}
+	List_Add(CONN_LIST_OUTPUT, Idx);
 
 	/* Adjust global write counter */
 	WCounter += Len;
@@ -994,6 +1259,57 @@ Conn_Write( CONN_ID Idx, char *Data, size_t Len )
 	return true;
 } /* Conn_Write */
 
+/**
+ * Make sure that Len more bytes can be queued for sending on a connection.
+ *
+ * The data pending in the write buffer and the output queue is flushed when
+ * it exceeds WRITEBUFFER_FLUSH_LEN. When there is still not enough space
+ * left afterwards, the connection is closed.
+ *
+ * @param Idx	Index of the connection.
+ * @param Len	Number of bytes to queue.
+ * @returns	true if the data can be queued, false otherwise.
+ */
+static bool
+Check_Write_Space(CONN_ID Idx, size_t Len)
+{
+	CLIENT *c;
+	size_t writebuf_limit = WRITEBUFFER_MAX_LEN, pending;
+
+	/* Make sure that there still exists a CLIENT structure associated
+	 * with this connection and check if this is a server or not: */
+	c = Conn_GetClient(Idx);
+	if (c) {
+		/* Servers do get special write buffer limits, so they can
+		 * generate all the messages that are required while peering. */
+		if (Client_Type(c) == CLIENT_SERVER)
+			writebuf_limit = WRITEBUFFER_SLINK_LEN;
+	} else
+		LogDebug("Write on socket without client (connection %d)!?", Idx);
+
+	pending = ringbuf_bytes(&My_Connections[Idx].wbuf)
+		  + My_Connections[Idx].outq_bytes;
+	if (pending + Len >= WRITEBUFFER_FLUSH_LEN) {
+		/* Buffer is full, flush it. Handle_Write deals with
+		 * low-level errors, if any. */
+		if (!Handle_Write(Idx))
+			return false;
+		pending = ringbuf_bytes(&My_Connections[Idx].wbuf)
+			  + My_Connections[Idx].outq_bytes;
+	}
+
+	/* When the write buffer is still too big after flushing it,
+	 * the connection will be killed. */
+	if (pending + Len >= writebuf_limit) {
+		Log(LOG_NOTICE,
+		    "Write buffer space exhausted (connection %d, limit is %lu bytes, %lu bytes new, %lu bytes pending)",
+		    Idx, writebuf_limit, Len, (unsigned long)pending);
+		Conn_Close(Idx, "Write buffer space exhausted", NULL, false);
+		return false;
+	}
+	return true;
+} /* Check_Write_Space */
+
 /**
  * Shut down a connection.
  *
@@ -1086,6 +1402,20 @@ Conn_Close(CONN_ID Idx, const char *LogMsg, const char *FwdMsg, bool InformClien
 
 	/* Mark socket as invalid: */
 	My_Connections[Idx].sock = NONE;
+	if (My_Connections[Idx].list_pos[CONN_LIST_ACTIVE] != NONE)
+		IPCount_Del(&My_Connections[Idx].addr);
+	List_Del(CONN_LIST_ACTIVE, Idx);
+	List_Del(CONN_LIST_INPUT, Idx);
+	List_Del(CONN_LIST_OUTPUT, Idx);
+	List_Del(CONN_LIST_READ, Idx);
+	Timer_Del(TIMER_CONN(Idx));
+	Resolve_Cancel(&My_Connections[Idx].res_stat);
+	Proc_Close(&My_Connections[Idx].proc_stat);
+	if (Conn_OPTION_ISSET(&My_Connections[Idx], CONN_ISPENDING)) {
+		/* The stale entry is skipped by Admit_Logins() */
+		Conn_OPTION_DEL(&My_Connections[Idx], CONN_ISPENDING);
+		NumLoginsQueued--;
+	}
 
 	/* If there is still a client, unregister it now */
 	if (c)
@@ -1124,19 +1454,21 @@ Conn_Close(CONN_ID Idx, const char *LogMsg, const char *FwdMsg, bool InformClien
 
 	/* Servers: Modify time of next connect attempt? */
 	Conf_UnsetServer( Idx );
+	Conn_ScheduleServerCheck();
 
 #ifdef ZLIB
 	/* Clean up zlib, if link was compressed */
 	if ( Conn_OPTION_ISSET( &My_Connections[Idx], CONN_ZIP )) {
 		inflateEnd( &My_Connections[Idx].zip.in );
 		deflateEnd( &My_Connections[Idx].zip.out );
-		array_free(&My_Connections[Idx].zip.rbuf);
-		array_free(&My_Connections[Idx].zip.wbuf);
+		ringbuf_free(&My_Connections[Idx].zip.rbuf);
+		ringbuf_free(&My_Connections[Idx].zip.wbuf);
 	}
 #endif
 
-	array_free(&My_Connections[Idx].rbuf);
-	array_free(&My_Connections[Idx].wbuf);
+	ringbuf_free(&My_Connections[Idx].rbuf);
+	ringbuf_free(&My_Connections[Idx].wbuf);
+	Queue_Free(Idx);
 	if (My_Connections[Idx].pwd != NULL)
 		free(My_Connections[Idx].pwd);
 
@@ -1186,18 +1518,51 @@ Conn_CountAccepted(void)
 } /* Conn_CountAccepted */
 
 /**
- * Synchronize established connections and configured server structures
- * after a configuration update and store the correct connection IDs, if any.
+ * Get number of connections waiting in the login queue.
+ *
+ * @returns	Number of queued connections.
  */
-GLOBAL void
-Conn_SyncServerStruct(void)
+GLOBAL long
+Conn_CountQueued(void)
 {
-	CLIENT *client;
-	CONN_ID i;
-	int c;
+	return NumLoginsQueued;
+} /* Conn_CountQueued */
 
-	for (i = 0; i < Pool_Size; i++) {
-		if (My_Connections[i].sock == NONE)
+/**
+ * Get maximum number of connections waiting in the login queue.
+ *
+ * @returns	Maximum number of queued connections.
+ */
+GLOBAL long
+Conn_CountQueuedMax(void)
+{
+	return NumLoginsQueuedMax;
+} /* Conn_CountQueuedMax */
+
+/**
+ * Get number of connections rejected because the login queue was full.
+ *
+ * @returns	Number of rejected connections.
+ */
+GLOBAL long
+Conn_CountRejected(void)
+{
+	return NumLoginsRejected;
+} /* Conn_CountRejected */
+
+/**
+ * Synchronize established connections and configured server structures
+ * after a configuration update and store the correct connection IDs, if any.
+ */
+GLOBAL void
+Conn_SyncServerStruct(void)
+{
+	CLIENT *client;
+	CONN_ID i;
+	int c;
+
+	for (i = 0; i < Pool_Size; i++) {
+		if (My_Connections[i].sock == NONE)
 			continue;
 
 		/* Server link? */
@@ -1214,6 +1579,9 @@ Conn_SyncServerStruct(void)
 				Conf_Server[c].conn_id = i;
 		}
 	}
+
+	/* The configuration of servers has been changed */
+	Conn_ScheduleServerCheck();
 } /* SyncServerStruct */
 
 /**
@@ -1238,8 +1606,10 @@ Conn_GetIPAInfo(CONN_ID Idx)
 static bool
 Handle_Write( CONN_ID Idx )
 {
+	struct iovec iov[MAX_WRITE_IOV];
 	ssize_t len;
 	size_t wdatalen;
+	int iovcnt;
 
 	assert( Idx > NONE );
 	if ( My_Connections[Idx].sock < 0 ) {
@@ -1248,7 +1618,8 @@ Handle_Write( CONN_ID Idx )
 	}
 	assert( My_Connections[Idx].sock > NONE );
 
-	wdatalen = array_bytes(&My_Connections[Idx].wbuf );
+	wdatalen = ringbuf_bytes(&My_Connections[Idx].wbuf)
+		   + My_Connections[Idx].outq_bytes;
 
 #ifdef ZLIB
 	if (wdatalen == 0) {
@@ -1258,13 +1629,14 @@ Handle_Write( CONN_ID Idx )
 			return false;
 
 		/* Now the write buffer most probably has changed: */
-		wdatalen = array_bytes(&My_Connections[Idx].wbuf);
+		wdatalen = ringbuf_bytes(&My_Connections[Idx].wbuf);
 	}
 #endif
 
 	if (wdatalen == 0) {
 		/* Still no data, fine. */
 		io_event_del(My_Connections[Idx].sock, IO_WANTWRITE );
+		List_Del(CONN_LIST_OUTPUT, Idx);
 		return true;
 	}
 
@@ -1276,17 +1648,29 @@ Handle_Write( CONN_ID Idx )
 
 #ifdef SSL_SUPPORT
 	if ( Conn_OPTION_ISSET( &My_Connections[Idx], CONN_SSL )) {
+		/* SSL connections never queue message blocks, see
+		 * Conn_WriteBlock(). Only write the data up to the end of
+		 * the buffer memory, the rest (if the data wraps around)
+		 * is written on the next call. */
+		assert(My_Connections[Idx].outq_bytes == 0);
+		iovcnt = 0;
 		len = ConnSSL_Write(&My_Connections[Idx],
-				    array_start(&My_Connections[Idx].wbuf),
-				    wdatalen);
+				    ringbuf_start(&My_Connections[Idx].wbuf),
+				    ringbuf_contiguous(&My_Connections[Idx].wbuf));
 	} else
 #endif
 	{
-		len = write(My_Connections[Idx].sock,
-			    array_start(&My_Connections[Idx].wbuf), wdatalen );
+		/* Write the queued message blocks and the write buffer
+		 * using a single system call */
+		iovcnt = Queue_Iovec(Idx, iov, MAX_WRITE_IOV);
+		len = io_writev(My_Connections[Idx].sock, iov, iovcnt);
 	}
 	if( len < 0 ) {
-		if (errno == EAGAIN || errno == EINTR)
+		if (errno == EAGAIN) {
+			io_event_blocked(My_Connections[Idx].sock, IO_WANTWRITE);
+			return true;
+		}
+		if (errno == EINTR)
 			return true;
 
 		/* Log write errors but do not close the connection yet.
@@ -1303,41 +1687,297 @@ Handle_Write( CONN_ID Idx )
 		return false;
 	}
 
-	/* move any data not yet written to beginning */
-	array_moveleft(&My_Connections[Idx].wbuf, 1, (size_t)len);
+	/* The socket buffer is full if not all data has been written, no
+	 * need to try again before it has drained (this isn't known for
+	 * TLS/SSL connections, which don't use "iov") */
+	if (iovcnt > 0 && (size_t)len < Iovec_Len(iov, iovcnt))
+		io_event_blocked(My_Connections[Idx].sock, IO_WANTWRITE);
+
+	/* remove written data from the output queue and the buffer */
+	Queue_Consume(Idx, (size_t)len);
 
 	return true;
 } /* Handle_Write */
 
+/**
+ * Append an entry to the output queue of a connection.
+ *
+ * @param Idx	Connection index.
+ * @param Block	Message block (the caller has to take a reference) or NULL
+ *		for data in the write buffer.
+ * @param Len	Number of bytes.
+ * @returns	true on success, false otherwise.
+ */
+static bool
+Queue_Add(CONN_ID Idx, MSGBLOCK *Block, size_t Len)
+{
+	OUTQ_ENTRY entry;
+
+	assert(Len > 0);
+
+	entry.block = Block;
+	entry.len = Len;
+	if (!array_catb(&My_Connections[Idx].outq, (char *)&entry,
+			sizeof(entry))) {
+		Log(LOG_EMERG, "Can't allocate memory! [Queue_Add]");
+		return false;
+	}
+	return true;
+} /* Queue_Add */
+
+/**
+ * Get the data pending on a connection, in order: the entries of the output
+ * queue, followed by the data of the write buffer that is not queued.
+ *
+ * @param Idx	Connection index.
+ * @param Iov	Array receiving the data.
+ * @param Max	Size of the array, at least 2.
+ * @returns	Number of elements of Iov filled in.
+ */
+static int
+Queue_Iovec(CONN_ID Idx, struct iovec *Iov, int Max)
+{
+	CONNECTION *c = &My_Connections[Idx];
+	OUTQ_ENTRY *entry;
+	size_t i, count, offset = 0;
+	int cnt = 0;
+
+	assert(Max >= 2);
+
+	count = array_length(&c->outq, sizeof(OUTQ_ENTRY));
+	for (i = c->outq_head; i < count && cnt + 2 <= Max; i++) {
+		entry = array_get(&c->outq, sizeof(OUTQ_ENTRY), i);
+		if (entry->block) {
+			Iov[cnt].iov_base = entry->block->data
+					    + entry->block->len - entry->len;
+			Iov[cnt].iov_len = entry->len;
+			cnt++;
+		} else {
+			cnt += ringbuf_peek(&c->wbuf, offset, entry->len,
+					    Iov + cnt);
+			offset += entry->len;
+		}
+	}
+	if (i == count && cnt + 2 <= Max)
+		cnt += ringbuf_peek(&c->wbuf, offset,
+				    ringbuf_bytes(&c->wbuf) - offset, Iov + cnt);
+	return cnt;
+} /* Queue_Iovec */
+
+/**
+ * Remove data that has been sent from the output queue of a connection and
+ * release message blocks that have been sent completely.
+ *
+ * @param Idx	Connection index.
+ * @param Len	Number of bytes sent.
+ */
+static void
+Queue_Consume(CONN_ID Idx, size_t Len)
+{
+	CONNECTION *c = &My_Connections[Idx];
+	OUTQ_ENTRY *entry;
+	size_t count, n;
+
+	count = array_length(&c->outq, sizeof(OUTQ_ENTRY));
+	while (Len > 0 && c->outq_head < count) {
+		entry = array_get(&c->outq, sizeof(OUTQ_ENTRY), c->outq_head);
+		n = Len < entry->len ? Len : entry->len;
+		if (entry->block)
+			c->outq_bytes -= n;
+		else {
+			ringbuf_consume(&c->wbuf, n);
+			c->outq_wbuf -= n;
+		}
+		entry->len -= n;
+		Len -= n;
+		if (entry->len > 0)
+			break;
+		if (entry->block)
+			Conn_ReleaseBlock(entry->block);
+		c->outq_head++;
+	}
+
+	if (c->outq_head == count) {
+		array_trunc(&c->outq);
+		c->outq_head = 0;
+	} else if (c->outq_head >= MAX_WRITE_IOV &&
+		   c->outq_head * 2 >= count) {
+		/* don't let sent entries pile up at the start of the queue */
+		array_moveleft(&c->outq, sizeof(OUTQ_ENTRY), c->outq_head);
+		c->outq_head = 0;
+	}
+
+	if (Len > 0)
+		ringbuf_consume(&c->wbuf, Len);
+} /* Queue_Consume */
+
+/**
+ * Release all message blocks in the output queue of a connection and free
+ * the queue.
+ *
+ * @param Idx	Connection index.
+ */
+static void
+Queue_Free(CONN_ID Idx)
+{
+	CONNECTION *c = &My_Connections[Idx];
+	OUTQ_ENTRY *entry;
+	size_t i, count;
+
+	count = array_length(&c->outq, sizeof(OUTQ_ENTRY));
+	for (i = c->outq_head; i < count; i++) {
+		entry = array_get(&c->outq, sizeof(OUTQ_ENTRY), i);
+		if (entry->block)
+			Conn_ReleaseBlock(entry->block);
+	}
+	array_free(&c->outq);
+	c->outq_head = 0;
+	c->outq_bytes = 0;
+	c->outq_wbuf = 0;
+} /* Queue_Free */
+
+/**
+ * Get the total length of the buffers of an I/O vector.
+ *
+ * @param Iov	I/O vector.
+ * @param Cnt	Number of elements.
+ * @returns	Number of bytes.
+ */
+static size_t
+Iovec_Len(const struct iovec *Iov, int Cnt)
+{
+	size_t len = 0;
+
+	while (Cnt-- > 0)
+		len += Iov[Cnt].iov_len;
+	return len;
+} /* Iovec_Len */
+
+/**
+ * Find the slot of an IP address in the hash table of connection counts.
+ *
+ * The table uses open addressing with linear probing and always has free
+ * slots, see IPCount_Add().
+ *
+ * @param Addr	IP address.
+ * @returns	Slot of the IP address, or free slot it can be stored in.
+ */
+static IPCOUNT *
+IPCount_Lookup(const ng_ipaddr_t *Addr)
+{
+	size_t mask = My_IPCountsSize - 1, i;
+
+	assert(My_IPCountsSize > 0);
+
+	i = ng_ipaddr_hash(Addr) & mask;
+	while (My_IPCounts[i].count > 0
+	       && !ng_ipaddr_ipequal(&My_IPCounts[i].addr, Addr))
+		i = (i + 1) & mask;
+	return &My_IPCounts[i];
+} /* IPCount_Lookup */
+
 /**
  * Count established connections to a specific IP address.
  *
+ * @param Addr	IP address.
  * @returns	Number of established connections.
  */
-static int
-Count_Connections(ng_ipaddr_t *a)
+static long
+IPCount_Get(const ng_ipaddr_t *Addr)
 {
-	int i, cnt;
+	if (My_IPCountsUsed == 0)
+		return 0;
+	return IPCount_Lookup(Addr)->count;
+} /* IPCount_Get */
 
-	cnt = 0;
-	for (i = 0; i < Pool_Size; i++) {
-		if (My_Connections[i].sock <= NONE)
+/**
+ * Count a new established connection to an IP address.
+ *
+ * The hash table is enlarged when it gets half full.
+ *
+ * @param Addr	IP address.
+ */
+static void
+IPCount_Add(const ng_ipaddr_t *Addr)
+{
+	IPCOUNT *table, *old = My_IPCounts, *slot;
+	size_t size, i, old_size = My_IPCountsSize;
+
+	if ((My_IPCountsUsed + 1) * 2 > My_IPCountsSize) {
+		size = old_size ? old_size * 2 : IPCOUNT_MIN;
+		table = calloc(size, sizeof(IPCOUNT));
+		if (!table) {
+			Log(LOG_EMERG, "Can't allocate memory! [IPCount_Add]");
+			if (My_IPCountsUsed + 1 >= My_IPCountsSize)
+				return;
+		} else {
+			My_IPCounts = table;
+			My_IPCountsSize = size;
+			for (i = 0; i < old_size; i++) {
+				if (old[i].count > 0)
+					*IPCount_Lookup(&old[i].addr) = old[i];
+			}
+			free(old);
+		}
+	}
+
+	slot = IPCount_Lookup(Addr);
+	if (slot->count == 0) {
+		slot->addr = *Addr;
+		My_IPCountsUsed++;
+	}
+	slot->count++;
+} /* IPCount_Add */
+
+/**
+ * Forget an established connection to an IP address.
+ *
+ * Following entries of the same probe sequence are moved back into the
+ * free slot, so that lookups never have to skip deleted entries.
+ *
+ * @param Addr	IP address.
+ */
+static void
+IPCount_Del(const ng_ipaddr_t *Addr)
+{
+	size_t mask = My_IPCountsSize - 1, i, j, k;
+	IPCOUNT *slot;
+
+	if (My_IPCountsUsed == 0)
+		return;
+
+	slot = IPCount_Lookup(Addr);
+	if (slot->count == 0 || --slot->count > 0)
+		return;
+
+	My_IPCountsUsed--;
+	i = j = (size_t)(slot - My_IPCounts);
+	for (;;) {
+		j = (j + 1) & mask;
+		if (My_IPCounts[j].count == 0)
+			break;
+		k = ng_ipaddr_hash(&My_IPCounts[j].addr) & mask;
+		/* Entry j can move to i if its home slot k isn't located
+		 * cyclically in (i, j] */
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
 			continue;
-		if (ng_ipaddr_ipequal(&My_Connections[i].addr, a))
-			cnt++;
+		My_IPCounts[i] = My_IPCounts[j];
+		i = j;
 	}
-	return cnt;
-} /* Count_Connections */
+	My_IPCounts[i].count = 0;
+} /* IPCount_Del */
 
 /**
  * Initialize new client connection on a listening socket.
  *
  * @param Sock	Listening socket descriptor.
  * @param IsSSL	true if this socket expects SSL-encrypted data.
- * @returns	Accepted socket descriptor or -1 on error.
+ * @returns	Accepted socket descriptor, -1 on error or if the connection
+ *		has been refused, or -2 if no connection could be accepted
+ *		(no more pending connections).
  */
 static int
-New_Connection(int Sock, UNUSED bool IsSSL)
+New_Connection(int Sock, bool IsSSL)
 {
 #ifdef TCPWRAP
 	struct request_info req;
@@ -1353,11 +1993,13 @@ New_Connection(int Sock, UNUSED bool IsSSL)
 	LogDebug("Accepting new connection on socket %d ...", Sock);
 
 	new_sock_len = (int)sizeof(new_addr);
-	new_sock = accept(Sock, (struct sockaddr *)&new_addr,
-			  (socklen_t *)&new_sock_len);
+	new_sock = io_accept(Sock, (struct sockaddr *)&new_addr,
+			     (socklen_t *)&new_sock_len);
 	if (new_sock < 0) {
-		Log(LOG_CRIT, "Can't accept connection: %s!", strerror(errno));
-		return -1;
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			Log(LOG_CRIT, "Can't accept connection: %s!",
+			    strerror(errno));
+		return -2;
 	}
 	NumConnectionsAccepted++;
 
@@ -1382,8 +2024,8 @@ New_Connection(int Sock, UNUSED bool IsSSL)
 	}
 #endif
 
-	if (!Init_Socket(new_sock))
-		return -1;
+	/* Socket is non-blocking already */
+	Set_Socket_Options(new_sock);
 
 	/* Check global connection limit */
 	if ((Conf_MaxConnections > 0) &&
@@ -1396,7 +2038,7 @@ New_Connection(int Sock, UNUSED bool IsSSL)
 	}
 
 	/* Check IP-based connection limit */
-	cnt = Count_Connections(&new_addr);
+	cnt = IPCount_Get(&new_addr);
 	if ((Conf_MaxConnectionsIP > 0) && (cnt >= Conf_MaxConnectionsIP)) {
 		/* Access denied, too many connections from this IP address! */
 		Log(LOG_ERR,
@@ -1408,6 +2050,19 @@ New_Connection(int Sock, UNUSED bool IsSSL)
 		return -1;
 	}
 
+	/* Check length of the login queue */
+	if (Conf_MaxLoginsPerSecond > 0 && NumLoginsQueued
+	    >= (long)Conf_MaxLoginsPerSecond * LOGIN_QUEUE_TIME) {
+		Log(LOG_ERR,
+		    "Refused connection from %s: login queue full (%ld connections waiting)!",
+		    ip_str, NumLoginsQueued);
+		Simple_Message(new_sock,
+			       "ERROR :Server busy, try again later");
+		close(new_sock);
+		NumLoginsRejected++;
+		return -1;
+	}
+
 	if (Socket2Index(new_sock) <= NONE) {
 		Simple_Message(new_sock, "ERROR: Internal error");
 		close(new_sock);
@@ -1415,7 +2070,8 @@ New_Connection(int Sock, UNUSED bool IsSSL)
 	}
 
 	/* register callback */
-	if (!io_event_create(new_sock, IO_WANTREAD, cb_clientserver)) {
+	if (!io_event_create(new_sock, IsSSL ? IO_WANTREAD|IO_EDGE
+			     : IO_WANTREAD|IO_EDGE|IO_MANAGED, cb_clientserver)) {
 		Log(LOG_ALERT,
 		    "Can't accept connection: io_event_create failed!");
 		Simple_Message(new_sock, "ERROR :Internal error");
@@ -1436,6 +2092,10 @@ New_Connection(int Sock, UNUSED bool IsSSL)
 	My_Connections[new_sock].sock = new_sock;
 	My_Connections[new_sock].addr = new_addr;
 	My_Connections[new_sock].client = c;
+	List_Add(CONN_LIST_ACTIVE, new_sock);
+	List_Add(CONN_LIST_READ, new_sock);
+	IPCount_Add(&new_addr);
+	Schedule_Connection(new_sock);
 
 	/* Set initial hostname to IP address. This becomes overwritten when
 	 * the DNS lookup is enabled and succeeds, but is used otherwise. */
@@ -1465,10 +2125,130 @@ New_Connection(int Sock, UNUSED bool IsSSL)
 /**
  * Finish connection initialization, start resolver subprocess.
  *
+ * When "MaxLoginsPerSecond" is set and more connections arrive, they are
+ * queued: no data is read from them, and the resolver subprocess isn't
+ * started, until Admit_Logins() admits them in the order they arrived.
+ *
  * @param Idx Connection index.
  */
 GLOBAL void
 Conn_StartLogin(CONN_ID Idx)
+{
+	assert(Idx >= 0);
+
+	if (Conf_MaxLoginsPerSecond <= 0
+	    || (NumLoginsQueued == 0 && Login_Token(time(NULL)))) {
+		Start_Login(Idx);
+		return;
+	}
+
+	if (!array_catb(&My_LoginQueue, (char *)&Idx, sizeof(Idx))) {
+		Log(LOG_EMERG, "Can't allocate memory! [Conn_StartLogin]");
+		Start_Login(Idx);
+		return;
+	}
+	Conn_OPTION_ADD(&My_Connections[Idx], CONN_ISPENDING);
+	Timer_Del(TIMER_CONN(Idx));
+	if (++NumLoginsQueued > NumLoginsQueuedMax)
+		NumLoginsQueuedMax = NumLoginsQueued;
+	if (NumLoginsQueued == 1)
+		(void)Timer_Set(TIMER_LOGINS, time(NULL) + 1);
+	LogDebug("Connection %d queued for login (%ld waiting).",
+		 Idx, NumLoginsQueued);
+} /* Conn_StartLogin */
+
+/**
+ * Check again whether to read from the socket of a connection.
+ *
+ * The main loop only looks at connections that are not read from, for
+ * example because of a "penalty time" or a pending lookup or subprocess,
+ * and watches their sockets for reading again as soon as possible. This
+ * function must be called whenever reading from a socket has to stop.
+ *
+ * @param Idx	Connection index.
+ */
+GLOBAL void
+Conn_CheckReading(CONN_ID Idx)
+{
+	assert(Idx > NONE);
+
+	if (My_Connections[Idx].sock > NONE)
+		List_Add(CONN_LIST_READ, Idx);
+} /* Conn_CheckReading */
+
+/**
+ * Take a login "token": at most "MaxLoginsPerSecond" logins are started
+ * within each second.
+ *
+ * @param Now	Current time.
+ * @returns	true if a login can be started now.
+ */
+static bool
+Login_Token(time_t Now)
+{
+	if (Now != LoginTokensTime) {
+		LoginTokensTime = Now;
+		LoginTokens = Conf_MaxLoginsPerSecond;
+	}
+	if (LoginTokens <= 0)
+		return false;
+	LoginTokens--;
+	return true;
+} /* Login_Token */
+
+/**
+ * Admit connections waiting in the login queue, as many as allowed in the
+ * current second, and schedule the next round.
+ */
+static void
+Admit_Logins(void)
+{
+	CONN_ID *queue, idx;
+	size_t len;
+	time_t now = time(NULL);
+
+	len = array_length(&My_LoginQueue, sizeof(CONN_ID));
+	queue = array_start(&My_LoginQueue);
+	while (LoginQueueHead < len) {
+		idx = queue[LoginQueueHead];
+		if (!Conn_OPTION_ISSET(&My_Connections[idx], CONN_ISPENDING)) {
+			/* Closed in the meantime */
+			LoginQueueHead++;
+			continue;
+		}
+		if (Conf_MaxLoginsPerSecond > 0 && !Login_Token(now))
+			break;
+		LoginQueueHead++;
+
+		Conn_OPTION_DEL(&My_Connections[idx], CONN_ISPENDING);
+		NumLoginsQueued--;
+
+		/* Registration timeout starts now */
+		My_Connections[idx].lastdata = now;
+		Schedule_Connection(idx);
+		List_Add(CONN_LIST_READ, idx);
+		Start_Login(idx);
+	}
+
+	if (LoginQueueHead >= len) {
+		array_trunc(&My_LoginQueue);
+		LoginQueueHead = 0;
+	} else if (LoginQueueHead * 2 > len) {
+		array_moveleft(&My_LoginQueue, sizeof(CONN_ID), LoginQueueHead);
+		LoginQueueHead = 0;
+	}
+
+	if (NumLoginsQueued > 0)
+		(void)Timer_Set(TIMER_LOGINS, now + 1);
+} /* Admit_Logins */
+
+/**
+ * Start the login of a connection: start resolver subprocess.
+ *
+ * @param Idx Connection index.
+ */
+static void
+Start_Login(CONN_ID Idx)
 {
 	int ident_sock = -1;
 
@@ -1501,9 +2281,10 @@ Conn_StartLogin(CONN_ID Idx)
 			return;
 	}
 
-	Resolve_Addr(&My_Connections[Idx].proc_stat, &My_Connections[Idx].addr,
-		     ident_sock, cb_Read_Resolver_Result);
-}
+	Resolve_Addr(&My_Connections[Idx].res_stat, Idx,
+		     &My_Connections[Idx].addr, ident_sock, cb_Resolver_Result);
+	List_Add(CONN_LIST_READ, Idx);
+} /* Start_Login */
 
 /**
  * Update global connection counters.
@@ -1535,23 +2316,91 @@ Socket2Index( int Sock )
 	if (Sock < Pool_Size)
 		return Sock;
 
-	/* Try to allocate more memory ... */
-	if (!array_alloc(&My_ConnArray, sizeof(CONNECTION), (size_t)Sock)) {
-		Log(LOG_EMERG,
-		    "Can't allocate memory to enlarge connection pool!");
-		return NONE;
+	if (Sock >= Pool_Reserved) {
+		/* Try to allocate more memory ... This moves all connection
+		 * structures, but should be rare: see Pool_ReserveSize(). */
+		if (!Pool_Resize(Sock < Pool_Reserved * 2 ? Pool_Reserved * 2
+							 : Sock + 1)) {
+			Log(LOG_EMERG,
+			    "Can't allocate memory to enlarge connection pool!");
+			return NONE;
+		}
+		Log(LOG_NOTICE,
+		    "Enlarged connection pool for %ld sockets (%lu bytes).",
+		    (long)Pool_Reserved,
+		    (unsigned long)Pool_Reserved * sizeof(CONNECTION));
 	}
-	LogDebug("Enlarged connection pool for %ld sockets (%ld items, %ld bytes)",
-		 Sock, array_length(&My_ConnArray, sizeof(CONNECTION)),
-		 array_bytes(&My_ConnArray));
 
-	/* Adjust pointer to new block, update size and initialize new items. */
-	My_Connections = array_start(&My_ConnArray);
+	/* Initialize new items, the memory has been reserved already */
 	while (Pool_Size <= Sock)
 		Init_Conn_Struct(Pool_Size++);
 
 	return Sock;
-}
+} /* Socket2Index */
+
+/**
+ * Get the number of connection structures to reserve at startup.
+ *
+ * Socket handles are used as connection indices, so they can't exceed the
+ * limit of open files (RLIMIT_NOFILE). When "MaxConnections" is set, at
+ * most one socket and one resolver pipe per connection are needed, plus a
+ * few other file descriptors.
+ *
+ * @returns	Size of the connection pool.
+ */
+static CONN_ID
+Pool_ReserveSize(void)
+{
+	long size = CONNECTION_POOL_MAX;
+#if defined(HAVE_GETRLIMIT) && defined(HAVE_SYS_RESOURCE_H)
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY
+	    && rl.rlim_cur < (rlim_t)size)
+		size = (long)rl.rlim_cur;
+#else
+	size = CONNECTION_POOL;
+#endif
+	if (Conf_MaxConnections > 0
+	    && size > 2L * Conf_MaxConnections + CONNECTION_POOL)
+		size = 2L * Conf_MaxConnections + CONNECTION_POOL;
+	if (size < CONNECTION_POOL)
+		size = CONNECTION_POOL;
+	return (CONN_ID)size;
+} /* Pool_ReserveSize */
+
+/**
+ * Allocate memory for a number of connection structures and the lists of
+ * connections. The structures are initialized later, when their socket
+ * handles are actually used (see Socket2Index()), so the memory of unused
+ * structures is not touched at all.
+ *
+ * @param Size	New size of the connection pool.
+ * @returns	true on success, false otherwise.
+ */
+static bool
+Pool_Resize(CONN_ID Size)
+{
+	CONNECTION *pool;
+	CONN_ID *list;
+	int i;
+
+	assert(Size > Pool_Size);
+
+	for (i = 0; i < CONN_LISTS; i++) {
+		list = realloc(My_ConnList[i], Size * sizeof(CONN_ID));
+		if (!list)
+			return false;
+		My_ConnList[i] = list;
+	}
+	pool = realloc(My_Connections, Size * sizeof(CONNECTION));
+	if (!pool)
+		return false;
+
+	My_Connections = pool;
+	Pool_Reserved = Size;
+	return true;
+} /* Pool_Resize */
 
 /**
  * Read data from the network to the read buffer. If an error occurs,
@@ -1564,38 +2413,83 @@ Read_Request(CONN_ID Idx)
 {
 	ssize_t len;
 	static const unsigned int maxbps = COMMAND_LEN / 2;
-	char readbuf[READBUFFER_LEN];
+	struct iovec iov[2];
+	ringbuf *rbuf;
+	size_t window;
+	int iovcnt;
+	bool ok;
 	time_t t;
 	CLIENT *c;
 
 	assert(Idx > NONE);
 	assert(My_Connections[Idx].sock > NONE);
 
+	/* Server links can read larger amounts of data at once */
+	c = Conn_GetClient(Idx);
+	if (c && Client_Type(c) == CLIENT_SERVER)
+		window = READBUFFER_SLINK_LEN;
+	else
+		window = READBUFFER_LEN;
+
 	/* Check if the read buffer is "full". Basically this shouldn't happen
 	 * here, because as long as there possibly are commands in the read
 	 * buffer (buffer usage > COMMAND_LEN), the socket shouldn't be
 	 * scheduled for reading in Conn_Handler() at all ... */
 #ifdef ZLIB
-	if ((array_bytes(&My_Connections[Idx].rbuf) >= READBUFFER_LEN) ||
-		(array_bytes(&My_Connections[Idx].zip.rbuf) >= READBUFFER_LEN))
+	if ((ringbuf_bytes(&My_Connections[Idx].rbuf) >= window) ||
+		(ringbuf_bytes(&My_Connections[Idx].zip.rbuf) >= window))
 #else
-	if (array_bytes(&My_Connections[Idx].rbuf) >= READBUFFER_LEN)
+	if (ringbuf_bytes(&My_Connections[Idx].rbuf) >= window)
 #endif
 	{
 		Log(LOG_ERR,
 		    "Receive buffer space exhausted (connection %d): %d/%d bytes",
-		    Idx, array_bytes(&My_Connections[Idx].rbuf), READBUFFER_LEN);
+		    Idx, (int)ringbuf_bytes(&My_Connections[Idx].rbuf),
+		    (int)window);
+		Conn_Close(Idx, "Receive buffer space exhausted", NULL, false);
+		return;
+	}
+
+	/* Received data is stored in the read buffer directly, or in the
+	 * buffer of compressed data, if link compression is in use */
+#ifdef ZLIB
+	if (Conn_OPTION_ISSET(&My_Connections[Idx], CONN_ZIP))
+		rbuf = &My_Connections[Idx].zip.rbuf;
+	else
+#endif
+		rbuf = &My_Connections[Idx].rbuf;
+
+	/* Read up to "window" bytes in total, so the buffer doesn't have to
+	 * grow beyond that size. */
+	window -= ringbuf_bytes(rbuf);
+#ifdef SSL_SUPPORT
+	/* The TLS/SSL layer needs all free space in one piece, otherwise
+	 * data could be left over in its buffers without the socket becoming
+	 * readable again. */
+	if (Conn_OPTION_ISSET(&My_Connections[Idx], CONN_SSL))
+		ok = ringbuf_linearize(rbuf, window);
+	else
+#endif
+		ok = ringbuf_reserve(rbuf, window);
+	if (!ok) {
+		Log(LOG_ERR,
+		    "Could not allocate input buffer (connection %d): %d bytes!",
+		    Idx, (int)window);
 		Conn_Close(Idx, "Receive buffer space exhausted", NULL, false);
 		return;
 	}
+	iovcnt = ringbuf_space(rbuf, iov, window);
+	assert(iovcnt > 0);
 
-	/* Now read new data from the network, up to READBUFFER_LEN bytes ... */
+	/* Now read new data from the network into the free space of the
+	 * buffer, which can be split in two when the data wraps around ... */
 #ifdef SSL_SUPPORT
 	if (Conn_OPTION_ISSET(&My_Connections[Idx], CONN_SSL))
-		len = ConnSSL_Read(&My_Connections[Idx], readbuf, sizeof(readbuf));
+		len = ConnSSL_Read(&My_Connections[Idx], iov[0].iov_base,
+				   iov[0].iov_len);
 	else
 #endif
-		len = read(My_Connections[Idx].sock, readbuf, sizeof(readbuf));
+	len = io_readv(My_Connections[Idx].sock, iov, iovcnt);
 
 	if (len == 0) {
 		LogDebug("Client \"%s:%u\" is closing connection %d ...",
@@ -1606,8 +2500,10 @@ Read_Request(CONN_ID Idx)
 	}
 
 	if (len < 0) {
-		if (errno == EAGAIN)
+		if (errno == EAGAIN) {
+			io_event_blocked(My_Connections[Idx].sock, IO_WANTREAD);
 			return;
+		}
 
 		Log(LOG_ERR, "Read error on connection %d (socket %d): %s!",
 		    Idx, My_Connections[Idx].sock, strerror(errno));
@@ -1616,35 +2512,25 @@ Read_Request(CONN_ID Idx)
 		return;
 	}
 
-	/* Now append the newly received data to the connection buffer.
-	 * NOTE: This can lead to connection read buffers being bigger(!) than
-	 * READBUFFER_LEN bytes, as we add up to READBUFFER_LEN new bytes to a
-	 * buffer possibly being "almost" READBUFFER_LEN bytes already! */
-#ifdef ZLIB
-	if (Conn_OPTION_ISSET(&My_Connections[Idx], CONN_ZIP)) {
-		if (!array_catb(&My_Connections[Idx].zip.rbuf, readbuf,
-				(size_t) len)) {
-			Log(LOG_ERR,
-			    "Could not append received data to zip input buffer (connection %d): %d bytes!",
-			    Idx, len);
-			Conn_Close(Idx, "Receive buffer space exhausted", NULL,
-				   false);
-			return;
-		}
-	} else
+#ifdef SSL_SUPPORT
+	if (!Conn_OPTION_ISSET(&My_Connections[Idx], CONN_SSL))
 #endif
 	{
-		if (!array_catb( &My_Connections[Idx].rbuf, readbuf, len)) {
-			Log(LOG_ERR,
-			    "Could not append received data to input buffer (connection %d): %d bytes!",
-			    Idx, len);
-			Conn_Close(Idx, "Receive buffer space exhausted", NULL,
-				   false );
-		}
+		/* The socket has been drained if less data than requested
+		 * has been received (the TLS/SSL layer can have buffered
+		 * more data, though) */
+		if ((size_t)len < Iovec_Len(iov, iovcnt))
+			io_event_blocked(My_Connections[Idx].sock,
+					 IO_WANTREAD);
 	}
 
+	ringbuf_commit(rbuf, (size_t)len);
+	if (ringbuf_bytes(rbuf) >= COMMAND_LEN)
+		List_Add(CONN_LIST_READ, Idx);
+
 	/* Update connection statistics */
 	My_Connections[Idx].bytes_in += len;
+	List_Add(CONN_LIST_INPUT, Idx);
 
 	/* Handle read buffer */
 	My_Connections[Idx].bps += Handle_Buffer(Idx);
@@ -1657,7 +2543,7 @@ Read_Request(CONN_ID Idx)
 	/* Update timestamp of last data received if this connection is
 	 * registered as a user, server or service connection. Don't update
 	 * otherwise, so users have at least Conf_PongTimeout seconds time to
-	 * register with the IRC server -- see Check_Connections().
+	 * register with the IRC server -- see Check_Connection().
 	 * Update "lastping", too, if time shifted backwards ... */
 	if (Client_Type(c) == CLIENT_USER
 	    || Client_Type(c) == CLIENT_SERVER
@@ -1689,11 +2575,9 @@ Read_Request(CONN_ID Idx)
 static unsigned int
 Handle_Buffer(CONN_ID Idx)
 {
-#ifndef STRICT_RFC
-	char *ptr1, *ptr2, *first_eol;
-#endif
-	char *ptr;
-	size_t len, delta;
+	LINE_SPAN lines[MAX_COMMANDS_BATCH];
+	char *buf;
+	size_t len, n, l;
 	time_t starttime;
 #ifdef ZLIB
 	bool old_z;
@@ -1725,7 +2609,8 @@ Handle_Buffer(CONN_ID Idx)
 		break;
 	}
 
-	for (i=0; i < maxcmd; i++) {
+	i = 0;
+	while (i < maxcmd) {
 		/* Check penalty */
 		if (My_Connections[Idx].delaytime > starttime)
 			return 0;
@@ -1739,182 +2624,260 @@ Handle_Buffer(CONN_ID Idx)
 		}
 #endif
 
-		if (0 == array_bytes(&My_Connections[Idx].rbuf))
+		if (0 == ringbuf_bytes(&My_Connections[Idx].rbuf))
 			break;
 
-		/* Make sure that the buffer is NULL terminated */
-		if (!array_cat0_temporary(&My_Connections[Idx].rbuf)) {
+		/* Make sure that all data is stored contiguously */
+		if (!ringbuf_linearize(&My_Connections[Idx].rbuf, 0)) {
 			Conn_Close(Idx, NULL,
 				   "Can't allocate memory [Handle_Buffer]",
 				   true);
 			return 0;
 		}
 
-		/* RFC 2812, section "2.3 Messages", 5th paragraph:
-		 * "IRC messages are always lines of characters terminated
-		 * with a CR-LF (Carriage Return - Line Feed) pair [...]". */
-		delta = 2;
-		ptr = strstr(array_start(&My_Connections[Idx].rbuf), "\r\n");
-
-#ifndef STRICT_RFC
-		/* Check for non-RFC-compliant request (only CR or LF)?
-		 * Unfortunately, there are quite a few clients out there
-		 * that do this -- e. g. mIRC, BitchX, and Trillian :-( */
-		ptr1 = strchr(array_start(&My_Connections[Idx].rbuf), '\r');
-		ptr2 = strchr(array_start(&My_Connections[Idx].rbuf), '\n');
-		if (ptr) {
-			/* Check if there is a single CR or LF _before_ the
-			 * correct CR+LF line terminator:  */
-			first_eol = ptr1 < ptr2 ? ptr1 : ptr2;
-			if (first_eol < ptr) {
-				/* Single CR or LF before CR+LF found */
-				ptr = first_eol;
-				delta = 1;
-			}
-		} else if (ptr1 || ptr2) {
-			/* No CR+LF terminated command found, but single
-			 * CR or LF found ... */
-			if (ptr1 && ptr2)
-				ptr = ptr1 < ptr2 ? ptr1 : ptr2;
-			else
-				ptr = ptr1 ? ptr1 : ptr2;
-			delta = 1;
-		}
-#endif
-
-		if (!ptr)
+		/* Find all complete (=line terminated) requests at once,
+		 * see Lines_Split() for the line terminators accepted. */
+		buf = ringbuf_start(&My_Connections[Idx].rbuf);
+		n = maxcmd - i;
+		if (n > C_ARRAY_SIZE(lines))
+			n = C_ARRAY_SIZE(lines);
+		n = Lines_Split(buf, ringbuf_bytes(&My_Connections[Idx].rbuf),
+				lines, n);
+		if (n == 0)
 			break;
 
-		/* Complete (=line terminated) request found, handle it! */
-		*ptr = '\0';
-
-		len = ptr - (char *)array_start(&My_Connections[Idx].rbuf) + delta;
-
-		if (len > (COMMAND_LEN - 1)) {
-			/* Request must not exceed 512 chars (incl. CR+LF!),
-			 * see RFC 2812. Disconnect Client if this happens. */
-			Log(LOG_ERR,
-			    "Request too long (connection %d): %d bytes (max. %d expected)!",
-			    Idx, array_bytes(&My_Connections[Idx].rbuf),
-			    COMMAND_LEN - 1);
-			Conn_Close(Idx, NULL, "Request too long", true);
-			return 0;
-		}
+		/* Handle them. Data of handled requests is removed from the
+		 * read buffer, which doesn't move the remaining data (and
+		 * requests can't add new data), so "buf" stays valid. */
+		for (l = 0; l < n; l++) {
+			/* Check penalty */
+			if (My_Connections[Idx].delaytime > starttime)
+				break;
+			i++;
+
+			len = lines[l].end - lines[l].start;
+			if (len > (COMMAND_LEN - 1)) {
+				/* Request must not exceed 512 chars (incl.
+				 * CR+LF!), see RFC 2812. Disconnect Client
+				 * if this happens. */
+				Log(LOG_ERR,
+				    "Request too long (connection %d): %d bytes (max. %d expected)!",
+				    Idx, ringbuf_bytes(&My_Connections[Idx].rbuf),
+				    COMMAND_LEN - 1);
+				Conn_Close(Idx, NULL, "Request too long", true);
+				return 0;
+			}
 
-		len_processed += (unsigned int)len;
-		if (len <= delta) {
-			/* Request is empty (only '\r\n', '\r' or '\n');
-			 * delta is 2 ('\r\n') or 1 ('\r' or '\n'), see above */
-			array_moveleft(&My_Connections[Idx].rbuf, 1, len);
-			continue;
-		}
+			len_processed += (unsigned int)len;
+			if (lines[l].len == 0) {
+				/* Request is empty (only '\r\n', '\r' or
+				 * '\n') */
+				ringbuf_consume(&My_Connections[Idx].rbuf, len);
+				continue;
+			}
 #ifdef ZLIB
-		/* remember if stream is already compressed */
-		old_z = My_Connections[Idx].options & CONN_ZIP;
+			/* remember if stream is already compressed */
+			old_z = My_Connections[Idx].options & CONN_ZIP;
 #endif
 
-		My_Connections[Idx].msg_in++;
-		if (!Parse_Request
-		    (Idx, (char *)array_start(&My_Connections[Idx].rbuf)))
-			return 0; /* error -> connection has been closed */
+			buf[lines[l].start + lines[l].len] = '\0';
+			My_Connections[Idx].msg_in++;
+			if (!Parse_Request(Idx, buf + lines[l].start))
+				return 0; /* error -> connection has been closed */
 
-		array_moveleft(&My_Connections[Idx].rbuf, 1, len);
+			ringbuf_consume(&My_Connections[Idx].rbuf, len);
+			if (ringbuf_bytes(&My_Connections[Idx].rbuf) == 0)
+				break;	/* no data left, or connection closed */
 #ifdef ZLIB
-		if ((!old_z) && (My_Connections[Idx].options & CONN_ZIP) &&
-		    (array_bytes(&My_Connections[Idx].rbuf) > 0)) {
-			/* The last command activated socket compression.
-			 * Data that was read after that needs to be copied
-			 * to the unzip buffer for decompression: */
-			if (!array_copy
-			    (&My_Connections[Idx].zip.rbuf,
-			     &My_Connections[Idx].rbuf)) {
-				Conn_Close(Idx, NULL,
-					   "Can't allocate memory [Handle_Buffer]",
-					   true);
-				return 0;
-			}
+			if ((!old_z) && (My_Connections[Idx].options & CONN_ZIP)) {
+				/* The last command activated socket compression.
+				 * Data that was read after that needs to be copied
+				 * to the unzip buffer for decompression: */
+				if (!ringbuf_cat
+				    (&My_Connections[Idx].zip.rbuf,
+				     &My_Connections[Idx].rbuf)) {
+					Conn_Close(Idx, NULL,
+						   "Can't allocate memory [Handle_Buffer]",
+						   true);
+					return 0;
+				}
 
-			array_trunc(&My_Connections[Idx].rbuf);
-			LogDebug
-			    ("Moved already received data (%u bytes) to uncompression buffer.",
-			     array_bytes(&My_Connections[Idx].zip.rbuf));
-		}
+				ringbuf_trunc(&My_Connections[Idx].rbuf);
+				LogDebug
+				    ("Moved already received data (%u bytes) to uncompression buffer.",
+				     ringbuf_bytes(&My_Connections[Idx].zip.rbuf));
+				break;
+			}
 #endif
+		}
 	}
 #if DEBUG_BUFFER
 	LogDebug("Connection %d: Processed %ld commands (max=%ld), %ld bytes. %ld bytes left in read buffer.",
 		 Idx, i, maxcmd, len_processed,
-		 array_bytes(&My_Connections[Idx].rbuf));
+		 ringbuf_bytes(&My_Connections[Idx].rbuf));
 #endif
 
 	/* If data has been processed but there is still data in the read
 	 * buffer, the command limit triggered. Enforce the penalty time: */
-	if (len_processed && array_bytes(&My_Connections[Idx].rbuf) > 2)
+	if (len_processed && ringbuf_bytes(&My_Connections[Idx].rbuf) > 2)
 		Throttle_Connection(Idx, c, THROTTLE_CMDS, maxcmd);
 
 	return len_processed;
 } /* Handle_Buffer */
 
 /**
- * Check whether established connections are still alive or not.
+ * Handle an expired timer of the connection module.
+ *
+ * @param Id	Timer ID.
+ */
+static void
+Handle_Timeout(int Id)
+{
+	switch (Id) {
+	case TIMER_SERVERS:
+		Check_Servers();
+		break;
+	case TIMER_HOUSEKEEPING:
+		/* Expire outdated class/list items */
+		Class_Expire();
+		/* Kill hanging worker processes */
+		Proc_Timeout(time(NULL));
+		(void)Timer_Set(TIMER_HOUSEKEEPING, time(NULL) + 1);
+		break;
+	case TIMER_LOGINS:
+		Admit_Logins();
+		break;
+	case TIMER_RESOLVER:
+		Resolve_Timeout(time(NULL));
+		break;
+	default:
+		Check_Connection(TIMER_CONN_IDX(Id));
+	}
+} /* Handle_Timeout */
+
+/**
+ * Check whether an established connection is still alive or not.
  * If not, play PING-PONG first; and if that doesn't help either,
  * disconnect the respective peer.
+ *
+ * This function is called when the timer of the connection expires, and
+ * sets up the timer for the next check.
+ *
+ * @param Idx	Connection index.
  */
 static void
-Check_Connections(void)
+Check_Connection(CONN_ID Idx)
 {
 	CLIENT *c;
-	CONN_ID i;
 	char msg[64];
 	time_t time_now;
 
-	time_now = time(NULL);
-
-	for (i = 0; i < Pool_Size; i++) {
-		if (My_Connections[i].sock < 0)
-			continue;
+	if (My_Connections[Idx].sock <= NONE)
+		return;
 
-		c = Conn_GetClient(i);
-		if (c && ((Client_Type(c) == CLIENT_USER)
-			  || (Client_Type(c) == CLIENT_SERVER)
-			  || (Client_Type(c) == CLIENT_SERVICE))) {
-			/* connected User, Server or Service */
-			if (My_Connections[i].lastping >
-			    My_Connections[i].lastdata) {
-				/* We already sent a ping */
-				if (My_Connections[i].lastping <
-				    time_now - Conf_PongTimeout) {
-					/* Timeout */
-					snprintf(msg, sizeof(msg),
-						 "Ping timeout: %d seconds",
-						 Conf_PongTimeout);
-					LogDebug("Connection %d: %s.", i, msg);
-					Conn_Close(i, NULL, msg, true);
-				}
-			} else if (My_Connections[i].lastdata <
-				   time_now - Conf_PingTimeout) {
-				/* We need to send a PING ... */
-				LogDebug("Connection %d: sending PING ...", i);
-				Conn_UpdatePing(i, time_now);
-				Conn_WriteStr(i, "PING :%s",
-					      Client_ID(Client_ThisServer()));
-			}
-		} else {
-			/* The connection is not fully established yet, so
-			 * we don't do the PING-PONG game here but instead
-			 * disconnect the client after "a short time" if it's
-			 * still not registered. */
+	time_now = time(NULL);
 
-			if (My_Connections[i].lastdata <
+	c = Conn_GetClient(Idx);
+	if (c && ((Client_Type(c) == CLIENT_USER)
+		  || (Client_Type(c) == CLIENT_SERVER)
+		  || (Client_Type(c) == CLIENT_SERVICE))) {
+		/* connected User, Server or Service */
+		if (My_Connections[Idx].lastping >
+		    My_Connections[Idx].lastdata) {
+			/* We already sent a ping */
+			if (My_Connections[Idx].lastping <
 			    time_now - Conf_PongTimeout) {
-				LogDebug
-				    ("Unregistered connection %d timed out ...",
-				     i);
-				Conn_Close(i, NULL, "Timeout", false);
+				/* Timeout */
+				snprintf(msg, sizeof(msg),
+					 "Ping timeout: %d seconds",
+					 Conf_PongTimeout);
+				LogDebug("Connection %d: %s.", Idx, msg);
+				Conn_Close(Idx, NULL, msg, true);
+				return;
 			}
+		} else if (My_Connections[Idx].lastdata <
+			   time_now - Conf_PingTimeout) {
+			/* We need to send a PING ... */
+			LogDebug("Connection %d: sending PING ...", Idx);
+			Conn_UpdatePing(Idx, time_now);
+			Conn_WriteStr(Idx, "PING :%s",
+				      Client_ID(Client_ThisServer()));
+		}
+	} else {
+		/* The connection is not fully established yet, so
+		 * we don't do the PING-PONG game here but instead
+		 * disconnect the client after "a short time" if it's
+		 * still not registered. */
+
+		if (My_Connections[Idx].lastdata <
+		    time_now - Conf_PongTimeout) {
+			LogDebug("Unregistered connection %d timed out ...",
+				 Idx);
+			Conn_Close(Idx, NULL, "Timeout", false);
+			return;
 		}
 	}
-} /* Check_Connections */
+
+	Schedule_Connection(Idx);
+} /* Check_Connection */
+
+/**
+ * Set the timer of a connection to the time of its next check.
+ *
+ * This is the time when a PING has to be sent, a PONG or the registration
+ * times out, or the "penalty time" of the connection ends. The timer is not
+ * updated when data is received, so the connection is checked again when
+ * the old timer expires and the timer is set up again then; only changes
+ * that result in an earlier check (like penalty times) update it directly.
+ *
+ * @param Idx	Connection index.
+ */
+static void
+Schedule_Connection(CONN_ID Idx)
+{
+	CLIENT *c;
+	time_t t, time_now;
+
+	if (My_Connections[Idx].sock <= NONE)
+		return;
+
+	/* No timeouts while waiting in the login queue */
+	if (Conn_OPTION_ISSET(&My_Connections[Idx], CONN_ISPENDING))
+		return;
+
+	time_now = time(NULL);
+
+	c = Conn_GetClient(Idx);
+	if (c && ((Client_Type(c) == CLIENT_USER)
+		  || (Client_Type(c) == CLIENT_SERVER)
+		  || (Client_Type(c) == CLIENT_SERVICE))) {
+		if (My_Connections[Idx].lastping > My_Connections[Idx].lastdata)
+			t = My_Connections[Idx].lastping + Conf_PongTimeout + 1;
+		else
+			t = My_Connections[Idx].lastdata + Conf_PingTimeout + 1;
+	} else
+		t = My_Connections[Idx].lastdata + Conf_PongTimeout + 1;
+
+	if (My_Connections[Idx].delaytime > time_now
+	    && My_Connections[Idx].delaytime < t)
+		t = My_Connections[Idx].delaytime;
+	if (t <= time_now)
+		t = time_now + 1;
+
+	(void)Timer_Set(TIMER_CONN(Idx), t);
+} /* Schedule_Connection */
+
+/**
+ * Check configured servers in the next iteration of the main loop.
+ *
+ * This must be called when the configuration of a server changed in a way
+ * that could allow a new connection attempt earlier than planned.
+ */
+GLOBAL void
+Conn_ScheduleServerCheck(void)
+{
+	(void)Timer_Set(TIMER_SERVERS, time(NULL));
+} /* Conn_ScheduleServerCheck */
 
 /**
  * Check if further server links should be established.
@@ -1923,20 +2886,34 @@ static void
 Check_Servers(void)
 {
 	int i, n;
-	time_t time_now;
+	time_t time_now, t, next = 0;
 
 	time_now = time(NULL);
 
 	/* Check all configured servers */
 	for (i = 0; i < MAX_SERVERS; i++) {
+		if (Conf_Server[i].conn_id == SERVER_WAIT) {
+			/* Still establishing, check again when it fails */
+			t = Conf_Server[i].lasttry + Conf_ConnectRetry;
+			if (t <= time_now)
+				t = time_now + 1;
+			if (!next || t < next)
+				next = t;
+			continue;
+		}
 		if (Conf_Server[i].conn_id != NONE)
-			continue;	/* Already establishing or connected */
+			continue;	/* Already connected */
 		if (!Conf_Server[i].host[0] || Conf_Server[i].port <= 0)
 			continue;	/* No host and/or port configured */
 		if (Conf_Server[i].flags & CONF_SFLAG_DISABLED)
 			continue;	/* Disabled configuration entry */
-		if (Conf_Server[i].lasttry > (time_now - Conf_ConnectRetry))
-			continue;	/* We have to wait a little bit ... */
+		if (Conf_Server[i].lasttry > (time_now - Conf_ConnectRetry)) {
+			/* We have to wait a little bit ... */
+			t = Conf_Server[i].lasttry + Conf_ConnectRetry;
+			if (!next || t < next)
+				next = t;
+			continue;
+		}
 
 		/* Is there already a connection in this group? */
 		if (Conf_Server[i].group > NONE) {
@@ -1947,8 +2924,14 @@ Check_Servers(void)
 				    (Conf_Server[n].group == Conf_Server[i].group))
 					break;
 			}
-			if (n < MAX_SERVERS)
+			if (n < MAX_SERVERS) {
+				/* Check again when the other link is closed
+				 * (see Conn_Close()) or failed to connect. */
+				if (Conf_Server[n].conn_id == SERVER_WAIT
+				    && (!next || time_now + 1 < next))
+					next = time_now + 1;
 				continue;
+			}
 		}
 
 		/* Okay, try to connect now */
@@ -1957,13 +2940,23 @@ Check_Servers(void)
 		    Conf_Server[i].name);
 		Conf_Server[i].lasttry = time_now;
 		Conf_Server[i].conn_id = SERVER_WAIT;
-		assert(Proc_GetPipeFd(&Conf_Server[i].res_stat) < 0);
+		assert(!Resolve_InProgress(&Conf_Server[i].res_stat));
 
-		/* Start resolver subprocess ... */
-		if (!Resolve_Name(&Conf_Server[i].res_stat, Conf_Server[i].host,
-				  cb_Connect_to_Server))
+		/* Start resolver ... */
+		if (!Resolve_Name(&Conf_Server[i].res_stat, i,
+				  Conf_Server[i].host, cb_Connect_to_Server))
 			Conf_Server[i].conn_id = NONE;
+
+		/* Retry when this attempt fails */
+		t = time_now + Conf_ConnectRetry;
+		if (!next || t < next)
+			next = t;
 	}
+
+	if (next)
+		(void)Timer_Set(TIMER_SERVERS, next);
+	else
+		Timer_Del(TIMER_SERVERS);
 } /* Check_Servers */
 
 /**
@@ -2043,7 +3036,7 @@ New_Server( int Server , ng_ipaddr_t *dest)
 		return;
 	}
 
-	if (!io_event_create( new_sock, IO_WANTWRITE, cb_connserver)) {
+	if (!io_event_create(new_sock, IO_WANTWRITE|IO_EDGE, cb_connserver)) {
 		Log(LOG_ALERT, "io_event_create(): could not add fd %d",
 		    strerror(errno));
 		close(new_sock);
@@ -2075,6 +3068,10 @@ New_Server( int Server , ng_ipaddr_t *dest)
 	My_Connections[new_sock].sock = new_sock;
 	My_Connections[new_sock].addr = *dest;
 	My_Connections[new_sock].client = c;
+	List_Add(CONN_LIST_ACTIVE, new_sock);
+	List_Add(CONN_LIST_READ, new_sock);
+	IPCount_Add(dest);
+	Schedule_Connection(new_sock);
 	strlcpy( My_Connections[new_sock].host, Conf_Server[Server].host,
 				sizeof(My_Connections[new_sock].host ));
 
@@ -2110,6 +3107,11 @@ Init_Conn_Struct(CONN_ID Idx)
 	My_Connections[Idx].signon = now;
 	My_Connections[Idx].lastdata = now;
 	My_Connections[Idx].lastprivmsg = now;
+	My_Connections[Idx].list_pos[CONN_LIST_ACTIVE] = NONE;
+	My_Connections[Idx].list_pos[CONN_LIST_INPUT] = NONE;
+	My_Connections[Idx].list_pos[CONN_LIST_OUTPUT] = NONE;
+	My_Connections[Idx].list_pos[CONN_LIST_READ] = NONE;
+	Resolve_InitStruct(&My_Connections[Idx].res_stat);
 	Proc_InitStruct(&My_Connections[Idx].proc_stat);
 
 #ifdef ICONV
@@ -2118,10 +3120,63 @@ Init_Conn_Struct(CONN_ID Idx)
 #endif
 } /* Init_Conn_Struct */
 
+/**
+ * Add a connection to a list of connections, if not already listed.
+ *
+ * The lists of active connections, of connections with pending input, of
+ * connections with pending output, and of connections not being read from
+ * are dense arrays, so the main loop only has to look at connections that
+ * actually need some work, regardless of the size of the connection pool.
+ * Each list can hold Pool_Size items.
+ *
+ * @param List	List to add the connection to (CONN_LIST_xxx).
+ * @param Idx	Connection index.
+ */
+static void
+List_Add(int List, CONN_ID Idx)
+{
+	assert(List >= 0 && List < CONN_LISTS);
+	assert(Idx > NONE);
+	assert(My_Connections[Idx].sock > NONE);
+
+	if (My_Connections[Idx].list_pos[List] != NONE)
+		return;
+
+	assert(My_ConnListLen[List] < Pool_Size);
+	My_Connections[Idx].list_pos[List] = My_ConnListLen[List];
+	My_ConnList[List][My_ConnListLen[List]++] = Idx;
+} /* List_Add */
+
+/**
+ * Remove a connection from a list of connections, if listed.
+ *
+ * The last connection of the list is moved to the free position.
+ *
+ * @param List	List to remove the connection from (CONN_LIST_xxx).
+ * @param Idx	Connection index.
+ */
+static void
+List_Del(int List, CONN_ID Idx)
+{
+	CONN_ID pos, last;
+
+	assert(List >= 0 && List < CONN_LISTS);
+	assert(Idx > NONE);
+
+	pos = My_Connections[Idx].list_pos[List];
+	if (pos == NONE)
+		return;
+
+	last = My_ConnList[List][--My_ConnListLen[List]];
+	My_ConnList[List][pos] = last;
+	My_Connections[last].list_pos[List] = pos;
+	My_Connections[Idx].list_pos[List] = NONE;
+} /* List_Del */
+
 /**
  * Initialize options of a new socket.
  *
- * For example, we try to set socket options SO_REUSEADDR and IPTOS_LOWDELAY.
+ * Enable non-blocking mode and set socket options, see Set_Socket_Options().
  * The socket is automatically closed if a fatal error is encountered.
  *
  * @param Sock	Socket handle.
@@ -2130,8 +3185,6 @@ Init_Conn_Struct(CONN_ID Idx)
 static bool
 Init_Socket( int Sock )
 {
-	int value;
-
 	if (!io_setnonblock(Sock)) {
 		Log(LOG_CRIT, "Can't enable non-blocking mode for socket: %s!",
 		    strerror(errno));
@@ -2139,6 +3192,21 @@ Init_Socket( int Sock )
 		return false;
 	}
 
+	Set_Socket_Options(Sock);
+	return true;
+} /* Init_Socket */
+
+/**
+ * Set options of a new socket, SO_REUSEADDR and IPTOS_LOWDELAY. Errors
+ * are ignored.
+ *
+ * @param Sock	Socket handle.
+ */
+static void
+Set_Socket_Options(int Sock)
+{
+	int value;
+
 	/* Don't block this port after socket shutdown */
 	value = 1;
 	if (setsockopt(Sock, SOL_SOCKET, SO_REUSEADDR, &value,
@@ -2160,120 +3228,76 @@ Init_Socket( int Sock )
 		LogDebug("IP_TOS on socket %d has been set to IPTOS_LOWDELAY.",
 			 Sock);
 #endif
-
-	return true;
-} /* Init_Socket */
+} /* Set_Socket_Options */
 
 /**
- * Read results of a resolver sub-process and try to initiate a new server
+ * Handle the result of the resolver and try to initiate a new server
  * connection.
  *
- * @param fd		File descriptor of the pipe to the sub-process.
- * @param events	(ignored IO specification)
+ * @param Server	Index of the server in the Conf_Server array.
+ * @param Addrs		Addresses of the remote server.
+ * @param Count		Number of addresses, 0 if the lookup failed.
  */
 static void
-cb_Connect_to_Server(int fd, UNUSED short events)
+cb_Connect_to_Server(int Server, const ng_ipaddr_t *Addrs, size_t Count)
 {
-	int i;
+	ng_ipaddr_t dest;
 	size_t len;
 
-	/* we can handle at most 3 addresses; but we read up to 4 so we can
-	 * log the 'more than we can handle' condition. First result is tried
-	 * immediately, rest is saved for later if needed. */
-	ng_ipaddr_t dest_addrs[4];
-
-	LogDebug("Resolver: Got forward lookup callback on fd %d, events %d",
-		 fd, events);
-
-	for (i=0; i < MAX_SERVERS; i++) {
-		  if (Proc_GetPipeFd(&Conf_Server[i].res_stat) == fd )
-			  break;
-	}
-
-	if( i >= MAX_SERVERS) {
-		/* Ops, no matching server found?! */
-		io_close( fd );
-		LogDebug("Resolver: Got Forward Lookup callback for unknown server!?");
-		return;
-	}
+	assert(Server >= 0 && Server < MAX_SERVERS);
 
-	/* Read result from pipe */
-	len = Proc_Read(&Conf_Server[i].res_stat, dest_addrs, sizeof(dest_addrs));
-	Proc_Close(&Conf_Server[i].res_stat);
-	if (len == 0) {
+	Resolve_InitStruct(&Conf_Server[Server].res_stat);
+	if (Count == 0) {
 		/* Error resolving hostname: reset server structure */
-		Conf_Server[i].conn_id = NONE;
+		Conf_Server[Server].conn_id = NONE;
 		return;
 	}
 
-	assert((len % sizeof(ng_ipaddr_t)) == 0);
-
-	LogDebug("Got result from resolver: %u structs (%u bytes).",
-		 len/sizeof(ng_ipaddr_t), len);
+	LogDebug("Got result from resolver: %u addresses.", (unsigned int)Count);
 
-	memset(&Conf_Server[i].dst_addr, 0, sizeof(Conf_Server[i].dst_addr));
-	if (len > sizeof(ng_ipaddr_t)) {
+	/* First address is tried immediately, rest is saved for later if
+	 * needed (we can handle at most 3 additional addresses). */
+	memset(&Conf_Server[Server].dst_addr, 0,
+	       sizeof(Conf_Server[Server].dst_addr));
+	if (Count > 1) {
 		/* more than one address for this hostname, remember them
 		 * in case first address is unreachable/not available */
-		len -= sizeof(ng_ipaddr_t);
-		if (len > sizeof(Conf_Server[i].dst_addr)) {
-			len = sizeof(Conf_Server[i].dst_addr);
+		len = (Count - 1) * sizeof(ng_ipaddr_t);
+		if (len > sizeof(Conf_Server[Server].dst_addr)) {
+			len = sizeof(Conf_Server[Server].dst_addr);
 			Log(LOG_NOTICE,
 				"Notice: Resolver returned more IP Addresses for host than we can handle, additional addresses dropped.");
 		}
-		memcpy(&Conf_Server[i].dst_addr, &dest_addrs[1], len);
+		memcpy(&Conf_Server[Server].dst_addr, &Addrs[1], len);
 	}
 	/* connect() */
-	New_Server(i, dest_addrs);
-} /* cb_Read_Forward_Lookup */
+	dest = Addrs[0];
+	New_Server(Server, &dest);
+} /* cb_Connect_to_Server */
 
 /**
- * Read results of a resolver sub-process from the pipe and update the
- * appropriate connection/client structure(s): hostname and/or IDENT user name.
+ * Handle the result of the resolver and update the appropriate
+ * connection/client structure(s): hostname and/or IDENT user name.
  *
- * @param r_fd		File descriptor of the pipe to the sub-process.
- * @param events	(ignored IO specification)
+ * @param Idx		Connection index.
+ * @param Host		Host name of the client (or its IP address).
+ * @param Ident		IDENT user name or empty string.
  */
 static void
-cb_Read_Resolver_Result( int r_fd, UNUSED short events )
+cb_Resolver_Result(int Idx, const char *Host, const char *Ident)
 {
 	CLIENT *c;
-	CONN_ID i;
-	size_t len;
-	char *identptr;
+	CONN_ID i = Idx;
 #ifdef IDENTAUTH
-	char readbuf[HOST_LEN + 2 + CLIENT_USER_LEN];
-	char *ptr;
-#else
-	char readbuf[HOST_LEN + 1];
+	const char *ptr;
 #endif
 
-	LogDebug("Resolver: Got callback on fd %d, events %d", r_fd, events );
-	i = Conn_GetFromProc(r_fd);
-	if (i == NONE) {
-		/* Ops, none found? Probably the connection has already
-		 * been closed!? We'll ignore that ... */
-		io_close( r_fd );
-		LogDebug("Resolver: Got callback for unknown connection!?");
-		return;
-	}
+	assert(Host != NULL);
+	assert(Ident != NULL);
 
-	/* Read result from pipe */
-	len = Proc_Read(&My_Connections[i].proc_stat, readbuf, sizeof readbuf -1);
-	Proc_Close(&My_Connections[i].proc_stat);
-	if (len == 0)
-		return;
+	Resolve_InitStruct(&My_Connections[i].res_stat);
 
-	readbuf[len] = '\0';
-	identptr = strchr(readbuf, '\n');
-	assert(identptr != NULL);
-	if (!identptr) {
-		Log( LOG_CRIT, "Resolver: Got malformed result!");
-		return;
-	}
-
-	*identptr = '\0';
-	LogDebug("Got result from resolver: \"%s\" (%u bytes read).", readbuf, len);
+	LogDebug("Got result from resolver: \"%s\", \"%s\".", Host, Ident);
 	/* Okay, we got a complete result: this is a host name for outgoing
 	 * connections and a host name and IDENT user name (if enabled) for
 	 * incoming connections.*/
@@ -2287,17 +3311,16 @@ cb_Read_Resolver_Result( int r_fd, UNUSED short events )
 	 * the resolver results, so we don't have to worry to override settings
 	 * from these commands here. */
 	if(Client_Type(c) == CLIENT_UNKNOWN) {
-		strlcpy(My_Connections[i].host, readbuf,
+		strlcpy(My_Connections[i].host, Host,
 			sizeof(My_Connections[i].host));
-		Client_SetHostname(c, readbuf);
+		Client_SetHostname(c, Host);
 		if (Conf_NoticeBeforeRegistration)
 			(void)Conn_WriteStr(i,
 					"NOTICE * :*** Found your hostname: %s",
 					My_Connections[i].host);
 #ifdef IDENTAUTH
-		++identptr;
-		if (*identptr) {
-			ptr = identptr;
+		if (*Ident) {
+			ptr = Ident;
 			while (*ptr) {
 				if ((*ptr < '0' || *ptr > '9') &&
 				    (*ptr < 'A' || *ptr > 'Z') &&
@@ -2313,15 +3336,15 @@ cb_Read_Resolver_Result( int r_fd, UNUSED short events )
 			} else {
 				Log(LOG_INFO,
 				    "IDENT lookup for connection %d: \"%s\".",
-				    i, identptr);
-				Client_SetUser(c, identptr, true);
+				    i, Ident);
+				Client_SetUser(c, Ident, true);
 			}
 			if (Conf_NoticeBeforeRegistration) {
 				(void)Conn_WriteStr(i,
 					"NOTICE * :*** Got %sident response%s%s",
 					*ptr ? "invalid " : "",
 					*ptr ? "" : ": ",
-					*ptr ? "" : identptr);
+					*ptr ? "" : Ident);
 			}
 		} else if(Conf_Ident) {
 			Log(LOG_INFO, "IDENT lookup for connection %d: no result.", i);
@@ -2345,7 +3368,7 @@ cb_Read_Resolver_Result( int r_fd, UNUSED short events )
 	else
 		LogDebug("Resolver: discarding result for already registered connection %d.", i);
 #endif
-} /* cb_Read_Resolver_Result */
+} /* cb_Resolver_Result */
 
 /**
  * Write a "simple" (error) message to a socket.
@@ -2394,7 +3417,7 @@ Conn_GetClient( CONN_ID Idx )
 	CONNECTION *c;
 
 	assert(Idx >= 0);
-	c = array_get(&My_ConnArray, sizeof (CONNECTION), (size_t)Idx);
+	c = Idx < Pool_Size ? &My_Connections[Idx] : NULL;
 	assert(c != NULL);
 	return c ? c->client : NULL;
 }
@@ -2411,31 +3434,11 @@ Conn_GetProcStat(CONN_ID Idx)
 	CONNECTION *c;
 
 	assert(Idx >= 0);
-	c = array_get(&My_ConnArray, sizeof (CONNECTION), (size_t)Idx);
+	c = Idx < Pool_Size ? &My_Connections[Idx] : NULL;
 	assert(c != NULL);
 	return &c->proc_stat;
 } /* Conn_GetProcStat */
 
-/**
- * Get CONN_ID from file descriptor associated to a subprocess structure.
- *
- * @param fd	File descriptor.
- * @returns	CONN_ID or NONE (-1).
- */
-GLOBAL CONN_ID
-Conn_GetFromProc(int fd)
-{
-	int i;
-
-	assert(fd > 0);
-	for (i = 0; i < Pool_Size; i++) {
-		if ((My_Connections[i].sock != NONE)
-		    && (Proc_GetPipeFd(&My_Connections[i].proc_stat) == fd))
-			return i;
-	}
-	return NONE;
-} /* Conn_GetFromProc */
-
 /**
  * Throttle a connection because of excessive usage.
  *
@@ -2530,10 +3533,11 @@ cb_listen_ssl(int sock, short irrelevant)
 	int fd;
 
 	(void) irrelevant;
-	fd = New_Connection(sock, true);
-	if (fd < 0)
-		return;
-	io_event_setcb(My_Connections[fd].sock, cb_clientserver_ssl);
+	while ((fd = New_Connection(sock, true)) != -2) {
+		if (fd >= 0)
+			io_event_setcb(My_Connections[fd].sock,
+				       cb_clientserver_ssl);
+	}
 }
 
 /**
@@ -2629,7 +3633,7 @@ Conn_GetCipherInfo(CONN_ID Idx, char *buf, size_t len)
 {
 	if (Idx < 0)
 		return false;
-	assert(Idx < (int) array_length(&My_ConnArray, sizeof(CONNECTION)));
+	assert(Idx < Pool_Size);
 	return ConnSSL_GetCipherInfo(&My_Connections[Idx], buf, len);
 }
 
@@ -2644,7 +3648,7 @@ Conn_UsesSSL(CONN_ID Idx)
 {
 	if (Idx < 0)
 		return false;
-	assert(Idx < (int) array_length(&My_ConnArray, sizeof(CONNECTION)));
+	assert(Idx < Pool_Size);
 	return Conn_OPTION_ISSET(&My_Connections[Idx], CONN_SSL);
 }
 
@@ -2653,7 +3657,7 @@ Conn_GetCertFp(CONN_ID Idx)
 {
 	if (Idx < 0)
 		return NULL;
-	assert(Idx < (int) array_length(&My_ConnArray, sizeof(CONNECTION)));
+	assert(Idx < Pool_Size);
 	return ConnSSL_GetCertFp(&My_Connections[Idx]);
 }
 
@@ -2662,7 +3666,7 @@ Conn_SetCertFp(CONN_ID Idx, const char *fingerprint)
 {
 	if (Idx < 0)
 		return false;
-	assert(Idx < (int) array_length(&My_ConnArray, sizeof(CONNECTION)));
+	assert(Idx < Pool_Size);
 	return ConnSSL_SetCertFp(&My_Connections[Idx], fingerprint);
 }
 
@@ -2706,7 +3710,7 @@ Conn_DebugDump(void)
 		    " - %d: host=%s, lastdata=%ld, lastping=%ld, delaytime=%ld, flag=%d, options=%d, bps=%d, client=%s",
 		    My_Connections[i].sock, My_Connections[i].host,
 		    My_Connections[i].lastdata, My_Connections[i].lastping,
-		    My_Connections[i].delaytime, My_Connections[i].flag,
+		    My_Connections[i].delaytime, Conn_Flag(i),
 		    My_Connections[i].options, My_Connections[i].bps,
 		    My_Connections[i].client ? Client_ID(My_Connections[i].client) : "-");
 	}
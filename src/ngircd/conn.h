@@ -42,15 +42,22 @@
 #define CONN_SSL_WANT_READ	128	/* SSL/TLS library needs to read protocol data */
 #define CONN_SSL_FLAGS_ALL	(CONN_SSL_CONNECT|CONN_SSL|CONN_SSL_WANT_WRITE|CONN_SSL_WANT_READ)
 #endif
+#define CONN_ISPENDING		256	/* waiting in the login queue */
 typedef int CONN_ID;
 
+/* Reference counted message line, shared by the output queues of all
+ * connections it is sent to, see Conn_NewBlock() and Conn_WriteBlock(). */
+typedef struct _MsgBlock MSGBLOCK;
+
 #include "client.h"
 #include "proc.h"
+#include "resolve.h"
 
 #ifdef CONN_MODULE
 
 #include "defines.h"
 #include "array.h"
+#include "ringbuf.h"
 #include "tool.h"
 #include "ng_ipaddr.h"
 
@@ -64,21 +71,72 @@ typedef struct _ZipData
 {
 	z_stream in;			/* "Handle" for input stream */
 	z_stream out;			/* "Handle" for output stream */
-	array rbuf;			/* Read buffer (compressed) */
-	array wbuf;			/* Write buffer (uncompressed) */
+	ringbuf rbuf;			/* Read buffer (compressed) */
+	ringbuf wbuf;			/* Write buffer (uncompressed) */
 	long bytes_in, bytes_out;	/* Counter for statistics (uncompressed!) */
 } ZIPDATA;
 #endif /* ZLIB */
 
+/*
+ * Lists of connections, see List_Add() and List_Del() in conn.c.
+ */
+#define CONN_LIST_ACTIVE	0	/* Connections with a valid socket */
+#define CONN_LIST_INPUT		1	/* Connections with data to handle */
+#define CONN_LIST_OUTPUT	2	/* Connections with data to write */
+#define CONN_LIST_READ		3	/* Connections not (yet) read from */
+#define CONN_LISTS		4
+
+struct _MsgBlock
+{
+	unsigned int refcnt;		/* Number of references */
+	size_t len;			/* Length of the data (including CR+LF) */
+	char data[1];			/* Data, NULL terminated */
+};
+
+/*
+ * Entry of the output queue of a connection: the last "len" bytes of a
+ * message block, or "len" bytes of the write buffer if "block" is NULL.
+ */
+typedef struct _OutQEntry
+{
+	MSGBLOCK *block;		/* Message block or NULL */
+	size_t len;			/* Bytes still to be sent */
+} OUTQ_ENTRY;
+
+/*
+ * Number of established connections to an IP address, entry of an open
+ * addressing hash table, see IPCount_Add() and IPCount_Del() in conn.c.
+ */
+typedef struct _IPCount
+{
+	ng_ipaddr_t addr;		/* IP address (and any port) */
+	long count;			/* Connections, 0 if slot is unused */
+} IPCOUNT;
+
+/*
+ * Timers of the connection module, see conn-timer.c.
+ */
+#define TIMER_SERVERS		0	/* Check configured servers */
+#define TIMER_HOUSEKEEPING	1	/* Expire G-Lines and K-Lines */
+#define TIMER_LOGINS		2	/* Admit connections of login queue */
+#define TIMER_RESOLVER		3	/* Retransmit and expire DNS queries */
+#define TIMER_CONN(Idx)		((Idx) + 4)	/* Connection timeouts */
+#define TIMER_CONN_IDX(Id)	((Id) - 4)
+
 typedef struct _Connection
 {
 	int sock;			/* Socket handle */
 	ng_ipaddr_t addr;		/* Client address */
-	PROC_STAT proc_stat;		/* Status of resolver process */
+	RES_STAT res_stat;		/* Status of resolver */
+	PROC_STAT proc_stat;		/* Status of PAM authentication */
 	char host[HOST_LEN];		/* Hostname */
 	char *pwd;			/* password received of the client */
-	array rbuf;			/* Read buffer */
-	array wbuf;			/* Write buffer */
+	ringbuf rbuf;			/* Read buffer */
+	ringbuf wbuf;			/* Write buffer */
+	array outq;			/* Output queue (OUTQ_ENTRY) */
+	size_t outq_head;		/* First pending entry of outq */
+	size_t outq_bytes;		/* Bytes of message blocks in outq */
+	size_t outq_wbuf;		/* Bytes of wbuf queued in outq */
 	time_t signon;			/* Signon ("connect") time */
 	time_t lastdata;		/* Last activity */
 	time_t lastping;		/* Last PING */
@@ -86,7 +144,9 @@ typedef struct _Connection
 	time_t delaytime;		/* Ignore link ("penalty") */
 	long bytes_in, bytes_out;	/* Received and sent bytes */
 	long msg_in, msg_out;		/* Received and sent IRC messages */
-	int flag;			/* Flag (see "irc-write" module) */
+	unsigned long flag_epoch;	/* Round the flag has been set in */
+	size_t flag_pos;		/* Position in list of marked connections */
+	CONN_ID list_pos[CONN_LISTS];	/* Positions in connection lists */
 	UINT16 options;			/* Link options / connection state */
 	UINT16 bps;			/* bytes processed within last second */
 	CLIENT *client;			/* pointer to client structure */
@@ -125,16 +185,22 @@ extern long WCounter;
 GLOBAL void Conn_Init PARAMS((void ));
 GLOBAL void Conn_Exit PARAMS(( void ));
 
-GLOBAL void Conn_CloseAllSockets PARAMS((int ExceptOf));
-
 GLOBAL unsigned int Conn_InitListeners PARAMS(( void ));
 GLOBAL void Conn_ExitListeners PARAMS(( void ));
 
 GLOBAL void Conn_StartLogin PARAMS((CONN_ID Idx));
+GLOBAL void Conn_CheckReading PARAMS((CONN_ID Idx));
 
 GLOBAL void Conn_Handler PARAMS(( void ));
+GLOBAL void Conn_ScheduleServerCheck PARAMS(( void ));
 
 GLOBAL bool Conn_WriteStr PARAMS(( CONN_ID Idx, const char *Format, ... ));
+GLOBAL size_t Conn_FormatLine PARAMS(( char *Buffer, const char *Format, ... ));
+GLOBAL bool Conn_WriteLine PARAMS(( CONN_ID Idx, const char *Line, size_t Len ));
+
+GLOBAL MSGBLOCK *Conn_NewBlock PARAMS((const char *Line, size_t Len));
+GLOBAL void Conn_ReleaseBlock PARAMS((MSGBLOCK *Block));
+GLOBAL bool Conn_WriteBlock PARAMS((CONN_ID Idx, MSGBLOCK *Block));
 
 GLOBAL char* Conn_Password PARAMS(( CONN_ID Idx ));
 GLOBAL void Conn_SetPassword PARAMS(( CONN_ID Idx, const char *Pwd ));
@@ -143,7 +209,6 @@ GLOBAL void Conn_Close PARAMS(( CONN_ID Idx, const char *LogMsg, const char *Fwd
 
 GLOBAL void Conn_SyncServerStruct PARAMS(( void ));
 
-GLOBAL CONN_ID Conn_GetFromProc PARAMS((int fd));
 GLOBAL CLIENT* Conn_GetClient PARAMS((CONN_ID i));
 GLOBAL PROC_STAT* Conn_GetProcStat PARAMS((CONN_ID i));
 
@@ -160,6 +225,9 @@ GLOBAL const char *Conn_GetIPAInfo PARAMS((CONN_ID Idx));
 GLOBAL long Conn_Count PARAMS((void));
 GLOBAL long Conn_CountMax PARAMS((void));
 GLOBAL long Conn_CountAccepted PARAMS((void));
+GLOBAL long Conn_CountQueued PARAMS((void));
+GLOBAL long Conn_CountQueuedMax PARAMS((void));
+GLOBAL long Conn_CountRejected PARAMS((void));
 
 #ifndef STRICT_RFC
 GLOBAL long Conn_GetAuthPing PARAMS((CONN_ID Idx));
@@ -61,6 +61,21 @@
 /** Size of default connection pool. */
 #define CONNECTION_POOL 100
 
+/** Max. size of the connection pool reserved at startup. */
+#define CONNECTION_POOL_MAX 65536
+
+/** Initial number of buckets of the nickname/server name index. */
+#define CLIENT_INDEX_SIZE 256
+
+/** Initial number of buckets of the channel name index. */
+#define CHANNEL_INDEX_SIZE 256
+
+/** Number of channel index buckets migrated per operation while resizing. */
+#define CHANNEL_INDEX_STEP 16
+
+/** Max. number of IP addresses whose host names are cached. */
+#define RESOLVE_CACHE_SIZE 4096
+
 /** Size of buffer for PAM service name. */
 #define MAX_PAM_SERVICE_NAME_LEN 64
 
@@ -73,6 +88,15 @@
 /** Time to delay re-connect attempts in seconds. */
 #define RECONNECT_DELAY 3
 
+/** Length of the login queue in seconds (multiplied by MaxLoginsPerSecond). */
+#define LOGIN_QUEUE_TIME 30
+
+/** Max. time to cache host names in seconds (limits the DNS TTL). */
+#define RESOLVE_CACHE_TTL 3600
+
+/** Time to cache failed host name lookups in seconds. */
+#define RESOLVE_CACHE_NEG_TTL 300
+
 /** Configuration file name. */
 #define CONFIG_FILE "/ngircd.conf"
 
@@ -91,6 +115,12 @@
 /** Default file for the process ID. */
 #define PID_FILE ""
 
+/** Default resolver configuration file, see resolv.conf(5). */
+#define RESOLV_CONF "/etc/resolv.conf"
+
+/** Static table of host names, see hosts(5). */
+#define HOSTS_FILE "/etc/hosts"
+
 
 /* Sizes of "IRC elements": nicks, users, ... */
 
@@ -153,6 +183,9 @@
 /** Size of the read buffer of a connection in bytes. */
 #define READBUFFER_LEN 2048
 
+/** Size of the read buffer of a server link connection in bytes. */
+#define READBUFFER_SLINK_LEN 16384
+
 /** Size that triggers write buffer flushing if more space is needed. */
 #define WRITEBUFFER_FLUSH_LEN 4096
 
@@ -0,0 +1,1289 @@
+/*
+ * ngIRCd -- The Next Generation IRC Daemon
+ * Copyright (c)2001-2014 Alexander Barton (alex@barton.de) and Contributors.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * Please read the file COPYING, README and AUTHORS for more information.
+ */
+
+#include "portab.h"
+
+/**
+ * @file
+ * Asynchronous DNS stub resolver
+ *
+ * Queries are sent to the name servers listed in the resolver configuration
+ * file (see resolv.conf(5)) using UDP, and are repeated using TCP when the
+ * answer has been truncated. All sockets are non-blocking and handled by
+ * the main loop of the daemon (see io.c), so a lookup never blocks.
+ *
+ * Each query uses its own socket, and therefore a random source port, and
+ * a random query ID; only answers matching the question are accepted.
+ *
+ * Names are looked up in the hosts file first, and IP addresses aren't
+ * looked up at all. Both files are read by Dns_Init() on startup, before
+ * ngIRCd changes its root directory.
+ *
+ * Pending queries are kept in a list ordered by the time of their next
+ * timeout, see Dns_Timeout(). New queries are sent from there, and queries
+ * that can be answered without asking a name server are completed from
+ * there, too: callback functions are never called from within Dns_Query().
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "array.h"
+#include "io.h"
+#include "log.h"
+
+#include "dns.h"
+
+#define DNS_SERVERS	3	/* Max. number of name servers */
+#define DNS_SEARCH	6	/* Max. number of search domains */
+#define DNS_PORT	53
+
+#define DNS_MSG_LEN	512	/* Max. size of an UDP message */
+#define DNS_TCP_LEN	65535	/* Max. size of a TCP message */
+#define DNS_HDR_LEN	12	/* Size of the message header */
+
+#define DNS_CLASS_IN	1
+
+#define DNS_FLAG_QR	0x8000	/* Message is a response */
+#define DNS_FLAG_TC	0x0200	/* Message has been truncated */
+#define DNS_FLAG_RD	0x0100	/* Recursion desired */
+#define DNS_OPCODE(f)	(((f) >> 11) & 0x0f)
+#define DNS_RCODE(f)	((f) & 0x0f)
+#define DNS_NXDOMAIN	3
+
+/* Results of Parse_Answer(), in addition to the status of an answer */
+#define DNS_IGNORE	-1	/* Not an answer to the query */
+#define DNS_TRUNCATED	-2	/* Truncated answer, retry using TCP */
+#define DNS_RETRY	-3	/* Server failure, try next name server */
+
+/* State of the socket of a query */
+#define DNS_UDP		0	/* UDP socket */
+#define DNS_TCP_SEND	1	/* TCP connection, sending the query */
+#define DNS_TCP_RECV	2	/* TCP connection, receiving the answer */
+
+#define GET16(p)	((unsigned int)((p)[0] << 8 | (p)[1]))
+#define GET32(p)	((UINT32)GET16(p) << 16 | GET16((p) + 2))
+
+typedef struct _Dns_Query {
+	void (*cbfunc) PARAMS((int, const DNS_ANSWER *)); /**< NULL if unused */
+	int token;		/**< Token passed to the callback function */
+	int type;		/**< Query type */
+	int sock;		/**< Socket or NONE */
+	int state;		/**< State of the socket (DNS_UDP, ...) */
+	UINT16 id;		/**< ID of the query sent last */
+	int server;		/**< Index of the name server */
+	int tries;		/**< Number of queries sent to name servers */
+	int search;		/**< Index of the name looked up, see Query_Name() */
+	bool absolute;		/**< Don't apply search domains to the name */
+	time_t expires;		/**< Time of next timeout */
+	time_t deadline;	/**< Time after which the query fails */
+	int prev, next;		/**< Links of pending list (or free list) */
+	DNS_ANSWER *answer;	/**< Answer known already, see Dns_Timeout() */
+	unsigned char *tcpbuf;	/**< TCP: query to send, then answer */
+	size_t tcplen, tcppos;	/**< TCP: bytes in tcpbuf, bytes transferred */
+	char name[HOST_LEN];	/**< Name to look up */
+} DNS_QUERY;
+
+/** Entry of the hosts file */
+typedef struct _Dns_Host {
+	ng_ipaddr_t addr;	/**< IP address */
+	size_t name;		/**< Offset of the name in My_HostNames */
+} DNS_HOST;
+
+static bool Read_ResolvConf PARAMS((const char *File));
+static void Read_Hosts PARAMS((const char *File));
+static bool Lookup_Hosts PARAMS((const char *Name, int Type,
+				 DNS_ANSWER *Answer));
+static int New_Query PARAMS((void));
+static void Free_Query PARAMS((int Idx));
+static void Link_Query PARAMS((int Idx, time_t Expires));
+static void Unlink_Query PARAMS((int Idx));
+static void Complete PARAMS((int Idx, const DNS_ANSWER *Answer));
+static void Send_Query PARAMS((int Idx, time_t Now, bool Tcp));
+static void Next_Try PARAMS((int Idx, time_t Now));
+static void Next_Name PARAMS((int Idx, time_t Now));
+static bool Query_Name PARAMS((const DNS_QUERY *Query, char *Buf, size_t Len));
+static size_t Build_Query PARAMS((unsigned char *Buf, size_t Len, UINT16 Id,
+				  const char *Name, int Type));
+static bool Get_Name PARAMS((const unsigned char *Msg, size_t Len,
+			     size_t *Pos, char *Name, size_t NameLen));
+static int Parse_Answer PARAMS((const DNS_QUERY *Query,
+				const unsigned char *Msg, size_t Len,
+				DNS_ANSWER *Answer));
+static bool Handle_Answer PARAMS((int Idx, const unsigned char *Msg,
+				  size_t Len));
+static void Read_Udp PARAMS((int Idx));
+static void Handle_Tcp PARAMS((int Idx));
+static void cb_Dns PARAMS((int Sock, short What));
+
+static ng_ipaddr_t Dns_Server[DNS_SERVERS];
+static int Dns_ServerCount;
+static char Dns_Search[DNS_SEARCH][HOST_LEN];
+static int Dns_SearchCount;
+static int Dns_Ndots = 1;
+static int Dns_RetryTime = 5;
+static int Dns_Attempts = 2;
+
+static array My_Hosts;
+static array My_HostNames;
+
+static DNS_QUERY *My_Queries;
+static int My_QueriesSize;
+static int Free_Head = NONE;
+static int Pending_Head = NONE, Pending_Tail = NONE;
+
+/** Query of each socket plus 1 (0 if none), indexed by socket handle */
+static int *My_Socks;
+static int My_SocksSize;
+
+
+/**
+ * Initialize the resolver.
+ *
+ * The resolver configuration file and the hosts file are read; when the
+ * resolver configuration can't be read, the previous configuration (or the
+ * default: a name server on the local host) stays in use.
+ *
+ * @param ResolvConf Name of the resolver configuration file.
+ */
+GLOBAL void
+Dns_Init(const char *ResolvConf)
+{
+	assert(ResolvConf != NULL);
+
+	if (!Read_ResolvConf(ResolvConf) && Dns_ServerCount == 0) {
+		(void)ng_ipaddr_init(&Dns_Server[0], "127.0.0.1", DNS_PORT);
+		Dns_ServerCount = 1;
+	}
+	Read_Hosts(HOSTS_FILE);
+} /* Dns_Init */
+
+/**
+ * Shut down the resolver: cancel all pending queries (without calling
+ * their callback functions) and free all memory.
+ */
+GLOBAL void
+Dns_Exit(void)
+{
+	int i;
+
+	for (i = 0; i < My_QueriesSize; i++) {
+		if (My_Queries[i].cbfunc)
+			Free_Query(i);
+	}
+	free(My_Queries);
+	My_Queries = NULL;
+	My_QueriesSize = 0;
+	Free_Head = Pending_Head = Pending_Tail = NONE;
+
+	free(My_Socks);
+	My_Socks = NULL;
+	My_SocksSize = 0;
+
+	array_free(&My_Hosts);
+	array_free(&My_HostNames);
+} /* Dns_Exit */
+
+/**
+ * Start a query.
+ *
+ * @param Name		Name to look up.
+ * @param Type		Query type: DNS_A, DNS_AAAA or DNS_PTR.
+ * @param Token		Token passed to the callback function.
+ * @param Deadline	Time after which the query fails.
+ * @param cbfunc	Function called with the answer.
+ * @returns		Query index (for Dns_Cancel()) or NONE on error.
+ */
+GLOBAL int
+Dns_Query(const char *Name, int Type, int Token, time_t Deadline,
+	  void (*cbfunc)(int, const DNS_ANSWER *))
+{
+	DNS_QUERY *q;
+	DNS_ANSWER *answer = NULL;
+	size_t len;
+	int i;
+
+	assert(Name != NULL);
+	assert(Type == DNS_A || Type == DNS_AAAA || Type == DNS_PTR);
+	assert(cbfunc != NULL);
+
+	i = New_Query();
+	if (i == NONE)
+		return NONE;
+
+	q = &My_Queries[i];
+	q->cbfunc = cbfunc;
+	q->token = Token;
+	q->type = Type;
+	q->deadline = Deadline;
+
+	len = strlcpy(q->name, Name, sizeof(q->name));
+	if (len > 0 && len < sizeof(q->name) && q->name[len - 1] == '.') {
+		q->name[--len] = '\0';
+		q->absolute = true;
+	}
+
+	if (Type != DNS_PTR || len == 0 || len >= sizeof(q->name)) {
+		/* Answer without asking a name server */
+		answer = malloc(sizeof(DNS_ANSWER));
+		if (!answer) {
+			Log(LOG_EMERG, "Can't allocate memory! [Dns_Query]");
+			Free_Query(i);
+			return NONE;
+		}
+		if (len == 0 || len >= sizeof(q->name)) {
+			answer->status = DNS_NOTFOUND;
+			answer->type = Type;
+			answer->name[0] = '\0';
+			answer->count = 0;
+			answer->ttl = 0;
+		} else if (!Lookup_Hosts(q->name, Type, answer)) {
+			free(answer);
+			answer = NULL;
+		}
+	}
+
+	/* The query is sent (or the answer is passed to the callback
+	 * function) by Dns_Timeout() */
+	q->answer = answer;
+	Link_Query(i, time(NULL));
+	return i;
+} /* Dns_Query */
+
+/**
+ * Start a reverse query ("PTR") for an IP address.
+ *
+ * @param Addr		IP address to look up.
+ * @param Token		Token passed to the callback function.
+ * @param Deadline	Time after which the query fails.
+ * @param cbfunc	Function called with the answer.
+ * @returns		Query index (for Dns_Cancel()) or NONE on error.
+ */
+GLOBAL int
+Dns_QueryAddr(const ng_ipaddr_t *Addr, int Token, time_t Deadline,
+	      void (*cbfunc)(int, const DNS_ANSWER *))
+{
+	char name[HOST_LEN];
+	const unsigned char *p;
+	size_t len = 0;
+	int i;
+
+	assert(Addr != NULL);
+
+#ifdef WANT_IPV6
+	if (ng_ipaddr_af(Addr) == AF_INET6) {
+		p = (const unsigned char *)&Addr->sin6.sin6_addr;
+		for (i = 15; i >= 0; i--)
+			len += snprintf(name + len, sizeof(name) - len,
+					"%x.%x.", p[i] & 0x0f, p[i] >> 4);
+		strlcpy(name + len, "ip6.arpa", sizeof(name) - len);
+		return Dns_Query(name, DNS_PTR, Token, Deadline, cbfunc);
+	}
+#endif
+	p = (const unsigned char *)&Addr->sin4.sin_addr;
+	for (i = 3; i >= 0; i--)
+		len += snprintf(name + len, sizeof(name) - len, "%u.", p[i]);
+	strlcpy(name + len, "in-addr.arpa", sizeof(name) - len);
+	return Dns_Query(name, DNS_PTR, Token, Deadline, cbfunc);
+} /* Dns_QueryAddr */
+
+/**
+ * Cancel a query. Its callback function isn't called.
+ *
+ * @param Query	Query index.
+ */
+GLOBAL void
+Dns_Cancel(int Query)
+{
+	assert(Query >= 0 && Query < My_QueriesSize);
+	assert(My_Queries[Query].cbfunc != NULL);
+
+	Free_Query(Query);
+} /* Dns_Cancel */
+
+/**
+ * Handle all queries whose timeout has expired: send new queries, resend
+ * queries, or call the callback functions of queries that failed or have
+ * been answered already.
+ *
+ * @param Now	Current time.
+ */
+GLOBAL void
+Dns_Timeout(time_t Now)
+{
+	DNS_ANSWER answer;
+	int i;
+
+	while (Pending_Head != NONE && My_Queries[Pending_Head].expires <= Now) {
+		i = Pending_Head;
+		if (My_Queries[i].answer) {
+			answer = *My_Queries[i].answer;
+			Complete(i, &answer);
+		} else if (My_Queries[i].tries == 0 && Dns_ServerCount > 0)
+			Send_Query(i, Now, false);
+		else
+			Next_Try(i, Now);
+	}
+} /* Dns_Timeout */
+
+/**
+ * Get the time at which Dns_Timeout() has to be called next.
+ *
+ * @returns	Time of the next timeout or 0 if no query is pending.
+ */
+GLOBAL time_t
+Dns_NextTimeout(void)
+{
+	if (Pending_Head == NONE)
+		return 0;
+	return My_Queries[Pending_Head].expires;
+} /* Dns_NextTimeout */
+
+/**
+ * Read the resolver configuration file.
+ *
+ * "nameserver", "domain", "search" and "options" (ndots, timeout and
+ * attempts) are supported. Name servers can be given as "[address]:port"
+ * to use a port other than 53.
+ *
+ * @param File	Name of the file.
+ * @returns	true if the file could be read.
+ */
+static bool
+Read_ResolvConf(const char *File)
+{
+	char line[1024], addr[NG_INET_ADDRSTRLEN], *ptr, *word, *end;
+	unsigned int port;
+	size_t len;
+	FILE *fd;
+	int n;
+
+	fd = fopen(File, "r");
+	if (!fd) {
+		Log(LOG_WARNING, "Can't read resolver configuration \"%s\": %s",
+		    File, strerror(errno));
+		return false;
+	}
+
+	Dns_ServerCount = Dns_SearchCount = 0;
+	Dns_Ndots = 1;
+	Dns_RetryTime = 5;
+	Dns_Attempts = 2;
+
+	while (fgets(line, (int)sizeof(line), fd)) {
+		ptr = strpbrk(line, "#;\r\n");
+		if (ptr)
+			*ptr = '\0';
+		word = strtok(line, " \t");
+		if (!word)
+			continue;
+
+		if (strcmp(word, "nameserver") == 0) {
+			word = strtok(NULL, " \t");
+			if (!word || Dns_ServerCount >= DNS_SERVERS)
+				continue;
+			port = DNS_PORT;
+			if (*word == '[') {
+				end = strchr(++word, ']');
+				if (!end)
+					continue;
+				*end++ = '\0';
+				if (*end == ':')
+					port = (unsigned int)atoi(end + 1);
+			}
+			if (strlcpy(addr, word, sizeof(addr)) >= sizeof(addr)
+			    || port == 0 || port > 0xffff
+			    || !ng_ipaddr_init(&Dns_Server[Dns_ServerCount],
+					       addr, (UINT16)port)) {
+				Log(LOG_WARNING,
+				    "Ignoring invalid name server \"%s\" in \"%s\"!",
+				    word, File);
+				continue;
+			}
+			LogDebug("Using name server %s, port %u.", addr, port);
+			Dns_ServerCount++;
+		} else if (strcmp(word, "domain") == 0
+			   || strcmp(word, "search") == 0) {
+			Dns_SearchCount = 0;
+			while ((word = strtok(NULL, " \t"))
+			       && Dns_SearchCount < DNS_SEARCH) {
+				len = strlcpy(Dns_Search[Dns_SearchCount], word,
+					      HOST_LEN);
+				if (len >= HOST_LEN)
+					continue;
+				if (len > 0 && word[len - 1] == '.')
+					Dns_Search[Dns_SearchCount][len - 1] = '\0';
+				if (Dns_Search[Dns_SearchCount][0])
+					Dns_SearchCount++;
+			}
+		} else if (strcmp(word, "options") == 0) {
+			while ((word = strtok(NULL, " \t"))) {
+				ptr = strchr(word, ':');
+				if (!ptr)
+					continue;
+				*ptr++ = '\0';
+				n = atoi(ptr);
+				if (strcmp(word, "ndots") == 0)
+					Dns_Ndots = n < 0 ? 0 : n > 15 ? 15 : n;
+				else if (strcmp(word, "timeout") == 0)
+					Dns_RetryTime = n < 1 ? 1 : n > 30 ? 30 : n;
+				else if (strcmp(word, "attempts") == 0)
+					Dns_Attempts = n < 1 ? 1 : n > 5 ? 5 : n;
+			}
+		}
+	}
+	fclose(fd);
+
+	if (Dns_ServerCount == 0) {
+		(void)ng_ipaddr_init(&Dns_Server[0], "127.0.0.1", DNS_PORT);
+		Dns_ServerCount = 1;
+	}
+	return true;
+} /* Read_ResolvConf */
+
+/**
+ * Read the hosts file.
+ *
+ * @param File	Name of the file.
+ */
+static void
+Read_Hosts(const char *File)
+{
+	char line[1024], *ptr, *word;
+	DNS_HOST host;
+	FILE *fd;
+
+	array_free(&My_Hosts);
+	array_free(&My_HostNames);
+
+	fd = fopen(File, "r");
+	if (!fd) {
+		LogDebug("Can't read hosts file \"%s\": %s", File,
+			 strerror(errno));
+		return;
+	}
+
+	while (fgets(line, (int)sizeof(line), fd)) {
+		ptr = strpbrk(line, "#\r\n");
+		if (ptr)
+			*ptr = '\0';
+		word = strtok(line, " \t");
+		if (!word || !ng_ipaddr_init(&host.addr, word, 0))
+			continue;
+		while ((word = strtok(NULL, " \t"))) {
+			host.name = array_bytes(&My_HostNames);
+			if (!array_catb(&My_HostNames, word, strlen(word) + 1)
+			    || !array_catb(&My_Hosts, (char *)&host,
+					   sizeof(host))) {
+				Log(LOG_EMERG,
+				    "Can't allocate memory! [Read_Hosts]");
+				fclose(fd);
+				return;
+			}
+		}
+	}
+	fclose(fd);
+} /* Read_Hosts */
+
+/**
+ * Look up a name in the hosts file, or convert an IP address.
+ *
+ * @param Name		Name to look up.
+ * @param Type		Query type: DNS_A or DNS_AAAA.
+ * @param Answer	Receives the answer.
+ * @returns		true if the name has been found, or is an address.
+ */
+static bool
+Lookup_Hosts(const char *Name, int Type, DNS_ANSWER *Answer)
+{
+	const DNS_HOST *host;
+	const char *names;
+	ng_ipaddr_t addr;
+	size_t i, count;
+	int af = Type == DNS_A ? AF_INET : AF_INET6;
+
+	Answer->type = Type;
+	Answer->name[0] = '\0';
+	Answer->count = 0;
+	Answer->ttl = DNS_TTL_MAX;
+
+	if (ng_ipaddr_init(&addr, Name, 0)) {
+		if (ng_ipaddr_af(&addr) == af)
+			Answer->addrs[Answer->count++] = addr;
+		Answer->status = Answer->count ? DNS_OK : DNS_NOTFOUND;
+		return true;
+	}
+
+	host = array_start(&My_Hosts);
+	names = array_start(&My_HostNames);
+	count = array_length(&My_Hosts, sizeof(*host));
+	for (i = 0; i < count && Answer->count < DNS_ADDRS; i++) {
+		if (ng_ipaddr_af(&host[i].addr) == af
+		    && strcasecmp(names + host[i].name, Name) == 0)
+			Answer->addrs[Answer->count++] = host[i].addr;
+	}
+	Answer->status = DNS_OK;
+	return Answer->count > 0;
+} /* Lookup_Hosts */
+
+/**
+ * Allocate a new query structure.
+ *
+ * @returns	Query index or NONE on error.
+ */
+static int
+New_Query(void)
+{
+	DNS_QUERY *tmp;
+	int i, size;
+
+	if (Free_Head == NONE) {
+		size = My_QueriesSize ? My_QueriesSize * 2 : 16;
+		tmp = realloc(My_Queries, (size_t)size * sizeof(DNS_QUERY));
+		if (!tmp) {
+			Log(LOG_EMERG, "Can't allocate memory! [New_Query]");
+			return NONE;
+		}
+		My_Queries = tmp;
+		for (i = size - 1; i > My_QueriesSize; i--) {
+			My_Queries[i].cbfunc = NULL;
+			My_Queries[i].next = Free_Head;
+			Free_Head = i;
+		}
+		/* Use the first new structure right away */
+		i = My_QueriesSize;
+		My_QueriesSize = size;
+	} else {
+		i = Free_Head;
+		Free_Head = My_Queries[i].next;
+	}
+
+	memset(&My_Queries[i], 0, sizeof(DNS_QUERY));
+	My_Queries[i].sock = NONE;
+	My_Queries[i].prev = My_Queries[i].next = NONE;
+	return i;
+} /* New_Query */
+
+/**
+ * Close the socket of a query.
+ *
+ * @param q	Query.
+ */
+static void
+Close_Socket(DNS_QUERY *q)
+{
+	if (q->sock == NONE)
+		return;
+
+	if (q->sock < My_SocksSize)
+		My_Socks[q->sock] = 0;
+	io_close(q->sock);
+	q->sock = NONE;
+
+	free(q->tcpbuf);
+	q->tcpbuf = NULL;
+	q->tcplen = q->tcppos = 0;
+	q->state = DNS_UDP;
+} /* Close_Socket */
+
+/**
+ * Free a query structure.
+ *
+ * @param Idx	Query index.
+ */
+static void
+Free_Query(int Idx)
+{
+	DNS_QUERY *q = &My_Queries[Idx];
+
+	Unlink_Query(Idx);
+	Close_Socket(q);
+	free(q->answer);
+	q->answer = NULL;
+	q->cbfunc = NULL;
+
+	q->next = Free_Head;
+	Free_Head = Idx;
+} /* Free_Query */
+
+/**
+ * Add a query to the list of pending queries. Queries are added with
+ * (almost) increasing expiry times, so the list is searched backwards.
+ *
+ * @param Idx		Query index.
+ * @param Expires	Time of next timeout.
+ */
+static void
+Link_Query(int Idx, time_t Expires)
+{
+	DNS_QUERY *q = &My_Queries[Idx];
+	int prev = Pending_Tail;
+
+	Unlink_Query(Idx);
+
+	if (q->deadline && Expires > q->deadline)
+		Expires = q->deadline;
+	q->expires = Expires;
+
+	while (prev != NONE && My_Queries[prev].expires > Expires)
+		prev = My_Queries[prev].prev;
+
+	q->prev = prev;
+	if (prev == NONE) {
+		q->next = Pending_Head;
+		Pending_Head = Idx;
+	} else {
+		q->next = My_Queries[prev].next;
+		My_Queries[prev].next = Idx;
+	}
+	if (q->next == NONE)
+		Pending_Tail = Idx;
+	else
+		My_Queries[q->next].prev = Idx;
+} /* Link_Query */
+
+/**
+ * Remove a query from the list of pending queries, if it is linked to it.
+ *
+ * @param Idx	Query index.
+ */
+static void
+Unlink_Query(int Idx)
+{
+	DNS_QUERY *q = &My_Queries[Idx];
+
+	if (q->prev == NONE && Pending_Head != Idx)
+		return;
+
+	if (q->prev == NONE)
+		Pending_Head = q->next;
+	else
+		My_Queries[q->prev].next = q->next;
+	if (q->next == NONE)
+		Pending_Tail = q->prev;
+	else
+		My_Queries[q->next].prev = q->prev;
+	q->prev = q->next = NONE;
+} /* Unlink_Query */
+
+/**
+ * Free a query and pass the answer to its callback function.
+ *
+ * @param Idx		Query index.
+ * @param Answer	Answer, must not be part of the query structure.
+ */
+static void
+Complete(int Idx, const DNS_ANSWER *Answer)
+{
+	void (*cbfunc) PARAMS((int, const DNS_ANSWER *));
+	int token;
+
+	cbfunc = My_Queries[Idx].cbfunc;
+	token = My_Queries[Idx].token;
+
+	/* The callback function can start new queries, which possibly
+	 * reuses this structure (or moves it around in memory). */
+	Free_Query(Idx);
+	cbfunc(token, Answer);
+} /* Complete */
+
+/**
+ * Get a random query ID.
+ */
+static UINT16
+Random_Id(void)
+{
+#ifdef HAVE_ARC4RANDOM
+	return (UINT16)arc4random();
+#else
+	return (UINT16)rand();
+#endif
+} /* Random_Id */
+
+/**
+ * Send a query to the current name server.
+ *
+ * @param Idx	Query index.
+ * @param Now	Current time.
+ * @param Tcp	Use TCP instead of UDP.
+ */
+static void
+Send_Query(int Idx, time_t Now, bool Tcp)
+{
+	DNS_QUERY *q = &My_Queries[Idx];
+	unsigned char msg[DNS_MSG_LEN];
+	char name[HOST_LEN];
+	const ng_ipaddr_t *server;
+	size_t len;
+	int sock, *tmp, size;
+
+	Close_Socket(q);
+	q->tries++;
+	q->id = Random_Id();
+	server = &Dns_Server[q->server];
+
+	if (!Query_Name(q, name, sizeof(name))) {
+		Next_Name(Idx, Now);
+		return;
+	}
+	len = Build_Query(msg, sizeof(msg), q->id, name, q->type);
+	if (len == 0) {
+		/* Invalid name, it can't exist */
+		Next_Name(Idx, Now);
+		return;
+	}
+
+	sock = socket(ng_ipaddr_af(server), Tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if (sock < 0) {
+		Log(LOG_CRIT, "Can't create socket for DNS query: %s!",
+		    strerror(errno));
+		goto failed;
+	}
+	if (!io_setnonblock(sock) || !io_setcloexec(sock)) {
+		Log(LOG_CRIT, "Can't initialize socket for DNS query: %s!",
+		    strerror(errno));
+		close(sock);
+		goto failed;
+	}
+
+	if (sock >= My_SocksSize) {
+		size = My_SocksSize ? My_SocksSize : 64;
+		while (size <= sock)
+			size *= 2;
+		tmp = realloc(My_Socks, (size_t)size * sizeof(int));
+		if (!tmp) {
+			Log(LOG_EMERG, "Can't allocate memory! [Send_Query]");
+			close(sock);
+			goto failed;
+		}
+		memset(tmp + My_SocksSize, 0,
+		       (size_t)(size - My_SocksSize) * sizeof(int));
+		My_Socks = tmp;
+		My_SocksSize = size;
+	}
+
+	if (Tcp) {
+		q->tcpbuf = malloc(DNS_TCP_LEN + 2);
+		if (!q->tcpbuf) {
+			Log(LOG_EMERG, "Can't allocate memory! [Send_Query]");
+			close(sock);
+			goto failed;
+		}
+		q->tcpbuf[0] = (unsigned char)(len >> 8);
+		q->tcpbuf[1] = (unsigned char)len;
+		memcpy(q->tcpbuf + 2, msg, len);
+		q->tcplen = len + 2;
+		q->tcppos = 0;
+		q->state = DNS_TCP_SEND;
+	}
+
+	if (connect(sock, (struct sockaddr *)server, ng_ipaddr_salen(server))
+	    != 0 && errno != EINPROGRESS) {
+		LogDebug("Can't connect to name server %s: %s",
+			 ng_ipaddr_tostr(server), strerror(errno));
+		close(sock);
+		goto retry;
+	}
+	if (!Tcp && send(sock, msg, len, 0) != (ssize_t)len) {
+		LogDebug("Can't send query to name server %s: %s",
+			 ng_ipaddr_tostr(server), strerror(errno));
+		close(sock);
+		goto retry;
+	}
+	if (!io_event_create(sock, Tcp ? IO_WANTWRITE : IO_WANTREAD, cb_Dns)) {
+		Log(LOG_CRIT, "Can't register socket for DNS query: %s!",
+		    strerror(errno));
+		close(sock);
+		goto failed;
+	}
+
+	q->sock = sock;
+	My_Socks[sock] = Idx + 1;
+	Link_Query(Idx, Now + Dns_RetryTime);
+	return;
+
+ retry:
+	free(q->tcpbuf);
+	q->tcpbuf = NULL;
+	q->state = DNS_UDP;
+	Next_Try(Idx, Now);
+	return;
+ failed:
+	free(q->tcpbuf);
+	q->tcpbuf = NULL;
+	q->state = DNS_UDP;
+	q->tries = Dns_Attempts * Dns_ServerCount;
+	Link_Query(Idx, Now);
+} /* Send_Query */
+
+/**
+ * Resend a query to the next name server after a timeout or an error,
+ * or let it fail when all attempts have been made.
+ *
+ * @param Idx	Query index.
+ * @param Now	Current time.
+ */
+static void
+Next_Try(int Idx, time_t Now)
+{
+	DNS_QUERY *q = &My_Queries[Idx];
+	DNS_ANSWER answer;
+
+	if (Dns_ServerCount == 0 || q->tries >= Dns_Attempts * Dns_ServerCount
+	    || (q->deadline && Now >= q->deadline)) {
+		answer.status = DNS_FAILED;
+		answer.type = q->type;
+		answer.name[0] = '\0';
+		answer.count = 0;
+		answer.ttl = 0;
+		Complete(Idx, &answer);
+		return;
+	}
+
+	q->server = (q->server + 1) % Dns_ServerCount;
+	Send_Query(Idx, Now, false);
+} /* Next_Try */
+
+/**
+ * Look up the next name of the search list, or let the query fail with
+ * "not found" when there is none left.
+ *
+ * @param Idx	Query index.
+ * @param Now	Current time.
+ */
+static void
+Next_Name(int Idx, time_t Now)
+{
+	DNS_QUERY *q = &My_Queries[Idx];
+	DNS_ANSWER answer;
+	char name[HOST_LEN];
+
+	q->search++;
+	if (!Query_Name(q, name, sizeof(name))) {
+		answer.status = DNS_NOTFOUND;
+		answer.type = q->type;
+		answer.name[0] = '\0';
+		answer.count = 0;
+		answer.ttl = 0;
+		Complete(Idx, &answer);
+		return;
+	}
+
+	q->tries = 0;
+	q->server = 0;
+	Send_Query(Idx, Now, false);
+} /* Next_Name */
+
+/**
+ * Get the name to look up: the name itself or the name with one of the
+ * search domains appended. Like the resolver of the C library, the name
+ * itself is tried first when it contains at least "ndots" dots, and last
+ * otherwise.
+ *
+ * @param Query	Query.
+ * @param Buf	Buffer receiving the name.
+ * @param Len	Size of the buffer.
+ * @returns	false if all names have been tried (or are too long).
+ */
+static bool
+Query_Name(const DNS_QUERY *Query, char *Buf, size_t Len)
+{
+	const char *ptr;
+	int search = Query->search, dots = 0;
+
+	if (Query->type == DNS_PTR || Query->absolute)
+		return search == 0 && strlcpy(Buf, Query->name, Len) < Len;
+
+	for (ptr = Query->name; *ptr; ptr++) {
+		if (*ptr == '.')
+			dots++;
+	}
+	if (dots >= Dns_Ndots) {
+		if (search == 0)
+			return strlcpy(Buf, Query->name, Len) < Len;
+		search--;
+	} else if (search == Dns_SearchCount)
+		return strlcpy(Buf, Query->name, Len) < Len;
+
+	if (search >= Dns_SearchCount)
+		return false;
+	return snprintf(Buf, Len, "%s.%s", Query->name, Dns_Search[search])
+		< (int)Len;
+} /* Query_Name */
+
+/**
+ * Build a query message.
+ *
+ * @param Buf	Buffer receiving the message.
+ * @param Len	Size of the buffer.
+ * @param Id	Query ID.
+ * @param Name	Name to look up.
+ * @param Type	Query type.
+ * @returns	Length of the message or 0 if the name is invalid.
+ */
+static size_t
+Build_Query(unsigned char *Buf, size_t Len, UINT16 Id, const char *Name,
+	    int Type)
+{
+	const char *label, *end;
+	size_t pos = DNS_HDR_LEN, n;
+
+	assert(Len >= DNS_HDR_LEN + HOST_LEN + 4);
+
+	memset(Buf, 0, DNS_HDR_LEN);
+	Buf[0] = (unsigned char)(Id >> 8);
+	Buf[1] = (unsigned char)Id;
+	Buf[2] = DNS_FLAG_RD >> 8;
+	Buf[5] = 1;		/* one question */
+
+	for (label = Name; *label; label = *end ? end + 1 : end) {
+		end = strchr(label, '.');
+		if (!end)
+			end = label + strlen(label);
+		n = (size_t)(end - label);
+		if (n == 0 || n > 63 || pos + n + 1 > DNS_HDR_LEN + 255
+		    || pos + n + 6 > Len)
+			return 0;
+		Buf[pos++] = (unsigned char)n;
+		memcpy(Buf + pos, label, n);
+		pos += n;
+	}
+	Buf[pos++] = 0;
+	Buf[pos++] = (unsigned char)(Type >> 8);
+	Buf[pos++] = (unsigned char)Type;
+	Buf[pos++] = 0;
+	Buf[pos++] = DNS_CLASS_IN;
+	return pos;
+} /* Build_Query */
+
+/**
+ * Read a (possibly compressed) domain name from a message.
+ *
+ * @param Msg		Message.
+ * @param Len		Length of the message.
+ * @param Pos		Offset of the name, set to the offset following it.
+ * @param Name		Buffer receiving the name.
+ * @param NameLen	Size of the buffer.
+ * @returns		false if the name is malformed or too long.
+ */
+static bool
+Get_Name(const unsigned char *Msg, size_t Len, size_t *Pos, char *Name,
+	 size_t NameLen)
+{
+	size_t pos = *Pos, out = 0, n;
+	int jumps = 0;
+
+	while (pos < Len) {
+		n = Msg[pos];
+		if ((n & 0xc0) == 0xc0) {
+			/* compression pointer */
+			if (pos + 1 >= Len || ++jumps > 32)
+				return false;
+			if (jumps == 1)
+				*Pos = pos + 2;
+			pos = (n & 0x3f) << 8 | Msg[pos + 1];
+			continue;
+		}
+		if (n & 0xc0)
+			return false;
+		pos++;
+		if (n == 0) {
+			if (jumps == 0)
+				*Pos = pos;
+			Name[out] = '\0';
+			return true;
+		}
+		if (pos + n > Len || out + n + 2 > NameLen)
+			return false;
+		if (out > 0)
+			Name[out++] = '.';
+		memcpy(Name + out, Msg + pos, n);
+		out += n;
+		pos += n;
+	}
+	return false;
+} /* Get_Name */
+
+/**
+ * Check that a host name contains valid characters only.
+ */
+static bool
+Valid_Hostname(const char *Name)
+{
+	const char *ptr;
+
+	if (!*Name || *Name == '.' || *Name == '-')
+		return false;
+	for (ptr = Name; *ptr; ptr++) {
+		if ((*ptr >= 'a' && *ptr <= 'z') || (*ptr >= 'A' && *ptr <= 'Z')
+		    || (*ptr >= '0' && *ptr <= '9') || *ptr == '-'
+		    || *ptr == '_' || (*ptr == '.' && ptr[1] != '.'))
+			continue;
+		return false;
+	}
+	return true;
+} /* Valid_Hostname */
+
+/**
+ * Parse an answer message.
+ *
+ * @param Query		Query.
+ * @param Msg		Message.
+ * @param Len		Length of the message.
+ * @param Answer	Receives the answer.
+ * @returns		Status of the answer, or DNS_IGNORE, DNS_TRUNCATED
+ *			or DNS_RETRY.
+ */
+static int
+Parse_Answer(const DNS_QUERY *Query, const unsigned char *Msg, size_t Len,
+	     DNS_ANSWER *Answer)
+{
+	char name[HOST_LEN], qname[HOST_LEN];
+	unsigned int flags, type, class, count, rdlen;
+	size_t pos = DNS_HDR_LEN, rdata;
+	UINT32 ttl;
+	ng_ipaddr_t *addr;
+
+	if (Len < DNS_HDR_LEN || GET16(Msg) != Query->id)
+		return DNS_IGNORE;
+	flags = GET16(Msg + 2);
+	if (!(flags & DNS_FLAG_QR) || DNS_OPCODE(flags) != 0
+	    || GET16(Msg + 4) != 1)
+		return DNS_IGNORE;
+
+	/* Question: must match the query */
+	if (!Query_Name(Query, qname, sizeof(qname))
+	    || !Get_Name(Msg, Len, &pos, name, sizeof(name))
+	    || pos + 4 > Len || strcasecmp(name, qname) != 0
+	    || GET16(Msg + pos) != (unsigned int)Query->type
+	    || GET16(Msg + pos + 2) != DNS_CLASS_IN)
+		return DNS_IGNORE;
+	pos += 4;
+
+	if (flags & DNS_FLAG_TC && Query->state == DNS_UDP)
+		return DNS_TRUNCATED;
+	if (DNS_RCODE(flags) == DNS_NXDOMAIN)
+		return DNS_NOTFOUND;
+	if (DNS_RCODE(flags) != 0)
+		return DNS_RETRY;
+
+	Answer->type = Query->type;
+	Answer->name[0] = '\0';
+	Answer->count = 0;
+	Answer->ttl = DNS_TTL_MAX;
+
+	for (count = GET16(Msg + 6); count > 0; count--) {
+		if (!Get_Name(Msg, Len, &pos, name, sizeof(name))
+		    || pos + 10 > Len)
+			return DNS_RETRY;
+		type = GET16(Msg + pos);
+		class = GET16(Msg + pos + 2);
+		ttl = GET32(Msg + pos + 4);
+		rdlen = GET16(Msg + pos + 8);
+		rdata = pos + 10;
+		pos = rdata + rdlen;
+		if (pos > Len)
+			return DNS_RETRY;
+		if (class != DNS_CLASS_IN || type != (unsigned int)Query->type)
+			continue;
+
+		/* The answer is valid as long as all of its records are */
+		if (ttl > DNS_TTL_MAX)
+			ttl = 0;
+		if (ttl < Answer->ttl)
+			Answer->ttl = ttl;
+
+		if (type == DNS_PTR) {
+			if (!Answer->name[0]
+			    && Get_Name(Msg, pos, &rdata, Answer->name,
+					sizeof(Answer->name))
+			    && !Valid_Hostname(Answer->name)) {
+				LogDebug("Ignoring invalid host name in DNS answer for \"%s\"!",
+					 qname);
+				Answer->name[0] = '\0';
+			}
+			continue;
+		}
+		if (Answer->count >= DNS_ADDRS)
+			continue;
+		addr = &Answer->addrs[Answer->count];
+		memset(addr, 0, sizeof(*addr));
+		if (type == DNS_A && rdlen == 4) {
+#ifdef HAVE_sockaddr_in_len
+			addr->sin4.sin_len = sizeof(addr->sin4);
+#endif
+			addr->sin4.sin_family = AF_INET;
+			memcpy(&addr->sin4.sin_addr, Msg + rdata, 4);
+			Answer->count++;
+		}
+#ifdef WANT_IPV6
+		else if (type == DNS_AAAA && rdlen == 16) {
+			addr->sin6.sin6_family = AF_INET6;
+			memcpy(&addr->sin6.sin6_addr, Msg + rdata, 16);
+			Answer->count++;
+		}
+#endif
+	}
+
+	if (Answer->count == 0 && !Answer->name[0])
+		return DNS_NOTFOUND;
+	return DNS_OK;
+} /* Parse_Answer */
+
+/**
+ * Handle a message received for a query.
+ *
+ * @param Idx	Query index.
+ * @param Msg	Message.
+ * @param Len	Length of the message.
+ * @returns	false if the message has been ignored.
+ */
+static bool
+Handle_Answer(int Idx, const unsigned char *Msg, size_t Len)
+{
+	DNS_ANSWER answer;
+	time_t now = time(NULL);
+
+	switch (Parse_Answer(&My_Queries[Idx], Msg, Len, &answer)) {
+	case DNS_IGNORE:
+		return false;
+	case DNS_TRUNCATED:
+		LogDebug("DNS answer for query %d truncated, using TCP ...",
+			 Idx);
+		My_Queries[Idx].tries--;
+		Send_Query(Idx, now, true);
+		break;
+	case DNS_RETRY:
+		Next_Try(Idx, now);
+		break;
+	case DNS_NOTFOUND:
+		Next_Name(Idx, now);
+		break;
+	default:
+		answer.status = DNS_OK;
+		Complete(Idx, &answer);
+	}
+	return true;
+} /* Handle_Answer */
+
+/**
+ * Read messages from the UDP socket of a query.
+ *
+ * @param Idx	Query index.
+ */
+static void
+Read_Udp(int Idx)
+{
+	unsigned char msg[8 * DNS_MSG_LEN];
+	ssize_t len;
+
+	for (;;) {
+		len = recv(My_Queries[Idx].sock, msg, sizeof(msg), 0);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK
+			    || errno == EINTR)
+				return;
+			/* ICMP "port unreachable" etc.: next server */
+			LogDebug("Can't receive DNS answer for query %d: %s",
+				 Idx, strerror(errno));
+			Next_Try(Idx, time(NULL));
+			return;
+		}
+		if (Handle_Answer(Idx, msg, (size_t)len))
+			return;
+	}
+} /* Read_Udp */
+
+/**
+ * Send the query to, or read the answer from, the TCP socket of a query.
+ *
+ * @param Idx	Query index.
+ */
+static void
+Handle_Tcp(int Idx)
+{
+	DNS_QUERY *q = &My_Queries[Idx];
+	ssize_t len;
+
+	if (q->state == DNS_TCP_SEND) {
+		len = write(q->sock, q->tcpbuf + q->tcppos,
+			    q->tcplen - q->tcppos);
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		if (len <= 0)
+			goto error;
+		q->tcppos += (size_t)len;
+		if (q->tcppos < q->tcplen)
+			return;
+
+		q->state = DNS_TCP_RECV;
+		q->tcplen = 2;
+		q->tcppos = 0;
+		io_event_del(q->sock, IO_WANTWRITE);
+		io_event_add(q->sock, IO_WANTREAD);
+		return;
+	}
+
+	len = read(q->sock, q->tcpbuf + q->tcppos, q->tcplen - q->tcppos);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (len <= 0)
+		goto error;
+	q->tcppos += (size_t)len;
+	if (q->tcppos < q->tcplen)
+		return;
+
+	if (q->tcplen == 2) {
+		/* length of the message has been received */
+		q->tcplen = 2 + GET16(q->tcpbuf);
+		if (q->tcplen > 2)
+			return;
+	} else if (Handle_Answer(Idx, q->tcpbuf + 2, q->tcplen - 2))
+		return;
+	len = 0;
+
+ error:
+	LogDebug("Can't receive DNS answer for query %d using TCP: %s",
+		 Idx, len < 0 ? strerror(errno) : "invalid answer");
+	Next_Try(Idx, time(NULL));
+} /* Handle_Tcp */
+
+/**
+ * IO callback of query sockets.
+ *
+ * @param Sock	Socket handle.
+ * @param What	IO specification (ignored).
+ */
+static void
+cb_Dns(int Sock, UNUSED short What)
+{
+	int i;
+
+	i = Sock < My_SocksSize ? My_Socks[Sock] - 1 : NONE;
+	if (i < 0) {
+		LogDebug("DNS: Got callback for unknown socket %d!?", Sock);
+		io_close(Sock);
+		return;
+	}
+
+	if (My_Queries[i].state == DNS_UDP)
+		Read_Udp(i);
+	else
+		Handle_Tcp(i);
+} /* cb_Dns */
+
+/* -eof- */
@@ -0,0 +1,68 @@
+/*
+ * ngIRCd -- The Next Generation IRC Daemon
+ * Copyright (c)2001-2014 Alexander Barton (alex@barton.de) and Contributors.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * Please read the file COPYING, README and AUTHORS for more information.
+ */
+
+#ifndef __dns_h__
+#define __dns_h__
+
+/**
+ * @file
+ * Asynchronous DNS stub resolver (header)
+ */
+
+#include <time.h>
+
+#include "defines.h"
+#include "ng_ipaddr.h"
+
+/* Query types, see RFC 1035 and RFC 3596 */
+#define DNS_A		1
+#define DNS_PTR		12
+#define DNS_AAAA	28
+
+/** Max. number of addresses returned by a query */
+#define DNS_ADDRS	16
+
+/** Max. "time to live" of an answer, see RFC 2181; answers which don't
+ * come from a name server (hosts file, IP addresses) have this TTL */
+#define DNS_TTL_MAX	0x7fffffffUL
+
+/* Status of an answer */
+#define DNS_OK		0	/* Query successful */
+#define DNS_NOTFOUND	1	/* Name or record does not exist */
+#define DNS_FAILED	2	/* No answer: timeout, server failure, ... */
+
+/** Answer to a query, passed to the callback function. */
+typedef struct _Dns_Answer {
+	int status;			/**< DNS_OK, DNS_NOTFOUND or DNS_FAILED */
+	int type;			/**< Query type */
+	char name[HOST_LEN];		/**< Host name (PTR queries) */
+	ng_ipaddr_t addrs[DNS_ADDRS];	/**< Addresses (A and AAAA queries) */
+	size_t count;			/**< Number of addresses */
+	UINT32 ttl;			/**< Time to live (in seconds) */
+} DNS_ANSWER;
+
+GLOBAL void Dns_Init PARAMS((const char *ResolvConf));
+GLOBAL void Dns_Exit PARAMS((void));
+
+GLOBAL int Dns_Query PARAMS((const char *Name, int Type, int Token,
+			     time_t Deadline,
+			     void (*cbfunc)(int, const DNS_ANSWER *)));
+GLOBAL int Dns_QueryAddr PARAMS((const ng_ipaddr_t *Addr, int Token,
+				 time_t Deadline,
+				 void (*cbfunc)(int, const DNS_ANSWER *)));
+GLOBAL void Dns_Cancel PARAMS((int Query));
+
+GLOBAL void Dns_Timeout PARAMS((time_t Now));
+GLOBAL time_t Dns_NextTimeout PARAMS((void));
+
+#endif
+
+/* -eof- */
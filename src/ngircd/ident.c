@@ -0,0 +1,604 @@
+/*
+ * ngIRCd -- The Next Generation IRC Daemon
+ * Copyright (c)2001-2014 Alexander Barton (alex@barton.de) and Contributors.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * Please read the file COPYING, README and AUTHORS for more information.
+ */
+
+#include "portab.h"
+
+#ifdef IDENTAUTH
+
+/**
+ * @file
+ * Asynchronous IDENT ("AUTH") client, see RFC 1413.
+ *
+ * For each query a non-blocking TCP connection is made from the local
+ * address of the client connection to port 113 of the client; the query is
+ * sent and the reply read by the main loop of the daemon (see io.c), so a
+ * lookup never blocks.
+ *
+ * Pending queries are kept in a list ordered by their deadline, queries
+ * whose deadline has passed are failed by Ident_Timeout(). Queries that
+ * can't be started fail from there, too: callback functions are never
+ * called from within Ident_Query().
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "defines.h"
+#include "io.h"
+#include "log.h"
+#include "ng_ipaddr.h"
+
+#include "ident.h"
+
+#define IDENT_PORT	113
+#define IDENT_LEN	1000	/* Max. length of a reply, see RFC 1413 */
+
+/* State of the socket of a query */
+#define IDENT_SEND	0	/* Connecting, sending the query */
+#define IDENT_RECV	1	/* Receiving the reply */
+
+typedef struct _Ident_Query {
+	void (*cbfunc) PARAMS((int, const char *)); /**< NULL if unused */
+	int token;		/**< Token passed to the callback function */
+	int sock;		/**< Socket or NONE */
+	int state;		/**< State of the socket (IDENT_SEND, ...) */
+	time_t deadline;	/**< Time after which the query fails */
+	int prev, next;		/**< Links of pending list (or free list) */
+	ng_ipaddr_t addr;	/**< Address of the IDENT server */
+	UINT16 rport, lport;	/**< Remote and local port of the connection */
+	char buf[IDENT_LEN + 1]; /**< Query to send, then reply */
+	size_t len, pos;	/**< Bytes in buf, bytes transferred */
+} IDENT_QUERY;
+
+static int New_Query PARAMS((void));
+static void Free_Query PARAMS((int Idx));
+static void Link_Query PARAMS((int Idx));
+static void Unlink_Query PARAMS((int Idx));
+static void Complete PARAMS((int Idx, const char *User));
+static bool Start_Query PARAMS((int Idx, int Sock));
+static const char *Parse_Reply PARAMS((IDENT_QUERY *Query));
+static void Handle_Send PARAMS((int Idx));
+static void Handle_Recv PARAMS((int Idx));
+static void cb_Ident PARAMS((int Sock, short What));
+
+static IDENT_QUERY *My_Queries;
+static int My_QueriesSize;
+static int Free_Head = NONE;
+static int Pending_Head = NONE, Pending_Tail = NONE;
+
+/** Query of each socket plus 1 (0 if none), indexed by socket handle */
+static int *My_Socks;
+static int My_SocksSize;
+
+
+/**
+ * Shut down the IDENT client: cancel all pending queries (without calling
+ * their callback functions) and free all memory.
+ */
+GLOBAL void
+Ident_Exit(void)
+{
+	int i;
+
+	for (i = 0; i < My_QueriesSize; i++) {
+		if (My_Queries[i].cbfunc)
+			Free_Query(i);
+	}
+	free(My_Queries);
+	My_Queries = NULL;
+	My_QueriesSize = 0;
+	Free_Head = Pending_Head = Pending_Tail = NONE;
+
+	free(My_Socks);
+	My_Socks = NULL;
+	My_SocksSize = 0;
+} /* Ident_Exit */
+
+/**
+ * Start an IDENT query for a client connection.
+ *
+ * The callback function is called with the token and the user name, or
+ * NULL when the query failed. It is never called from within this function.
+ *
+ * @param Sock		Socket of the client connection.
+ * @param Token		Token passed to the callback function.
+ * @param Deadline	Time after which the query fails; it is limited to
+ *			IDENT_TIMEOUT seconds from now.
+ * @param cbfunc	Callback function.
+ * @returns		Query index (for Ident_Cancel()) or NONE on error.
+ */
+GLOBAL int
+Ident_Query(int Sock, int Token, time_t Deadline,
+	    void (*cbfunc)(int, const char *))
+{
+	IDENT_QUERY *q;
+	time_t now = time(NULL);
+	int i;
+
+	assert(Sock >= 0);
+	assert(cbfunc != NULL);
+
+	i = New_Query();
+	if (i == NONE)
+		return NONE;
+
+	q = &My_Queries[i];
+	q->cbfunc = cbfunc;
+	q->token = Token;
+	q->deadline = now + IDENT_TIMEOUT;
+	if (Deadline && Deadline < q->deadline)
+		q->deadline = Deadline;
+
+	/* When the query can't be started, it fails on the next call
+	 * of Ident_Timeout() */
+	if (!Start_Query(i, Sock))
+		q->deadline = now;
+	Link_Query(i);
+	return i;
+} /* Ident_Query */
+
+/**
+ * Cancel a query. Its callback function isn't called.
+ *
+ * @param Query	Query index.
+ */
+GLOBAL void
+Ident_Cancel(int Query)
+{
+	assert(Query >= 0 && Query < My_QueriesSize);
+	assert(My_Queries[Query].cbfunc != NULL);
+
+	Free_Query(Query);
+} /* Ident_Cancel */
+
+/**
+ * Fail all queries whose deadline has passed.
+ *
+ * @param Now	Current time.
+ */
+GLOBAL void
+Ident_Timeout(time_t Now)
+{
+	int i;
+
+	while (Pending_Head != NONE
+	       && My_Queries[Pending_Head].deadline <= Now) {
+		i = Pending_Head;
+		if (My_Queries[i].sock != NONE)
+			LogDebug("IDENT query to %s timed out.",
+				 ng_ipaddr_tostr(&My_Queries[i].addr));
+		Complete(i, NULL);
+	}
+} /* Ident_Timeout */
+
+/**
+ * Get the time at which Ident_Timeout() has to be called next.
+ *
+ * @returns	Time of the next timeout or 0 if no query is pending.
+ */
+GLOBAL time_t
+Ident_NextTimeout(void)
+{
+	if (Pending_Head == NONE)
+		return 0;
+	return My_Queries[Pending_Head].deadline;
+} /* Ident_NextTimeout */
+
+/**
+ * Allocate a new query structure.
+ *
+ * @returns	Query index or NONE on error.
+ */
+static int
+New_Query(void)
+{
+	IDENT_QUERY *tmp;
+	int i, size;
+
+	if (Free_Head == NONE) {
+		size = My_QueriesSize ? My_QueriesSize * 2 : 16;
+		tmp = realloc(My_Queries, (size_t)size * sizeof(IDENT_QUERY));
+		if (!tmp) {
+			Log(LOG_EMERG, "Can't allocate memory! [New_Query]");
+			return NONE;
+		}
+		My_Queries = tmp;
+		for (i = size - 1; i > My_QueriesSize; i--) {
+			My_Queries[i].cbfunc = NULL;
+			My_Queries[i].next = Free_Head;
+			Free_Head = i;
+		}
+		/* Use the first new structure right away */
+		i = My_QueriesSize;
+		My_QueriesSize = size;
+	} else {
+		i = Free_Head;
+		Free_Head = My_Queries[i].next;
+	}
+
+	memset(&My_Queries[i], 0, sizeof(IDENT_QUERY));
+	My_Queries[i].sock = NONE;
+	My_Queries[i].prev = My_Queries[i].next = NONE;
+	return i;
+} /* New_Query */
+
+/**
+ * Free a query structure and close its socket.
+ *
+ * @param Idx	Query index.
+ */
+static void
+Free_Query(int Idx)
+{
+	IDENT_QUERY *q = &My_Queries[Idx];
+
+	Unlink_Query(Idx);
+	if (q->sock != NONE) {
+		if (q->sock < My_SocksSize)
+			My_Socks[q->sock] = 0;
+		io_close(q->sock);
+		q->sock = NONE;
+	}
+	q->cbfunc = NULL;
+
+	q->next = Free_Head;
+	Free_Head = Idx;
+} /* Free_Query */
+
+/**
+ * Add a query to the list of pending queries. Queries are added with
+ * (almost) increasing deadlines, so the list is searched backwards.
+ *
+ * @param Idx	Query index.
+ */
+static void
+Link_Query(int Idx)
+{
+	IDENT_QUERY *q = &My_Queries[Idx];
+	int prev = Pending_Tail;
+
+	while (prev != NONE && My_Queries[prev].deadline > q->deadline)
+		prev = My_Queries[prev].prev;
+
+	q->prev = prev;
+	if (prev == NONE) {
+		q->next = Pending_Head;
+		Pending_Head = Idx;
+	} else {
+		q->next = My_Queries[prev].next;
+		My_Queries[prev].next = Idx;
+	}
+	if (q->next == NONE)
+		Pending_Tail = Idx;
+	else
+		My_Queries[q->next].prev = Idx;
+} /* Link_Query */
+
+/**
+ * Remove a query from the list of pending queries.
+ *
+ * @param Idx	Query index.
+ */
+static void
+Unlink_Query(int Idx)
+{
+	IDENT_QUERY *q = &My_Queries[Idx];
+
+	if (q->prev == NONE && Pending_Head != Idx)
+		return;
+
+	if (q->prev == NONE)
+		Pending_Head = q->next;
+	else
+		My_Queries[q->prev].next = q->next;
+	if (q->next == NONE)
+		Pending_Tail = q->prev;
+	else
+		My_Queries[q->next].prev = q->prev;
+	q->prev = q->next = NONE;
+} /* Unlink_Query */
+
+/**
+ * Free a query and pass the result to its callback function.
+ *
+ * @param Idx	Query index.
+ * @param User	User name or NULL, must not be part of the query structure.
+ */
+static void
+Complete(int Idx, const char *User)
+{
+	void (*cbfunc) PARAMS((int, const char *));
+	int token;
+
+	cbfunc = My_Queries[Idx].cbfunc;
+	token = My_Queries[Idx].token;
+
+	/* The callback function can start new queries, which possibly
+	 * reuses this structure (or moves it around in memory). */
+	Free_Query(Idx);
+	cbfunc(token, User);
+} /* Complete */
+
+/**
+ * Connect to the IDENT server of a client: port 113 of the address of the
+ * client, using the local address of the client connection.
+ *
+ * @param Idx	Query index.
+ * @param Sock	Socket of the client connection.
+ * @returns	true if the connection is being established.
+ */
+static bool
+Start_Query(int Idx, int Sock)
+{
+	IDENT_QUERY *q = &My_Queries[Idx];
+	ng_ipaddr_t local;
+	socklen_t len;
+	int sock, *tmp, size;
+
+	len = (socklen_t)sizeof(local);
+	if (getsockname(Sock, (struct sockaddr *)&local, &len) != 0)
+		return false;
+	len = (socklen_t)sizeof(q->addr);
+	if (getpeername(Sock, (struct sockaddr *)&q->addr, &len) != 0)
+		return false;
+
+	q->lport = ng_ipaddr_getport(&local);
+	q->rport = ng_ipaddr_getport(&q->addr);
+	ng_ipaddr_setport(&local, 0);
+	ng_ipaddr_setport(&q->addr, IDENT_PORT);
+
+	q->len = (size_t)snprintf(q->buf, sizeof(q->buf), "%u , %u\r\n",
+				  (unsigned int)q->rport,
+				  (unsigned int)q->lport);
+	q->pos = 0;
+	q->state = IDENT_SEND;
+
+	sock = socket(ng_ipaddr_af(&q->addr), SOCK_STREAM, 0);
+	if (sock < 0) {
+		Log(LOG_CRIT, "Can't create socket for IDENT query: %s!",
+		    strerror(errno));
+		return false;
+	}
+	if (!io_setnonblock(sock) || !io_setcloexec(sock)) {
+		Log(LOG_CRIT, "Can't initialize socket for IDENT query: %s!",
+		    strerror(errno));
+		close(sock);
+		return false;
+	}
+
+	if (sock >= My_SocksSize) {
+		size = My_SocksSize ? My_SocksSize : 64;
+		while (size <= sock)
+			size *= 2;
+		tmp = realloc(My_Socks, (size_t)size * sizeof(int));
+		if (!tmp) {
+			Log(LOG_EMERG, "Can't allocate memory! [Start_Query]");
+			close(sock);
+			return false;
+		}
+		memset(tmp + My_SocksSize, 0,
+		       (size_t)(size - My_SocksSize) * sizeof(int));
+		My_Socks = tmp;
+		My_SocksSize = size;
+	}
+
+	if (bind(sock, (struct sockaddr *)&local, ng_ipaddr_salen(&local))
+	    != 0
+	    || (connect(sock, (struct sockaddr *)&q->addr,
+			ng_ipaddr_salen(&q->addr)) != 0
+		&& errno != EINPROGRESS)) {
+		LogDebug("Can't connect to IDENT server %s: %s",
+			 ng_ipaddr_tostr(&q->addr), strerror(errno));
+		close(sock);
+		return false;
+	}
+	if (!io_event_create(sock, IO_WANTWRITE, cb_Ident)) {
+		Log(LOG_CRIT, "Can't register socket for IDENT query: %s!",
+		    strerror(errno));
+		close(sock);
+		return false;
+	}
+
+	LogDebug("Doing IDENT lookup for %s, ports %u, %u ...",
+		 ng_ipaddr_tostr(&q->addr), (unsigned int)q->rport,
+		 (unsigned int)q->lport);
+	q->sock = sock;
+	My_Socks[sock] = Idx + 1;
+	return true;
+} /* Start_Query */
+
+/**
+ * Skip white space.
+ */
+static char *
+Skip_Space(char *Ptr)
+{
+	while (*Ptr == ' ' || *Ptr == '\t')
+		Ptr++;
+	return Ptr;
+} /* Skip_Space */
+
+/**
+ * Parse the reply of an IDENT server:
+ * "<port> , <port> : USERID : <opsys> : <user>" or
+ * "<port> , <port> : ERROR : <error>".
+ *
+ * @param Query	Query, the reply is modified.
+ * @returns	User name (stored in the reply) or NULL.
+ */
+static const char *
+Parse_Reply(IDENT_QUERY *Query)
+{
+	char *ptr, *field, *end;
+	unsigned long rport, lport;
+
+	Query->buf[Query->len] = '\0';
+	ptr = strpbrk(Query->buf, "\r\n");
+	if (ptr)
+		*ptr = '\0';
+
+	ptr = Skip_Space(Query->buf);
+	rport = strtoul(ptr, &ptr, 10);
+	ptr = Skip_Space(ptr);
+	if (*ptr++ != ',')
+		goto invalid;
+	lport = strtoul(ptr, &ptr, 10);
+	ptr = Skip_Space(ptr);
+	if (*ptr++ != ':' || rport != Query->rport || lport != Query->lport)
+		goto invalid;
+
+	/* Response type */
+	field = Skip_Space(ptr);
+	ptr = strchr(field, ':');
+	if (!ptr)
+		goto invalid;
+	*ptr++ = '\0';
+	for (end = field + strlen(field); end > field
+	     && (end[-1] == ' ' || end[-1] == '\t'); end--)
+		end[-1] = '\0';
+	if (strcasecmp(field, "USERID") != 0) {
+		LogDebug("IDENT server %s: %s \"%s\"",
+			 ng_ipaddr_tostr(&Query->addr), field, Skip_Space(ptr));
+		return NULL;
+	}
+
+	/* Operating system (and character set), then user name */
+	ptr = strchr(ptr, ':');
+	if (!ptr)
+		goto invalid;
+	field = Skip_Space(ptr + 1);
+	for (end = field + strlen(field); end > field
+	     && (end[-1] == ' ' || end[-1] == '\t'); end--)
+		end[-1] = '\0';
+	if (!*field)
+		goto invalid;
+	return field;
+
+ invalid:
+	LogDebug("Got invalid reply from IDENT server %s!",
+		 ng_ipaddr_tostr(&Query->addr));
+	return NULL;
+} /* Parse_Reply */
+
+/**
+ * The connection to the IDENT server has been established (or failed):
+ * send the query.
+ *
+ * @param Idx	Query index.
+ */
+static void
+Handle_Send(int Idx)
+{
+	IDENT_QUERY *q = &My_Queries[Idx];
+	ssize_t len;
+	socklen_t sock_len;
+	int err;
+
+	if (q->pos == 0) {
+		sock_len = (socklen_t)sizeof(err);
+		if (getsockopt(q->sock, SOL_SOCKET, SO_ERROR, &err, &sock_len)
+		    != 0)
+			err = errno;
+		if (err != 0) {
+			LogDebug("Can't connect to IDENT server %s: %s",
+				 ng_ipaddr_tostr(&q->addr), strerror(err));
+			Complete(Idx, NULL);
+			return;
+		}
+	}
+
+	len = write(q->sock, q->buf + q->pos, q->len - q->pos);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (len <= 0) {
+		LogDebug("Can't send IDENT query to %s: %s",
+			 ng_ipaddr_tostr(&q->addr), strerror(errno));
+		Complete(Idx, NULL);
+		return;
+	}
+	q->pos += (size_t)len;
+	if (q->pos < q->len)
+		return;
+
+	q->state = IDENT_RECV;
+	q->len = 0;
+	io_event_del(q->sock, IO_WANTWRITE);
+	io_event_add(q->sock, IO_WANTREAD);
+} /* Handle_Send */
+
+/**
+ * Read the reply of the IDENT server, which ends with the end of the line
+ * or when the server closes the connection.
+ *
+ * @param Idx	Query index.
+ */
+static void
+Handle_Recv(int Idx)
+{
+	IDENT_QUERY *q = &My_Queries[Idx];
+	char user[IDENT_LEN + 1];
+	const char *result;
+	ssize_t len;
+
+	len = read(q->sock, q->buf + q->len, IDENT_LEN - q->len);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (len < 0) {
+		LogDebug("Can't read IDENT reply from %s: %s",
+			 ng_ipaddr_tostr(&q->addr), strerror(errno));
+		Complete(Idx, NULL);
+		return;
+	}
+	if (len > 0) {
+		q->len += (size_t)len;
+		if (q->len < IDENT_LEN && !memchr(q->buf, '\n', q->len))
+			return;
+	}
+
+	result = Parse_Reply(q);
+	if (result)
+		strlcpy(user, result, sizeof(user));
+	Complete(Idx, result ? user : NULL);
+} /* Handle_Recv */
+
+/**
+ * IO callback of query sockets.
+ *
+ * @param Sock	Socket handle.
+ * @param What	IO specification (ignored).
+ */
+static void
+cb_Ident(int Sock, UNUSED short What)
+{
+	int i;
+
+	i = Sock < My_SocksSize ? My_Socks[Sock] - 1 : NONE;
+	if (i < 0) {
+		LogDebug("IDENT: Got callback for unknown socket %d!?", Sock);
+		io_close(Sock);
+		return;
+	}
+
+	if (My_Queries[i].state == IDENT_SEND)
+		Handle_Send(i);
+	else
+		Handle_Recv(i);
+} /* cb_Ident */
+
+#endif /* IDENTAUTH */
+
+/* -eof- */
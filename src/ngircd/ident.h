@@ -0,0 +1,36 @@
+/*
+ * ngIRCd -- The Next Generation IRC Daemon
+ * Copyright (c)2001-2014 Alexander Barton (alex@barton.de) and Contributors.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * Please read the file COPYING, README and AUTHORS for more information.
+ */
+
+#ifndef __ident_h__
+#define __ident_h__
+
+/**
+ * @file
+ * Asynchronous IDENT ("AUTH") client (header)
+ */
+
+#include <time.h>
+
+/** Max. time (in seconds) an IDENT query may take */
+#define IDENT_TIMEOUT	10
+
+GLOBAL void Ident_Exit PARAMS((void));
+
+GLOBAL int Ident_Query PARAMS((int Sock, int Token, time_t Deadline,
+			       void (*cbfunc)(int, const char *)));
+GLOBAL void Ident_Cancel PARAMS((int Query));
+
+GLOBAL void Ident_Timeout PARAMS((time_t Now));
+GLOBAL time_t Ident_NextTimeout PARAMS((void));
+
+#endif
+
+/* -eof- */
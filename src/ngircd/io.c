@@ -10,6 +10,11 @@
  * Please read the file COPYING, README and AUTHORS for more information.
  */
 
+/* for accept4(), if available */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
 #include "portab.h"
 
 /**
@@ -21,8 +26,13 @@
 #define DEBUG_IO 0
 
 #include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -31,21 +41,11 @@
 #include "io.h"
 #include "log.h"
 
-typedef struct {
-#ifdef PROTOTYPES
- void (*callback)(int, short);
-#else
- void (*callback)();
-#endif
- short what;
-} io_event;
-
-#define INIT_IOEVENT		{ NULL, -1, 0, NULL }
-#define IO_ERROR		4
-#define MAX_EVENTS		100
-
 #ifdef HAVE_EPOLL_CREATE
 #  define IO_USE_EPOLL		1
+#  ifdef HAVE_LINUX_IO_URING_H
+#    define IO_USE_IOURING	1
+#  endif
 #  ifdef HAVE_SELECT
 #    define IO_USE_SELECT	1
 #  endif
@@ -69,16 +69,162 @@ typedef struct {
 #  endif /* HAVE_KQUEUE */
 #endif /* HAVE_EPOLL_CREATE */
 
+typedef struct {
+#ifdef PROTOTYPES
+ void (*callback)(int, short);
+#else
+ void (*callback)();
+#endif
+ short what;
+#ifdef IO_USE_EPOLL
+ bool edge;		/* edge triggered, see io_event_blocked() */
+ bool changed;		/* listed in io_changes, see io_event_commit_epoll() */
+ short registered;	/* events registered with epoll_ctl() */
+ short ready;		/* readiness of edge triggered fds */
+ size_t ready_pos;	/* position in io_ready (if listed) */
+#endif
+#ifdef IO_USE_IOURING
+ unsigned int gen;	/* registration of the fd, see io_event_create() */
+ short armed;		/* poll requests pending in the ring */
+ short mode;		/* IO_MANAGED or IO_LISTEN (completion based) */
+ bool active;		/* multishot recv or accept request pending */
+ bool rearm;		/* listed in io_rearm, see io_iouring_retry() */
+ bool eof;		/* end of stream received */
+ int error;		/* errno of failed recv, send or accept request */
+ int rq_head, rq_tail;	/* queue of received buffers */
+ int rq_count;		/* received buffers or accepted connections */
+ int send;		/* send slot (index in io_sends) or -1 */
+#endif
+} io_event;
+
+#define INIT_IOEVENT		{ NULL, -1, 0, NULL }
+#define IO_ERROR		4
+#define MAX_EVENTS		100
+
 static bool library_initialized = false;
+static const char *library_backend;	/* see io_library_init_using() */
+
+/* backend "name" is to be initialized, see io_library_init_using() */
+static bool
+io_backend_wanted(const char *name)
+{
+	return !library_initialized
+	    && (!library_backend || strcmp(library_backend, name) == 0);
+}
 
 #ifdef IO_USE_EPOLL
 #include <sys/epoll.h>
 
 static int io_masterfd = -1;
+static array io_changes;	/* level triggered fds with changed events */
+static array io_ready;		/* edge triggered fds ready for IO */
+
 static bool io_event_change_epoll(int fd, short what, const int action);
+static bool io_event_queue_epoll PARAMS((int fd));
+static void io_event_commit_epoll PARAMS((void));
+static void io_ready_update PARAMS((int fd));
+static void io_ready_dispatch PARAMS((void));
 static int io_dispatch_epoll(struct timeval *tv);
 #endif
 
+#ifdef IO_USE_IOURING
+#include <poll.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* Size of the submission queue. The completion queue can't overflow (the
+ * kernel has to support IORING_FEAT_NODROP), so this is not a limit. */
+#define IOURING_ENTRIES		1024
+/* Number and size of the buffers provided for receiving data; when all of
+ * them are in use, receiving is retried in the next loop (ENOBUFS). */
+#define IOURING_BUFS		1024
+#define IOURING_BUF_LEN		4096
+/* Received buffers queued per fd before receiving is paused */
+#define IOURING_RECV_QUEUE	4
+/* Size of the send buffer of a fd */
+#define IOURING_SEND_LEN	16384
+/* Seconds to finish sending data of closed fds */
+#define IOURING_CLOSE_TIMEOUT	30
+
+/* kind of a request, stored in the lower bits of its user_data */
+#define IOURING_POLLIN		0
+#define IOURING_POLLOUT		1
+#define IOURING_RECV		2
+#define IOURING_ACCEPT		3
+#define IOURING_SEND		4
+#define IOURING_KIND(data)	((int)((data) & 7))
+/* user_data of requests whose completion is of no interest */
+#define IOURING_IGNORE		(~(__u64)0)
+/* user_data of poll, recv and accept requests: registration, fd and kind */
+#define IOURING_DATA(gen, fd, kind) \
+	(((__u64)(gen) << 32) | ((__u64)(fd) << 3) | (kind))
+/* user_data of send requests: send slot */
+#define IOURING_SEND_DATA(slot)	(((__u64)(slot) << 3) | IOURING_SEND)
+
+#define io_ring_load(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define io_ring_store(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* received data in a provided buffer, see io_iouring_received() */
+typedef struct {
+	unsigned int len;	/* bytes received */
+	unsigned int off;	/* bytes already read */
+	int next;		/* next buffer in the queue of the fd, or -1 */
+} io_rbuf;
+
+/* poll completion, see io_iouring_reap() */
+typedef struct {
+	__u64 data;
+	int res;
+} io_cqe;
+
+/* send buffer of a fd, see io_writev_iouring() */
+typedef struct {
+	char *buf;		/* IOURING_SEND_LEN bytes, NULL if unused */
+	size_t len;		/* bytes in buffer */
+	size_t inflight;	/* bytes of the pending send request, or 0 */
+	int fd;			/* socket, or duplicate of it after io_close() */
+	bool orphan;		/* io_close() has been called already */
+	time_t deadline;	/* of orphans, cancel send request after it */
+	int next;		/* next free slot, see io_iouring_send_alloc() */
+} io_send;
+
+static int io_ringfd = -1;
+static unsigned int io_ring_gen;
+static void *io_sq_ring, *io_cq_ring;
+static size_t io_sq_ring_size, io_cq_ring_size, io_sqes_size;
+static unsigned int *io_sq_head, *io_sq_tail, *io_sq_mask, *io_sq_array;
+static unsigned int *io_cq_head, *io_cq_tail, *io_cq_mask;
+static unsigned int io_sq_entries, io_sq_queued;
+static struct io_uring_sqe *io_sqes;
+static struct io_uring_cqe *io_cqes;
+
+static struct io_uring_buf *io_buf_ring;	/* provided buffer ring */
+static char *io_bufs;				/* and its buffers */
+static __u16 io_buf_tail;
+static io_rbuf io_rbufs[IOURING_BUFS];
+static array io_accepted;	/* accepted connections: listening fd, fd */
+static array io_rearm;		/* fds whose recv request must be re-armed */
+static array io_resend;		/* send slots whose request must be re-armed */
+static array io_sends;		/* send slots (io_send) */
+static array io_deferred;	/* poll completions, see io_iouring_reap() */
+static int io_sends_free = -1;	/* first free send slot */
+static unsigned int io_orphans;	/* send slots of closed fds */
+
+static bool io_event_create_iouring PARAMS((int fd, short what));
+static bool io_event_change_iouring PARAMS((int fd, short what));
+static void io_iouring_update PARAMS((int fd, io_event *i));
+static int io_accept_iouring PARAMS((int fd, io_event *i,
+				     struct sockaddr *addr, socklen_t *addrlen));
+static ssize_t io_readv_iouring PARAMS((int fd, io_event *i,
+					const struct iovec *iov, int iovcnt));
+static ssize_t io_writev_iouring PARAMS((int fd, io_event *i,
+					 const struct iovec *iov, int iovcnt));
+static int io_iouring_reap PARAMS((bool callbacks));
+static int io_dispatch_iouring PARAMS((struct timeval *tv));
+#endif
+
 #ifdef IO_USE_KQUEUE
 #include <sys/types.h>
 #include <sys/event.h>
@@ -177,7 +323,7 @@ io_dispatch_devpoll(struct timeval *tv)
 {
 	struct dvpoll dvp;
 	time_t sec = tv->tv_sec * 1000;
-	int i, ret, timeout = tv->tv_usec + sec;
+	int i, ret, timeout = (tv->tv_usec + 999) / 1000 + sec;
 	short what;
 	struct pollfd p[MAX_EVENTS];
 
@@ -236,6 +382,8 @@ io_close_devpoll(int fd)
 static void
 io_library_init_devpoll(unsigned int eventsize)
 {
+	if (!io_backend_wanted("/dev/poll"))
+		return;
 	io_masterfd = open("/dev/poll", O_RDWR);
 	if (io_masterfd >= 0)
 		library_initialized = true;
@@ -257,7 +405,7 @@ static int
 io_dispatch_poll(struct timeval *tv)
 {
 	time_t sec = tv->tv_sec * 1000;
-	int i, ret, timeout = tv->tv_usec + sec;
+	int i, ret, timeout = (tv->tv_usec + 999) / 1000 + sec;
 	int fds_ready;
 	short what;
 	struct pollfd *p = array_start(&pollfds);
@@ -336,6 +484,9 @@ static void
 io_library_init_poll(unsigned int eventsize)
 {
 	struct pollfd *p;
+
+	if (!io_backend_wanted("poll"))
+		return;
 	array_init(&pollfds);
 	poll_maxfd = 0;
 	Log(LOG_INFO, "IO subsystem: poll (initial maxfd %u).",
@@ -402,7 +553,7 @@ io_dispatch_select(struct timeval *tv)
 static void
 io_library_init_select(unsigned int eventsize)
 {
-	if (library_initialized)
+	if (!io_backend_wanted("select"))
 		return;
 	Log(LOG_INFO, "IO subsystem: select (initial maxfd %u).",
 	    eventsize);
@@ -430,6 +581,10 @@ io_close_select(int fd)
 
 	if (io_masterfd >= 0)	/* Are we using epoll()? */
 		return;
+#ifdef IO_USE_IOURING
+	if (io_ringfd >= 0)	/* ... or io_uring? */
+		return;
+#endif
 
 	FD_CLR(fd, &writers);
 	FD_CLR(fd, &readers);
@@ -456,32 +611,150 @@ io_close_select(int UNUSED x)
 
 
 #ifdef IO_USE_EPOLL
+/*
+ * Sockets of connections are registered edge triggered, for reading and
+ * writing, once (see IO_EDGE). Their readiness is tracked in user space:
+ * it is set when epoll reports an edge and cleared when their owner reports
+ * that reading or writing would block (see io_event_blocked()). Adding and
+ * removing interest in events of these fds doesn't require any system call
+ * at all, fds that are ready for an event of interest are kept in the
+ * io_ready list and their callback is invoked in each loop.
+ *
+ * Changes of the events of all other (level triggered) fds are collected
+ * and applied once per loop, so that an event removed and added again in
+ * between doesn't result in any epoll_ctl() call.
+ */
+
 static bool
 io_event_change_epoll(int fd, short what, const int action)
 {
 	struct epoll_event ev = { 0, {0} };
 	ev.data.fd = fd;
 
-	if (what & IO_WANTREAD)
-		ev.events = EPOLLIN | EPOLLPRI;
-	if (what & IO_WANTWRITE)
-		ev.events |= EPOLLOUT;
+	if (action == EPOLL_CTL_ADD && io_event_get(fd)->edge)
+		ev.events = EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLET;
+	else {
+		if (what & IO_WANTREAD)
+			ev.events = EPOLLIN | EPOLLPRI;
+		if (what & IO_WANTWRITE)
+			ev.events |= EPOLLOUT;
+	}
 
 	return epoll_ctl(io_masterfd, action, fd, &ev) == 0;
 }
 
+/* events of interest of fd have been changed */
+static bool
+io_event_queue_epoll(int fd)
+{
+	io_event *i = io_event_get(fd);
+
+	if (i->edge) {
+		io_ready_update(fd);
+		return true;
+	}
+	if (i->changed)
+		return true;
+	if (!array_catb(&io_changes, (char *)&fd, sizeof(fd))) {
+		/* can't queue the change, apply it right now */
+		if (!io_event_change_epoll(fd, i->what, EPOLL_CTL_MOD))
+			return false;
+		i->registered = i->what;
+		return true;
+	}
+	i->changed = true;
+	return true;
+}
+
+/* apply all changes of the events of level triggered fds */
+static void
+io_event_commit_epoll(void)
+{
+	int *fds = array_start(&io_changes);
+	size_t n, len = array_length(&io_changes, sizeof(int));
+	io_event *i;
+
+	for (n = 0; n < len; n++) {
+		i = io_event_get(fds[n]);
+		if (!i->changed)	/* fd has been closed */
+			continue;
+		i->changed = false;
+		if (i->registered == i->what)
+			continue;
+		if (io_event_change_epoll(fds[n], i->what, EPOLL_CTL_MOD))
+			i->registered = i->what;
+		else
+			Log(LOG_ERR, "epoll_ctl(): can't change events of fd %d: %s!",
+			    fds[n], strerror(errno));
+	}
+	array_trunc(&io_changes);
+}
+
+/* add an edge triggered fd to the io_ready list when it is ready for an
+ * event of interest, and remove it otherwise */
+static void
+io_ready_update(int fd)
+{
+	io_event *i = io_event_get(fd), *last;
+	size_t len = array_length(&io_ready, sizeof(int));
+	int *fds = array_start(&io_ready);
+	bool listed = i->ready_pos < len && fds[i->ready_pos] == fd;
+
+	if (i->ready & i->what) {
+		if (listed)
+			return;
+		if (!array_catb(&io_ready, (char *)&fd, sizeof(fd))) {
+			Log(LOG_EMERG, "Can't allocate memory! [io_ready_update]");
+			return;
+		}
+		i->ready_pos = len;
+	} else if (listed) {
+		/* move last fd in the list to the position of this one */
+		fds[i->ready_pos] = fds[len - 1];
+		last = io_event_get(fds[len - 1]);
+		last->ready_pos = i->ready_pos;
+		array_truncate(&io_ready, sizeof(int), len - 1);
+	}
+}
+
+/* invoke the callback of all edge triggered fds that are ready */
+static void
+io_ready_dispatch(void)
+{
+	io_event *ev;
+	int *fds, n;
+
+	/* Walk the list backwards: callbacks can remove fds from the list
+	 * (moving the last entry to their position), fds added in the
+	 * meantime are handled in the next loop. */
+	for (n = (int)array_length(&io_ready, sizeof(int)) - 1; n >= 0; n--) {
+		if (n >= (int)array_length(&io_ready, sizeof(int)))
+			continue;
+		fds = array_start(&io_ready);
+		ev = io_event_get(fds[n]);
+		io_docallback(fds[n], ev->ready & ev->what);
+	}
+}
+
 static int
 io_dispatch_epoll(struct timeval *tv)
 {
 	time_t sec = tv->tv_sec * 1000;
-	int i, ret, timeout = tv->tv_usec + sec;
+	int i, ret, timeout = (tv->tv_usec + 999) / 1000 + sec;
 	struct epoll_event epoll_ev[MAX_EVENTS];
+	io_event *ev;
 	short type;
 
+	io_event_commit_epoll();
+
 	if (timeout < 0)
 		timeout = 1000;
+	if (array_length(&io_ready, sizeof(int)) > 0)
+		timeout = 0;
 
 	ret = epoll_wait(io_masterfd, epoll_ev, MAX_EVENTS, timeout);
+	if (ret < 0)
+		return ret;
 
 	for (i = 0; i < ret; i++) {
 		type = 0;
@@ -494,9 +767,20 @@ io_dispatch_epoll(struct timeval *tv)
 		if (epoll_ev[i].events & EPOLLOUT)
 			type |= IO_WANTWRITE;
 
+		ev = io_event_get(epoll_ev[i].data.fd);
+		if (ev->edge) {
+			/* errors are reported by read() and write() */
+			if (type & IO_ERROR)
+				type = IO_WANTREAD | IO_WANTWRITE;
+			ev->ready |= type;
+			io_ready_update(epoll_ev[i].data.fd);
+			continue;
+		}
+
 		io_docallback(epoll_ev[i].data.fd, type);
 	}
 
+	io_ready_dispatch();
 	return ret;
 }
 
@@ -504,6 +788,8 @@ static void
 io_library_init_epoll(unsigned int eventsize)
 {
 	int ecreate_hint = (int)eventsize;
+	if (!io_backend_wanted("epoll"))
+		return;
 	if (ecreate_hint <= 0)
 		ecreate_hint = 128;
 	io_masterfd = epoll_create(ecreate_hint);
@@ -512,6 +798,8 @@ io_library_init_epoll(unsigned int eventsize)
 		Log(LOG_INFO,
 		    "IO subsystem: epoll (hint size %d, initial maxfd %u, masterfd %d).",
 		    ecreate_hint, eventsize, io_masterfd);
+		array_init(&io_changes);
+		array_init(&io_ready);
 		return;
 	}
 #ifdef IO_USE_SELECT
@@ -525,6 +813,1083 @@ io_library_init_epoll(unsigned int UNUSED ev)
 #endif /* IO_USE_EPOLL */
 
 
+#ifdef IO_USE_IOURING
+/*
+ * Sockets of connections (IO_MANAGED) and listening sockets (IO_LISTEN) are
+ * completion based: a "multishot" recv request per socket receives data
+ * into buffers provided to the kernel (a ring of IOURING_BUFS buffers shared
+ * by all sockets), a multishot accept request per listening socket accepts
+ * new connections, and data written is copied to a send buffer per socket
+ * and sent by the kernel using send requests. io_readv(), io_writev() and
+ * io_accept() only work on these queues, without any system call at all.
+ * The readiness of these sockets is derived from the state of their queues
+ * and tracked using the io_ready list of the epoll backend (see above).
+ *
+ * All other fds use "one shot" poll requests (IORING_OP_POLL_ADD), one per
+ * fd and direction, which are re-armed after each notification as long as
+ * the event is still of interest. This keeps the level triggered semantics
+ * of all other backends. Removing interest is "lazy": pending poll requests
+ * are left in place, and their notification is discarded (and the request
+ * not re-armed) if nobody is interested in it any more.
+ *
+ * New requests are only queued in the submission ring and handed to the
+ * kernel together with waiting for completions, using a single system call
+ * per loop. The ring is used by the process that created it only, so the
+ * kernel is asked to defer its completion work to this system call, too,
+ * instead of interrupting the process for each completion (if supported).
+ */
+
+static int
+io_iouring_enter(unsigned int submit, unsigned int wait, unsigned int flags,
+		 void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, io_ringfd, submit, wait,
+			    flags, arg, argsz);
+}
+
+/* hand all queued requests to the kernel, without waiting; and let the
+ * kernel post all completions available right now, if Getevents is set */
+static void
+io_iouring_flush(bool Getevents)
+{
+	unsigned int pending;
+
+	io_ring_store(io_sq_tail, io_sq_queued);
+	pending = io_sq_queued - io_ring_load(io_sq_head);
+	if (pending == 0 && !Getevents)
+		return;
+	while (io_iouring_enter(pending, 0,
+				Getevents ? IORING_ENTER_GETEVENTS : 0,
+				NULL, 0) < 0) {
+		if (errno != EINTR) {
+			Log(LOG_ERR, "io_uring_enter(): %s!", strerror(errno));
+			break;
+		}
+	}
+}
+
+static struct io_uring_sqe *
+io_iouring_get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int idx;
+
+	if (io_sq_queued - io_ring_load(io_sq_head) >= io_sq_entries) {
+		io_iouring_flush(false);
+		if (io_sq_queued - io_ring_load(io_sq_head) >= io_sq_entries)
+			return NULL;
+	}
+
+	idx = io_sq_queued & *io_sq_mask;
+	sqe = &io_sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	io_sq_array[idx] = idx;
+	io_sq_queued++;
+	return sqe;
+}
+
+static bool
+io_iouring_arm(int fd, io_event *i, short dir)
+{
+	struct io_uring_sqe *sqe;
+	__u32 events = (dir == IO_WANTREAD) ? POLLIN | POLLPRI : POLLOUT;
+
+	sqe = io_iouring_get_sqe();
+	if (!sqe)
+		return false;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	events = (events << 16) | (events >> 16);
+#endif
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = IOURING_DATA(i->gen, fd, dir == IO_WANTWRITE
+				      ? IOURING_POLLOUT : IOURING_POLLIN);
+	i->armed |= dir;
+	return true;
+}
+
+/* arm the multishot recv (or accept) request of a completion based fd */
+static bool
+io_iouring_arm_multishot(int fd, io_event *i)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = io_iouring_get_sqe();
+	if (!sqe)
+		return false;
+
+	sqe->fd = fd;
+	if (i->mode == IO_LISTEN) {
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+		sqe->user_data = IOURING_DATA(i->gen, fd, IOURING_ACCEPT);
+	} else {
+		sqe->opcode = IORING_OP_RECV;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = 0;
+		sqe->user_data = IOURING_DATA(i->gen, fd, IOURING_RECV);
+	}
+	i->active = true;
+	return true;
+}
+
+static void
+io_iouring_cancel(__u64 data)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = io_iouring_get_sqe();
+	if (!sqe)
+		return;
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = data;
+	sqe->user_data = IOURING_IGNORE;
+}
+
+/* hand a provided buffer back to the kernel */
+static void
+io_iouring_recycle(int bid)
+{
+	struct io_uring_buf *b;
+
+	b = &io_buf_ring[io_buf_tail & (IOURING_BUFS - 1)];
+	b->addr = (__u64)(uintptr_t)(io_bufs + (size_t)bid * IOURING_BUF_LEN);
+	b->len = IOURING_BUF_LEN;
+	b->bid = (__u16)bid;
+	/* the tail of the ring overlays the reserved field of its first entry */
+	io_ring_store(&io_buf_ring[0].resv, ++io_buf_tail);
+}
+
+/* re-arm the multishot request of a fd in the next loop */
+static void
+io_iouring_rearm_later(int fd, io_event *i)
+{
+	if (i->rearm)
+		return;
+	if (!array_catb(&io_rearm, (char *)&fd, sizeof(fd))) {
+		Log(LOG_EMERG, "Can't allocate memory! [io_iouring_rearm_later]");
+		return;
+	}
+	i->rearm = true;
+}
+
+static int
+io_iouring_send_alloc(int fd)
+{
+	io_send *s;
+	int slot;
+
+	if (io_sends_free >= 0) {
+		slot = io_sends_free;
+		s = array_get(&io_sends, sizeof(io_send), (size_t)slot);
+		io_sends_free = s->next;
+	} else {
+		slot = (int)array_length(&io_sends, sizeof(io_send));
+		s = array_alloc(&io_sends, sizeof(io_send), (size_t)slot);
+		if (!s)
+			return -1;
+		s->buf = NULL;
+	}
+	if (!s->buf) {
+		s->buf = malloc(IOURING_SEND_LEN);
+		if (!s->buf) {
+			s->next = io_sends_free;
+			io_sends_free = slot;
+			return -1;
+		}
+	}
+	s->len = s->inflight = 0;
+	s->fd = fd;
+	s->orphan = false;
+	s->deadline = 0;
+	return slot;
+}
+
+static void
+io_iouring_send_free(int slot)
+{
+	io_send *s = array_get(&io_sends, sizeof(io_send), (size_t)slot);
+
+	s->fd = -1;
+	s->orphan = false;
+	s->next = io_sends_free;
+	io_sends_free = slot;
+}
+
+/* submit a send request for all data in the buffer of a send slot */
+static void
+io_iouring_send(int slot)
+{
+	io_send *s = array_get(&io_sends, sizeof(io_send), (size_t)slot);
+	struct io_uring_sqe *sqe;
+
+	assert(s->inflight == 0);
+
+	sqe = io_iouring_get_sqe();
+	if (!sqe) {
+		if (!array_catb(&io_resend, (char *)&slot, sizeof(slot)))
+			Log(LOG_EMERG, "Can't allocate memory! [io_iouring_send]");
+		return;
+	}
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = s->fd;
+	sqe->addr = (__u64)(uintptr_t)s->buf;
+	sqe->len = (__u32)s->len;
+	sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+	sqe->user_data = IOURING_SEND_DATA(slot);
+	s->inflight = s->len;
+}
+
+/* hand the send slot of a fd that is going to be closed over to a
+ * duplicate of the fd, which is closed when all data has been sent */
+static void
+io_iouring_orphan(int fd, int slot)
+{
+	io_send *s = array_get(&io_sends, sizeof(io_send), (size_t)slot);
+
+	if (s->len == 0) {
+		io_iouring_send_free(slot);
+		return;
+	}
+	s->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (s->fd < 0) {
+		Log(LOG_ERR, "Can't duplicate fd %d to finish sending: %s!",
+		    fd, strerror(errno));
+		if (!s->inflight) {
+			io_iouring_send_free(slot);
+			return;
+		}
+	}
+	s->orphan = true;
+	s->deadline = time(NULL) + IOURING_CLOSE_TIMEOUT;
+	io_orphans++;
+}
+
+/* recompute the readiness of a completion based fd and resume receiving,
+ * if it has been paused */
+static void
+io_iouring_update(int fd, io_event *i)
+{
+	io_send *s = NULL;
+
+	if (!i->active && !i->rearm && !i->eof && !i->error
+	    && (i->mode == IO_LISTEN || i->rq_count < IOURING_RECV_QUEUE)
+	    && !io_iouring_arm_multishot(fd, i))
+		io_iouring_rearm_later(fd, i);
+
+	if (i->send >= 0)
+		s = array_get(&io_sends, sizeof(io_send), (size_t)i->send);
+
+	/* errors are reported by reading, the owner may keep on trying to
+	 * write until it reads again otherwise */
+	i->ready = 0;
+	if (i->rq_count > 0 || i->eof || i->error)
+		i->ready |= IO_WANTREAD;
+	if (i->mode == IO_MANAGED && !i->error
+	    && (!s || s->len < IOURING_SEND_LEN))
+		i->ready |= IO_WANTWRITE;
+	io_ready_update(fd);
+}
+
+static bool
+io_event_create_iouring(int fd, short what)
+{
+	io_event *i = io_event_get(fd);
+
+	if (!i->mode)
+		return io_event_change_iouring(fd, what);
+
+	if (!io_iouring_arm_multishot(fd, i))
+		return false;
+	if (i->mode == IO_MANAGED)
+		i->ready = IO_WANTWRITE;
+	return true;
+}
+
+static bool
+io_event_change_iouring(int fd, short what)
+{
+	io_event *i = io_event_get(fd);
+
+	if ((what & IO_WANTREAD) && !(i->armed & IO_WANTREAD)
+	    && !io_iouring_arm(fd, i, IO_WANTREAD))
+		return false;
+	if ((what & IO_WANTWRITE) && !(i->armed & IO_WANTWRITE)
+	    && !io_iouring_arm(fd, i, IO_WANTWRITE))
+		return false;
+	return true;
+}
+
+static void
+io_close_iouring(int fd, io_event *i)
+{
+	struct io_uring_sqe *sqe;
+	size_t n, len;
+	short dir;
+	int bid, *acc;
+
+	if (io_ringfd < 0)
+		return;
+
+	if (i->active)
+		io_iouring_cancel(IOURING_DATA(i->gen, fd, i->mode == IO_LISTEN
+					       ? IOURING_ACCEPT : IOURING_RECV));
+	if (i->mode == IO_LISTEN && i->rq_count > 0) {
+		/* close all connections accepted but not yet picked up */
+		acc = array_start(&io_accepted);
+		len = array_length(&io_accepted, 2 * sizeof(int));
+		for (n = 0; n < len; ) {
+			if (acc[2 * n] != fd) {
+				n++;
+				continue;
+			}
+			close(acc[2 * n + 1]);
+			len--;
+			memmove(&acc[2 * n], &acc[2 * n + 2],
+				(len - n) * 2 * sizeof(int));
+		}
+		array_truncate(&io_accepted, 2 * sizeof(int), len);
+	}
+	if (i->mode == IO_MANAGED) {
+		while (i->rq_head >= 0) {
+			bid = i->rq_head;
+			i->rq_head = io_rbufs[bid].next;
+			io_iouring_recycle(bid);
+		}
+		if (i->send >= 0)
+			io_iouring_orphan(fd, i->send);
+	}
+	i->mode = 0;
+	i->active = i->rearm = i->eof = false;
+	i->error = 0;
+	i->rq_head = i->rq_tail = -1;
+	i->rq_count = 0;
+	i->send = -1;
+
+	for (dir = IO_WANTREAD; dir <= IO_WANTWRITE; dir <<= 1) {
+		if (!(i->armed & dir))
+			continue;
+		sqe = io_iouring_get_sqe();
+		if (!sqe)
+			break;
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = IOURING_DATA(i->gen, fd, dir == IO_WANTWRITE
+					 ? IOURING_POLLOUT : IOURING_POLLIN);
+		sqe->user_data = IOURING_IGNORE;
+	}
+	i->armed = 0;
+	i->gen = ++io_ring_gen;
+
+	/* Pending requests hold a reference to the file, so they must be
+	 * removed right now for close() to actually shut down the socket;
+	 * and queued send requests must take their reference before. */
+	io_iouring_flush(false);
+}
+
+static int
+io_accept_iouring(int fd, io_event *i, struct sockaddr *addr,
+		  socklen_t *addrlen)
+{
+	socklen_t addrsize = *addrlen;
+	size_t n, len;
+	int *acc, new_fd;
+
+	while (i->rq_count > 0) {
+		acc = array_start(&io_accepted);
+		len = array_length(&io_accepted, 2 * sizeof(int));
+		for (n = 0; n < len && acc[2 * n] != fd; n++)
+			/* nothing */ ;
+		assert(n < len);
+
+		new_fd = acc[2 * n + 1];
+		memmove(&acc[2 * n], &acc[2 * n + 2],
+			(len - n - 1) * 2 * sizeof(int));
+		array_truncate(&io_accepted, 2 * sizeof(int), len - 1);
+		i->rq_count--;
+
+		*addrlen = addrsize;
+		if (getpeername(new_fd, addr, addrlen) == 0) {
+			io_iouring_update(fd, i);
+			return new_fd;
+		}
+		/* connection has been reset already */
+		close(new_fd);
+	}
+
+	if (i->error) {
+		errno = i->error;
+		i->error = 0;
+	} else
+		errno = EAGAIN;
+	io_iouring_update(fd, i);
+	return -1;
+}
+
+static ssize_t
+io_readv_iouring(int fd, io_event *i, const struct iovec *iov, int iovcnt)
+{
+	size_t len, off = 0, done = 0;
+	io_rbuf *b;
+	int bid, n = 0;
+
+	while (i->rq_head >= 0 && n < iovcnt) {
+		bid = i->rq_head;
+		b = &io_rbufs[bid];
+		len = b->len - b->off;
+		if (len > iov[n].iov_len - off)
+			len = iov[n].iov_len - off;
+		memcpy((char *)iov[n].iov_base + off,
+		       io_bufs + (size_t)bid * IOURING_BUF_LEN + b->off, len);
+		b->off += (unsigned int)len;
+		off += len;
+		done += len;
+		if (off == iov[n].iov_len) {
+			n++;
+			off = 0;
+		}
+		if (b->off == b->len) {
+			i->rq_head = b->next;
+			if (i->rq_head < 0)
+				i->rq_tail = -1;
+			i->rq_count--;
+			io_iouring_recycle(bid);
+		}
+	}
+
+	io_iouring_update(fd, i);
+
+	if (done > 0)
+		return (ssize_t)done;
+	if (i->error) {
+		errno = i->error;
+		return -1;
+	}
+	if (i->eof)
+		return 0;
+	errno = EAGAIN;
+	return -1;
+}
+
+static ssize_t
+io_writev_iouring(int fd, io_event *i, const struct iovec *iov, int iovcnt)
+{
+	size_t len, off = 0, done = 0;
+	bool reaped = false;
+	io_send *s;
+	int n = 0;
+
+	while (n < iovcnt && !i->error) {
+		if (i->send < 0) {
+			i->send = io_iouring_send_alloc(fd);
+			if (i->send < 0) {
+				Log(LOG_EMERG,
+				    "Can't allocate memory! [io_writev_iouring]");
+				if (done > 0)
+					break;
+				errno = ENOMEM;
+				return -1;
+			}
+		}
+		s = array_get(&io_sends, sizeof(io_send), (size_t)i->send);
+		if (s->len == IOURING_SEND_LEN) {
+			/* Buffer is full: hand the pending send request to
+			 * the kernel right now and collect its result, which
+			 * usually is available immediately. */
+			if (reaped || !s->inflight)
+				break;
+			io_iouring_flush(true);
+			io_iouring_reap(false);
+			reaped = true;
+			continue;
+		}
+
+		/* Data can be appended while a send request is pending,
+		 * it only covers the first s->inflight bytes. */
+		len = iov[n].iov_len - off;
+		if (len > IOURING_SEND_LEN - s->len)
+			len = IOURING_SEND_LEN - s->len;
+		memcpy(s->buf + s->len, (char *)iov[n].iov_base + off, len);
+		s->len += len;
+		off += len;
+		done += len;
+		if (off == iov[n].iov_len) {
+			n++;
+			off = 0;
+		}
+	}
+
+	if (i->send >= 0) {
+		s = array_get(&io_sends, sizeof(io_send), (size_t)i->send);
+		if (s->len > 0 && !s->inflight)
+			io_iouring_send(i->send);
+	}
+	io_iouring_update(fd, i);
+
+	if (done > 0)
+		return (ssize_t)done;
+	if (i->error) {
+		errno = i->error;
+		return -1;
+	}
+	if (n < iovcnt) {
+		errno = EAGAIN;
+		return -1;
+	}
+	return 0;
+}
+
+static void
+io_iouring_sent(int slot, int res)
+{
+	io_send *s = array_get(&io_sends, sizeof(io_send), (size_t)slot);
+	io_event *i = NULL;
+	int fd;
+
+	assert(s != NULL);
+	assert(s->inflight > 0);
+
+	fd = s->fd;
+	if (!s->orphan)
+		i = io_event_get(fd);
+	s->inflight = 0;
+
+	if (res > 0) {
+		s->len -= (size_t)res;
+		memmove(s->buf, s->buf + res, s->len);
+	} else {
+		/* error or connection closed, discard all data */
+		if (i)
+			i->error = res < 0 ? -res : EPIPE;
+		s->len = 0;
+	}
+	if (s->orphan && (fd < 0 || s->deadline == 0))
+		s->len = 0;	/* can't send the rest or timed out */
+
+	if (s->len > 0)
+		io_iouring_send(slot);
+	else {
+		if (s->orphan) {
+			if (fd >= 0)
+				close(fd);
+			io_orphans--;
+		} else
+			i->send = -1;
+		io_iouring_send_free(slot);
+	}
+
+	if (i)
+		io_iouring_update(fd, i);
+}
+
+static void
+io_iouring_received(int fd, io_event *i, __u64 data, int res,
+		    unsigned int flags)
+{
+	int bid = -1;
+
+	if (flags & IORING_CQE_F_BUFFER)
+		bid = (int)(flags >> IORING_CQE_BUFFER_SHIFT);
+	if (i->gen != (unsigned int)(data >> 32)) {
+		/* fd has been closed in the meantime */
+		if (bid >= 0)
+			io_iouring_recycle(bid);
+		return;
+	}
+	if (!(flags & IORING_CQE_F_MORE))
+		i->active = false;
+
+	if (bid >= 0 && res > 0) {
+		io_rbufs[bid].len = (unsigned int)res;
+		io_rbufs[bid].off = 0;
+		io_rbufs[bid].next = -1;
+		if (i->rq_tail >= 0)
+			io_rbufs[i->rq_tail].next = bid;
+		else
+			i->rq_head = bid;
+		i->rq_tail = bid;
+		/* pause receiving when the owner doesn't keep up reading,
+		 * so that a single fd can't use up all buffers */
+		if (++i->rq_count == IOURING_RECV_QUEUE && i->active)
+			io_iouring_cancel(data);
+	} else {
+		if (bid >= 0)
+			io_iouring_recycle(bid);
+		if (res == 0)
+			i->eof = true;
+		else if (res == -ENOBUFS)	/* try again in next loop */
+			io_iouring_rearm_later(fd, i);
+		else if (res != -ECANCELED)
+			i->error = -res;
+	}
+	io_iouring_update(fd, i);
+}
+
+static void
+io_iouring_accepted(int fd, io_event *i, __u64 data, int res,
+		    unsigned int flags)
+{
+	int acc[2];
+
+	if (i->gen != (unsigned int)(data >> 32)) {
+		if (res >= 0)
+			close(res);
+		return;
+	}
+	if (!(flags & IORING_CQE_F_MORE))
+		i->active = false;
+
+	if (res >= 0) {
+		acc[0] = fd;
+		acc[1] = res;
+		if (array_catb(&io_accepted, (char *)acc, sizeof(acc)))
+			i->rq_count++;
+		else {
+			Log(LOG_EMERG, "Can't allocate memory! [io_iouring_accepted]");
+			close(res);
+		}
+	} else if (res != -ECANCELED)
+		i->error = -res;
+	io_iouring_update(fd, i);
+}
+
+static void
+io_iouring_complete(__u64 data, int res, unsigned int flags)
+{
+	int fd = (int)((data & 0xffffffffU) >> 3);
+	unsigned int gen = (unsigned int)(data >> 32);
+	int kind = IOURING_KIND(data);
+	short dir, what;
+	io_event *i;
+
+	if (kind == IOURING_SEND) {
+		io_iouring_sent((int)(data >> 3), res);
+		return;
+	}
+
+	i = io_event_get(fd);
+	if (kind == IOURING_RECV) {
+		io_iouring_received(fd, i, data, res, flags);
+		return;
+	}
+	if (kind == IOURING_ACCEPT) {
+		io_iouring_accepted(fd, i, data, res, flags);
+		return;
+	}
+
+	if (i->gen != gen)	/* fd has been closed in the meantime */
+		return;
+
+	dir = (kind == IOURING_POLLOUT) ? IO_WANTWRITE : IO_WANTREAD;
+	what = dir;
+	i->armed &= ~dir;
+	if (res == -ECANCELED || !(i->what & dir))
+		return;		/* not of interest any more, don't re-arm */
+
+	if (res < 0 || (res & (POLLERR | POLLHUP | POLLNVAL)))
+		what = IO_ERROR;
+	io_docallback(fd, what);
+
+	/* The callback could have closed the fd (or even created new ones,
+	 * so that the array has been relocated): re-arm the poll request,
+	 * if the fd still is registered and interested in this event. */
+	i = io_event_get(fd);
+	if (i->gen == gen && (i->what & dir) && !(i->armed & dir))
+		(void)io_iouring_arm(fd, i, dir);
+}
+
+/* re-arm requests that couldn't be submitted (or ran out of buffers)
+ * before, and cancel send requests of closed fds that timed out */
+static void
+io_iouring_retry(void)
+{
+	size_t n, len;
+	io_event *i;
+	io_send *s;
+	time_t now;
+	int *list;
+
+	len = array_length(&io_rearm, sizeof(int));
+	for (n = 0; n < len; n++) {
+		list = array_start(&io_rearm);
+		i = io_event_get(list[n]);
+		if (!i->rearm)	/* fd has been closed */
+			continue;
+		i->rearm = false;
+		io_iouring_update(list[n], i);
+	}
+	array_moveleft(&io_rearm, sizeof(int), len);
+
+	len = array_length(&io_resend, sizeof(int));
+	for (n = 0; n < len; n++) {
+		list = array_start(&io_resend);
+		s = array_get(&io_sends, sizeof(io_send), (size_t)list[n]);
+		if (s->fd >= 0 && !s->inflight && s->len > 0)
+			io_iouring_send(list[n]);
+	}
+	array_moveleft(&io_resend, sizeof(int), len);
+
+	if (io_orphans == 0)
+		return;
+	now = time(NULL);
+	s = array_start(&io_sends);
+	len = array_length(&io_sends, sizeof(io_send));
+	for (n = 0; n < len; n++) {
+		if (!s[n].orphan || !s[n].inflight || !s[n].deadline
+		    || s[n].deadline > now)
+			continue;
+		s[n].deadline = 0;
+		io_iouring_cancel(IOURING_SEND_DATA(n));
+	}
+}
+
+/* Process all completions, but only queue poll completions (which invoke
+ * callbacks) for the next loop if "callbacks" is false; see
+ * io_writev_iouring(), which can be called by callbacks itself. */
+static int
+io_iouring_reap(bool callbacks)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head, flags;
+	io_cqe deferred;
+	__u64 data;
+	int res, count = 0;
+
+	/* io_cq_head is advanced before each completion is processed, so
+	 * that nested calls continue with the next one */
+	while ((head = *io_cq_head) != io_ring_load(io_cq_tail)) {
+		cqe = &io_cqes[head & *io_cq_mask];
+		data = cqe->user_data;
+		res = cqe->res;
+		flags = cqe->flags;
+		io_ring_store(io_cq_head, head + 1);
+
+		if (data == IOURING_IGNORE) {
+			if (flags & IORING_CQE_F_BUFFER)
+				io_iouring_recycle((int)(flags
+						  >> IORING_CQE_BUFFER_SHIFT));
+			continue;
+		}
+		if (!callbacks && IOURING_KIND(data) <= IOURING_POLLOUT) {
+			deferred.data = data;
+			deferred.res = res;
+			if (!array_catb(&io_deferred, (char *)&deferred,
+					sizeof(deferred)))
+				Log(LOG_EMERG,
+				    "Can't allocate memory! [io_iouring_reap]");
+			continue;
+		}
+		io_iouring_complete(data, res, flags);
+		count++;
+	}
+	return count;
+}
+
+static int
+io_dispatch_iouring(struct timeval *tv)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int pending, wait = 1;
+	io_cqe *cqe;
+	size_t n;
+	__u64 data;
+	int ret, res, count = 0;
+
+	io_iouring_retry();
+
+	ts.tv_sec = tv->tv_sec;
+	ts.tv_nsec = (long long)tv->tv_usec * 1000;
+	memset(&arg, 0, sizeof(arg));
+	arg.ts = (__u64)(uintptr_t)&ts;
+	if (array_length(&io_ready, sizeof(int)) > 0)
+		wait = 0;
+
+	/* submit all queued requests and wait for completions */
+	io_ring_store(io_sq_tail, io_sq_queued);
+	pending = io_sq_queued - io_ring_load(io_sq_head);
+	if (pending > 0 || wait > 0) {
+		ret = io_iouring_enter(pending, wait,
+				       IORING_ENTER_GETEVENTS
+				       | IORING_ENTER_EXT_ARG,
+				       &arg, sizeof(arg));
+		if (ret < 0 && errno != ETIME && errno != EINTR
+		    && errno != EBUSY)
+			return -1;
+	}
+
+	/* poll completions collected by io_writev() before */
+	for (n = 0; n < array_length(&io_deferred, sizeof(io_cqe)); n++) {
+		cqe = array_get(&io_deferred, sizeof(io_cqe), n);
+		data = cqe->data;
+		res = cqe->res;
+		io_iouring_complete(data, res, 0);
+		count++;
+	}
+	array_trunc(&io_deferred);
+
+	count += io_iouring_reap(true);
+	io_ready_dispatch();
+	return count;
+}
+
+/* set up the ring of provided buffers */
+static bool
+io_iouring_init_bufs(void)
+{
+	struct io_uring_buf_reg reg;
+	int bid;
+
+	io_buf_ring = mmap(NULL, IOURING_BUFS * sizeof(struct io_uring_buf),
+			   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+			   -1, 0);
+	if (io_buf_ring == MAP_FAILED) {
+		io_buf_ring = NULL;
+		return false;
+	}
+	io_bufs = malloc((size_t)IOURING_BUFS * IOURING_BUF_LEN);
+	if (!io_bufs)
+		return false;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (__u64)(uintptr_t)io_buf_ring;
+	reg.ring_entries = IOURING_BUFS;
+	reg.bgid = 0;
+	if (syscall(__NR_io_uring_register, io_ringfd,
+		    IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+		return false;
+
+	io_buf_tail = 0;
+	for (bid = 0; bid < IOURING_BUFS; bid++)
+		io_iouring_recycle(bid);
+	return true;
+}
+
+/* check that the kernel supports multishot recv requests */
+static bool
+io_iouring_probe(void)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned int head, flags;
+	int sv[2], res;
+	bool ok = false;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+		return false;
+	sqe = io_iouring_get_sqe();
+	if (!sqe || write(sv[1], "", 1) != 1) {
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	}
+	close(sv[1]);
+
+	/* data followed by end of stream: a multishot request completes
+	 * with the data first, flagged that there is "more" to come */
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = sv[0];
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = IOURING_IGNORE;
+	io_ring_store(io_sq_tail, io_sq_queued);
+	do {
+		flags = 0;
+		if (io_iouring_enter(io_sq_queued - io_ring_load(io_sq_head), 1,
+				     IORING_ENTER_GETEVENTS, NULL, 0) < 0
+		    && errno != EINTR)
+			break;
+		head = *io_cq_head;
+		if (head == io_ring_load(io_cq_tail))
+			continue;
+		cqe = &io_cqes[head & *io_cq_mask];
+		res = cqe->res;
+		flags = cqe->flags;
+		io_ring_store(io_cq_head, head + 1);
+
+		if (flags & IORING_CQE_F_BUFFER)
+			io_iouring_recycle((int)(flags
+						 >> IORING_CQE_BUFFER_SHIFT));
+		if (res == 1 && (flags & IORING_CQE_F_MORE))
+			ok = true;
+	} while (flags & IORING_CQE_F_MORE);
+	close(sv[0]);
+
+	return ok;
+}
+
+static void io_library_shutdown_iouring PARAMS((void));
+
+static void
+io_library_init_iouring(unsigned int eventsize)
+{
+	struct io_uring_params p;
+	char *sq_ring;
+	int fd;
+
+	if (!io_backend_wanted("io_uring"))
+		return;
+
+	/* Defer completion work to io_uring_enter() (Linux >= 6.1), or at
+	 * least don't interrupt the process for it (Linux >= 5.19) */
+	fd = -1;
+	errno = EINVAL;
+#ifdef IORING_SETUP_DEFER_TASKRUN
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	fd = (int)syscall(__NR_io_uring_setup, IOURING_ENTRIES, &p);
+#endif
+	if (fd < 0 && errno == EINVAL) {
+		memset(&p, 0, sizeof(p));
+		p.flags = IORING_SETUP_COOP_TASKRUN;
+		fd = (int)syscall(__NR_io_uring_setup, IOURING_ENTRIES, &p);
+	}
+	if (fd < 0 && errno == EINVAL) {
+		memset(&p, 0, sizeof(p));
+		fd = (int)syscall(__NR_io_uring_setup, IOURING_ENTRIES, &p);
+	}
+	if (fd < 0) {
+		Log(LOG_INFO,
+		    "Can't initialize io_uring IO interface (%s), falling back to epoll() ...",
+		    strerror(errno));
+		return;
+	}
+	if (!(p.features & IORING_FEAT_NODROP)
+	    || !(p.features & IORING_FEAT_EXT_ARG)) {
+		Log(LOG_INFO,
+		    "io_uring IO interface of this kernel is too old, falling back to epoll() ...");
+		close(fd);
+		return;
+	}
+
+	io_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	io_cq_ring_size = p.cq_off.cqes
+			  + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (io_cq_ring_size > io_sq_ring_size)
+			io_sq_ring_size = io_cq_ring_size;
+		io_cq_ring_size = io_sq_ring_size;
+	}
+	io_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	io_sq_ring = mmap(NULL, io_sq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		io_cq_ring = io_sq_ring;
+	else
+		io_cq_ring = mmap(NULL, io_cq_ring_size,
+				  PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, fd,
+				  IORING_OFF_CQ_RING);
+	io_sqes = mmap(NULL, io_sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (io_sq_ring == MAP_FAILED || io_cq_ring == MAP_FAILED
+	    || io_sqes == MAP_FAILED) {
+		Log(LOG_ERR,
+		    "Can't map io_uring IO interface (%s), falling back to epoll() ...",
+		    strerror(errno));
+		if (io_sq_ring != MAP_FAILED)
+			munmap(io_sq_ring, io_sq_ring_size);
+		if (io_cq_ring != MAP_FAILED && io_cq_ring != io_sq_ring)
+			munmap(io_cq_ring, io_cq_ring_size);
+		if (io_sqes != MAP_FAILED)
+			munmap(io_sqes, io_sqes_size);
+		close(fd);
+		return;
+	}
+
+	sq_ring = io_sq_ring;
+	io_sq_head = (unsigned int *)(sq_ring + p.sq_off.head);
+	io_sq_tail = (unsigned int *)(sq_ring + p.sq_off.tail);
+	io_sq_mask = (unsigned int *)(sq_ring + p.sq_off.ring_mask);
+	io_sq_array = (unsigned int *)(sq_ring + p.sq_off.array);
+	io_sq_entries = p.sq_entries;
+	io_sq_queued = *io_sq_tail;
+	io_cq_head = (unsigned int *)((char *)io_cq_ring + p.cq_off.head);
+	io_cq_tail = (unsigned int *)((char *)io_cq_ring + p.cq_off.tail);
+	io_cq_mask = (unsigned int *)((char *)io_cq_ring + p.cq_off.ring_mask);
+	io_cqes = (struct io_uring_cqe *)((char *)io_cq_ring + p.cq_off.cqes);
+
+	io_setcloexec(fd);
+	io_ringfd = fd;
+
+	if (!io_iouring_init_bufs() || !io_iouring_probe()) {
+		Log(LOG_INFO,
+		    "io_uring IO interface of this kernel lacks multishot receive support, falling back to epoll() ...");
+		io_library_shutdown_iouring();
+		return;
+	}
+
+	array_init(&io_accepted);
+	array_init(&io_rearm);
+	array_init(&io_resend);
+	array_init(&io_sends);
+	array_init(&io_deferred);
+	array_init(&io_ready);
+	library_initialized = true;
+	Log(LOG_INFO,
+	    "IO subsystem: io_uring (%u entries, %u buffers, initial maxfd %u, ringfd %d).",
+	    p.sq_entries, IOURING_BUFS, eventsize, io_ringfd);
+}
+
+static void
+io_library_shutdown_iouring(void)
+{
+	io_send *s;
+	size_t n, len;
+	int *acc;
+
+	if (io_ringfd < 0)
+		return;
+
+	acc = array_start(&io_accepted);
+	len = array_length(&io_accepted, 2 * sizeof(int));
+	for (n = 0; n < len; n++)
+		close(acc[2 * n + 1]);
+	s = array_start(&io_sends);
+	len = array_length(&io_sends, sizeof(io_send));
+	for (n = 0; n < len; n++) {
+		if (s[n].orphan && s[n].fd >= 0)
+			close(s[n].fd);
+		free(s[n].buf);
+	}
+	array_free(&io_accepted);
+	array_free(&io_rearm);
+	array_free(&io_resend);
+	array_free(&io_sends);
+	array_free(&io_deferred);
+	io_sends_free = -1;
+	io_orphans = 0;
+
+	munmap(io_sqes, io_sqes_size);
+	if (io_cq_ring != io_sq_ring)
+		munmap(io_cq_ring, io_cq_ring_size);
+	munmap(io_sq_ring, io_sq_ring_size);
+	close(io_ringfd);
+	io_ringfd = -1;
+
+	if (io_buf_ring)
+		munmap(io_buf_ring, IOURING_BUFS * sizeof(struct io_uring_buf));
+	io_buf_ring = NULL;
+	free(io_bufs);
+	io_bufs = NULL;
+}
+#else
+static inline void
+io_library_init_iouring(unsigned int UNUSED ev)
+{ /* NOTHING */ }
+static inline void
+io_library_shutdown_iouring(void)
+{ /* NOTHING */ }
+#endif /* IO_USE_IOURING */
+
+
 #ifdef IO_USE_KQUEUE
 static bool
 io_event_kqueue_commit_cache(void)
@@ -630,6 +1995,8 @@ io_dispatch_kqueue(struct timeval *tv)
 static void
 io_library_init_kqueue(unsigned int eventsize)
 {
+	if (!io_backend_wanted("kqueue"))
+		return;
 	io_masterfd = kqueue();
 
 	Log(LOG_INFO,
@@ -654,6 +2021,7 @@ io_library_init(unsigned int eventsize)
 	if ((eventsize > 0) && !array_alloc(&io_events, sizeof(io_event), (size_t)eventsize))
 		eventsize = 0;
 
+	io_library_init_iouring(eventsize);
 	io_library_init_epoll(eventsize);
 	io_library_init_kqueue(eventsize);
 	io_library_init_devpoll(eventsize);
@@ -664,6 +2032,20 @@ io_library_init(unsigned int eventsize)
 }
 
 
+bool
+io_library_init_using(unsigned int eventsize, const char *backend)
+{
+	bool ret;
+
+	assert(backend != NULL);
+
+	library_backend = backend;
+	ret = io_library_init(eventsize);
+	library_backend = NULL;
+	return ret;
+}
+
+
 void
 io_library_shutdown(void)
 {
@@ -679,6 +2061,11 @@ io_library_shutdown(void)
 #ifdef IO_USE_KQUEUE
 	array_free(&io_evcache);
 #endif
+#ifdef IO_USE_EPOLL
+	array_free(&io_changes);
+	array_free(&io_ready);
+#endif
+	io_library_shutdown_iouring();
 	library_initialized = false;
 }
 
@@ -699,6 +2086,10 @@ static bool
 backend_create_ev(int fd, short what)
 {
 	bool ret;
+#ifdef IO_USE_IOURING
+	if (io_ringfd >= 0)
+		return io_event_create_iouring(fd, what);
+#endif
 #ifdef IO_USE_DEVPOLL
 	ret = io_event_change_devpoll(fd, what);
 #endif
@@ -724,10 +2115,21 @@ io_event_create(int fd, short what, void (*cbfunc) (int, short))
 {
 	bool ret;
 	io_event *i;
+#ifdef IO_USE_EPOLL
+	bool edge = (what & IO_EDGE) != 0;
+#endif
+#ifdef IO_USE_IOURING
+	short mode = what & (IO_MANAGED | IO_LISTEN);
+#endif
 
 	assert(fd >= 0);
+	what &= ~(IO_EDGE | IO_MANAGED | IO_LISTEN);
 #if defined(IO_USE_SELECT) && defined(FD_SETSIZE)
-	if (io_masterfd < 0 && fd >= FD_SETSIZE) {
+	if (io_masterfd < 0 && fd >= FD_SETSIZE
+#ifdef IO_USE_IOURING
+	    && io_ringfd < 0
+#endif
+	   ) {
 		Log(LOG_ERR,
 		    "fd %d exceeds FD_SETSIZE (%u) (select can't handle more file descriptors)",
 		    fd, FD_SETSIZE);
@@ -744,9 +2146,32 @@ io_event_create(int fd, short what, void (*cbfunc) (int, short))
 
 	i->callback = cbfunc;
 	i->what = 0;
+#ifdef IO_USE_EPOLL
+	i->edge = edge && io_masterfd >= 0;
+	i->changed = false;
+	i->ready = 0;
+#endif
+#ifdef IO_USE_IOURING
+	i->gen = ++io_ring_gen;
+	i->armed = 0;
+	i->mode = io_ringfd >= 0 ? mode : 0;
+	i->active = i->rearm = i->eof = false;
+	i->error = 0;
+	i->rq_head = i->rq_tail = -1;
+	i->rq_count = 0;
+	i->send = -1;
+	if (i->mode)	/* completion based, see io_iouring_update() */
+		i->edge = true;
+#endif
 	ret = backend_create_ev(fd, what);
-	if (ret)
+	if (ret) {
 		i->what = what;
+#ifdef IO_USE_EPOLL
+		i->registered = what;
+		if (i->edge)
+			io_ready_update(fd);
+#endif
+	}
 	return ret;
 }
 
@@ -764,9 +2189,17 @@ io_event_add(int fd, short what)
 	io_debug("io_event_add: fd, what", fd, what);
 
 	i->what |= what;
+#ifdef IO_USE_IOURING
+	if (io_ringfd >= 0) {
+		if (!i->edge)
+			return io_event_change_iouring(fd, i->what);
+		io_ready_update(fd);
+		return true;
+	}
+#endif
 #ifdef IO_USE_EPOLL
 	if (io_masterfd >= 0)
-		return io_event_change_epoll(fd, i->what, EPOLL_CTL_MOD);
+		return io_event_queue_epoll(fd);
 #endif
 #ifdef IO_USE_KQUEUE
 	return io_event_change_kqueue(fd, what, EV_ADD | EV_ENABLE);
@@ -819,6 +2252,61 @@ io_setcloexec(int fd)
 	return fcntl(fd, F_SETFD, flags) == 0;
 }
 
+int
+io_accept(int fd, struct sockaddr *addr, socklen_t *addrlen)
+{
+#if !defined(HAVE_ACCEPT4) || !defined(SOCK_NONBLOCK) || !defined(SOCK_CLOEXEC)
+	int new_fd;
+#endif
+#ifdef IO_USE_IOURING
+	io_event *i = array_get(&io_events, sizeof(io_event), (size_t)fd);
+
+	if (i && i->mode == IO_LISTEN)
+		return io_accept_iouring(fd, i, addr, addrlen);
+#endif
+#if defined(HAVE_ACCEPT4) && defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+	return accept4(fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	new_fd = accept(fd, addr, addrlen);
+	if (new_fd < 0)
+		return -1;
+	if (!io_setnonblock(new_fd)) {
+		close(new_fd);
+		return -1;
+	}
+	io_setcloexec(new_fd);
+	return new_fd;
+#endif
+}
+
+ssize_t
+io_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+#ifdef IO_USE_IOURING
+	io_event *i = array_get(&io_events, sizeof(io_event), (size_t)fd);
+
+	if (i && i->mode == IO_MANAGED)
+		return io_readv_iouring(fd, i, iov, iovcnt);
+#endif
+	if (iovcnt == 1)
+		return read(fd, iov[0].iov_base, iov[0].iov_len);
+	return readv(fd, iov, iovcnt);
+}
+
+ssize_t
+io_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+#ifdef IO_USE_IOURING
+	io_event *i = array_get(&io_events, sizeof(io_event), (size_t)fd);
+
+	if (i && i->mode == IO_MANAGED)
+		return io_writev_iouring(fd, i, iov, iovcnt);
+#endif
+	if (iovcnt == 1)
+		return write(fd, iov[0].iov_base, iov[0].iov_len);
+	return writev(fd, iov, iovcnt);
+}
+
 bool
 io_close(int fd)
 {
@@ -836,6 +2324,10 @@ io_close(int fd)
 		io_event_change_kqueue(fd, i->what, EV_DELETE);
 		io_event_kqueue_commit_cache();
 	}
+#endif
+#ifdef IO_USE_IOURING
+	if (i)
+		io_close_iouring(fd, i);
 #endif
 	io_close_devpoll(fd);
 	io_close_poll(fd);
@@ -846,6 +2338,14 @@ io_close(int fd)
 	if (i) {
 		i->callback = NULL;
 		i->what = 0;
+#ifdef IO_USE_EPOLL
+		if (i->edge) {
+			i->ready = 0;
+			io_ready_update(fd);
+		}
+		i->edge = false;
+		i->changed = false;
+#endif
 	}
 	return close(fd) == 0;
 }
@@ -869,9 +2369,16 @@ io_event_del(int fd, short what)
 #ifdef IO_USE_POLL
 	return io_event_change_poll(fd, i->what);
 #endif
+#ifdef IO_USE_IOURING
+	if (io_ringfd >= 0) {	/* see io_iouring_complete() */
+		if (i->edge)
+			io_ready_update(fd);
+		return true;
+	}
+#endif
 #ifdef IO_USE_EPOLL
 	if (io_masterfd >= 0)
-		return io_event_change_epoll(fd, i->what, EPOLL_CTL_MOD);
+		return io_event_queue_epoll(fd);
 #endif
 #ifdef IO_USE_KQUEUE
 	return io_event_change_kqueue(fd, what, EV_DISABLE);
@@ -888,9 +2395,35 @@ io_event_del(int fd, short what)
 }
 
 
+void
+io_event_blocked(int fd, short what)
+{
+#ifdef IO_USE_EPOLL
+	io_event *i = io_event_get(fd);
+
+	if (!i->edge || !(i->ready & what))
+		return;
+#ifdef IO_USE_IOURING
+	if (i->mode)	/* readiness is known, see io_iouring_update() */
+		return;
+#endif
+
+	i->ready &= ~what;
+	io_ready_update(fd);
+#else
+	(void)fd;
+	(void)what;
+#endif
+}
+
+
 int
 io_dispatch(struct timeval *tv)
 {
+#ifdef IO_USE_IOURING
+	if (io_ringfd >= 0)
+		return io_dispatch_iouring(tv);
+#endif
 #ifdef IO_USE_EPOLL
 	if (io_masterfd >= 0)
 		return io_dispatch_epoll(tv);
@@ -16,15 +16,25 @@
 
 #include "portab.h"
 #include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #define IO_WANTREAD	1
 #define IO_WANTWRITE	2
+#define IO_EDGE		8	/* io_event_create(): see io_event_blocked() */
+#define IO_MANAGED	16	/* io_event_create(): see io_readv(), io_writev() */
+#define IO_LISTEN	32	/* io_event_create(): see io_accept() */
 
 /* init library.
    sets up epoll/kqueue descriptors and tries to allocate space for ioevlen
    file descriptors. ioevlen is just the _initial_ size, not a limit. */
 bool io_library_init PARAMS((unsigned int ioevlen));
 
+/* init library using the named backend ("io_uring", "epoll", "kqueue",
+   "/dev/poll", "poll" or "select") only, fails if it isn't available. */
+bool io_library_init_using PARAMS((unsigned int ioevlen, const char *backend));
+
 /* shutdown and free all internal data structures */
 void io_library_shutdown PARAMS((void));
 
@@ -40,6 +50,25 @@ bool io_event_add PARAMS((int fd, short what));
 /* do not watch fd for event of type what */
 bool io_event_del PARAMS((int fd, short what));
 
+/* reading from or writing to fd (what) would block (EAGAIN).
+   fds created with IO_EDGE are registered edge triggered (if supported by
+   the backend): their callback is invoked as long as they are considered
+   ready, until this function has been called. */
+void io_event_blocked PARAMS((int fd, short what));
+
+/* accept a connection on the listening socket fd, like accept(2).
+   The new socket is non-blocking and close-on-exec already. Listening
+   sockets created with IO_LISTEN must be accepted from using this function
+   only, their connections may have been accepted by the backend already. */
+int io_accept PARAMS((int fd, struct sockaddr *addr, socklen_t *addrlen));
+
+/* read from or write to fd, like readv(2) and writev(2).
+   Sockets created with IO_MANAGED must be read from and written to using
+   these functions only: the backend may receive and send their data on its
+   own, so data written isn't necessarily sent yet when this returns. */
+ssize_t io_readv PARAMS((int fd, const struct iovec *iov, int iovcnt));
+ssize_t io_writev PARAMS((int fd, const struct iovec *iov, int iovcnt));
+
 /* remove fd from watchlist, close() fd.  */
 bool io_close PARAMS((int fd));
 
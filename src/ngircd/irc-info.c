@@ -883,6 +883,14 @@ IRC_STATS( CLIENT *Client, REQUEST *Req )
 		query = '*';
 
 	switch (query) {
+	case 'd':	/* Host name cache (resolver) */
+	case 'D':
+		if (!IRC_WriteStrClient(from, RPL_STATSRESOLVE_MSG,
+					Client_ID(from), Resolve_CountCached(),
+					RESOLVE_CACHE_SIZE, Resolve_CountHits(),
+					Resolve_CountMisses()))
+			return DISCONNECTED;
+		break;
 	case 'g':	/* Network-wide bans ("G-Lines") */
 	case 'G':
 	case 'k':	/* Server-local bans ("K-Lines") */
@@ -958,6 +966,15 @@ IRC_STATS( CLIENT *Client, REQUEST *Req )
 				return DISCONNECTED;
 		}
 		break;
+	case 'q':	/* Login queue (admission control) */
+	case 'Q':
+		if (!IRC_WriteStrClient(from, RPL_STATSQUEUE_MSG,
+					Client_ID(from), Conn_CountQueued(),
+					Conn_CountQueuedMax(),
+					Conn_CountRejected(),
+					Conf_MaxLoginsPerSecond))
+			return DISCONNECTED;
+		break;
 	case 'u':	/* Server uptime */
 	case 'U':
 		time_now = time(NULL) - NGIRCd_Start;
@@ -283,6 +283,9 @@ IRC_CONNECT(CLIENT * Client, REQUEST * Req)
 						  Req->argv[0]);
 	}
 
+	/* Try to establish the link without waiting for the next check */
+	Conn_ScheduleServerCheck();
+
 	Log(LOG_NOTICE | LOG_snotice,
 	    "Got CONNECT command from \"%s\" for \"%s\".", Client_Mask(from),
 	    Req->argv[0]);
@@ -23,19 +23,52 @@
 #	include <varargs.h>
 #endif
 #include <stdio.h>
+#include <stdlib.h>
 
+#include "array.h"
 #include "conn-func.h"
 #include "channel.h"
+#include "log.h"
 
 #include "irc-write.h"
 
 #define SEND_TO_USER 1
 #define SEND_TO_SERVER 2
 
+/** Queued QUIT message of a netsplit, see IRC_QueueRelatedQuit(). */
+typedef struct {
+	CONN_ID conn;		/**< Receiving connection */
+	size_t line;		/**< Offset of the message line in the buffer */
+	size_t len;		/**< Length of the message line */
+} QUIT_RCPT;
+
+/** Local members of a channel affected by a netsplit, see Split_Members(). */
+typedef struct {
+	CHANNEL *chan;		/**< Channel or NULL if the slot is unused */
+	size_t first;		/**< First member in Split_Conns */
+	size_t count;		/**< Number of local members */
+} SPLIT_CHAN;
+
 static const char *Get_Prefix PARAMS((CLIENT *Target, CLIENT *Client));
 static void cb_writeStrServersPrefixFlag PARAMS((CLIENT *Client,
 					 CLIENT *Prefix, void *Buffer));
-static void Send_Marked_Connections PARAMS((CLIENT *Prefix, const char *Buffer));
+static void Send_Marked_Connections PARAMS((CLIENT *Prefix, const char *Buffer,
+					    size_t First));
+static void Mark_Related PARAMS((CLIENT *Client, bool Remote));
+static int Compare_Rcpt PARAMS((const void *a, const void *b));
+static bool Split_Members PARAMS((CHANNEL *Chan, size_t *First,
+				  size_t *Count));
+static SPLIT_CHAN *Split_Slot PARAMS((SPLIT_CHAN *Table, size_t Size,
+				      CHANNEL *Chan));
+
+static array Quit_Lines, Quit_Rcpts;
+
+/** Hash table of the channels affected by the current netsplit */
+static SPLIT_CHAN *Split_Chans;
+static size_t Split_ChansSize, Split_ChansUsed;
+
+/** Connections of the local members of all affected channels */
+static array Split_Conns;
 
 /**
  * Send an error message to a client and enforce a penalty time.
@@ -224,6 +257,7 @@ va_dcl
 	CONN_ID conn;
 	CLIENT *c;
 	va_list ap;
+	size_t first;
 
 	assert( Client != NULL );
 	assert( Chan != NULL );
@@ -238,7 +272,7 @@ va_dcl
 	vsnprintf(buffer, sizeof(buffer), Format, ap);
 	va_end( ap );
 
-	Conn_ClearFlags( );
+	first = Conn_ClearFlags( );
 
 	cl2chan = Channel_FirstMember( Chan );
 	while(cl2chan) {
@@ -262,7 +296,7 @@ va_dcl
 		}
 		cl2chan = Channel_NextMember(Chan, cl2chan);
 	}
-	Send_Marked_Connections(Prefix, buffer);
+	Send_Marked_Connections(Prefix, buffer, first);
 }
 
 /**
@@ -430,12 +464,9 @@ const char *Format;
 va_dcl
 #endif
 {
-	CL2CHAN *chan_cl2chan, *cl2chan;
 	char buffer[1000];
-	CHANNEL *chan;
-	CONN_ID conn;
 	va_list ap;
-	CLIENT *c;
+	size_t first;
 
 	assert( Client != NULL );
 	assert( Prefix != NULL );
@@ -449,36 +480,122 @@ va_dcl
 	vsnprintf(buffer, sizeof(buffer), Format, ap);
 	va_end( ap );
 
-	Conn_ClearFlags( );
+	first = Conn_ClearFlags();
+	Mark_Related(Client, Remote);
+	Send_Marked_Connections(Prefix, buffer, first);
+} /* IRC_WriteStrRelatedPrefix */
 
-	chan_cl2chan = Channel_FirstChannelOf( Client );
-	while( chan_cl2chan )
-	{
-		chan = Channel_GetChannel( chan_cl2chan );
-		cl2chan = Channel_FirstMember( chan );
-		while( cl2chan )
-		{
-			c = Channel_GetClient( cl2chan );
-			if( ! Remote )
-			{
-				if( Client_Conn( c ) <= NONE ) c = NULL;
-				else if( Client_Type( c ) == CLIENT_SERVER ) c = NULL;
-			}
-			if( c ) c = Client_NextHop( c );
+/**
+ * Queue a QUIT message for all local users sharing a channel with a client.
+ *
+ * This is used while a netsplit removes a whole set of clients at once:
+ * the QUIT line of each client is formatted only once and queued for all
+ * receiving connections, IRC_FlushRelatedQuits() then sends all queued
+ * messages ordered by connection, so that each connection gets all of its
+ * QUIT messages in one go.
+ *
+ * The local members of each affected channel are collected only once per
+ * netsplit (see Split_Members()), so the member lists of big channels are
+ * not walked again for every departing client.
+ *
+ * The messages must be flushed before any local client is removed.
+ *
+ * @param Client The client quitting.
+ * @param Reason Quit reason.
+ */
+GLOBAL void
+IRC_QueueRelatedQuit(CLIENT *Client, const char *Reason)
+{
+	char buffer[1000], line[COMMAND_LEN];
+	size_t first, pos, member, count, i;
+	CL2CHAN *cl2chan;
+	CONN_ID *conns;
+	QUIT_RCPT rcpt;
+	int flag;
 
-			if( c && ( c != Client ))
-			{
-				conn = Client_Conn( c );
-				if( Client_Type( c ) == CLIENT_SERVER ) Conn_SetFlag( conn, SEND_TO_SERVER );
-				else Conn_SetFlag( conn, SEND_TO_USER );
-			}
-			cl2chan = Channel_NextMember( chan, cl2chan );
+	assert(Client != NULL);
+	assert(Reason != NULL);
+
+	first = Conn_ClearFlags();
+	for (cl2chan = Channel_FirstChannelOf(Client); cl2chan;
+	     cl2chan = Channel_NextChannelOf(Client, cl2chan)) {
+		if (!Split_Members(Channel_GetChannel(cl2chan), &member,
+				   &count)) {
+			/* Out of memory: walk all channels of the client */
+			Mark_Related(Client, false);
+			break;
 		}
+		conns = (CONN_ID *)array_start(&Split_Conns);
+		for (i = 0; i < count; i++)
+			Conn_SetFlag(conns[member + i], SEND_TO_USER);
+	}
 
-		chan_cl2chan = Channel_NextChannelOf( Client, chan_cl2chan );
+	pos = first;
+	if (Conn_NextFlagged(&pos, &flag) == NONE) {
+		Conn_ReleaseFlags(first);
+		return;
 	}
-	Send_Marked_Connections(Prefix, buffer);
-} /* IRC_WriteStrRelatedPrefix */
+
+	snprintf(buffer, sizeof(buffer), "QUIT :%s", Reason);
+
+	/* Keep the terminating NULL byte of the line in the buffer,
+	 * Conn_WriteLine() may treat the line as a string. */
+	rcpt.len = Conn_FormatLine(line, ":%s %s", Client_MaskCloaked(Client),
+				   buffer);
+	rcpt.line = array_bytes(&Quit_Lines);
+	if (!array_catb(&Quit_Lines, line, rcpt.len + 1)) {
+		Log(LOG_EMERG, "Can't allocate memory! [IRC_QueueRelatedQuit]");
+		Send_Marked_Connections(Client, buffer, first);
+		return;
+	}
+
+	pos = first;
+	while ((rcpt.conn = Conn_NextFlagged(&pos, &flag)) != NONE) {
+		if (!array_catb(&Quit_Rcpts, (char *)&rcpt, sizeof(rcpt)))
+			(void)Conn_WriteLine(rcpt.conn, line, rcpt.len);
+	}
+	Conn_ReleaseFlags(first);
+} /* IRC_QueueRelatedQuit */
+
+/**
+ * Send all QUIT messages queued by IRC_QueueRelatedQuit().
+ *
+ * The queue is detached first: sending can close connections (when their
+ * write buffer overflows), and the QUIT messages of their users are sent
+ * directly then, because the netsplit must already have been finished by
+ * the caller.
+ */
+GLOBAL void
+IRC_FlushRelatedQuits(void)
+{
+	array rcpts, lines;
+	QUIT_RCPT *rcpt;
+	size_t i, n;
+
+	rcpts = Quit_Rcpts;
+	lines = Quit_Lines;
+	array_init(&Quit_Rcpts);
+	array_init(&Quit_Lines);
+
+	/* Forget the affected channels of this netsplit */
+	free(Split_Chans);
+	Split_Chans = NULL;
+	Split_ChansSize = Split_ChansUsed = 0;
+	array_free(&Split_Conns);
+
+	n = array_length(&rcpts, sizeof(QUIT_RCPT));
+	if (n > 0) {
+		rcpt = (QUIT_RCPT *)array_start(&rcpts);
+		qsort(rcpt, n, sizeof(QUIT_RCPT), Compare_Rcpt);
+		for (i = 0; i < n; i++)
+			(void)Conn_WriteLine(rcpt[i].conn,
+					     (char *)array_start(&lines)
+					     + rcpt[i].line, rcpt[i].len);
+	}
+
+	array_free(&rcpts);
+	array_free(&lines);
+} /* IRC_FlushRelatedQuits */
 
 /**
  * Send WALLOPS message.
@@ -577,27 +694,215 @@ cb_writeStrServersPrefixFlag(CLIENT *Client, CLIENT *Prefix, void *Buffer)
 /**
  * Send a message to all marked connections using a specific prefix.
  *
+ * The message is formatted at most twice, once with the prefix for servers
+ * and once with the prefix for users, and then queued on all the marked
+ * connections as a shared message block, see Conn_WriteBlock().
+ *
  * @param Prefix The prefix to use.
  * @param Buffer The message to send.
+ * @param First Start of the marked connections, see Conn_ClearFlags().
  */
 static void
-Send_Marked_Connections(CLIENT *Prefix, const char *Buffer)
+Send_Marked_Connections(CLIENT *Prefix, const char *Buffer, size_t First)
 {
+	char server_line[COMMAND_LEN], user_line[COMMAND_LEN];
+	size_t server_len = 0, user_len = 0, pos;
+	MSGBLOCK *server_block = NULL, *user_block = NULL;
 	CONN_ID conn;
+	int flag;
 
 	assert(Prefix != NULL);
 	assert(Buffer != NULL);
 
-	conn = Conn_First();
-	while (conn != NONE) {
-		if (Conn_Flag(conn) == SEND_TO_SERVER)
-			Conn_WriteStr(conn, ":%s %s",
-				      Client_ID(Prefix), Buffer);
-		else if (Conn_Flag(conn) == SEND_TO_USER)
-			Conn_WriteStr(conn, ":%s %s",
-				      Client_MaskCloaked(Prefix), Buffer);
-		conn = Conn_Next(conn);
+	/* The first recipient of each form of the message gets a copy of
+	 * it, all others share a message block (if it can be allocated). */
+	pos = First;
+	while ((conn = Conn_NextFlagged(&pos, &flag)) != NONE) {
+		if (flag == SEND_TO_SERVER) {
+			if (!server_len) {
+				server_len = Conn_FormatLine(server_line,
+					":%s %s", Client_ID(Prefix), Buffer);
+				Conn_WriteLine(conn, server_line, server_len);
+				continue;
+			}
+			if (!server_block)
+				server_block = Conn_NewBlock(server_line,
+							     server_len);
+			if (server_block)
+				Conn_WriteBlock(conn, server_block);
+			else
+				Conn_WriteLine(conn, server_line, server_len);
+		} else if (flag == SEND_TO_USER) {
+			if (!user_len) {
+				user_len = Conn_FormatLine(user_line,
+					":%s %s", Client_MaskCloaked(Prefix),
+					Buffer);
+				Conn_WriteLine(conn, user_line, user_len);
+				continue;
+			}
+			if (!user_block)
+				user_block = Conn_NewBlock(user_line, user_len);
+			if (user_block)
+				Conn_WriteBlock(conn, user_block);
+			else
+				Conn_WriteLine(conn, user_line, user_len);
+		}
+	}
+	Conn_ReleaseFlags(First);
+
+	if (server_block)
+		Conn_ReleaseBlock(server_block);
+	if (user_block)
+		Conn_ReleaseBlock(user_block);
+}
+
+/**
+ * Mark all connections of clients sharing a channel with a given client.
+ *
+ * @param Client The client.
+ * @param Remote If true, mark server links, too; otherwise only local users.
+ */
+static void
+Mark_Related(CLIENT *Client, bool Remote)
+{
+	CL2CHAN *chan_cl2chan, *cl2chan;
+	CHANNEL *chan;
+	CONN_ID conn;
+	CLIENT *c;
+
+	chan_cl2chan = Channel_FirstChannelOf( Client );
+	while( chan_cl2chan )
+	{
+		chan = Channel_GetChannel( chan_cl2chan );
+		cl2chan = Channel_FirstMember( chan );
+		while( cl2chan )
+		{
+			c = Channel_GetClient( cl2chan );
+			if( ! Remote )
+			{
+				if( Client_Conn( c ) <= NONE ) c = NULL;
+				else if( Client_Type( c ) == CLIENT_SERVER ) c = NULL;
+			}
+			if( c ) c = Client_NextHop( c );
+
+			if( c && ( c != Client ))
+			{
+				conn = Client_Conn( c );
+				if( Client_Type( c ) == CLIENT_SERVER ) Conn_SetFlag( conn, SEND_TO_SERVER );
+				else Conn_SetFlag( conn, SEND_TO_USER );
+			}
+			cl2chan = Channel_NextMember( chan, cl2chan );
+		}
+
+		chan_cl2chan = Channel_NextChannelOf( Client, chan_cl2chan );
+	}
+}
+
+/**
+ * Get the connections of the local members of a channel affected by the
+ * current netsplit.
+ *
+ * The member list of each channel is walked only once per netsplit: local
+ * users don't leave channels while the remote clients are removed, and no
+ * channels are created in the meantime, so the result stays valid until
+ * IRC_FlushRelatedQuits() is called.
+ *
+ * @param Chan The channel.
+ * @param First Receives the position of the first connection in Split_Conns.
+ * @param Count Receives the number of connections.
+ * @return true on success, false if out of memory.
+ */
+static bool
+Split_Members(CHANNEL *Chan, size_t *First, size_t *Count)
+{
+	SPLIT_CHAN *sc, *table;
+	CL2CHAN *cl2chan;
+	CONN_ID conn;
+	size_t i, size;
+	CLIENT *c;
+
+	assert(Chan != NULL);
+
+	if (Split_ChansUsed * 2 >= Split_ChansSize) {
+		/* Grow the hash table, keep it at most half full */
+		size = Split_ChansSize ? Split_ChansSize * 2 : 64;
+		table = calloc(size, sizeof(SPLIT_CHAN));
+		if (!table) {
+			Log(LOG_EMERG, "Can't allocate memory! [Split_Members]");
+			return false;
+		}
+		for (i = 0; i < Split_ChansSize; i++) {
+			if (Split_Chans[i].chan)
+				*Split_Slot(table, size, Split_Chans[i].chan) =
+					Split_Chans[i];
+		}
+		free(Split_Chans);
+		Split_Chans = table;
+		Split_ChansSize = size;
 	}
+
+	sc = Split_Slot(Split_Chans, Split_ChansSize, Chan);
+	if (!sc->chan) {
+		sc->first = array_length(&Split_Conns, sizeof(CONN_ID));
+		for (cl2chan = Channel_FirstMember(Chan); cl2chan;
+		     cl2chan = Channel_NextMember(Chan, cl2chan)) {
+			c = Channel_GetClient(cl2chan);
+			conn = Client_Conn(c);
+			if (conn <= NONE || Client_Type(c) == CLIENT_SERVER)
+				continue;
+			if (!array_catb(&Split_Conns, (char *)&conn,
+					sizeof(conn))) {
+				Log(LOG_EMERG,
+				    "Can't allocate memory! [Split_Members]");
+				array_truncate(&Split_Conns, sizeof(CONN_ID),
+					       sc->first);
+				return false;
+			}
+		}
+		sc->count = array_length(&Split_Conns, sizeof(CONN_ID))
+			    - sc->first;
+		sc->chan = Chan;
+		Split_ChansUsed++;
+	}
+
+	*First = sc->first;
+	*Count = sc->count;
+	return true;
+}
+
+/**
+ * Find the slot of a channel in a hash table of affected channels.
+ *
+ * @param Table Hash table.
+ * @param Size Size of the hash table (a power of 2).
+ * @param Chan The channel.
+ * @return Slot of the channel or the unused slot to store it.
+ */
+static SPLIT_CHAN *
+Split_Slot(SPLIT_CHAN *Table, size_t Size, CHANNEL *Chan)
+{
+	size_t i;
+
+	i = ((size_t)Chan >> 4) * 2654435761UL;
+	for (i &= Size - 1; Table[i].chan && Table[i].chan != Chan;
+	     i = (i + 1) & (Size - 1))
+		/* nothing */ ;
+	return &Table[i];
+}
+
+/**
+ * Order pending QUIT messages by connection, keeping their original order.
+ */
+static int
+Compare_Rcpt(const void *a, const void *b)
+{
+	const QUIT_RCPT *ra = (const QUIT_RCPT *)a, *rb = (const QUIT_RCPT *)b;
+
+	if (ra->conn != rb->conn)
+		return ra->conn < rb->conn ? -1 : 1;
+	if (ra->line != rb->line)
+		return ra->line < rb->line ? -1 : 1;
+	return 0;
 }
 
 /* -eof- */
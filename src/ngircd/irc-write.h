@@ -40,6 +40,8 @@ GLOBAL void IRC_WriteStrServersPrefixFlag_CB PARAMS((CLIENT *ExceptOf,
 
 GLOBAL void IRC_WriteStrRelatedPrefix PARAMS((CLIENT *Client, CLIENT *Prefix,
 		bool Remote, const char *Format, ...));
+GLOBAL void IRC_QueueRelatedQuit PARAMS((CLIENT *Client, const char *Reason));
+GLOBAL void IRC_FlushRelatedQuits PARAMS((void));
 
 GLOBAL void IRC_SendWallops PARAMS((CLIENT *Client, CLIENT *From,
 		const char *Format, ...));
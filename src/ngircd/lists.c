@@ -25,12 +25,14 @@
 #include "conn.h"
 #include "log.h"
 #include "match.h"
+#include "tool.h"
 
 #include "lists.h"
 
 struct list_elem {
 	struct list_elem *next;	/** pointer to next list element */
 	char mask[MASK_LEN];	/** IRC mask */
+	MATCH_MASK match;	/** Compiled IRC mask, see MatchCompile() */
 	char *reason;		/** Optional "reason" text */
 	time_t valid_until;	/** 0: unlimited; t(>0): until t */
 	bool onlyonce;
@@ -153,6 +155,7 @@ Lists_Add(struct list_head *h, const char *Mask, time_t ValidUntil,
 	}
 
 	strlcpy(newelem->mask, Mask, sizeof(newelem->mask));
+	MatchCompile(&newelem->match, newelem->mask);
 	if (Reason) {
 		newelem->reason = strdup(Reason);
 		if (!newelem->reason)
@@ -333,15 +336,24 @@ bool
 Lists_CheckReason(struct list_head *h, CLIENT *Client, char *reason, size_t len)
 {
 	struct list_elem *e, *last, *next;
+	char mask[COMMAND_LEN];
+	size_t mask_len;
 
 	assert(h != NULL);
 
 	e = h->first;
 	last = NULL;
+	if (!e)
+		return false;
+
+	/* The list entries are compiled case-folded already, so only the
+	 * mask of the client has to be converted (once for all entries) */
+	strlcpy(mask, Client_MaskCloaked(Client), sizeof(mask));
+	mask_len = strlen(ngt_LowerStr(mask));
 
 	while (e) {
 		next = e->next;
-		if (MatchCaseInsensitive(e->mask, Client_MaskCloaked(Client))) {
+		if (MatchCompiled(&e->match, mask, mask_len)) {
 			if (len && e->reason)
 				strlcpy(reason, e->reason, len);
 			if (e->onlyonce) {
@@ -210,7 +210,7 @@ va_dcl
 
 
 GLOBAL void
-Log_Init_Subprocess(char UNUSED *Name)
+Log_Init_Subprocess(const char UNUSED *Name)
 {
 #ifdef SYSLOG
 	openlog(PACKAGE, LOG_CONS|LOG_PID, Conf_SyslogFacility);
@@ -223,7 +223,7 @@ Log_Init_Subprocess(char UNUSED *Name)
 
 
 GLOBAL void
-Log_Exit_Subprocess(char UNUSED *Name)
+Log_Exit_Subprocess(const char UNUSED *Name)
 {
 #ifdef DEBUG
 	Log_Subprocess(LOG_DEBUG, "%s sub-process %ld done.",
@@ -46,8 +46,8 @@ GLOBAL void LogDebug PARAMS(( const char *Format, ... ));
 static inline void LogDebug PARAMS(( UNUSED const char *Format, ... )){/* Do nothing. The compiler should optimize this out, please ;-) */}
 #endif
 
-GLOBAL void Log_Init_Subprocess PARAMS((char *Name));
-GLOBAL void Log_Exit_Subprocess PARAMS((char *Name));
+GLOBAL void Log_Init_Subprocess PARAMS((const char *Name));
+GLOBAL void Log_Exit_Subprocess PARAMS((const char *Name));
 
 GLOBAL void Log_Subprocess PARAMS((const int Level, const char *Format, ...));
 
@@ -20,7 +20,6 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <unistd.h>
 
 #include "conn.h"
 #include "class.h"
@@ -39,20 +38,50 @@
 
 #ifdef PAM
 
-#include "io.h"
 #include "pam.h"
 
-static void cb_Read_Auth_Result PARAMS((int r_fd, UNUSED short events));
+static bool Add_Job_Field PARAMS((char *Job, size_t *Len, const char *Str));
+static size_t Do_Authenticate PARAMS((const void *Job, size_t Len, int fd,
+				      void *Result, size_t ResultLen));
+static void cb_Read_Auth_Result PARAMS((int Idx, const void *Result,
+					size_t Len));
 
+/** Worker processes doing PAM authentication */
+static PROC_POOL Auth_Pool;
+
+#endif
+
+/**
+ * Initialize the login subsystem (authenticator worker processes).
+ */
+GLOBAL void
+Login_Init(void)
+{
+#ifdef PAM
+	Proc_PoolInit(&Auth_Pool, "Auth", Conf_HelperProcesses,
+		      Conf_PongTimeout + 1, NULL, Do_Authenticate,
+		      cb_Read_Auth_Result);
+#endif
+} /* Login_Init */
+
+/**
+ * Shut down the login subsystem and stop all authenticator worker processes.
+ */
+GLOBAL void
+Login_Exit(void)
+{
+#ifdef PAM
+	Proc_PoolExit(&Auth_Pool);
 #endif
+} /* Login_Exit */
 
 /**
  * Initiate client login.
  *
  * This function is called after the daemon received the required NICK and
  * USER commands of a new client. If the daemon is compiled with support for
- * PAM, the authentication sub-processs is forked; otherwise the global server
- * password is checked.
+ * PAM, the authentication is handed over to an authenticator worker process;
+ * otherwise the global server password is checked.
  *
  * @param Client The client logging in.
  * @returns CONNECTED or DISCONNECTED.
@@ -61,8 +90,8 @@ GLOBAL bool
 Login_User(CLIENT * Client)
 {
 #ifdef PAM
-	int pipefd[2], result;
-	pid_t pid;
+	char job[PROC_JOB_LEN];
+	size_t len = 0;
 #endif
 	CONN_ID conn;
 
@@ -109,25 +138,25 @@ Login_User(CLIENT * Client)
 	}
 
 	if (Conf_PAM) {
-		/* Fork child process for PAM authentication; and make sure that the
-		 * process timeout is set higher than the login timeout! */
-		pid = Proc_Fork(Conn_GetProcStat(conn), pipefd,
-				cb_Read_Auth_Result, Conf_PongTimeout + 1);
-		if (pid > 0) {
-			LogDebug("Authenticator for connection %d created (PID %d).",
-				 conn, pid);
-			return CONNECTED;
-		} else {
-			/* Sub process */
-			Log_Init_Subprocess("Auth");
-			Conn_CloseAllSockets(NONE);
-			result = PAM_Authenticate(Client);
-			if (write(pipefd[1], &result, sizeof(result)) != sizeof(result))
-				Log_Subprocess(LOG_ERR,
-					       "Failed to pipe result to parent!");
-			Log_Exit_Subprocess("Auth");
-			exit(0);
+		/* Queue PAM authentication for the authenticator worker
+		 * processes; the job carries user name, IDENT name, address
+		 * and password of the client. Make sure that its timeout is
+		 * set higher than the login timeout! */
+		if (!Add_Job_Field(job, &len, Client_OrigUser(Client))
+		    || !Add_Job_Field(job, &len, Client_User(Client))
+		    || !Add_Job_Field(job, &len, Client_Hostname(Client))
+		    || !Add_Job_Field(job, &len, Conn_Password(conn))) {
+			Client_Reject(Client, "Bad password", false);
+			return DISCONNECTED;
 		}
+		if (!Proc_PoolStart(Conn_GetProcStat(conn), &Auth_Pool, conn,
+				    job, len, Conf_PongTimeout + 1)) {
+			Client_Reject(Client, "Internal error", false);
+			return DISCONNECTED;
+		}
+		Conn_CheckReading(conn);
+		LogDebug("Authentication of connection %d queued.", conn);
+		return CONNECTED;
 	} else return CONNECTED;
 #else
 	/* Check global server password ... */
@@ -207,44 +236,93 @@ Login_User_PostAuth(CLIENT *Client)
 #ifdef PAM
 
 /**
- * Read result of the authenticator sub-process from pipe
+ * Append a string, including its terminating NULL byte, to a job for the
+ * authenticator worker processes.
+ *
+ * @param Job	Job buffer (PROC_JOB_LEN bytes).
+ * @param Len	Length of the job data, updated.
+ * @param Str	String to append.
+ * @returns	true on success, false if the job buffer is too small.
+ */
+static bool
+Add_Job_Field(char *Job, size_t *Len, const char *Str)
+{
+	size_t len = strlen(Str) + 1;
+
+	if (*Len + len > PROC_JOB_LEN)
+		return false;
+	memcpy(Job + *Len, Str, len);
+	*Len += len;
+	return true;
+} /* Add_Job_Field */
+
+/**
+ * Authenticate a client using PAM (authenticator worker process).
+ *
+ * @param Job		User name, IDENT name, address and password of the
+ *			client, each terminated by a NULL byte.
+ * @param Len		Length of the job data.
+ * @param fd		(ignored file descriptor)
+ * @param Result	Buffer for the result.
+ * @param ResultLen	Size of the buffer.
+ * @returns		Length of the result, 0 if the job is malformed.
+ */
+static size_t
+Do_Authenticate(const void *Job, size_t Len, UNUSED int fd, void *Result,
+		size_t ResultLen)
+{
+	const char *field[4], *ptr = Job, *end;
+	int i, result;
+
+	for (i = 0; i < 4; i++) {
+		end = memchr(ptr, '\0', Len - (size_t)(ptr - (const char *)Job));
+		if (!end)
+			return 0;
+		field[i] = ptr;
+		ptr = end + 1;
+	}
+
+	if (ResultLen < sizeof(result))
+		return 0;
+	result = PAM_Authenticate(field[0], field[1], field[2], field[3]);
+	memcpy(Result, &result, sizeof(result));
+	return sizeof(result);
+} /* Do_Authenticate */
+
+/**
+ * Handle the result of an authenticator worker process.
  *
- * @param r_fd		File descriptor of the pipe.
- * @param events	(ignored IO specification)
+ * @param Idx		Connection index.
+ * @param Result	Result of PAM_Authenticate() or NULL if the worker
+ *			process failed or timed out.
+ * @param Len		Length of the result.
  */
 static void
-cb_Read_Auth_Result(int r_fd, UNUSED short events)
+cb_Read_Auth_Result(int Idx, const void *Result, size_t Len)
 {
 	char user[CLIENT_USER_LEN], *ptr;
-	CONN_ID conn;
 	CLIENT *client;
 	int result;
-	size_t len;
 	PROC_STAT *proc;
 
-	LogDebug("Auth: Got callback on fd %d, events %d", r_fd, events);
-	conn = Conn_GetFromProc(r_fd);
-	if (conn == NONE) {
-		/* Ops, none found? Probably the connection has already
-		 * been closed!? We'll ignore that ... */
-		io_close(r_fd);
-		LogDebug("Auth: Got callback for unknown connection!?");
-		return;
-	}
-	proc = Conn_GetProcStat(conn);
-	client = Conn_GetClient(conn);
+	LogDebug("Auth: Got result for connection %d (%d bytes)", Idx,
+		 Result ? (int)Len : -1);
+	proc = Conn_GetProcStat(Idx);
+	assert(Proc_InProgress(proc));
+	Proc_InitStruct(proc);
+	client = Conn_GetClient(Idx);
 
-	/* Read result from pipe */
-	len = Proc_Read(proc, &result, sizeof(result));
-	Proc_Close(proc);
-	if (len == 0)
+	if (!Result) {
+		Log(LOG_ERR, "Auth: No result for connection %d!", Idx);
+		Client_Reject(client, "Internal error", false);
 		return;
-
-	if (len != sizeof(result)) {
+	}
+	if (Len != sizeof(result)) {
 		Log(LOG_CRIT, "Auth: Got malformed result!");
 		Client_Reject(client, "Internal error", false);
 		return;
 	}
+	memcpy(&result, Result, sizeof(result));
 
 	if (result == true) {
 		/* Authentication succeeded, now set the correct user name
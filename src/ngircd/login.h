@@ -17,6 +17,9 @@
  * Functions to deal with client logins (header)
  */
 
+GLOBAL void Login_Init PARAMS((void));
+GLOBAL void Login_Exit PARAMS((void));
+
 GLOBAL bool Login_User PARAMS((CLIENT * Client));
 GLOBAL bool Login_User_PostAuth PARAMS((CLIENT *Client));
 
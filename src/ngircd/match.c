@@ -32,6 +32,8 @@
 
 static int Matche PARAMS(( const char *p, const char *t ));
 static int Matche_After_Star PARAMS(( const char *p, const char *t ));
+static bool Match_Glob PARAMS((const char *p, const char *p_end,
+			       const char *t, const char *t_end));
 
 #define MATCH_PATTERN	6	/**< bad pattern */
 #define MATCH_LITERAL	5	/**< match failure on literal match */
@@ -100,6 +102,122 @@ MatchCaseInsensitiveList(const char *Pattern, const char *String,
 	return false;
 } /* MatchCaseInsensitive */
 
+/**
+ * Compile a pattern for case-insensitive matching using MatchCompiled().
+ *
+ * The pattern is case-folded, and its literal prefix (up to the first
+ * wildcard) and suffix (after the last wildcard) as well as the length
+ * bounds of matching strings are precomputed, so that most strings can be
+ * rejected without running the wildcard matcher at all.
+ *
+ * @param Mask Compiled pattern (output)
+ * @param Pattern Pattern to compile, at most MASK_LEN-1 characters long
+ */
+GLOBAL void
+MatchCompile(MATCH_MASK *Mask, const char *Pattern)
+{
+	const char *first, *last;
+	size_t i, stars = 0;
+
+	assert(Mask != NULL);
+	assert(Pattern != NULL);
+
+	strlcpy(Mask->pattern, Pattern, sizeof(Mask->pattern));
+	ngt_LowerStr(Mask->pattern);
+	Mask->len = strlen(Mask->pattern);
+
+	for (i = 0; i < Mask->len; i++) {
+		if (Mask->pattern[i] == '*')
+			stars++;
+	}
+	Mask->min_len = Mask->len - stars;
+	Mask->max_len = stars ? (size_t)-1 : Mask->len;
+
+	first = strpbrk(Mask->pattern, "*?");
+	if (!first) {
+		/* No wildcards at all */
+		Mask->prefix_len = Mask->len;
+		Mask->suffix_len = 0;
+		return;
+	}
+	for (last = Mask->pattern + Mask->len - 1; *last != '*' && *last != '?';
+	     last--)
+		/* nothing */ ;
+	Mask->prefix_len = (size_t)(first - Mask->pattern);
+	Mask->suffix_len = Mask->len - (size_t)(last - Mask->pattern) - 1;
+} /* MatchCompile */
+
+/**
+ * Match string with a compiled pattern.
+ *
+ * Only "*" and "?" are wildcards, all other characters are matched
+ * literally, and no recursion is used.
+ *
+ * @param Mask Pattern compiled using MatchCompile()
+ * @param String Input string, already converted to lower case
+ * @param Len Length of the input string
+ * @return true if pattern matches
+ */
+GLOBAL bool
+MatchCompiled(const MATCH_MASK *Mask, const char *String, size_t Len)
+{
+	assert(Mask != NULL);
+	assert(String != NULL);
+
+	if (Len < Mask->min_len || Len > Mask->max_len)
+		return false;
+	if (memcmp(String, Mask->pattern, Mask->prefix_len) != 0)
+		return false;
+	if (Mask->suffix_len > 0
+	    && memcmp(String + Len - Mask->suffix_len,
+		      Mask->pattern + Mask->len - Mask->suffix_len,
+		      Mask->suffix_len) != 0)
+		return false;
+
+	return Match_Glob(Mask->pattern + Mask->prefix_len,
+			  Mask->pattern + Mask->len - Mask->suffix_len,
+			  String + Mask->prefix_len,
+			  String + Len - Mask->suffix_len);
+} /* MatchCompiled */
+
+/**
+ * Match text with a pattern containing "*" and "?" wildcards.
+ *
+ * When a mismatch occurs after a "*", the match is resumed right after the
+ * "*" at the next position of the text where the character following the
+ * "*" occurs; earlier "*"s never have to be revisited, because the later
+ * "*" can absorb any text they could have absorbed.
+ */
+static bool
+Match_Glob(const char *p, const char *p_end, const char *t, const char *t_end)
+{
+	const char *star_p = NULL, *star_t = NULL;
+
+	while (t < t_end) {
+		if (p < p_end && *p == '*') {
+			star_p = ++p;
+			star_t = t;
+		} else if (p < p_end && (*p == '?' || *p == *t)) {
+			p++;
+			t++;
+		} else if (star_p) {
+			p = star_p;
+			t = ++star_t;
+			if (p < p_end && *p != '*' && *p != '?') {
+				/* Skip to the next candidate position */
+				t = memchr(t, *p, (size_t)(t_end - t));
+				if (!t)
+					return false;
+				star_t = t;
+			}
+		} else
+			return false;
+	}
+	while (p < p_end && *p == '*')
+		p++;
+	return p == p_end;
+} /* Match_Glob */
+
 static int
 Matche( const char *p, const char *t )
 {
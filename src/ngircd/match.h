@@ -17,6 +17,21 @@
  * Wildcard pattern matching (header)
  */
 
+#include "defines.h"
+
+/**
+ * Compiled pattern, see MatchCompile().
+ * This struct must not be accessed directly!
+ */
+typedef struct _Match_Mask {
+	size_t min_len;		/**< Min. length of a matching string */
+	size_t max_len;		/**< Max. length of a matching string */
+	size_t prefix_len;	/**< Length of the literal prefix */
+	size_t suffix_len;	/**< Length of the literal suffix */
+	size_t len;		/**< Length of the pattern */
+	char pattern[MASK_LEN];	/**< Case-folded pattern */
+} MATCH_MASK;
+
 GLOBAL bool Match PARAMS((const char *Pattern, const char *String));
 
 GLOBAL bool MatchCaseInsensitive PARAMS((const char *Pattern,
@@ -26,6 +41,10 @@ GLOBAL bool MatchCaseInsensitiveList PARAMS((const char *Pattern,
 					     const char *String,
 					     const char *Separator));
 
+GLOBAL void MatchCompile PARAMS((MATCH_MASK *Mask, const char *Pattern));
+GLOBAL bool MatchCompiled PARAMS((const MATCH_MASK *Mask, const char *String,
+				  size_t Len));
+
 #endif
 
 /* -eof- */
@@ -36,6 +36,8 @@
 #define RPL_SERVLIST_MSG		"234 %s %s %s %s %d %d :%s"
 #define RPL_SERVLISTEND_MSG		"235 %s %s %s :End of service listing"
 #define RPL_STATSUPTIME			"242 %s :Server Up %u days %u:%02u:%02u"
+#define RPL_STATSQUEUE_MSG		"249 %s :Login queue: %ld waiting (max. %ld), %ld rejected, %d logins per second"
+#define RPL_STATSRESOLVE_MSG		"249 %s :Host name cache: %ld entries (max. %d), %ld hits, %ld misses"
 #define RPL_LUSERCLIENT_MSG		"251 %s :There are %ld users and %ld services on %ld servers"
 #define RPL_LUSEROP_MSG			"252 %s %lu :operator(s) online"
 #define RPL_LUSERUNKNOWN_MSG		"253 %s %lu :unknown connection(s)"
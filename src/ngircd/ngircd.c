@@ -40,6 +40,8 @@
 #include "channel.h"
 #include "conf.h"
 #include "log.h"
+#include "login.h"
+#include "resolve.h"
 #include "sighandlers.h"
 #include "io.h"
 
@@ -254,6 +256,10 @@ main(int argc, const char *argv[])
 		Conf_Init();
 		Log_ReInit();
 
+		/* Read resolver configuration before chroot() */
+		Resolve_Init();
+		Login_Init();
+
 		/* Initialize the "main program":
 		 * chroot environment, user and group ID, ... */
 		if (!NGIRCd_Init(NGIRCd_NoDaemon)) {
@@ -317,6 +323,8 @@ main(int argc, const char *argv[])
 		Conn_Handler();
 
 		Conn_Exit();
+		Login_Exit();
+		Resolve_Exit();
 		Client_Exit();
 		Channel_Exit();
 		Class_Exit();
@@ -31,7 +31,6 @@
 #include "defines.h"
 #include "log.h"
 #include "conn.h"
-#include "client.h"
 #include "conf.h"
 
 #include "pam.h"
@@ -84,32 +83,43 @@ static struct pam_conv conv = {
 
 /**
  * Authenticate a connecting client using PAM.
- * @param Client The client to authenticate.
+ *
+ * This function is called in the authenticator worker processes, so it
+ * must not access the client structures of the daemon.
+ *
+ * @param User The user name supplied by the client.
+ * @param RUser The (remote) user name of the client, see IDENT.
+ * @param Host The host name or IP address of the client.
+ * @param Password The password supplied by the client.
  * @return true when authentication succeeded, false otherwise.
  */
 GLOBAL bool
-PAM_Authenticate(CLIENT *Client) {
+PAM_Authenticate(const char *User, const char *RUser, const char *Host,
+		 const char *Password) {
 	pam_handle_t *pam;
 	int retval = PAM_SUCCESS;
 
-	LogDebug("PAM: Authenticate \"%s\" (%s) ...",
-		 Client_OrigUser(Client), Client_Mask(Client));
+	LogDebug("PAM: Authenticate \"%s\" (%s@%s) ...", User, RUser, Host);
 
 	/* Set supplied client password */
 	if (password)
 		free(password);
-	password = strdup(Conn_Password(Client_Conn(Client)));
-	conv.appdata_ptr = Conn_Password(Client_Conn(Client));
+	password = strdup(Password);
+	if (!password) {
+		Log(LOG_EMERG, "Can't allocate memory! [PAM_Authenticate]");
+		return false;
+	}
+	conv.appdata_ptr = password;
 
 	/* Initialize PAM */
-	retval = pam_start(Conf_PAMServiceName, Client_OrigUser(Client), &conv, &pam);
+	retval = pam_start(Conf_PAMServiceName, User, &conv, &pam);
 	if (retval != PAM_SUCCESS) {
 		Log(LOG_ERR, "PAM: Failed to create authenticator! (%d)", retval);
 		return false;
 	}
 
-	pam_set_item(pam, PAM_RUSER, Client_User(Client));
-	pam_set_item(pam, PAM_RHOST, Client_Hostname(Client));
+	pam_set_item(pam, PAM_RUSER, RUser);
+	pam_set_item(pam, PAM_RHOST, Host);
 #if defined(HAVE_PAM_FAIL_DELAY) && !defined(NO_PAM_FAIL_DELAY)
 	pam_fail_delay(pam, 0);
 #endif
@@ -119,12 +129,11 @@ PAM_Authenticate(CLIENT *Client) {
 
 	/* Success? */
 	if (retval == PAM_SUCCESS)
-		Log(LOG_INFO, "PAM: Authenticated \"%s\" (%s).",
-		    Client_OrigUser(Client), Client_Mask(Client));
+		Log(LOG_INFO, "PAM: Authenticated \"%s\" (%s@%s).",
+		    User, RUser, Host);
 	else
-		Log(LOG_ERR, "PAM: Error on \"%s\" (%s): %s",
-		    Client_OrigUser(Client), Client_Mask(Client),
-		    pam_strerror(pam, retval));
+		Log(LOG_ERR, "PAM: Error on \"%s\" (%s@%s): %s",
+		    User, RUser, Host, pam_strerror(pam, retval));
 
 	/* Free PAM structures */
 	if (pam_end(pam, retval) != PAM_SUCCESS)
@@ -19,7 +19,8 @@
  * PAM User Authentication (header)
  */
 
-GLOBAL bool PAM_Authenticate PARAMS((CLIENT *Client));
+GLOBAL bool PAM_Authenticate PARAMS((const char *User, const char *RUser,
+				      const char *Host, const char *Password));
 
 #endif	/* __pam_h__ */
 
@@ -22,15 +22,73 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <time.h>
 
+#include "defines.h"
 #include "log.h"
 #include "io.h"
 #include "sighandlers.h"
 
 #include "proc.h"
 
+/** Header of messages between a pool and its workers */
+typedef struct _Proc_Msg {
+	UINT32 id;		/**< Job ID */
+	UINT32 len;		/**< Length of the data following */
+} PROC_MSG;
+
+/** Worker process of a pool */
+typedef struct _Proc_Worker {
+	pid_t pid;		/**< PID of the worker or 0 if not running */
+	int fd;			/**< Socket to the worker or -1 */
+	int job;		/**< Job in progress or NONE */
+	size_t rlen;		/**< Bytes in the receive buffer */
+	char rbuf[sizeof(PROC_MSG) + PROC_JOB_LEN];	/**< Receive buffer */
+} PROC_WORKER;
+
+/** Job of a pool */
+typedef struct _Proc_Job {
+	int token;		/**< Token of the owner or NONE if canceled */
+	bool used;		/**< Entry in use? */
+	UINT32 id;		/**< Job ID, see PROC_MSG */
+	int next;		/**< Next job in queue or free list */
+	int fd;			/**< File descriptor passed to the worker */
+	time_t deadline;	/**< Time after which the job fails */
+	size_t len;		/**< Length of the job data */
+	char data[PROC_JOB_LEN];	/**< Job data */
+} PROC_JOB;
+
+/** Owner of a socket to a worker process, see cb_Worker() */
+typedef struct _Proc_Fd {
+	PROC_POOL *pool;	/**< Pool of the worker or NULL */
+	int worker;		/**< Index of the worker */
+} PROC_FD;
+
+static PROC_FD *My_Fds;
+static int My_FdsSize;
+
+/** List of all initialized pools */
+static PROC_POOL *My_Pools;
+
+static pid_t Fork_Child PARAMS((void));
+static bool Set_Fd PARAMS((int fd, PROC_POOL *pool, int worker));
+static void Clear_Fd PARAMS((int fd));
+static int Close_Fds PARAMS((int fd));
+
+static bool Start_Worker PARAMS((PROC_POOL *pool, int w));
+static int Stop_Worker PARAMS((PROC_POOL *pool, int w, int sig));
+static void Worker_Main PARAMS((PROC_POOL *pool, int fd));
+static void Worker_Failed PARAMS((PROC_POOL *pool, int w, int sig));
+static void cb_Worker PARAMS((int fd, short events));
+
+static int New_Job PARAMS((PROC_POOL *pool));
+static void Free_Job PARAMS((PROC_POOL *pool, int j));
+static bool Send_Job PARAMS((PROC_POOL *pool, int w, int j));
+static void Dispatch_Jobs PARAMS((PROC_POOL *pool));
+
 /**
  * Initialize process structure.
  */
@@ -38,32 +96,295 @@ GLOBAL void
 Proc_InitStruct (PROC_STAT *proc)
 {
 	assert(proc != NULL);
-	proc->pid = 0;
-	proc->pipe_fd = -1;
+	proc->pool = NULL;
+	proc->job = NONE;
 }
 
 /**
- * Fork a child process.
+ * Generic signal handler for forked child processes.
  */
-GLOBAL pid_t
-Proc_Fork(PROC_STAT *proc, int *pipefds, void (*cbfunc)(int, short), int timeout)
+GLOBAL void
+Proc_GenericSignalHandler(int Signal)
 {
-	pid_t pid;
-#ifndef HAVE_ARC4RANDOM
-	unsigned int seed;
+	switch(Signal) {
+	case SIGTERM:
+#ifdef DEBUG
+		Log_Subprocess(LOG_DEBUG, "Child got TERM signal, exiting.");
 #endif
+		exit(1);
+	case SIGALRM:
+#ifdef DEBUG
+		Log_Subprocess(LOG_DEBUG, "Child got ALARM signal, exiting.");
+#endif
+		exit(1);
+	}
+}
 
-	assert(proc != NULL);
-	assert(pipefds != NULL);
+/**
+ * Cancel the job of a worker pool tracked by a process structure.
+ */
+GLOBAL void
+Proc_Close(PROC_STAT *proc)
+{
+	if (proc->job != NONE)
+		Proc_PoolCancel(proc->pool, proc->job);
+
+	Proc_InitStruct(proc);
+}
+
+/**
+ * Initialize a pool of worker processes.
+ *
+ * Workers are forked on demand, when a job is submitted and all running
+ * workers are busy, and then handle one job after the other until the pool
+ * is shut down. A worker is killed and replaced when it exceeds the job
+ * timeout, and the job fails when the worker dies while handling it.
+ *
+ * @param pool		Pool structure to initialize.
+ * @param name		Name of the pool, used for logging.
+ * @param size		Max. number of worker processes.
+ * @param timeout	Max. time of a job (including waiting) in seconds.
+ * @param initfunc	Function called in new worker processes or NULL.
+ * @param jobfunc	Function handling a job in a worker process; it gets
+ *			the job data, an optional file descriptor (or -1) and
+ *			a buffer for the result, and returns the result length.
+ * @param cbfunc	Function called in the daemon with the token and the
+ *			result of a job; the result is NULL if the job failed.
+ */
+GLOBAL void
+Proc_PoolInit(PROC_POOL *pool, const char *name, int size, int timeout,
+	      void (*initfunc)(void),
+	      size_t (*jobfunc)(const void *, size_t, int, void *, size_t),
+	      void (*cbfunc)(int, const void *, size_t))
+{
+	int w;
+
+	assert(pool != NULL);
+	assert(name != NULL);
+	assert(jobfunc != NULL);
 	assert(cbfunc != NULL);
 
-	if (pipe(pipefds) != 0) {
-		Log(LOG_ALERT, "Can't create output pipe for child process: %s!",
-		    strerror(errno));
-		return -1;
+	memset(pool, 0, sizeof(PROC_POOL));
+	pool->name = name;
+	pool->size = size > 0 ? size : 1;
+	pool->timeout = timeout;
+	pool->initfunc = initfunc;
+	pool->jobfunc = jobfunc;
+	pool->cbfunc = cbfunc;
+	pool->free_head = pool->queue_head = pool->queue_tail = NONE;
+
+	pool->workers = calloc((size_t)pool->size, sizeof(PROC_WORKER));
+	if (!pool->workers) {
+		Log(LOG_EMERG, "Can't allocate memory! [Proc_PoolInit]");
+		pool->size = 0;
+	}
+	for (w = 0; w < pool->size; w++) {
+		pool->workers[w].fd = -1;
+		pool->workers[w].job = NONE;
+	}
+
+	pool->next = My_Pools;
+	My_Pools = pool;
+} /* Proc_PoolInit */
+
+/**
+ * Shut down a pool of worker processes and discard all pending jobs.
+ *
+ * @param pool	Pool structure.
+ */
+GLOBAL void
+Proc_PoolExit(PROC_POOL *pool)
+{
+	PROC_POOL **p;
+	int w, j;
+
+	assert(pool != NULL);
+
+	for (w = 0; w < pool->size; w++)
+		(void)Stop_Worker(pool, w, SIGTERM);
+	for (j = 0; j < pool->jobs_size; j++) {
+		if (pool->jobs[j].used)
+			Free_Job(pool, j);
 	}
+	free(pool->workers);
+	free(pool->jobs);
+
+	for (p = &My_Pools; *p; p = &(*p)->next) {
+		if (*p == pool) {
+			*p = pool->next;
+			break;
+		}
+	}
+	memset(pool, 0, sizeof(PROC_POOL));
+} /* Proc_PoolExit */
+
+/**
+ * Submit a job to a pool of worker processes.
+ *
+ * The callback function of the pool is called with the result later on,
+ * but never from within this function.
+ *
+ * @param pool	Pool structure.
+ * @param token	Token passed to the callback function.
+ * @param job	Job data.
+ * @param len	Length of the job data, max. PROC_JOB_LEN.
+ * @param fd	File descriptor passed to the worker or -1.
+ * @returns	Job index (for Proc_PoolCancel()) or NONE on error.
+ */
+GLOBAL int
+Proc_PoolSubmit(PROC_POOL *pool, int token, const void *job, size_t len,
+		int fd)
+{
+	PROC_JOB *jp;
+	int j;
+
+	assert(pool != NULL);
+	assert(token > NONE);
+	assert(len <= PROC_JOB_LEN);
+
+	if (pool->size < 1)
+		return NONE;
 
+	j = New_Job(pool);
+	if (j == NONE)
+		return NONE;
+
+	jp = &pool->jobs[j];
+	if (fd >= 0) {
+		jp->fd = dup(fd);
+		if (jp->fd < 0) {
+			Log(LOG_CRIT, "Can't duplicate socket %d for %s job: %s!",
+			    fd, pool->name, strerror(errno));
+			Free_Job(pool, j);
+			return NONE;
+		}
+	}
+	if (len > 0)
+		memcpy(jp->data, job, len);
+	jp->len = len;
+	jp->token = token;
+	jp->id = (UINT32)++pool->next_id;
+	jp->deadline = time(NULL) + pool->timeout;
+
+	if (pool->queue_tail != NONE)
+		pool->jobs[pool->queue_tail].next = j;
+	else
+		pool->queue_head = j;
+	pool->queue_tail = j;
+
+	Dispatch_Jobs(pool);
+	return j;
+} /* Proc_PoolSubmit */
+
+/**
+ * Cancel a job; its result (if any) is discarded.
+ *
+ * @param pool	Pool structure.
+ * @param job	Job index returned by Proc_PoolSubmit().
+ */
+GLOBAL void
+Proc_PoolCancel(PROC_POOL *pool, int job)
+{
+	assert(pool != NULL);
+	assert(job >= 0 && job < pool->jobs_size);
+	assert(pool->jobs[job].used);
+
+	/* Queued and running jobs are freed when they are dequeued or
+	 * have been finished by the worker, see Dispatch_Jobs() and
+	 * cb_Worker(). */
+	pool->jobs[job].token = NONE;
+} /* Proc_PoolCancel */
+
+/**
+ * Submit a job to a pool of worker processes and track it using a process
+ * structure.
+ *
+ * The job is canceled by Proc_Close(); the callback function of the pool
+ * must reset the process structure using Proc_InitStruct() before the
+ * result is handled.
+ *
+ * @param proc		Process structure.
+ * @param pool		Pool structure.
+ * @param token		Token passed to the callback function.
+ * @param job		Job data.
+ * @param len		Length of the job data, max. PROC_JOB_LEN.
+ * @param timeout	Max. time of this job in seconds, 0 for the default
+ *			timeout of the pool.
+ * @returns		true on success, false otherwise.
+ */
+GLOBAL bool
+Proc_PoolStart(PROC_STAT *proc, PROC_POOL *pool, int token, const void *job,
+	       size_t len, int timeout)
+{
+	int j;
+
+	assert(proc != NULL);
+	assert(!Proc_InProgress(proc));
+
+	j = Proc_PoolSubmit(pool, token, job, len, -1);
+	if (j == NONE)
+		return false;
+	if (timeout > 0)
+		pool->jobs[j].deadline = time(NULL) + timeout;
+
+	proc->pool = pool;
+	proc->job = j;
+	return true;
+} /* Proc_PoolStart */
+
+/**
+ * Handle timeouts of the jobs of all pools.
+ *
+ * Workers exceeding the timeout are killed, and jobs waiting in the queue
+ * for too long fail.
+ *
+ * @param now	Current time.
+ */
+GLOBAL void
+Proc_Timeout(time_t now)
+{
+	PROC_POOL *pool;
+	int w, j, token;
+
+	for (pool = My_Pools; pool; pool = pool->next) {
+		for (w = 0; w < pool->size; w++) {
+			j = pool->workers[w].job;
+			if (j == NONE || pool->jobs[j].deadline > now)
+				continue;
+			Log(LOG_WARNING,
+			    "%s worker process %ld timed out, killing it!",
+			    pool->name, (long)pool->workers[w].pid);
+			Worker_Failed(pool, w, SIGKILL);
+		}
+
+		while ((j = pool->queue_head) != NONE
+		       && pool->jobs[j].deadline <= now) {
+			pool->queue_head = pool->jobs[j].next;
+			if (pool->queue_head == NONE)
+				pool->queue_tail = NONE;
+			token = pool->jobs[j].token;
+			Free_Job(pool, j);
+			if (token == NONE)
+				continue;
+			Log(LOG_WARNING, "%s job timed out in queue!",
+			    pool->name);
+			pool->cbfunc(token, NULL, 0);
+		}
+	}
+} /* Proc_Timeout */
+
+/**
+ * Fork a child process and set up its environment.
+ *
+ * @returns		PID in the parent, 0 in the child, -1 on error.
+ */
+static pid_t
+Fork_Child(void)
+{
+	pid_t pid;
 #ifndef HAVE_ARC4RANDOM
+	unsigned int seed;
+
 	seed = (unsigned int)rand();
 #endif
 	pid = fork();
@@ -71,8 +392,6 @@ Proc_Fork(PROC_STAT *proc, int *pipefds, void (*cbfunc)(int, short), int timeout
 	case -1:
 		/* Error on fork: */
 		Log(LOG_CRIT, "Can't fork child process: %s!", strerror(errno));
-		close(pipefds[0]);
-		close(pipefds[1]);
 		return -1;
 	case 0:
 		/* New child process: */
@@ -85,88 +404,513 @@ Proc_Fork(PROC_STAT *proc, int *pipefds, void (*cbfunc)(int, short), int timeout
 		Signals_Exit();
 		signal(SIGTERM, Proc_GenericSignalHandler);
 		signal(SIGALRM, Proc_GenericSignalHandler);
-		close(pipefds[0]);
-		alarm(timeout);
 		return 0;
 	}
+	return pid;
+} /* Fork_Child */
 
-	/* Old parent process: */
-	close(pipefds[1]);
+/**
+ * Remember the owner of a file descriptor.
+ */
+static bool
+Set_Fd(int fd, PROC_POOL *pool, int worker)
+{
+	PROC_FD *tmp;
+	int size;
 
-	if (!io_setnonblock(pipefds[0])
-	 || !io_event_create(pipefds[0], IO_WANTREAD, cbfunc)) {
-		Log(LOG_CRIT, "Can't register callback for child process: %s!",
-		    strerror(errno));
-		close(pipefds[0]);
-		return -1;
+	assert(fd >= 0);
+
+	if (fd >= My_FdsSize) {
+		size = My_FdsSize ? My_FdsSize : 64;
+		while (size <= fd)
+			size *= 2;
+		tmp = realloc(My_Fds, (size_t)size * sizeof(PROC_FD));
+		if (!tmp) {
+			Log(LOG_EMERG, "Can't allocate memory! [Set_Fd]");
+			return false;
+		}
+		memset(tmp + My_FdsSize, 0,
+		       (size_t)(size - My_FdsSize) * sizeof(PROC_FD));
+		My_Fds = tmp;
+		My_FdsSize = size;
 	}
+	My_Fds[fd].pool = pool;
+	My_Fds[fd].worker = worker;
+	return true;
+} /* Set_Fd */
 
-	proc->pid = pid;
-	proc->pipe_fd = pipefds[0];
-	return pid;
+/**
+ * Forget the owner of a file descriptor.
+ */
+static void
+Clear_Fd(int fd)
+{
+	if (fd < 0 || fd >= My_FdsSize)
+		return;
+	My_Fds[fd].pool = NULL;
 }
 
 /**
- * Generic signal handler for forked child processes.
+ * Close all file descriptors of the daemon in a new child process, that is
+ * listening sockets, connections, the event notification descriptor, and
+ * sockets of the resolver and of other worker processes, so that the child
+ * doesn't keep any of them open.
+ *
+ * The standard input, output and error descriptors are kept, and the
+ * descriptor to keep is moved right behind them.
+ *
+ * @param fd	File descriptor to keep.
+ * @returns	The new number of the descriptor to keep.
  */
-GLOBAL void
-Proc_GenericSignalHandler(int Signal)
+static int
+Close_Fds(int fd)
 {
-	switch(Signal) {
-	case SIGTERM:
-#ifdef DEBUG
-		Log_Subprocess(LOG_DEBUG, "Child got TERM signal, exiting.");
+#ifndef HAVE_CLOSEFROM
+	int i, max;
 #endif
-		exit(1);
-	case SIGALRM:
-#ifdef DEBUG
-		Log_Subprocess(LOG_DEBUG, "Child got ALARM signal, exiting.");
+
+	if (fd != 3) {
+		if (dup2(fd, 3) < 0)
+			return -1;
+		close(fd);
+	}
+#ifdef SYSLOG
+	/* The connection to syslog is opened again on demand */
+	closelog();
 #endif
-		exit(1);
+#ifdef HAVE_CLOSEFROM
+	closefrom(4);
+#else
+	max = (int)sysconf(_SC_OPEN_MAX);
+	if (max < 0)
+		max = 1024;
+	for (i = 4; i < max; i++)
+		close(i);
+#endif
+	return 3;
+} /* Close_Fds */
+
+/**
+ * Fork a new worker process.
+ *
+ * @param pool	Pool structure.
+ * @param w	Index of the worker.
+ * @returns	true on success, false otherwise.
+ */
+static bool
+Start_Worker(PROC_POOL *pool, int w)
+{
+	PROC_WORKER *wp = &pool->workers[w];
+	int sv[2], fd;
+	pid_t pid;
+
+	assert(wp->pid == 0);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		Log(LOG_ALERT, "Can't create socket pair for %s worker: %s!",
+		    pool->name, strerror(errno));
+		return false;
+	}
+
+	pid = Fork_Child();
+	if (pid < 0) {
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	}
+	if (pid == 0) {
+		/* New worker process: don't keep any file descriptors of
+		 * the daemon open, except of the socket to the daemon */
+		fd = Close_Fds(sv[1]);
+		Log_Init_Subprocess(pool->name);
+		if (fd < 0) {
+			Log_Subprocess(LOG_CRIT,
+				       "Can't move socket of %s worker: %s!",
+				       pool->name, strerror(errno));
+			exit(1);
+		}
+		if (pool->initfunc)
+			pool->initfunc();
+		Worker_Main(pool, fd);
+		/* NOTREACHED */
+	}
+
+	close(sv[1]);
+	if (!io_setnonblock(sv[0])
+	    || !io_event_create(sv[0], IO_WANTREAD, cb_Worker)) {
+		Log(LOG_CRIT, "Can't register callback for %s worker: %s!",
+		    pool->name, strerror(errno));
+		close(sv[0]);
+		kill(pid, SIGTERM);
+		return false;
+	}
+	if (!Set_Fd(sv[0], pool, w)) {
+		io_close(sv[0]);
+		kill(pid, SIGTERM);
+		return false;
 	}
-}
+
+	wp->pid = pid;
+	wp->fd = sv[0];
+	wp->job = NONE;
+	wp->rlen = 0;
+	LogDebug("%s worker process %ld started (%d/%d).", pool->name,
+		 (long)pid, w + 1, pool->size);
+	return true;
+} /* Start_Worker */
 
 /**
- * Read bytes from a pipe of a forked child process.
- * In addition, this function makes sure that the child process is ignored
- * after all data has been read or a fatal error occurred.
+ * Stop a worker process.
+ *
+ * @param pool	Pool structure.
+ * @param w	Index of the worker.
+ * @param sig	Signal to send to the worker process.
+ * @returns	Job the worker was handling or NONE.
  */
-GLOBAL size_t
-Proc_Read(PROC_STAT *proc, void *buffer, size_t buflen)
+static int
+Stop_Worker(PROC_POOL *pool, int w, int sig)
 {
-	ssize_t bytes_read = 0;
+	PROC_WORKER *wp = &pool->workers[w];
+	int j = wp->job;
+
+	if (wp->fd >= 0) {
+		Clear_Fd(wp->fd);
+		io_close(wp->fd);
+	}
+	if (wp->pid > 0)
+		kill(wp->pid, sig);
+
+	wp->pid = 0;
+	wp->fd = -1;
+	wp->job = NONE;
+	wp->rlen = 0;
+	return j;
+} /* Stop_Worker */
+
+/**
+ * Main loop of a worker process: handle jobs until the daemon closes the
+ * socket.
+ *
+ * @param pool	Pool structure.
+ * @param fd	Socket to the daemon.
+ */
+static void
+Worker_Main(PROC_POOL *pool, int fd)
+{
+	char buf[sizeof(PROC_MSG) + PROC_JOB_LEN], data[PROC_JOB_LEN];
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr mh;
+	struct iovec iov;
+	PROC_MSG msg;
+	ssize_t r;
+	size_t len;
+	int job_fd;
+
+	for (;;) {
+		/* Read header and (optional) file descriptor ... */
+		memset(&mh, 0, sizeof(mh));
+		iov.iov_base = (void *)&msg;
+		iov.iov_len = sizeof(msg);
+		mh.msg_iov = &iov;
+		mh.msg_iovlen = 1;
+		mh.msg_control = cbuf;
+		mh.msg_controllen = sizeof(cbuf);
+		do {
+			r = recvmsg(fd, &mh, MSG_WAITALL);
+		} while (r < 0 && errno == EINTR);
+		if (r != (ssize_t)sizeof(msg) || msg.len > PROC_JOB_LEN)
+			break;
 
-	assert(buffer != NULL);
-	assert(buflen > 0);
+		job_fd = -1;
+		cmsg = CMSG_FIRSTHDR(&mh);
+		if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+		    && cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(&job_fd, CMSG_DATA(cmsg), sizeof(int));
 
-	bytes_read = read(proc->pipe_fd, buffer, buflen);
-	if (bytes_read < 0) {
-		if (errno == EAGAIN)
-			return 0;
-		Log(LOG_CRIT, "Can't read from child process %ld: %s",
-		    proc->pid, strerror(errno));
-		Proc_Close(proc);
-		bytes_read = 0;
-	} else if (bytes_read == 0) {
-		/* EOF: clean up */
-		LogDebug("Child process %ld: EOF reached, closing pipe.",
-		         proc->pid);
-		Proc_Close(proc);
+		/* ... and the job data */
+		for (len = 0; len < msg.len; len += (size_t)r) {
+			r = read(fd, data + len, msg.len - len);
+			if (r < 0 && errno == EINTR)
+				r = 0;
+			else if (r <= 0)
+				break;
+		}
+		if (len < msg.len)
+			break;
+
+		len = pool->jobfunc(data, len, job_fd, buf + sizeof(msg),
+				    PROC_JOB_LEN);
+		if (job_fd >= 0)
+			close(job_fd);
+
+		assert(len <= PROC_JOB_LEN);
+		msg.len = (UINT32)len;
+		memcpy(buf, &msg, sizeof(msg));
+		if (write(fd, buf, sizeof(msg) + len)
+		    != (ssize_t)(sizeof(msg) + len)) {
+			Log_Subprocess(LOG_CRIT,
+				       "%s: Can't write to parent: %s!",
+				       pool->name, strerror(errno));
+			break;
+		}
 	}
-	return (size_t)bytes_read;
-}
+	Log_Exit_Subprocess(pool->name);
+	exit(0);
+} /* Worker_Main */
 
 /**
- * Close pipe to a forked child process.
+ * Handle a worker process that died or has to be killed: fail its job and
+ * hand out the next jobs to a new worker.
+ *
+ * @param pool	Pool structure.
+ * @param w	Index of the worker.
+ * @param sig	Signal to send to the worker process.
  */
-GLOBAL void
-Proc_Close(PROC_STAT *proc)
+static void
+Worker_Failed(PROC_POOL *pool, int w, int sig)
 {
-	/* Close socket, if it exists */
-	if (proc->pipe_fd >= 0)
-		io_close(proc->pipe_fd);
+	int j, token;
 
-	Proc_InitStruct(proc);
-}
+	j = Stop_Worker(pool, w, sig);
+	if (j == NONE)
+		return;
+
+	token = pool->jobs[j].token;
+	Free_Job(pool, j);
+	Dispatch_Jobs(pool);
+	if (token != NONE)
+		pool->cbfunc(token, NULL, 0);
+} /* Worker_Failed */
+
+/**
+ * Read results of a worker process.
+ *
+ * @param fd		Socket to the worker process.
+ * @param events	(ignored IO specification)
+ */
+static void
+cb_Worker(int fd, UNUSED short events)
+{
+	char result[PROC_JOB_LEN];
+	PROC_WORKER *wp;
+	PROC_POOL *pool;
+	PROC_MSG msg;
+	ssize_t r;
+	size_t len;
+	int w, j, token;
+
+	if (fd >= My_FdsSize || !My_Fds[fd].pool) {
+		io_close(fd);
+		LogDebug("Got callback for unknown worker process!?");
+		return;
+	}
+	pool = My_Fds[fd].pool;
+	w = My_Fds[fd].worker;
+
+	for (;;) {
+		wp = &pool->workers[w];
+		if (wp->fd != fd)
+			return;
+
+		r = read(fd, wp->rbuf + wp->rlen, sizeof(wp->rbuf) - wp->rlen);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0 && errno == EAGAIN)
+			return;
+		if (r <= 0) {
+			if (r < 0)
+				Log(LOG_CRIT,
+				    "Can't read from %s worker process %ld: %s!",
+				    pool->name, (long)wp->pid, strerror(errno));
+			else if (wp->job != NONE)
+				Log(LOG_ERR,
+				    "%s worker process %ld died unexpectedly!",
+				    pool->name, (long)wp->pid);
+			Worker_Failed(pool, w, SIGKILL);
+			return;
+		}
+		wp->rlen += (size_t)r;
+
+		if (wp->rlen < sizeof(msg))
+			continue;
+		memcpy(&msg, wp->rbuf, sizeof(msg));
+		if (msg.len > PROC_JOB_LEN || wp->job == NONE
+		    || pool->jobs[wp->job].id != msg.id
+		    || wp->rlen > sizeof(msg) + msg.len) {
+			Log(LOG_CRIT, "Got malformed result from %s worker!",
+			    pool->name);
+			Worker_Failed(pool, w, SIGKILL);
+			return;
+		}
+		if (wp->rlen < sizeof(msg) + msg.len)
+			continue;
+
+		/* Result complete: free job and worker, call callback */
+		len = msg.len;
+		memcpy(result, wp->rbuf + sizeof(msg), len);
+		wp->rlen = 0;
+		j = wp->job;
+		wp->job = NONE;
+		token = pool->jobs[j].token;
+		Free_Job(pool, j);
+		Dispatch_Jobs(pool);
+		if (token != NONE)
+			pool->cbfunc(token, result, len);
+	}
+} /* cb_Worker */
+
+/**
+ * Allocate a new job structure.
+ */
+static int
+New_Job(PROC_POOL *pool)
+{
+	PROC_JOB *tmp;
+	int j, size;
+
+	if (pool->free_head == NONE) {
+		size = pool->jobs_size ? pool->jobs_size * 2 : 8;
+		tmp = realloc(pool->jobs, (size_t)size * sizeof(PROC_JOB));
+		if (!tmp) {
+			Log(LOG_EMERG, "Can't allocate memory! [New_Job]");
+			return NONE;
+		}
+		pool->jobs = tmp;
+		for (j = size - 1; j > pool->jobs_size; j--) {
+			pool->jobs[j].used = false;
+			pool->jobs[j].next = pool->free_head;
+			pool->free_head = j;
+		}
+		/* Use the first new structure right away */
+		j = pool->jobs_size;
+		pool->jobs_size = size;
+	} else {
+		j = pool->free_head;
+		pool->free_head = pool->jobs[j].next;
+	}
+
+	pool->jobs[j].used = true;
+	pool->jobs[j].token = NONE;
+	pool->jobs[j].next = NONE;
+	pool->jobs[j].fd = -1;
+	pool->jobs[j].len = 0;
+	return j;
+} /* New_Job */
+
+/**
+ * Free a job structure.
+ */
+static void
+Free_Job(PROC_POOL *pool, int j)
+{
+	assert(pool->jobs[j].used);
+
+	if (pool->jobs[j].fd >= 0)
+		close(pool->jobs[j].fd);
+	pool->jobs[j].used = false;
+	pool->jobs[j].next = pool->free_head;
+	pool->free_head = j;
+} /* Free_Job */
+
+/**
+ * Send a job to a worker process.
+ */
+static bool
+Send_Job(PROC_POOL *pool, int w, int j)
+{
+	char buf[sizeof(PROC_MSG) + PROC_JOB_LEN];
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	PROC_JOB *jp = &pool->jobs[j];
+	struct cmsghdr *cmsg;
+	struct msghdr mh;
+	struct iovec iov;
+	PROC_MSG msg;
+	ssize_t r;
+
+	msg.id = jp->id;
+	msg.len = (UINT32)jp->len;
+	memcpy(buf, &msg, sizeof(msg));
+	memcpy(buf + sizeof(msg), jp->data, jp->len);
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = buf;
+	iov.iov_len = sizeof(msg) + jp->len;
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	if (jp->fd >= 0) {
+		memset(cbuf, 0, sizeof(cbuf));
+		mh.msg_control = cbuf;
+		mh.msg_controllen = sizeof(cbuf);
+		cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &jp->fd, sizeof(int));
+	}
+
+	/* The worker is idle, so its socket buffer is empty and the job
+	 * can always be sent at once. */
+	r = sendmsg(pool->workers[w].fd, &mh, 0);
+	if (r != (ssize_t)iov.iov_len) {
+		Log(LOG_CRIT, "Can't send job to %s worker process %ld: %s!",
+		    pool->name, (long)pool->workers[w].pid,
+		    r < 0 ? strerror(errno) : "short write");
+		return false;
+	}
+
+	/* The worker has got its own copy of the file descriptor */
+	if (jp->fd >= 0) {
+		close(jp->fd);
+		jp->fd = -1;
+	}
+	pool->workers[w].job = j;
+	return true;
+} /* Send_Job */
+
+/**
+ * Hand out queued jobs to idle workers, starting new workers as needed.
+ */
+static void
+Dispatch_Jobs(PROC_POOL *pool)
+{
+	int j, w, idle;
+
+	while ((j = pool->queue_head) != NONE) {
+		if (pool->jobs[j].token == NONE) {
+			/* Canceled while waiting */
+			pool->queue_head = pool->jobs[j].next;
+			if (pool->queue_head == NONE)
+				pool->queue_tail = NONE;
+			Free_Job(pool, j);
+			continue;
+		}
+
+		idle = NONE;
+		for (w = 0; w < pool->size; w++) {
+			if (pool->workers[w].pid > 0
+			    && pool->workers[w].job == NONE) {
+				idle = w;
+				break;
+			}
+			if (pool->workers[w].pid == 0 && idle == NONE)
+				idle = w;
+		}
+		if (idle == NONE)
+			return;	/* All workers are busy */
+		if (pool->workers[idle].pid == 0 && !Start_Worker(pool, idle))
+			return;	/* Try again later */
+
+		if (!Send_Job(pool, idle, j)) {
+			/* Keep the job queued, try again later */
+			(void)Stop_Worker(pool, idle, SIGKILL);
+			return;
+		}
+		pool->queue_head = pool->jobs[j].next;
+		if (pool->queue_head == NONE)
+			pool->queue_tail = NONE;
+		pool->jobs[j].next = NONE;
+	}
+} /* Dispatch_Jobs */
 
 /* -eof- */
@@ -17,29 +17,64 @@
  * Process management (header)
  */
 
+#include <time.h>
+
 /** Process status. This struct must not be accessed directly! */
 typedef struct _Proc_Stat {
-	pid_t pid;	/**< PID of the child process or 0 if none */
-	int pipe_fd;	/**< Pipe file descriptor or -1 if none */
+	struct _Proc_Pool *pool;	/**< Pool of the job or NULL if none */
+	int job;	/**< Job of the worker pool or NONE if none */
 } PROC_STAT;
 
-/** Return true if sub-process is still running */
-#define Proc_InProgress(x)	((x)->pid != 0)
+/** Return true if the job of a worker pool is still running */
+#define Proc_InProgress(x)	((x)->job != NONE)
 
-/** Return file descriptor of pipe to sub-process (or -1 if none open) */
-#define Proc_GetPipeFd(x)	((x)->pipe_fd)
+/** Max. size of a job or result of a worker pool */
+#define PROC_JOB_LEN		1024
 
-GLOBAL void Proc_InitStruct PARAMS((PROC_STAT *proc));
+/**
+ * Pool of persistent worker processes, see Proc_PoolInit().
+ * This struct must not be accessed directly!
+ */
+typedef struct _Proc_Pool {
+	const char *name;	/**< Name of the pool, used for logging */
+	int size;		/**< Max. number of worker processes */
+	int timeout;		/**< Max. time of a job in seconds */
+	void (*initfunc) PARAMS((void));
+	size_t (*jobfunc) PARAMS((const void *, size_t, int, void *, size_t));
+	void (*cbfunc) PARAMS((int, const void *, size_t));
+	struct _Proc_Worker *workers;	/**< Worker processes */
+	struct _Proc_Job *jobs;		/**< Job table */
+	int jobs_size;		/**< Size of the job table */
+	int free_head;		/**< First unused job */
+	int queue_head;		/**< First job waiting for a worker */
+	int queue_tail;		/**< Last job waiting for a worker */
+	unsigned long next_id;	/**< ID of the next job */
+	struct _Proc_Pool *next;	/**< Next initialized pool */
+} PROC_POOL;
 
-GLOBAL pid_t Proc_Fork PARAMS((PROC_STAT *proc, int *pipefds,
-			       void (*cbfunc)(int, short), int timeout));
+GLOBAL void Proc_InitStruct PARAMS((PROC_STAT *proc));
 
 GLOBAL void Proc_GenericSignalHandler PARAMS((int Signal));
 
-GLOBAL size_t Proc_Read PARAMS((PROC_STAT *proc, void *buffer, size_t buflen));
-
 GLOBAL void Proc_Close PARAMS((PROC_STAT *proc));
 
+GLOBAL void Proc_PoolInit PARAMS((PROC_POOL *pool, const char *name,
+				  int size, int timeout,
+				  void (*initfunc)(void),
+				  size_t (*jobfunc)(const void *, size_t, int,
+						    void *, size_t),
+				  void (*cbfunc)(int, const void *, size_t)));
+GLOBAL void Proc_PoolExit PARAMS((PROC_POOL *pool));
+
+GLOBAL int Proc_PoolSubmit PARAMS((PROC_POOL *pool, int token,
+				   const void *job, size_t len, int fd));
+GLOBAL void Proc_PoolCancel PARAMS((PROC_POOL *pool, int job));
+GLOBAL bool Proc_PoolStart PARAMS((PROC_STAT *proc, PROC_POOL *pool,
+				   int token, const void *job, size_t len,
+				   int timeout));
+
+GLOBAL void Proc_Timeout PARAMS((time_t now));
+
 
 #endif
 
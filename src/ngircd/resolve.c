@@ -16,6 +16,16 @@
 /**
  * @file
  * Asynchronous resolver
+ *
+ * Host names and IP addresses are looked up using the DNS stub resolver of
+ * the daemon (see dns.c), and IDENT requests are made by the IDENT client
+ * of the daemon (see ident.c); both are driven by the main loop.
+ *
+ * The host names of IP addresses (or the fact that an IP address has no
+ * valid host name) are cached, for the "time to live" of the DNS records
+ * but at most RESOLVE_CACHE_TTL seconds (RESOLVE_CACHE_NEG_TTL seconds for
+ * failed lookups). The cache holds up to RESOLVE_CACHE_SIZE addresses, the
+ * least recently used entries are dropped when it is full.
  */
 
 #include <assert.h>
@@ -23,441 +33,874 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/stat.h>
 #include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <netdb.h>
-
-#ifdef IDENTAUTH
-#ifdef HAVE_IDENT_H
-#include <ident.h>
-#endif
-#endif
 
 #include "conn.h"
 #include "conf.h"
+#include "dns.h"
+#include "ident.h"
+#include "io.h"
 #include "log.h"
 #include "ng_ipaddr.h"
 
 #include "resolve.h"
 
-static void Do_ResolveAddr PARAMS(( const ng_ipaddr_t *Addr, int Sock, int w_fd ));
-static void Do_ResolveName PARAMS(( const char *Host, int w_fd ));
+/** Max. number of addresses of a host name (Resolve_Name()) */
+#define RESOLVE_ADDRS	(2 * DNS_ADDRS)
+
+/* How to cache the result of Resolve_Addr() */
+#define CACHE_NONE	0	/* Don't cache: lookup failed, or cached */
+#define CACHE_POSITIVE	1	/* Verified host name */
+#define CACHE_NEGATIVE	2	/* No valid host name */
+
+/** Lookup in progress */
+typedef struct _Resolve_Request {
+	int token;			/**< Token passed to the callback function,
+					     NONE if the structure is unused */
+	int next;			/**< Next unused structure, or next
+					     request in the list of completed
+					     requests */
+	int prev;			/**< Previous request in the list of
+					     completed requests */
+	int query[2];			/**< DNS queries in progress or NONE */
+	int ident;			/**< IDENT query in progress or NONE */
+	bool ready;			/**< In the list of completed requests */
+	time_t deadline;		/**< Time after which DNS queries fail */
+	ng_ipaddr_t addr;		/**< IP address looked up */
+	char name[CLIENT_HOST_LEN];	/**< Host name of the IP address */
+	char host[CLIENT_HOST_LEN];	/**< Result: verified host name */
+	char user[CLIENT_USER_LEN];	/**< Result: IDENT user name */
+	ng_ipaddr_t addrs[2][DNS_ADDRS]; /**< Result: IPv6 and IPv4 addresses */
+	size_t count[2];		/**< Result: number of addresses */
+	int cache;			/**< Result: CACHE_NONE, ... */
+	UINT32 ttl;			/**< Result: time to live of host name */
+	void (*addr_cb) PARAMS((int, const char *, const char *));
+	void (*name_cb) PARAMS((int, const ng_ipaddr_t *, size_t));
+} RESOLVE;
+
+/** Cached host name of an IP address */
+typedef struct _Resolve_Cache {
+	ng_ipaddr_t addr;		/**< IP address */
+	char host[CLIENT_HOST_LEN];	/**< Verified host name or empty */
+	time_t expires;			/**< Time at which the entry expires */
+	int hnext;			/**< Next entry of the hash chain, or
+					     next unused entry */
+	int prev, next;			/**< Links of the LRU list */
+} RESOLVE_CACHE;
+
+static int New_Request PARAMS((int Token));
+static void Free_Request PARAMS((int Idx));
+static void Check_Done PARAMS((int Idx));
+static void cb_Reverse_Lookup PARAMS((int Idx, const DNS_ANSWER *Answer));
+static void cb_Forward_Lookup PARAMS((int Idx, const DNS_ANSWER *Answer));
+static void cb_Name_Lookup PARAMS((int Idx, const DNS_ANSWER *Answer));
+#ifdef IDENTAUTH
+static void cb_Ident_Result PARAMS((int Idx, const char *User));
+#endif
+static void Ready_Add PARAMS((int Idx));
+static void Ready_Del PARAMS((int Idx));
+static void Lru_Unlink PARAMS((int Idx));
+static void Lru_Push PARAMS((int Idx));
+static int Cache_Find PARAMS((const ng_ipaddr_t *Addr));
+static int Cache_Lookup PARAMS((const ng_ipaddr_t *Addr, time_t Now));
+static void Cache_Add PARAMS((const ng_ipaddr_t *Addr, const char *Host,
+			      UINT32 Ttl, time_t Now));
+static void Cache_Del PARAMS((int Idx));
 
-#ifdef WANT_IPV6
-extern bool Conf_ConnectIPv4;
-extern bool Conf_ConnectIPv6;
+static RESOLVE *My_Requests;
+static int My_RequestsSize;
+static int Free_Head = NONE;
+
+/** Completed requests, whose callback functions are called by
+ * Resolve_Timeout() */
+static int Ready_Head = NONE, Ready_Tail = NONE;
+
+static RESOLVE_CACHE *My_Cache;
+static int My_CacheSize, My_CacheUsed;
+static int Cache_Free = NONE;
+static int Lru_Head = NONE, Lru_Tail = NONE;
+
+/** First cache entry of each hash chain (RESOLVE_CACHE_SIZE buckets) */
+static int *My_CacheHash;
+
+static long Cache_Hits, Cache_Misses;
+
+
+/**
+ * Initialize the resolver and read its configuration.
+ */
+GLOBAL void
+Resolve_Init(void)
+{
+	Dns_Init(Conf_ResolvConfFile);
+} /* Resolve_Init */
+
+/**
+ * Cancel all lookups and shut down the resolver.
+ */
+GLOBAL void
+Resolve_Exit(void)
+{
+	int i;
+
+	for (i = 0; i < My_RequestsSize; i++) {
+		if (My_Requests[i].token != NONE)
+			Free_Request(i);
+	}
+	free(My_Requests);
+	My_Requests = NULL;
+	My_RequestsSize = 0;
+	Free_Head = Ready_Head = Ready_Tail = NONE;
+
+	free(My_Cache);
+	My_Cache = NULL;
+	My_CacheSize = My_CacheUsed = 0;
+	Cache_Free = Lru_Head = Lru_Tail = NONE;
+	free(My_CacheHash);
+	My_CacheHash = NULL;
+
+#ifdef IDENTAUTH
+	Ident_Exit();
 #endif
+	Dns_Exit();
+} /* Resolve_Exit */
 
+/**
+ * Initialize resolver status structure.
+ */
+GLOBAL void
+Resolve_InitStruct(RES_STAT *s)
+{
+	assert(s != NULL);
+	s->id = 0;
+} /* Resolve_InitStruct */
 
 /**
  * Resolve IP (asynchronous!).
+ *
+ * The IP address is looked up in DNS, and the host name found is verified
+ * by looking up its addresses ("forward-confirmed reverse DNS"), unless
+ * the result is cached already. When IDENT is enabled, an IDENT request is
+ * made at the same time.
+ *
+ * When the lookup has been completed, the callback function is called with
+ * the token, the host name (the IP address if no valid host name has been
+ * found) and the IDENT user name (or an empty string). It must reset the
+ * status structure using Resolve_InitStruct().
+ *
+ * @param s		Resolver status structure.
+ * @param Token		Token passed to the callback function.
+ * @param Addr		IP address to look up.
+ * @param identsock	Socket for the IDENT request or -1.
+ * @param cbfunc	Callback function.
+ * @returns		true if the lookup has been started.
  */
 GLOBAL bool
-Resolve_Addr(PROC_STAT * s, const ng_ipaddr_t *Addr, int identsock,
-	     void (*cbfunc) (int, short))
+Resolve_Addr(RES_STAT *s, int Token, const ng_ipaddr_t *Addr, int identsock,
+	     void (*cbfunc) (int, const char *, const char *))
 {
-	int pipefd[2];
-	pid_t pid;
+	RESOLVE *r;
+	int i, c;
 
 	assert(s != NULL);
+	assert(!Resolve_InProgress(s));
+	assert(Addr != NULL);
+	assert(cbfunc != NULL);
 
-	pid = Proc_Fork(s, pipefd, cbfunc, RESOLVER_TIMEOUT);
-	if (pid > 0) {
-		LogDebug("Resolver for %s created (PID %d).", ng_ipaddr_tostr(Addr), pid);
-		return true;
-	} else if( pid == 0 ) {
-		/* Sub process */
-		Log_Init_Subprocess("Resolver");
-		Conn_CloseAllSockets(identsock);
-		Do_ResolveAddr(Addr, identsock, pipefd[1]);
-		Log_Exit_Subprocess("Resolver");
-		exit(0);
+	i = New_Request(Token);
+	if (i == NONE)
+		return false;
+
+	r = &My_Requests[i];
+	r->addr = *Addr;
+	r->addr_cb = cbfunc;
+	ng_ipaddr_tostr_r(Addr, r->host);
+
+	c = Cache_Lookup(Addr, time(NULL));
+	if (c != NONE) {
+		Cache_Hits++;
+		if (My_Cache[c].host[0])
+			strlcpy(r->host, My_Cache[c].host, sizeof(r->host));
+		LogDebug("Using cached host name of %s: \"%s\".",
+			 ng_ipaddr_tostr(Addr), r->host);
+	} else {
+		Cache_Misses++;
+		LogDebug("Now resolving %s ...", r->host);
+		r->query[0] = Dns_QueryAddr(Addr, i, r->deadline,
+					    cb_Reverse_Lookup);
+		if (r->query[0] == NONE) {
+			Free_Request(i);
+			return false;
+		}
 	}
-	return false;
-} /* Resolve_Addr */
 
+#ifdef IDENTAUTH
+	if (identsock >= 0)
+		r->ident = Ident_Query(identsock, i, r->deadline,
+				       cb_Ident_Result);
+#else
+	(void)identsock;
+#endif
+
+	/* Callback functions are never called from within this function */
+	if (r->query[0] == NONE && r->ident == NONE)
+		Ready_Add(i);
+
+	s->id = i + 1;
+	return true;
+} /* Resolve_Addr */
 
 /**
  * Resolve hostname (asynchronous!).
+ *
+ * When the lookup has been completed, the callback function is called with
+ * the token and the list of IP addresses found (none on errors). It must
+ * reset the status structure using Resolve_InitStruct().
+ *
+ * @param s		Resolver status structure.
+ * @param Token		Token passed to the callback function.
+ * @param Host		Host name to look up.
+ * @param cbfunc	Callback function.
+ * @returns		true if the lookup has been started.
  */
 GLOBAL bool
-Resolve_Name( PROC_STAT *s, const char *Host, void (*cbfunc)(int, short))
+Resolve_Name(RES_STAT *s, int Token, const char *Host,
+	     void (*cbfunc) (int, const ng_ipaddr_t *, size_t))
 {
-	int pipefd[2];
-	pid_t pid;
+	RESOLVE *r;
+	int i;
 
 	assert(s != NULL);
+	assert(!Resolve_InProgress(s));
+	assert(Host != NULL);
+	assert(cbfunc != NULL);
 
-	pid = Proc_Fork(s, pipefd, cbfunc, RESOLVER_TIMEOUT);
-	if (pid > 0) {
-		/* Main process */
-#ifdef DEBUG
-		Log( LOG_DEBUG, "Resolver for \"%s\" created (PID %d).", Host, pid );
+	i = New_Request(Token);
+	if (i == NONE)
+		return false;
+
+	r = &My_Requests[i];
+	r->name_cb = cbfunc;
+	strlcpy(r->name, Host, sizeof(r->name));
+
+	LogDebug("Now resolving \"%s\" ...", Host);
+#ifdef WANT_IPV6
+	assert(Conf_ConnectIPv6 || Conf_ConnectIPv4);
+
+	if (Conf_ConnectIPv6) {
+		r->query[0] = Dns_Query(Host, DNS_AAAA, i, r->deadline,
+					cb_Name_Lookup);
+		if (r->query[0] == NONE) {
+			Free_Request(i);
+			return false;
+		}
+	}
+	if (Conf_ConnectIPv4)
 #endif
-		return true;
-	} else if( pid == 0 ) {
-		/* Sub process */
-		Log_Init_Subprocess("Resolver");
-		Conn_CloseAllSockets(NONE);
-		Do_ResolveName(Host, pipefd[1]);
-		Log_Exit_Subprocess("Resolver");
-		exit(0);
+	{
+		r->query[1] = Dns_Query(Host, DNS_A, i, r->deadline,
+					cb_Name_Lookup);
+		if (r->query[1] == NONE) {
+			Free_Request(i);
+			return false;
+		}
 	}
-	return false;
+
+	s->id = i + 1;
+	return true;
 } /* Resolve_Name */
 
-#if !defined(HAVE_WORKING_GETADDRINFO) || !defined(HAVE_GETNAMEINFO)
-#ifdef h_errno
-static char *
-Get_Error( int H_Error )
+/**
+ * Cancel a lookup in progress, if any. The callback function isn't called.
+ *
+ * @param s	Resolver status structure.
+ */
+GLOBAL void
+Resolve_Cancel(RES_STAT *s)
 {
-	/* Get error message for H_Error */
-	switch( H_Error ) {
-	case HOST_NOT_FOUND:
-		return "host not found";
-	case NO_DATA:
-		return "name valid but no IP address defined";
-	case NO_RECOVERY:
-		return "name server error";
-	case TRY_AGAIN:
-		return "name server temporary not available";
-	}
-	return "unknown error";
-}
-#endif
-#endif
+	assert(s != NULL);
 
+	if (!Resolve_InProgress(s))
+		return;
 
-/* Do "IDENT" (aka "AUTH") lookup and append result to resolved_addr array */
-static void
-Do_IdentQuery(int identsock, array *resolved_addr)
+	assert(s->id <= My_RequestsSize);
+	Free_Request(s->id - 1);
+	Resolve_InitStruct(s);
+} /* Resolve_Cancel */
+
+/**
+ * Handle timeouts of the resolver; this function must be called when the
+ * time returned by Resolve_NextTimeout() has been reached.
+ *
+ * @param Now	Current time.
+ */
+GLOBAL void
+Resolve_Timeout(time_t Now)
 {
-#ifdef IDENTAUTH
-	char *res;
+	int i;
 
-	if (identsock < 0)
-		return;
+	while (Ready_Head != NONE) {
+		i = Ready_Head;
+		Ready_Del(i);
+		Check_Done(i);
+	}
 
-#ifdef DEBUG
-	Log_Subprocess(LOG_DEBUG, "Doing IDENT lookup on socket %d ...",
-		       identsock);
-#endif
-	res = ident_id( identsock, 10 );
-#ifdef DEBUG
-	Log_Subprocess(LOG_DEBUG, "Ok, IDENT lookup on socket %d done: \"%s\"",
-		       identsock, res ? res : "(NULL)");
+	Dns_Timeout(Now);
+#ifdef IDENTAUTH
+	Ident_Timeout(Now);
 #endif
-	if (!res) /* no result */
-		return;
-	if (!array_cats(resolved_addr, res))
-		Log_Subprocess(LOG_WARNING,
-			       "Resolver: Cannot copy IDENT result: %s!",
-			       strerror(errno));
+} /* Resolve_Timeout */
 
-	free(res);
-#else
-	(void) identsock;
-	(void) resolved_addr;
+/**
+ * Get the time at which Resolve_Timeout() has to be called next.
+ *
+ * @returns	Time or 0 if there is nothing to do.
+ */
+GLOBAL time_t
+Resolve_NextTimeout(void)
+{
+	time_t next;
+#ifdef IDENTAUTH
+	time_t ident;
 #endif
-}
 
+	if (Ready_Head != NONE)
+		return time(NULL);
+
+	next = Dns_NextTimeout();
+#ifdef IDENTAUTH
+	ident = Ident_NextTimeout();
+	if (ident && (!next || ident < next))
+		next = ident;
+#endif
+	return next;
+} /* Resolve_NextTimeout */
 
 /**
- * perform reverse DNS lookup and put result string into resbuf.
- * If no hostname could be obtained, this function stores the string representation of
- * the IP address in resbuf and returns false.
- * @param IpAddr ip address to resolve
- * @param resbuf result buffer to store DNS name/string representation of ip address
- * @param reslen size of result buffer (must be >= NGT_INET_ADDRSTRLEN)
- * @return true if reverse lookup successful, false otherwise
+ * Get the number of IP addresses in the host name cache.
+ *
+ * @returns	Number of cache entries.
  */
-static bool
-ReverseLookup(const ng_ipaddr_t *IpAddr, char *resbuf, size_t reslen)
+GLOBAL long
+Resolve_CountCached(void)
 {
-	char tmp_ip_str[NG_INET_ADDRSTRLEN];
-	const char *errmsg;
-#ifdef HAVE_GETNAMEINFO
-	static const char funcname[]="getnameinfo";
-	int res;
+	return My_CacheUsed;
+} /* Resolve_CountCached */
 
-	*resbuf = 0;
+/**
+ * Get the number of lookups of IP addresses answered from the cache.
+ *
+ * @returns	Number of cache hits.
+ */
+GLOBAL long
+Resolve_CountHits(void)
+{
+	return Cache_Hits;
+} /* Resolve_CountHits */
 
-	res = getnameinfo((struct sockaddr *) IpAddr, ng_ipaddr_salen(IpAddr),
-			  resbuf, (socklen_t)reslen, NULL, 0, NI_NAMEREQD);
-	if (res == 0)
-		return true;
+/**
+ * Get the number of lookups of IP addresses which had to ask DNS.
+ *
+ * @returns	Number of cache misses.
+ */
+GLOBAL long
+Resolve_CountMisses(void)
+{
+	return Cache_Misses;
+} /* Resolve_CountMisses */
 
-	if (res == EAI_SYSTEM)
-		errmsg = strerror(errno);
-	else
-		errmsg = gai_strerror(res);
-#else
-	const struct sockaddr_in *Addr = (const struct sockaddr_in *) IpAddr;
-	struct hostent *h;
-	static const char funcname[]="gethostbyaddr";
-
-	h = gethostbyaddr((char *)&Addr->sin_addr, sizeof(Addr->sin_addr), AF_INET);
-	if (h) {
-		if (strlcpy(resbuf, h->h_name, reslen) < reslen)
-			return true;
-		errmsg = "hostname too long";
-	} else {
-# ifdef h_errno
-		errmsg = Get_Error(h_errno);
-# else
-		errmsg = "unknown error";
-# endif /* h_errno */
+/**
+ * Allocate a new request structure.
+ *
+ * @param Token	Token passed to the callback function.
+ * @returns	Index or NONE on error.
+ */
+static int
+New_Request(int Token)
+{
+	RESOLVE *tmp;
+	int i, size;
+
+	if (Free_Head == NONE) {
+		size = My_RequestsSize ? My_RequestsSize * 2 : 16;
+		tmp = realloc(My_Requests, (size_t)size * sizeof(RESOLVE));
+		if (!tmp) {
+			Log(LOG_EMERG, "Can't allocate memory! [New_Request]");
+			return NONE;
+		}
+		My_Requests = tmp;
+		for (i = size - 1; i >= My_RequestsSize; i--) {
+			My_Requests[i].token = NONE;
+			My_Requests[i].next = Free_Head;
+			Free_Head = i;
+		}
+		My_RequestsSize = size;
 	}
-#endif	/* HAVE_GETNAMEINFO */
-
-	assert(errmsg);
-	assert(reslen >= NG_INET_ADDRSTRLEN);
-	ng_ipaddr_tostr_r(IpAddr, tmp_ip_str);
 
-	Log_Subprocess(LOG_WARNING, "Can't resolve address \"%s\": %s [%s].",
-		       tmp_ip_str, errmsg, funcname);
-	strlcpy(resbuf, tmp_ip_str, reslen);
-	return false;
-}
+	i = Free_Head;
+	Free_Head = My_Requests[i].next;
 
+	memset(&My_Requests[i], 0, sizeof(RESOLVE));
+	My_Requests[i].token = Token;
+	My_Requests[i].query[0] = My_Requests[i].query[1] = NONE;
+	My_Requests[i].deadline = time(NULL) + RESOLVER_TIMEOUT;
+	My_Requests[i].ident = NONE;
+	return i;
+} /* New_Request */
 
 /**
- * perform DNS lookup of given host name and fill IpAddr with a list of
- * ip addresses associated with that name.
- * ip addresses found are stored in the "array *IpAddr" argument (type ng_ipaddr_t)
- * @param hostname The domain name to look up.
- * @param IpAddr pointer to empty and initialized array to store results
- * @return true if lookup successful, false if domain name not found
+ * Free a request structure and cancel everything still in progress.
+ *
+ * @param Idx	Index.
  */
-static bool
-#ifdef HAVE_WORKING_GETADDRINFO
-ForwardLookup(const char *hostname, array *IpAddr, int af)
-#else
-ForwardLookup(const char *hostname, array *IpAddr, UNUSED int af)
-#endif
+static void
+Free_Request(int Idx)
 {
-	ng_ipaddr_t addr;
+	RESOLVE *r = &My_Requests[Idx];
 
-#ifdef HAVE_WORKING_GETADDRINFO
-	int res;
-	struct addrinfo *a, *ai_results;
-	static struct addrinfo hints;
+	assert(r->token != NONE);
 
-#ifdef AI_ADDRCONFIG	/* glibc has this, but not e.g. netbsd 4.0 */
-	hints.ai_flags = AI_ADDRCONFIG;
+	if (r->query[0] != NONE)
+		Dns_Cancel(r->query[0]);
+	if (r->query[1] != NONE)
+		Dns_Cancel(r->query[1]);
+#ifdef IDENTAUTH
+	if (r->ident != NONE)
+		Ident_Cancel(r->ident);
 #endif
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = IPPROTO_TCP;
-	hints.ai_family = af;
+	if (r->ready)
+		Ready_Del(Idx);
 
-	memset(&addr, 0, sizeof(addr));
+	r->token = NONE;
+	r->next = Free_Head;
+	Free_Head = Idx;
+} /* Free_Request */
 
-	res = getaddrinfo(hostname, NULL, &hints, &ai_results);
-	switch (res) {
-	case 0:	break;
-	case EAI_SYSTEM:
-		Log_Subprocess(LOG_WARNING, "Can't resolve \"%s\": %s", hostname, strerror(errno));
-		return false;
-	default:
-		Log_Subprocess(LOG_WARNING, "Can't resolve \"%s\": %s", hostname, gai_strerror(res));
-		return false;
-	}
-
-	for (a = ai_results; a != NULL; a = a->ai_next) {
-		assert((size_t)a->ai_addrlen <= sizeof(addr));
-
-		if ((size_t)a->ai_addrlen > sizeof(addr))
-			continue;
+/**
+ * Call the callback function of a request when all of its lookups have been
+ * completed, and free it.
+ *
+ * @param Idx	Index.
+ */
+static void
+Check_Done(int Idx)
+{
+	void (*addr_cb) PARAMS((int, const char *, const char *));
+	void (*name_cb) PARAMS((int, const ng_ipaddr_t *, size_t));
+	RESOLVE *r = &My_Requests[Idx];
+	ng_ipaddr_t addrs[RESOLVE_ADDRS];
+	char host[CLIENT_HOST_LEN], user[CLIENT_USER_LEN];
+	size_t count = 0, n;
+	int token;
+
+	if (r->query[0] != NONE || r->query[1] != NONE || r->ident != NONE)
+		return;
 
-		memcpy(&addr, a->ai_addr, a->ai_addrlen);
+	token = r->token;
+	if (r->addr_cb) {
+		if (r->cache == CACHE_POSITIVE)
+			Cache_Add(&r->addr, r->host,
+				  r->ttl < RESOLVE_CACHE_TTL
+					? r->ttl : RESOLVE_CACHE_TTL,
+				  time(NULL));
+		else if (r->cache == CACHE_NEGATIVE)
+			Cache_Add(&r->addr, "", RESOLVE_CACHE_NEG_TTL,
+				  time(NULL));
+
+		addr_cb = r->addr_cb;
+		strlcpy(host, r->host, sizeof(host));
+		strlcpy(user, r->user, sizeof(user));
+		Free_Request(Idx);
+		addr_cb(token, host, user);
+	} else {
+		/* Alternate between IPv6 and IPv4 addresses, so that both
+		 * are tried when connecting to the first address fails */
+		for (n = 0; n < DNS_ADDRS; n++) {
+			if (n < r->count[0])
+				addrs[count++] = r->addrs[0][n];
+			if (n < r->count[1])
+				addrs[count++] = r->addrs[1][n];
+		}
+		if (count == 0)
+			Log(LOG_WARNING, "Can't resolve \"%s\"!", r->name);
 
-		if (!array_catb(IpAddr, (char *)&addr, sizeof(addr)))
-			break;
+		name_cb = r->name_cb;
+		Free_Request(Idx);
+		name_cb(token, addrs, count);
 	}
+} /* Check_Done */
 
-	freeaddrinfo(ai_results);
-	return a == NULL;
-#else
-	struct hostent *h = gethostbyname(hostname);
+/**
+ * Get a description of the status of a DNS answer.
+ */
+static const char *
+Status_Str(int Status)
+{
+	if (Status == DNS_NOTFOUND)
+		return "host not found";
+	return "name server timeout or failure";
+} /* Status_Str */
 
-	if (!h) {
-#ifdef h_errno
-		Log_Subprocess(LOG_WARNING, "Can't resolve \"%s\": %s",
-			       hostname, Get_Error(h_errno));
+/**
+ * Callback of the reverse DNS lookup ("PTR") of an IP address: verify the
+ * host name found.
+ *
+ * @param Idx		Request index.
+ * @param Answer	DNS answer.
+ */
+static void
+cb_Reverse_Lookup(int Idx, const DNS_ANSWER *Answer)
+{
+	RESOLVE *r = &My_Requests[Idx];
+
+	r->query[0] = NONE;
+
+	/* Transient errors aren't cached */
+	if (Answer->status != DNS_OK) {
+		Log(LOG_WARNING, "Can't resolve address \"%s\": %s.", r->host,
+		    Status_Str(Answer->status));
+		if (Answer->status == DNS_NOTFOUND)
+			r->cache = CACHE_NEGATIVE;
+	} else if (strlcpy(r->name, Answer->name, sizeof(r->name))
+		   >= sizeof(r->name)) {
+		Log(LOG_WARNING, "Can't resolve address \"%s\": %s.", r->host,
+		    "host name too long");
+		r->cache = CACHE_NEGATIVE;
+	} else {
+		r->ttl = Answer->ttl;
+		r->query[0] = Dns_Query(Answer->name,
+#ifdef WANT_IPV6
+					ng_ipaddr_af(&r->addr) == AF_INET6
+						? DNS_AAAA : DNS_A,
 #else
-		Log_Subprocess(LOG_WARNING, "Can't resolve \"%s\"", hostname);
+					DNS_A,
 #endif
-		return false;
+					Idx, r->deadline, cb_Forward_Lookup);
+		if (r->query[0] != NONE)
+			return;
 	}
-	memset(&addr, 0, sizeof(addr));
+	Check_Done(Idx);
+} /* cb_Reverse_Lookup */
 
-	addr.sin4.sin_family = AF_INET;
-	memcpy(&addr.sin4.sin_addr, h->h_addr, sizeof(struct in_addr));
+/**
+ * Callback of the forward DNS lookup of the host name of an IP address:
+ * accept the host name when it points to the IP address.
+ *
+ * @param Idx		Request index.
+ * @param Answer	DNS answer.
+ */
+static void
+cb_Forward_Lookup(int Idx, const DNS_ANSWER *Answer)
+{
+	RESOLVE *r = &My_Requests[Idx];
+	size_t i;
 
-	return array_copyb(IpAddr, (char *)&addr, sizeof(addr));
-#endif /* HAVE_GETADDRINFO */
-}
+	r->query[0] = NONE;
 
+	if (Answer->status != DNS_OK) {
+		Log(LOG_WARNING,
+		    "Possible forgery: %s resolved to \"%s\", which has no IP address!",
+		    r->host, r->name);
+		if (Answer->status == DNS_NOTFOUND)
+			r->cache = CACHE_NEGATIVE;
+	} else {
+		for (i = 0; i < Answer->count; i++) {
+			if (ng_ipaddr_ipequal(&r->addr, &Answer->addrs[i]))
+				break;
+		}
+		if (i < Answer->count) {
+			LogDebug("Ok, translated %s to \"%s\".", r->host,
+				 r->name);
+			strlcpy(r->host, r->name, sizeof(r->host));
+			r->cache = CACHE_POSITIVE;
+			if (Answer->ttl < r->ttl)
+				r->ttl = Answer->ttl;
+		} else {
+			for (i = 0; i < Answer->count; i++)
+				Log(LOG_WARNING, "Address mismatch: %s != %s",
+				    r->host, ng_ipaddr_tostr(&Answer->addrs[i]));
+			Log(LOG_WARNING,
+			    "Possible forgery: %s resolved to \"%s\", which points to a different address!",
+			    r->host, r->name);
+			r->cache = CACHE_NEGATIVE;
+		}
+	}
+	Check_Done(Idx);
+} /* cb_Forward_Lookup */
 
-static bool
-Addr_in_list(const array *resolved_addr, const ng_ipaddr_t *Addr)
+/**
+ * Callback of the DNS lookups ("AAAA" and "A") of a host name.
+ *
+ * @param Idx		Request index.
+ * @param Answer	DNS answer.
+ */
+static void
+cb_Name_Lookup(int Idx, const DNS_ANSWER *Answer)
 {
-	char tmp_ip_str[NG_INET_ADDRSTRLEN];
-	const ng_ipaddr_t *tmpAddrs = array_start(resolved_addr);
-	size_t len = array_length(resolved_addr, sizeof(*tmpAddrs));
-
-	assert(len > 0);
-	assert(tmpAddrs);
-
-	while (len > 0) {
-		if (ng_ipaddr_ipequal(Addr, tmpAddrs))
-			return true;
-		tmpAddrs++;
-		len--;
-	}
-	/* failed; print list of addresses */
-	ng_ipaddr_tostr_r(Addr, tmp_ip_str);
-	len = array_length(resolved_addr, sizeof(*tmpAddrs));
-	tmpAddrs = array_start(resolved_addr);
-
-	while (len > 0) {
-		Log_Subprocess(LOG_WARNING, "Address mismatch: %s != %s",
-			tmp_ip_str, ng_ipaddr_tostr(tmpAddrs));
-		tmpAddrs++;
-		len--;
-	}
+	RESOLVE *r = &My_Requests[Idx];
+	int n = Answer->type == DNS_AAAA ? 0 : 1;
+#ifdef DEBUG
+	size_t i;
+#endif
 
-	return false;
-}
+	r->query[n] = NONE;
+
+	if (Answer->status == DNS_OK) {
+		memcpy(r->addrs[n], Answer->addrs,
+		       Answer->count * sizeof(ng_ipaddr_t));
+		r->count[n] = Answer->count;
+#ifdef DEBUG
+		for (i = 0; i < Answer->count; i++)
+			LogDebug("translated \"%s\" to %s.", r->name,
+				 ng_ipaddr_tostr(&Answer->addrs[i]));
+#endif
+	} else
+		LogDebug("Can't resolve \"%s\" (%s): %s.", r->name,
+			 n == 0 ? "IPv6" : "IPv4", Status_Str(Answer->status));
+	Check_Done(Idx);
+} /* cb_Name_Lookup */
 
+/**
+ * Append a request to the list of completed requests.
+ *
+ * @param Idx	Request index.
+ */
+static void
+Ready_Add(int Idx)
+{
+	My_Requests[Idx].ready = true;
+	My_Requests[Idx].next = NONE;
+	My_Requests[Idx].prev = Ready_Tail;
+	if (Ready_Tail == NONE)
+		Ready_Head = Idx;
+	else
+		My_Requests[Ready_Tail].next = Idx;
+	Ready_Tail = Idx;
+} /* Ready_Add */
 
+/**
+ * Remove a request from the list of completed requests.
+ *
+ * @param Idx	Request index.
+ */
 static void
-Log_Forgery_NoIP(const char *ip, const char *host)
+Ready_Del(int Idx)
 {
-	Log_Subprocess(LOG_WARNING,
-		"Possible forgery: %s resolved to \"%s\", which has no IP address!",
-		ip, host);
-}
+	RESOLVE *r = &My_Requests[Idx];
 
+	assert(r->ready);
+
+	if (r->prev == NONE)
+		Ready_Head = r->next;
+	else
+		My_Requests[r->prev].next = r->next;
+	if (r->next == NONE)
+		Ready_Tail = r->prev;
+	else
+		My_Requests[r->next].prev = r->prev;
+	r->ready = false;
+} /* Ready_Del */
+
+/**
+ * Remove a cache entry from the LRU list.
+ *
+ * @param Idx	Cache index.
+ */
 static void
-Log_Forgery_WrongIP(const char *ip, const char *host)
+Lru_Unlink(int Idx)
 {
-	Log_Subprocess(LOG_WARNING,
-		"Possible forgery: %s resolved to \"%s\", which points to a different address!",
-		ip, host);
-}
+	RESOLVE_CACHE *c = &My_Cache[Idx];
 
+	if (c->prev == NONE)
+		Lru_Head = c->next;
+	else
+		My_Cache[c->prev].next = c->next;
+	if (c->next == NONE)
+		Lru_Tail = c->prev;
+	else
+		My_Cache[c->next].prev = c->prev;
+	c->prev = c->next = NONE;
+} /* Lru_Unlink */
 
+/**
+ * Insert a cache entry at the head (most recently used end) of the
+ * LRU list.
+ *
+ * @param Idx	Cache index.
+ */
 static void
-ArrayWrite(int fd, const array *a)
+Lru_Push(int Idx)
 {
-	size_t len = array_bytes(a);
-	const char *data = array_start(a);
+	RESOLVE_CACHE *c = &My_Cache[Idx];
 
-	assert(data);
+	c->prev = NONE;
+	c->next = Lru_Head;
+	if (Lru_Head == NONE)
+		Lru_Tail = Idx;
+	else
+		My_Cache[Lru_Head].prev = Idx;
+	Lru_Head = Idx;
+} /* Lru_Push */
 
-	if( (size_t)write(fd, data, len) != len )
-		Log_Subprocess( LOG_CRIT, "Resolver: Can't write to parent: %s!",
-							strerror(errno));
-}
+/**
+ * Find the cache entry of an IP address.
+ *
+ * @param Addr	IP address.
+ * @returns	Cache index or NONE.
+ */
+static int
+Cache_Find(const ng_ipaddr_t *Addr)
+{
+	int i;
 
+	if (!My_CacheHash)
+		return NONE;
 
+	i = My_CacheHash[ng_ipaddr_hash(Addr) % RESOLVE_CACHE_SIZE];
+	while (i != NONE && !ng_ipaddr_ipequal(&My_Cache[i].addr, Addr))
+		i = My_Cache[i].hnext;
+	return i;
+} /* Cache_Find */
+
+/**
+ * Look up the cached host name of an IP address, and mark the entry as
+ * recently used. Expired entries are removed.
+ *
+ * @param Addr	IP address.
+ * @param Now	Current time.
+ * @returns	Cache index or NONE.
+ */
+static int
+Cache_Lookup(const ng_ipaddr_t *Addr, time_t Now)
+{
+	int i;
+
+	i = Cache_Find(Addr);
+	if (i == NONE)
+		return NONE;
+	if (My_Cache[i].expires <= Now) {
+		Cache_Del(i);
+		return NONE;
+	}
+
+	Lru_Unlink(i);
+	Lru_Push(i);
+	return i;
+} /* Cache_Lookup */
+
+/**
+ * Add the host name of an IP address to the cache, replacing the least
+ * recently used entry when the cache is full.
+ *
+ * @param Addr	IP address.
+ * @param Host	Verified host name, or empty string if there is none.
+ * @param Ttl	Time to live in seconds, nothing is cached if it is 0.
+ * @param Now	Current time.
+ */
 static void
-Do_ResolveAddr(const ng_ipaddr_t *Addr, int identsock, int w_fd)
+Cache_Add(const ng_ipaddr_t *Addr, const char *Host, UINT32 Ttl, time_t Now)
 {
-	/* Resolver sub-process: resolve IP address and write result into
-	 * pipe to parent. */
-	char hostname[CLIENT_HOST_LEN];
-	char tmp_ip_str[NG_INET_ADDRSTRLEN];
-	size_t len;
-	array resolved_addr;
-
-	array_init(&resolved_addr);
-	ng_ipaddr_tostr_r(Addr, tmp_ip_str);
-#ifdef DEBUG
-	Log_Subprocess(LOG_DEBUG, "Now resolving %s ...", tmp_ip_str);
-#endif
-	if (!ReverseLookup(Addr, hostname, sizeof(hostname)))
-		goto dns_done;
+	RESOLVE_CACHE *tmp;
+	unsigned int bucket;
+	int i, size;
 
-	if (ForwardLookup(hostname, &resolved_addr, ng_ipaddr_af(Addr))) {
-		if (!Addr_in_list(&resolved_addr, Addr)) {
-			Log_Forgery_WrongIP(tmp_ip_str, hostname);
-			strlcpy(hostname, tmp_ip_str, sizeof(hostname));
-		}
-	} else {
-		Log_Forgery_NoIP(tmp_ip_str, hostname);
-		strlcpy(hostname, tmp_ip_str, sizeof(hostname));
-	}
-#ifdef DEBUG
-	Log_Subprocess(LOG_DEBUG, "Ok, translated %s to \"%s\".", tmp_ip_str, hostname);
-#endif
- dns_done:
-	len = strlen(hostname);
-	hostname[len] = '\n';
-	if (!array_copyb(&resolved_addr, hostname, ++len)) {
-		Log_Subprocess(LOG_CRIT,
-			       "Resolver: Can't copy resolved name: %s!",
-			       strerror(errno));
-		array_free(&resolved_addr);
+	if (Ttl == 0)
 		return;
+
+	if (!My_CacheHash) {
+		My_CacheHash = malloc(RESOLVE_CACHE_SIZE * sizeof(int));
+		if (!My_CacheHash) {
+			Log(LOG_EMERG, "Can't allocate memory! [Cache_Add]");
+			return;
+		}
+		for (i = 0; i < RESOLVE_CACHE_SIZE; i++)
+			My_CacheHash[i] = NONE;
 	}
 
-	Do_IdentQuery(identsock, &resolved_addr);
+	i = Cache_Find(Addr);
+	if (i != NONE)
+		Cache_Del(i);
+
+	if (Cache_Free == NONE && My_CacheSize < RESOLVE_CACHE_SIZE) {
+		size = My_CacheSize ? My_CacheSize * 2 : 64;
+		if (size > RESOLVE_CACHE_SIZE)
+			size = RESOLVE_CACHE_SIZE;
+		tmp = realloc(My_Cache, (size_t)size * sizeof(RESOLVE_CACHE));
+		if (tmp) {
+			My_Cache = tmp;
+			for (i = size - 1; i >= My_CacheSize; i--) {
+				My_Cache[i].hnext = Cache_Free;
+				Cache_Free = i;
+			}
+			My_CacheSize = size;
+		} else
+			Log(LOG_EMERG, "Can't allocate memory! [Cache_Add]");
+	}
+	if (Cache_Free == NONE) {
+		if (Lru_Tail == NONE)
+			return;
+		Cache_Del(Lru_Tail);
+	}
 
-	ArrayWrite(w_fd, &resolved_addr);
+	i = Cache_Free;
+	Cache_Free = My_Cache[i].hnext;
+	My_CacheUsed++;
 
-	array_free(&resolved_addr);
-} /* Do_ResolveAddr */
+	My_Cache[i].addr = *Addr;
+	strlcpy(My_Cache[i].host, Host, sizeof(My_Cache[i].host));
+	My_Cache[i].expires = Now + (time_t)Ttl;
 
+	bucket = ng_ipaddr_hash(Addr) % RESOLVE_CACHE_SIZE;
+	My_Cache[i].hnext = My_CacheHash[bucket];
+	My_CacheHash[bucket] = i;
+	Lru_Push(i);
+} /* Cache_Add */
 
+/**
+ * Remove an entry from the cache.
+ *
+ * @param Idx	Cache index.
+ */
 static void
-Do_ResolveName( const char *Host, int w_fd )
+Cache_Del(int Idx)
 {
-	/* Resolver sub-process: resolve name and write result into pipe
-	 * to parent. */
-	array IpAddrs;
-	int af;
-#ifdef DEBUG
-	ng_ipaddr_t *addr;
-	size_t len;
-#endif
-	Log_Subprocess(LOG_DEBUG, "Now resolving \"%s\" ...", Host);
+	int *link;
 
-	array_init(&IpAddrs);
+	link = &My_CacheHash[ng_ipaddr_hash(&My_Cache[Idx].addr)
+			     % RESOLVE_CACHE_SIZE];
+	while (*link != Idx) {
+		assert(*link != NONE);
+		link = &My_Cache[*link].hnext;
+	}
+	*link = My_Cache[Idx].hnext;
+	Lru_Unlink(Idx);
 
-#ifdef WANT_IPV6
-	af = AF_UNSPEC;
-	assert(Conf_ConnectIPv6 || Conf_ConnectIPv4);
+	My_Cache[Idx].hnext = Cache_Free;
+	Cache_Free = Idx;
+	My_CacheUsed--;
+} /* Cache_Del */
 
-	if (!Conf_ConnectIPv6)
-		af = AF_INET;
-	if (!Conf_ConnectIPv4)
-		af = AF_INET6;
-#else
-	af = AF_INET;
-#endif
-	if (!ForwardLookup(Host, &IpAddrs, af)) {
-		close(w_fd);
-		return;
-	}
-#ifdef DEBUG
-	len = array_length(&IpAddrs, sizeof(*addr));
-	assert(len > 0);
-	addr = array_start(&IpAddrs);
-	assert(addr);
-	for (; len > 0; --len,addr++) {
-		Log_Subprocess(LOG_DEBUG, "translated \"%s\" to %s.",
-					Host, ng_ipaddr_tostr(addr));
-	}
-#endif
-	/* Write result into pipe to parent */
-	ArrayWrite(w_fd, &IpAddrs);
+#ifdef IDENTAUTH
+
+/**
+ * Callback of the IDENT query of an IP address.
+ *
+ * @param Idx	Request index.
+ * @param User	IDENT user name or NULL.
+ */
+static void
+cb_Ident_Result(int Idx, const char *User)
+{
+	RESOLVE *r = &My_Requests[Idx];
+
+	assert(r->token != NONE);
 
-	array_free(&IpAddrs);
-} /* Do_ResolveName */
+	r->ident = NONE;
+	if (User)
+		strlcpy(r->user, User, sizeof(r->user));
+	Check_Done(Idx);
+} /* cb_Ident_Result */
 
+#endif /* IDENTAUTH */
 
 /* -eof- */
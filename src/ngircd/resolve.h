@@ -17,10 +17,38 @@
  * Asynchronous resolver (header)
  */
 
-GLOBAL bool Resolve_Addr PARAMS((PROC_STAT * s, const ng_ipaddr_t * Addr,
-				 int identsock, void (*cbfunc) (int, short)));
-GLOBAL bool Resolve_Name PARAMS((PROC_STAT * s, const char *Host,
-				 void (*cbfunc) (int, short)));
+#include <time.h>
+
+#include "ng_ipaddr.h"
+
+/** Resolver status. This struct must not be accessed directly! */
+typedef struct _Res_Stat {
+	int id;		/**< Lookup in progress (index plus 1) or 0 if none */
+} RES_STAT;
+
+/** Return true if a lookup is in progress */
+#define Resolve_InProgress(x)	((x)->id != 0)
+
+GLOBAL void Resolve_Init PARAMS((void));
+GLOBAL void Resolve_Exit PARAMS((void));
+
+GLOBAL void Resolve_InitStruct PARAMS((RES_STAT *s));
+
+GLOBAL bool Resolve_Addr PARAMS((RES_STAT * s, int Token,
+				 const ng_ipaddr_t * Addr, int identsock,
+				 void (*cbfunc) (int, const char *,
+						 const char *)));
+GLOBAL bool Resolve_Name PARAMS((RES_STAT * s, int Token, const char *Host,
+				 void (*cbfunc) (int, const ng_ipaddr_t *,
+						 size_t)));
+GLOBAL void Resolve_Cancel PARAMS((RES_STAT *s));
+
+GLOBAL void Resolve_Timeout PARAMS((time_t Now));
+GLOBAL time_t Resolve_NextTimeout PARAMS((void));
+
+GLOBAL long Resolve_CountCached PARAMS((void));
+GLOBAL long Resolve_CountHits PARAMS((void));
+GLOBAL long Resolve_CountMisses PARAMS((void));
 
 #endif
 
@@ -0,0 +1,354 @@
+/*
+ * ngIRCd -- The Next Generation IRC Daemon
+ * Copyright (c)2001-2014 Alexander Barton (alex@barton.de) and Contributors.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * Please read the file COPYING, README and AUTHORS for more information.
+ */
+
+/**
+ * @file
+ * Ring buffers for connection I/O.
+ *
+ * Unlike an array, removing data from the beginning of a ring buffer only
+ * advances its start offset, so consuming bytes doesn't move the remaining
+ * data around in memory. New data wraps around at the end of the allocated
+ * memory; functions needing all data in one piece can make it contiguous
+ * again using ringbuf_linearize(), which only copies data when it actually
+ * wraps around (or there is not enough free space following it).
+ *
+ * Memory is allocated in powers of two (of RINGBUF_MIN) and never shrinks.
+ */
+
+#include "ringbuf.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Minimum size of allocated memory */
+#define RINGBUF_MIN 256
+
+static bool Relocate PARAMS((ringbuf *r, size_t need));
+
+
+void
+ringbuf_init(ringbuf *r)
+{
+	assert(r != NULL);
+	r->mem = NULL;
+	r->allocated = 0;
+	r->start = 0;
+	r->used = 0;
+}
+
+
+/* move data to newly allocated memory of at least need bytes, starting
+   at offset 0. */
+static bool
+Relocate(ringbuf *r, size_t need)
+{
+	size_t size, first;
+	char *tmp;
+
+	assert(need >= r->used);
+
+	size = r->allocated > RINGBUF_MIN ? r->allocated : RINGBUF_MIN;
+	while (size < need) {
+		if (size * 2 < size) {	/* integer overflow */
+			size = need;
+			break;
+		}
+		size *= 2;
+	}
+
+	tmp = malloc(size);
+	if (!tmp)
+		return false;
+
+	first = ringbuf_contiguous(r);
+	if (first)
+		memcpy(tmp, r->mem + r->start, first);
+	if (r->used > first)
+		memcpy(tmp + first, r->mem, r->used - first);
+
+	free(r->mem);
+	r->mem = tmp;
+	r->allocated = size;
+	r->start = 0;
+	return true;
+}
+
+
+/* append len bytes from src to r.
+   return false if we could not append all bytes (malloc failure) */
+bool
+ringbuf_catb(ringbuf *r, const char *src, size_t len)
+{
+	size_t need, end, n;
+
+	assert(r != NULL);
+
+	if (!len)
+		return true;
+
+	assert(src != NULL);
+
+	need = r->used + len;
+	if (need < len)		/* integer overflow */
+		return false;
+
+	if (need > r->allocated && !Relocate(r, need))
+		return false;
+
+	if (r->used == 0)
+		r->start = 0;
+
+	end = r->start + r->used;
+	if (end >= r->allocated)
+		end -= r->allocated;
+
+	n = r->allocated - end;
+	if (n > len)
+		n = len;
+	memcpy(r->mem + end, src, n);
+	if (len > n)
+		memcpy(r->mem, src + n, len - n);
+
+	r->used = need;
+	return true;
+}
+
+
+/* make sure that at least len bytes of free space are available */
+bool
+ringbuf_reserve(ringbuf *r, size_t len)
+{
+	size_t need;
+
+	assert(r != NULL);
+
+	need = r->used + len;
+	if (need < len)		/* integer overflow */
+		return false;
+
+	if (need > r->allocated)
+		return Relocate(r, need);
+	return true;
+}
+
+
+/* get free space following the data, at most len bytes */
+int
+ringbuf_space(ringbuf *r, struct iovec *iov, size_t len)
+{
+	size_t end, n;
+	int cnt = 0;
+
+	assert(r != NULL);
+	assert(iov != NULL);
+
+	if (r->used == 0)
+		r->start = 0;
+
+	end = r->start + r->used;
+	if (end >= r->allocated) {
+		/* data wraps around (or ends at the end of the memory),
+		 * the free space is located in between */
+		end -= r->allocated;
+		n = r->start - end;
+	} else
+		n = r->allocated - end;
+
+	if (n > len)
+		n = len;
+	if (n > 0) {
+		iov[cnt].iov_base = r->mem + end;
+		iov[cnt].iov_len = n;
+		cnt++;
+		len -= n;
+	}
+
+	/* free space at the beginning of the memory */
+	if (end >= r->start && r->start > 0 && len > 0) {
+		n = r->start < len ? r->start : len;
+		iov[cnt].iov_base = r->mem;
+		iov[cnt].iov_len = n;
+		cnt++;
+	}
+	return cnt;
+}
+
+
+/* append len bytes stored in the free space already */
+void
+ringbuf_commit(ringbuf *r, size_t len)
+{
+	assert(r != NULL);
+	assert(r->used + len <= r->allocated);
+
+	r->used += len;
+}
+
+
+/* append contents of ring buffer src to r */
+bool
+ringbuf_cat(ringbuf *r, const ringbuf *src)
+{
+	size_t need, first;
+
+	assert(r != NULL);
+	assert(src != NULL);
+	assert(r != src);
+
+	need = r->used + src->used;
+	if (need < src->used)	/* integer overflow */
+		return false;
+
+	/* allocate in advance, so that appending can't fail half-way */
+	if (need > r->allocated && !Relocate(r, need))
+		return false;
+
+	first = ringbuf_contiguous(src);
+	if (!ringbuf_catb(r, src->mem + src->start, first))
+		return false;
+	return ringbuf_catb(r, src->mem, src->used - first);
+}
+
+
+/* make all data contiguous, followed by at least extra free bytes */
+bool
+ringbuf_linearize(ringbuf *r, size_t extra)
+{
+	size_t need;
+
+	assert(r != NULL);
+
+	need = r->used + extra;
+	if (need < extra)	/* integer overflow */
+		return false;
+
+	if (r->start + r->used <= r->allocated) {
+		/* data is contiguous already ... */
+		if (r->allocated - r->start - r->used >= extra)
+			return true;
+		/* ... but there is not enough space following it */
+		if (need <= r->allocated) {
+			memmove(r->mem, r->mem + r->start, r->used);
+			r->start = 0;
+			return true;
+		}
+	}
+
+	return Relocate(r, need);
+}
+
+
+/* append trailing NUL byte to ring buffer, but do not count it. */
+bool
+ringbuf_cat0_temporary(ringbuf *r)
+{
+	if (!ringbuf_linearize(r, 1))
+		return false;
+
+	r->mem[r->start + r->used] = '\0';
+	return true;
+}
+
+
+void *
+ringbuf_start(const ringbuf *r)
+{
+	assert(r != NULL);
+
+	if (!r->mem)
+		return NULL;
+	return r->mem + r->start;
+}
+
+
+size_t
+ringbuf_contiguous(const ringbuf *r)
+{
+	assert(r != NULL);
+
+	if (r->start + r->used <= r->allocated)
+		return r->used;
+	return r->allocated - r->start;
+}
+
+
+/* get len bytes of data, starting at offset */
+int
+ringbuf_peek(const ringbuf *r, size_t offset, size_t len, struct iovec *iov)
+{
+	size_t pos, n;
+	int cnt = 0;
+
+	assert(r != NULL);
+	assert(iov != NULL);
+	assert(offset + len <= r->used);
+
+	if (len == 0)
+		return 0;
+
+	pos = r->start + offset;
+	if (pos >= r->allocated)
+		pos -= r->allocated;
+
+	n = r->allocated - pos;
+	if (n > len)
+		n = len;
+	iov[cnt].iov_base = r->mem + pos;
+	iov[cnt].iov_len = n;
+	cnt++;
+
+	if (len > n) {
+		iov[cnt].iov_base = r->mem;
+		iov[cnt].iov_len = len - n;
+		cnt++;
+	}
+	return cnt;
+}
+
+
+void
+ringbuf_consume(ringbuf *r, size_t len)
+{
+	assert(r != NULL);
+
+	if (r->used <= len) {
+		/* buffer is empty now, start over at the beginning */
+		r->start = 0;
+		r->used = 0;
+		return;
+	}
+
+	r->start += len;
+	if (r->start >= r->allocated)
+		r->start -= r->allocated;
+	r->used -= len;
+}
+
+
+void
+ringbuf_trunc(ringbuf *r)
+{
+	assert(r != NULL);
+	r->start = 0;
+	r->used = 0;
+}
+
+
+void
+ringbuf_free(ringbuf *r)
+{
+	assert(r != NULL);
+	free(r->mem);
+	ringbuf_init(r);
+}
+
+/* -eof- */
@@ -0,0 +1,95 @@
+/*
+ * ngIRCd -- The Next Generation IRC Daemon
+ * Copyright (c)2001-2014 Alexander Barton (alex@barton.de) and Contributors.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * Please read the file COPYING, README and AUTHORS for more information.
+ */
+
+#ifndef ringbuf_h_included
+#define ringbuf_h_included
+
+/**
+ * @file
+ * Ring buffers for connection I/O (header).
+ */
+
+#include "portab.h"
+
+#include <sys/uio.h>
+
+typedef struct {
+	char * mem;
+	size_t allocated;
+	size_t start;
+	size_t used;
+} ringbuf;
+
+/* allocated: mem != NULL, start < allocated, used <= allocated
+   unallocated: mem == NULL, allocated == 0, start == 0, used == 0
+   The data starts at mem + start and wraps around at mem + allocated. */
+
+#define INIT_RINGBUF		{ NULL, 0, 0, 0 }
+
+/* set all variables in r to 0 */
+extern void ringbuf_init PARAMS((ringbuf *r));
+
+/* returns the number of BYTES stored in r. */
+#define ringbuf_bytes(r)	( (r)->used )
+
+/* append len bytes from src to r.
+   return true if OK, else false (e. g. malloc failure). In that case
+   r is left unchanged. */
+extern bool ringbuf_catb PARAMS((ringbuf *r, const char *src, size_t len));
+
+/* make sure that at least len bytes of free space are available in r.
+   return false if memory could not be allocated (r is left unchanged). */
+extern bool ringbuf_reserve PARAMS((ringbuf *r, size_t len));
+
+/* store the free space following the data in r, at most len bytes, in
+   iov[0] and iov[1] (the free space can wrap around the end of the
+   allocated memory). return the number of iovecs filled in (0 to 2). */
+extern int ringbuf_space PARAMS((ringbuf *r, struct iovec *iov, size_t len));
+
+/* append len bytes that have been stored in the free space described by
+   ringbuf_space() already. */
+extern void ringbuf_commit PARAMS((ringbuf *r, size_t len));
+
+/* append contents of ring buffer src to r (src is left unchanged). */
+extern bool ringbuf_cat PARAMS((ringbuf *r, const ringbuf *src));
+
+/* make all data of r contiguous, with at least extra free bytes following
+   it. return false if memory could not be allocated (r is left unchanged). */
+extern bool ringbuf_linearize PARAMS((ringbuf *r, size_t extra));
+
+/* make all data of r contiguous and append a NUL byte, but do not
+   count it. */
+extern bool ringbuf_cat0_temporary PARAMS((ringbuf *r));
+
+/* return pointer to the first byte stored in r */
+extern void * ringbuf_start PARAMS((const ringbuf *r));
+
+/* return number of bytes stored contiguously at ringbuf_start() */
+extern size_t ringbuf_contiguous PARAMS((const ringbuf *r));
+
+/* store len bytes of data of r, starting at offset, in iov[0] and iov[1]
+   (the data can wrap around the end of the allocated memory). return the
+   number of iovecs filled in (0 to 2). */
+extern int ringbuf_peek PARAMS((const ringbuf *r, size_t offset, size_t len,
+				struct iovec *iov));
+
+/* remove len bytes from the beginning of r */
+extern void ringbuf_consume PARAMS((ringbuf *r, size_t len));
+
+/* remove all data from r (the memory is not free'd) */
+extern void ringbuf_trunc PARAMS((ringbuf *r));
+
+/* free the contents of r. */
+extern void ringbuf_free PARAMS((ringbuf *r));
+
+#endif
+
+/* -eof- */
@@ -0,0 +1,69 @@
+# ngIRCd test suite
+# DNS test
+
+spawn telnet 127.0.0.1 6791
+expect {
+	timeout { exit 1 }
+	"Connected"
+}
+expect {
+	timeout { exit 1 }
+	"NOTICE * :*** Looking up your hostname"
+}
+expect {
+	timeout { exit 1 }
+	"NOTICE * :*** Found your hostname: client.dns.test"
+}
+
+send "nick nick\r"
+send "user user . . :Real Name\r"
+expect {
+	timeout { exit 1 }
+	"376"
+}
+
+send "whois nick\r"
+expect {
+	timeout { exit 1 }
+	"311 nick nick ~user client.dns.test \* :Real Name\r"
+}
+
+send "quit\r"
+expect {
+	timeout { exit 1 }
+	"ERROR"
+}
+
+# The host name is cached now
+spawn telnet 127.0.0.1 6791
+expect {
+	timeout { exit 1 }
+	"Connected"
+}
+expect {
+	timeout { exit 1 }
+	"NOTICE * :*** Found your hostname: client.dns.test"
+}
+
+send "nick nick\r"
+send "user user . . :Real Name\r"
+expect {
+	timeout { exit 1 }
+	"376"
+}
+
+send "stats d\r"
+expect {
+	timeout { exit 1 }
+	"249 nick :Host name cache: 1 entries (max. 4096), 1 hits, 1 misses"
+}
+expect {
+	timeout { exit 1 }
+	"219 nick d :End of STATS report"
+}
+
+send "quit\r"
+expect {
+	timeout { exit 1 }
+	"ERROR"
+}
@@ -0,0 +1,297 @@
+/*
+ * ngIRCd -- The Next Generation IRC Daemon
+ * Copyright (c)2001-2014 Alexander Barton (alex@barton.de) and Contributors.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * Please read the file COPYING, README and AUTHORS for more information.
+ */
+
+#include "portab.h"
+
+/**
+ * @file
+ * Minimal DNS server for the test suite.
+ *
+ * Usage: fake-dns [-t] <port> <name>=<address> [...]
+ *
+ * The server listens on 127.0.0.1 (UDP and TCP) and answers A, AAAA and
+ * PTR queries for the given names and addresses; all other names don't
+ * exist. With "-t", answers to PTR queries sent using UDP are truncated,
+ * so that the client has to retry using TCP.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define HDR_LEN		12
+#define MSG_LEN		512
+#define MAX_ENTRIES	16
+
+#define T_A		1
+#define T_PTR		12
+#define T_AAAA		28
+
+typedef struct _Entry {
+	char name[256];			/* Host name */
+	char ptr[80];			/* Reverse name of the address */
+	int type;			/* T_A or T_AAAA */
+	unsigned char addr[16];		/* Address */
+} ENTRY;
+
+static ENTRY Entries[MAX_ENTRIES];
+static int EntryCount;
+static int Truncate;
+
+static int
+Add_Entry(const char *Arg)
+{
+	static const char hex[] = "0123456789abcdef";
+	ENTRY *e = &Entries[EntryCount];
+	const char *addr = strchr(Arg, '=');
+	char *ptr;
+	int i;
+
+	if (!addr || EntryCount >= MAX_ENTRIES
+	    || (size_t)(addr - Arg) >= sizeof(e->name))
+		return 0;
+	memcpy(e->name, Arg, (size_t)(addr - Arg));
+	e->name[addr - Arg] = '\0';
+	addr++;
+
+	ptr = e->ptr;
+	if (inet_pton(AF_INET, addr, e->addr) == 1) {
+		e->type = T_A;
+		sprintf(ptr, "%u.%u.%u.%u.in-addr.arpa", e->addr[3],
+			e->addr[2], e->addr[1], e->addr[0]);
+	} else if (inet_pton(AF_INET6, addr, e->addr) == 1) {
+		e->type = T_AAAA;
+		for (i = 15; i >= 0; i--) {
+			*ptr++ = hex[e->addr[i] & 0xf];
+			*ptr++ = '.';
+			*ptr++ = hex[e->addr[i] >> 4];
+			*ptr++ = '.';
+		}
+		strcpy(ptr, "ip6.arpa");
+	} else
+		return 0;
+	EntryCount++;
+	return 1;
+}
+
+/* Encode a name (without compression), returns its length or 0. */
+static size_t
+Put_Name(unsigned char *Buf, size_t Len, const char *Name)
+{
+	const char *label, *end;
+	size_t pos = 0, n;
+
+	for (label = Name; *label; label = *end ? end + 1 : end) {
+		end = strchr(label, '.');
+		if (!end)
+			end = label + strlen(label);
+		n = (size_t)(end - label);
+		if (n == 0 || n > 63 || pos + n + 2 > Len)
+			return 0;
+		Buf[pos++] = (unsigned char)n;
+		memcpy(Buf + pos, label, n);
+		pos += n;
+	}
+	Buf[pos++] = 0;
+	return pos;
+}
+
+/* Build the answer to a query, returns its length or 0 to drop it. */
+static size_t
+Handle_Query(unsigned char *Msg, size_t Len, int Udp)
+{
+	char name[256];
+	size_t pos = HDR_LEN, n, qend, rdlen;
+	int type, i, found = 0, answers = 0;
+
+	if (Len < HDR_LEN + 5 || (Msg[2] & 0x80) || Msg[4] != 0 || Msg[5] != 1)
+		return 0;
+
+	/* Question name */
+	name[0] = '\0';
+	while (pos < Len && Msg[pos]) {
+		n = Msg[pos++];
+		if (n > 63 || pos + n >= Len || strlen(name) + n + 2 > sizeof(name))
+			return 0;
+		if (name[0])
+			strcat(name, ".");
+		strncat(name, (char *)Msg + pos, n);
+		pos += n;
+	}
+	if (pos + 5 > Len)
+		return 0;
+	type = (Msg[pos + 1] << 8) | Msg[pos + 2];
+	qend = pos + 5;
+
+	/* Header: response, recursion available, no additional sections */
+	Msg[2] = (Msg[2] & 0x79) | 0x80;
+	Msg[3] = 0x80;
+	Msg[6] = Msg[7] = Msg[8] = Msg[9] = Msg[10] = Msg[11] = 0;
+	pos = qend;
+
+	if (Udp && Truncate && type == T_PTR) {
+		Msg[2] |= 0x02;
+		return pos;
+	}
+
+	for (i = 0; i < EntryCount; i++) {
+		if (type == T_PTR) {
+			if (strcasecmp(name, Entries[i].ptr) != 0)
+				continue;
+			found = 1;
+		} else {
+			if (strcasecmp(name, Entries[i].name) != 0)
+				continue;
+			found = 1;
+			if (type != Entries[i].type)
+				continue;
+		}
+
+		if (pos + 12 + 256 > MSG_LEN)
+			break;
+		Msg[pos++] = 0xc0;	/* Pointer to question name */
+		Msg[pos++] = HDR_LEN;
+		Msg[pos++] = (unsigned char)(type >> 8);
+		Msg[pos++] = (unsigned char)type;
+		Msg[pos++] = 0;
+		Msg[pos++] = 1;		/* Class IN */
+		Msg[pos++] = 0;
+		Msg[pos++] = 0;
+		Msg[pos++] = 0;
+		Msg[pos++] = 60;	/* TTL */
+		if (type == T_PTR)
+			rdlen = Put_Name(Msg + pos + 2, MSG_LEN - pos - 2,
+					 Entries[i].name);
+		else {
+			rdlen = type == T_A ? 4 : 16;
+			memcpy(Msg + pos + 2, Entries[i].addr, rdlen);
+		}
+		Msg[pos++] = (unsigned char)(rdlen >> 8);
+		Msg[pos++] = (unsigned char)rdlen;
+		pos += rdlen;
+		answers++;
+	}
+	Msg[7] = (unsigned char)answers;
+	if (!found)
+		Msg[3] |= 3;		/* NXDOMAIN */
+	return pos;
+}
+
+static void
+Handle_Tcp(int Sock)
+{
+	unsigned char buf[2 + MSG_LEN];
+	size_t len, got = 0;
+	ssize_t r;
+
+	while (got < 2 || got < 2 + (size_t)((buf[0] << 8) | buf[1])) {
+		r = read(Sock, buf + got, sizeof(buf) - got);
+		if (r <= 0)
+			return;
+		got += (size_t)r;
+	}
+	len = Handle_Query(buf + 2, (size_t)((buf[0] << 8) | buf[1]), 0);
+	if (len == 0)
+		return;
+	buf[0] = (unsigned char)(len >> 8);
+	buf[1] = (unsigned char)len;
+	(void)write(Sock, buf, len + 2);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned char buf[MSG_LEN];
+	struct sockaddr_in sin, from;
+	socklen_t fromlen;
+	int udp, tcp, sock, i = 1, on = 1;
+	fd_set fds;
+	ssize_t len;
+
+	if (argc > 1 && strcmp(argv[1], "-t") == 0) {
+		Truncate = 1;
+		i++;
+	}
+	if (argc < i + 2) {
+		fprintf(stderr, "Usage: %s [-t] <port> <name>=<addr> [...]\n",
+			argv[0]);
+		return 1;
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons((unsigned short)atoi(argv[i++]));
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	for (; i < argc; i++) {
+		if (!Add_Entry(argv[i])) {
+			fprintf(stderr, "%s: invalid entry \"%s\"!\n",
+				argv[0], argv[i]);
+			return 1;
+		}
+	}
+
+	udp = socket(AF_INET, SOCK_DGRAM, 0);
+	tcp = socket(AF_INET, SOCK_STREAM, 0);
+	if (udp < 0 || tcp < 0) {
+		perror("socket");
+		return 1;
+	}
+	(void)setsockopt(tcp, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(udp, (struct sockaddr *)&sin, sizeof(sin)) != 0
+	    || bind(tcp, (struct sockaddr *)&sin, sizeof(sin)) != 0
+	    || listen(tcp, 5) != 0) {
+		perror("bind");
+		return 1;
+	}
+
+	for (;;) {
+		FD_ZERO(&fds);
+		FD_SET(udp, &fds);
+		FD_SET(tcp, &fds);
+		if (select((udp > tcp ? udp : tcp) + 1, &fds, NULL, NULL,
+			   NULL) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("select");
+			return 1;
+		}
+		if (FD_ISSET(udp, &fds)) {
+			fromlen = sizeof(from);
+			len = recvfrom(udp, buf, sizeof(buf), 0,
+				       (struct sockaddr *)&from, &fromlen);
+			if (len > 0) {
+				len = (ssize_t)Handle_Query(buf, (size_t)len, 1);
+				if (len > 0)
+					(void)sendto(udp, buf, (size_t)len, 0,
+						     (struct sockaddr *)&from,
+						     fromlen);
+			}
+		}
+		if (FD_ISSET(tcp, &fds)) {
+			sock = accept(tcp, NULL, NULL);
+			if (sock >= 0) {
+				Handle_Tcp(sock);
+				close(sock);
+			}
+		}
+	}
+}
+
+/* -eof- */
@@ -0,0 +1,103 @@
+/*
+ * ngIRCd -- The Next Generation IRC Daemon
+ * Copyright (c)2001-2014 Alexander Barton (alex@barton.de) and Contributors.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * Please read the file COPYING, README and AUTHORS for more information.
+ */
+
+#include "portab.h"
+
+/**
+ * @file
+ * Minimal IDENT server for the test suite.
+ *
+ * Usage: fake-identd <port> <user>
+ *
+ * The server listens on 127.0.0.1 and answers all queries with the given
+ * user name, see RFC 1413.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define LINE_LEN	1000
+
+static void
+Handle_Query(int Sock, const char *User)
+{
+	char buf[LINE_LEN + 1];
+	size_t got = 0;
+	unsigned int rport, lport;
+	ssize_t r;
+
+	while (got < LINE_LEN) {
+		r = read(Sock, buf + got, LINE_LEN - got);
+		if (r <= 0)
+			return;
+		got += (size_t)r;
+		buf[got] = '\0';
+		if (strchr(buf, '\n'))
+			break;
+	}
+
+	if (sscanf(buf, "%u , %u", &rport, &lport) == 2)
+		snprintf(buf, sizeof(buf), "%u , %u : USERID : UNIX : %s\r\n",
+			 rport, lport, User);
+	else
+		snprintf(buf, sizeof(buf), "0 , 0 : ERROR : INVALID-PORT\r\n");
+	(void)write(Sock, buf, strlen(buf));
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sockaddr_in sin;
+	int sock, conn, on = 1;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <port> <user>\n", argv[0]);
+		return 1;
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons((unsigned short)atoi(argv[1]));
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) {
+		perror("socket");
+		return 1;
+	}
+	(void)setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) != 0
+	    || listen(sock, 5) != 0) {
+		perror("bind");
+		return 1;
+	}
+
+	for (;;) {
+		conn = accept(sock, NULL, NULL);
+		if (conn < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("accept");
+			return 1;
+		}
+		Handle_Query(conn, argv[2]);
+		close(conn);
+	}
+}
+
+/* -eof- */
@@ -0,0 +1,39 @@
+# ngIRCd test suite
+# IDENT test
+
+spawn telnet 127.0.0.1 6791
+expect {
+	timeout { exit 1 }
+	"Connected"
+}
+expect {
+	timeout { exit 1 }
+	"NOTICE * :*** Looking up your hostname and checking ident"
+}
+expect {
+	timeout { exit 1 }
+	"NOTICE * :*** Found your hostname: client.dns.test"
+}
+expect {
+	timeout { exit 1 }
+	"NOTICE * :*** Got ident response: identuser"
+}
+
+send "nick nick\r"
+send "user user . . :Real Name\r"
+expect {
+	timeout { exit 1 }
+	"376"
+}
+
+send "whois nick\r"
+expect {
+	timeout { exit 1 }
+	"311 nick nick identuser client.dns.test \* :Real Name\r"
+}
+
+send "quit\r"
+expect {
+	timeout { exit 1 }
+	"ERROR"
+}
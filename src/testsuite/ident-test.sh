@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# ngIRCd Test Suite
+# Copyright (c)2001-2014 Alexander Barton (alex@barton.de) and Contributors.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+# Please read the file COPYING, README and AUTHORS for more information.
+#
+
+# IDENT test, using test server 4: the IDENT server (see fake-identd.c)
+# has to listen on the privileged port 113, so this test is skipped when
+# this isn't possible, or when ngIRCd has been built without IDENT support.
+
+# detect source directory
+[ -z "$srcdir" ] && srcdir=`dirname $0`
+
+name=`basename $0`
+test=ident-test
+[ -d logs ] || mkdir logs
+
+# read in functions
+. ${srcdir}/functions.inc
+
+./T-ngircd4 --version | grep "[-+]IDENT" >/dev/null 2>&1
+if [ $? -ne 0 ]; then
+  echo "$test: no IDENT support" >>tests-skipped.lst
+  echo "${name}: ngIRCd has been built without IDENT support.";  exit 77
+fi
+type expect > /dev/null 2>&1
+if [ $? -ne 0 ]; then
+  echo "$test: \"expect\" not found" >>tests-skipped.lst
+  echo "${name}: \"expect\" not found.";  exit 77
+fi
+type telnet > /dev/null 2>&1
+if [ $? -ne 0 ]; then
+  echo "$test: \"telnet\" not found" >>tests-skipped.lst
+  echo "${name}: \"telnet\" not found.";  exit 77
+fi
+
+./fake-identd 113 identuser >/dev/null 2>&1 &
+pid=$!
+sleep 1
+kill -0 $pid >/dev/null 2>&1
+if [ $? -ne 0 ]; then
+  echo "$test: can't listen on port 113" >>tests-skipped.lst
+  echo "${name}: can't start IDENT server on port 113.";  exit 77
+fi
+
+echo_n "running ${test} ..."
+expect ${srcdir}/${test}.e > logs/${test}.log; r=$?
+[ $r -eq 0 ] && echo " ok." || echo " failure!"
+
+kill $pid >/dev/null 2>&1
+exit $r
+
+# -eof-